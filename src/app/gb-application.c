@@ -27,6 +27,7 @@
 
 #include "gb-application.h"
 #include "gb-editor-file-marks.h"
+#include "gb-editor-language-cache.h"
 #include "gb-editor-workspace.h"
 #include "gb-glib.h"
 #include "gb-log.h"
@@ -41,17 +42,195 @@
 #define LANGUAGE_PATH "/org/gnome/builder/editor/language/"
 #define GSV_PATH "resource:///org/gnome/builder/styles/"
 
+typedef void (*GbApplicationPhase) (GbApplication *application);
+
+typedef struct
+{
+  const gchar *name;
+  gint64       begin;
+  gint64       end;
+} StartupSpan;
+
+typedef struct
+{
+  const gchar        *name;
+  GbApplicationPhase  func;
+} DeferredPhase;
+
 struct _GbApplicationPrivate
 {
   GbKeybindings       *keybindings;
   GSettings           *editor_settings;
   GbPreferencesWindow *preferences_window;
+
+  gint64               startup_time;
+  GArray              *startup_spans;
+  GQueue               deferred;
+  guint                deferred_handler;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GbApplication, gb_application, GTK_TYPE_APPLICATION)
 
 static void
-gb_application_setup_search_paths (void)
+gb_application_add_span (GbApplication *self,
+                         const gchar   *name,
+                         gint64         begin,
+                         gint64         end)
+{
+  StartupSpan span = { name, begin, end };
+
+  g_array_append_val (self->priv->startup_spans, span);
+}
+
+/*
+ * Runs a startup phase right away, recording how long it took.
+ */
+static void
+gb_application_run_phase (GbApplication      *self,
+                          const gchar        *name,
+                          GbApplicationPhase  func)
+{
+  gint64 begin;
+
+  g_assert (GB_IS_APPLICATION (self));
+  g_assert (name);
+  g_assert (func);
+
+  begin = g_get_monotonic_time ();
+  func (self);
+  gb_application_add_span (self, name, begin, g_get_monotonic_time ());
+}
+
+/*
+ * Queues a phase that is not needed for the first frame. Deferred phases
+ * run one per main loop iteration at low priority once the first workbench
+ * has been drawn.
+ */
+static void
+gb_application_defer_phase (GbApplication      *self,
+                            const gchar        *name,
+                            GbApplicationPhase  func)
+{
+  DeferredPhase *phase;
+
+  g_assert (GB_IS_APPLICATION (self));
+
+  phase = g_slice_new (DeferredPhase);
+  phase->name = name;
+  phase->func = func;
+
+  g_queue_push_tail (&self->priv->deferred, phase);
+}
+
+static gboolean
+gb_application_run_deferred (GbApplication *self)
+{
+  DeferredPhase *phase;
+
+  g_assert (GB_IS_APPLICATION (self));
+
+  if ((phase = g_queue_pop_head (&self->priv->deferred)))
+    {
+      gb_application_run_phase (self, phase->name, phase->func);
+      g_slice_free (DeferredPhase, phase);
+    }
+
+  if (!g_queue_is_empty (&self->priv->deferred))
+    return G_SOURCE_CONTINUE;
+
+  self->priv->deferred_handler = 0;
+
+  if (g_getenv ("GB_STARTUP_PROFILE"))
+    {
+      gchar *profile;
+
+      profile = gb_application_get_startup_profile (self);
+      g_message ("Startup profile:\n%s", profile);
+      g_free (profile);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Runs whatever is still queued, for callers that need the deferred state
+ * before the queue would have gotten to it.
+ */
+static void
+gb_application_flush_deferred (GbApplication *self)
+{
+  g_assert (GB_IS_APPLICATION (self));
+
+  if (self->priv->deferred_handler)
+    {
+      g_source_remove (self->priv->deferred_handler);
+      self->priv->deferred_handler = 0;
+    }
+
+  while (!g_queue_is_empty (&self->priv->deferred))
+    gb_application_run_deferred (self);
+}
+
+static gboolean
+gb_application_on_first_draw (GbApplication *self,
+                              cairo_t       *cr,
+                              GtkWidget     *widget)
+{
+  g_assert (GB_IS_APPLICATION (self));
+
+  g_signal_handlers_disconnect_by_func (widget,
+                                        G_CALLBACK (gb_application_on_first_draw),
+                                        self);
+
+  gb_application_add_span (self, "first-frame", self->priv->startup_time,
+                           g_get_monotonic_time ());
+
+  if (!self->priv->deferred_handler && !g_queue_is_empty (&self->priv->deferred))
+    self->priv->deferred_handler =
+      g_idle_add_full (G_PRIORITY_LOW,
+                       (GSourceFunc)gb_application_run_deferred,
+                       g_object_ref (self),
+                       g_object_unref);
+
+  return FALSE;
+}
+
+/**
+ * gb_application_get_startup_profile:
+ * @application: A #GbApplication.
+ *
+ * Formats the startup phases recorded so far, one per line. Each line has
+ * the offset of the phase from application creation and its duration, both
+ * in milliseconds.
+ *
+ * Returns: (transfer full): A newly allocated string.
+ */
+gchar *
+gb_application_get_startup_profile (GbApplication *application)
+{
+  GString *str;
+  guint i;
+
+  g_return_val_if_fail (GB_IS_APPLICATION (application), NULL);
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < application->priv->startup_spans->len; i++)
+    {
+      StartupSpan *span;
+
+      span = &g_array_index (application->priv->startup_spans, StartupSpan, i);
+      g_string_append_printf (str, "%s = [%.3f, %.3f]\n",
+                              span->name,
+                              (span->begin - application->priv->startup_time) / 1000.0,
+                              (span->end - span->begin) / 1000.0);
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+gb_application_setup_search_paths (GbApplication *self)
 {
   GtkSourceStyleSchemeManager *mgr;
 
@@ -199,6 +378,14 @@ gb_application_load_file_marks (GbApplication *application)
     }
 }
 
+static void
+gb_application_preload_language_cache (GbApplication *application)
+{
+  g_return_if_fail (GB_IS_APPLICATION (application));
+
+  gb_editor_language_cache_preload (gb_editor_language_cache_get_default ());
+}
+
 static void
 gb_application_on_theme_changed (GbApplication *self,
                                  GParamSpec    *pspec,
@@ -422,6 +609,14 @@ gb_application_create_workbench (GApplication *application)
 
   gtk_application_add_window (GTK_APPLICATION (application), window);
 
+  if (!GB_APPLICATION (application)->priv->deferred_handler &&
+      !g_queue_is_empty (&GB_APPLICATION (application)->priv->deferred))
+    g_signal_connect_object (window,
+                             "draw",
+                             G_CALLBACK (gb_application_on_first_draw),
+                             application,
+                             G_CONNECT_SWAPPED | G_CONNECT_AFTER);
+
   RETURN (GB_WORKBENCH (window));
 }
 
@@ -431,6 +626,7 @@ gb_application_activate (GApplication *application)
   GbWorkbench *workbench;
   GbWorkspace *workspace;
   GList *list;
+  gint64 begin;
 
   g_return_if_fail (GB_IS_APPLICATION (application));
 
@@ -445,9 +641,12 @@ gb_application_activate (GApplication *application)
         }
     }
 
+  begin = g_get_monotonic_time ();
   workbench = gb_application_create_workbench (application);
   workspace = gb_workbench_get_workspace (workbench, GB_TYPE_EDITOR_WORKSPACE);
   gb_editor_workspace_new_document (GB_EDITOR_WORKSPACE (workspace));
+  gb_application_add_span (GB_APPLICATION (application), "workbench", begin,
+                           g_get_monotonic_time ());
 
   gtk_window_present (GTK_WINDOW (workbench));
 }
@@ -461,7 +660,6 @@ gb_application_open (GApplication   *application,
   GbWorkbench *workbench = NULL;
   GbWorkspace *workspace;
   GList *list;
-  guint i;
 
   ENTRY;
 
@@ -483,16 +681,16 @@ gb_application_open (GApplication   *application,
 
   gtk_window_present (GTK_WINDOW (workbench));
 
+  /* Restoring the cursor position of the files needs the file marks. */
+  gb_application_flush_deferred (GB_APPLICATION (application));
+
   workspace = gb_workbench_get_workspace (workbench,
                                           GB_TYPE_EDITOR_WORKSPACE);
 
   g_assert (GB_IS_EDITOR_WORKSPACE (workspace));
 
-  for (i = 0; i < n_files; i++)
-    {
-      g_return_if_fail (G_IS_FILE (files [i]));
-      gb_editor_workspace_open (GB_EDITOR_WORKSPACE (workspace), files [i]);
-    }
+  gb_editor_workspace_open_files (GB_EDITOR_WORKSPACE (workspace),
+                                  files, n_files);
 
   EXIT;
 }
@@ -621,13 +819,23 @@ gb_application_startup (GApplication *app)
 
   G_APPLICATION_CLASS (gb_application_parent_class)->startup (app);
 
-  gb_application_make_skeleton_dirs (self);
-  gb_application_install_language_defaults (self);
-  gb_application_register_actions (self);
-  gb_application_register_keybindings (self);
-  gb_application_register_theme_overrides (self);
-  gb_application_load_file_marks (self);
-  gb_application_setup_search_paths ();
+  gb_application_run_phase (self, "language-defaults",
+                            gb_application_install_language_defaults);
+  gb_application_run_phase (self, "actions",
+                            gb_application_register_actions);
+  gb_application_run_phase (self, "keybindings",
+                            gb_application_register_keybindings);
+  gb_application_run_phase (self, "theme-overrides",
+                            gb_application_register_theme_overrides);
+  gb_application_run_phase (self, "search-paths",
+                            gb_application_setup_search_paths);
+
+  gb_application_defer_phase (self, "skeleton-dirs",
+                              gb_application_make_skeleton_dirs);
+  gb_application_defer_phase (self, "file-marks",
+                              gb_application_load_file_marks);
+  gb_application_defer_phase (self, "language-cache",
+                              gb_application_preload_language_cache);
 
   EXIT;
 }
@@ -636,6 +844,7 @@ static void
 gb_application_shutdown (GApplication *app)
 {
   GbApplication *self = (GbApplication *)app;
+  GbEditorLanguageCache *languages;
   GbEditorFileMarks *marks;
   GError *error = NULL;
 
@@ -643,6 +852,8 @@ gb_application_shutdown (GApplication *app)
 
   g_assert (GB_IS_APPLICATION (self));
 
+  gb_application_flush_deferred (self);
+
   marks = gb_editor_file_marks_get_default ();
 
   if (!gb_editor_file_marks_save (marks, NULL, &error))
@@ -651,6 +862,14 @@ gb_application_shutdown (GApplication *app)
       g_clear_error (&error);
     }
 
+  languages = gb_editor_language_cache_get_default ();
+
+  if (!gb_editor_language_cache_flush (languages, &error))
+    {
+      g_warning ("%s", error->message);
+      g_clear_error (&error);
+    }
+
   G_APPLICATION_CLASS (gb_application_parent_class)->shutdown (app);
 
   EXIT;
@@ -678,6 +897,7 @@ gb_application_finalize (GObject *object)
 
   g_clear_object (&priv->editor_settings);
   g_clear_object (&priv->keybindings);
+  g_clear_pointer (&priv->startup_spans, g_array_unref);
 
   G_OBJECT_CLASS (gb_application_parent_class)->finalize (object);
 
@@ -708,5 +928,9 @@ gb_application_init (GbApplication *application)
 {
   ENTRY;
   application->priv = gb_application_get_instance_private (application);
+  application->priv->startup_time = g_get_monotonic_time ();
+  application->priv->startup_spans = g_array_new (FALSE, FALSE,
+                                                  sizeof (StartupSpan));
+  g_queue_init (&application->priv->deferred);
   EXIT;
 }
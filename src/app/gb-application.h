@@ -48,7 +48,8 @@ struct _GbApplicationClass
   GtkApplicationClass parent_class;
 };
 
-GType gb_application_get_type (void);
+GType  gb_application_get_type            (void);
+gchar *gb_application_get_startup_profile (GbApplication *application);
 
 G_END_DECLS
 
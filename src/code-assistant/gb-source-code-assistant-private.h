@@ -0,0 +1,32 @@
+/* gb-source-code-assistant-private.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_SOURCE_CODE_ASSISTANT_PRIVATE_H
+#define GB_SOURCE_CODE_ASSISTANT_PRIVATE_H
+
+#include "gb-source-code-assistant.h"
+
+G_BEGIN_DECLS
+
+gboolean gb_source_code_assistant_write_buffer (GtkTextBuffer  *buffer,
+                                                int             fd,
+                                                GError        **error) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* GB_SOURCE_CODE_ASSISTANT_PRIVATE_H */
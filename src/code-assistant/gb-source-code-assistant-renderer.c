@@ -23,13 +23,12 @@
 #include "gb-log.h"
 #include "gb-source-code-assistant.h"
 #include "gb-source-code-assistant-renderer.h"
-#include "gca-structs.h"
+#include "gb-source-diagnostics.h"
 
 struct _GbSourceCodeAssistantRendererPrivate
 {
   GbSourceCodeAssistant *code_assistant;
-  GHashTable            *line_to_severity_hash;
-  GArray                *diagnostics;
+  GbSourceDiagnostics   *diagnostics;
   gulong                 changed_handler;
 };
 
@@ -54,36 +53,6 @@ gb_source_code_assistant_renderer_get_code_assistant (GbSourceCodeAssistantRende
   return renderer->priv->code_assistant;
 }
 
-static void
-gb_source_code_assistant_renderer_add_diagnostic_range (GbSourceCodeAssistantRenderer *renderer,
-                                                        GcaDiagnostic                 *diag,
-                                                        GcaSourceRange                *range)
-{
-  gint64 i;
-
-  g_assert (GB_IS_SOURCE_CODE_ASSISTANT_RENDERER (renderer));
-  g_assert (diag);
-  g_assert (range);
-
-  if (range->begin.line == -1 || range->end.line == -1)
-    return;
-
-  g_return_if_fail (renderer->priv->line_to_severity_hash);
-
-  for (i = range->begin.line; i <= range->end.line; i++)
-    {
-      gpointer val;
-
-      val = g_hash_table_lookup (renderer->priv->line_to_severity_hash,
-                                 GINT_TO_POINTER (i));
-      if (GPOINTER_TO_INT (val) < diag->severity)
-        val = GINT_TO_POINTER (diag->severity);
-
-      g_hash_table_replace (renderer->priv->line_to_severity_hash,
-                            GINT_TO_POINTER (i), val);
-    }
-}
-
 static void
 gb_source_code_assistant_renderer_changed (GbSourceCodeAssistantRenderer *renderer,
                                            GbSourceCodeAssistant         *code_assistant)
@@ -95,41 +64,9 @@ gb_source_code_assistant_renderer_changed (GbSourceCodeAssistantRenderer *render
 
   priv = renderer->priv;
 
-  g_hash_table_remove_all (priv->line_to_severity_hash);
-
-  if (priv->diagnostics)
-    {
-      g_array_unref (priv->diagnostics);
-      priv->diagnostics = NULL;
-    }
-
+  g_clear_pointer (&priv->diagnostics, gb_source_diagnostics_unref);
   priv->diagnostics = gb_source_code_assistant_get_diagnostics (code_assistant);
 
-  if (priv->diagnostics)
-    {
-      guint i;
-
-      for (i = 0; i < priv->diagnostics->len; i++)
-        {
-          GcaDiagnostic *diag;
-
-          diag = &g_array_index (priv->diagnostics, GcaDiagnostic, i);
-
-          if (diag->locations)
-            {
-              guint j;
-
-              for (j = 0; j < diag->locations->len; j++)
-                {
-                  GcaSourceRange *range;
-
-                  range = &g_array_index (diag->locations, GcaSourceRange, j);
-                  gb_source_code_assistant_renderer_add_diagnostic_range (renderer, diag, range);
-                }
-            }
-        }
-    }
-
   gtk_source_gutter_renderer_queue_draw (GTK_SOURCE_GUTTER_RENDERER (renderer));
 }
 
@@ -199,19 +136,19 @@ gb_source_code_assistant_renderer_query_data (GtkSourceGutterRenderer      *rend
                                               GtkSourceGutterRendererState  state)
 {
   GbSourceCodeAssistantRenderer *self = (GbSourceCodeAssistantRenderer *)renderer;
+  GcaSeverity severity = GCA_SEVERITY_NONE;
   const gchar *icon_name = NULL;
-  gpointer key;
-  gpointer val;
   guint line;
 
   g_return_if_fail (GB_IS_SOURCE_CODE_ASSISTANT_RENDERER (self));
 
   line = gtk_text_iter_get_line (begin);
 
-  key = GINT_TO_POINTER (line);
-  val = g_hash_table_lookup (self->priv->line_to_severity_hash, key);
+  if (self->priv->diagnostics)
+    severity = gb_source_diagnostics_get_line_severity (self->priv->diagnostics,
+                                                        line);
 
-  switch (GPOINTER_TO_INT (val))
+  switch (severity)
     {
     case GCA_SEVERITY_FATAL:
     case GCA_SEVERITY_ERROR:
@@ -254,10 +191,7 @@ gb_source_code_assistant_renderer_finalize (GObject *object)
       priv->code_assistant = NULL;
     }
 
-  if (priv->diagnostics)
-    g_clear_pointer (&priv->diagnostics, g_array_unref);
-
-  g_clear_pointer (&priv->line_to_severity_hash, g_hash_table_unref);
+  g_clear_pointer (&priv->diagnostics, gb_source_diagnostics_unref);
 
   G_OBJECT_CLASS (gb_source_code_assistant_renderer_parent_class)->finalize (object);
 
@@ -328,5 +262,4 @@ static void
 gb_source_code_assistant_renderer_init (GbSourceCodeAssistantRenderer *renderer)
 {
   renderer->priv = gb_source_code_assistant_renderer_get_instance_private (renderer);
-  renderer->priv->line_to_severity_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
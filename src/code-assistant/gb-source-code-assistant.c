@@ -18,43 +18,53 @@
 
 #define G_LOG_DOMAIN "code-assistant"
 
+#include <errno.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <gtksourceview/gtksource.h>
+#include <unistd.h>
 
 #include "gb-editor-document.h"
 #include "gb-log.h"
+#include "gb-source-code-assistant-private.h"
 #include "gb-source-code-assistant.h"
+#include "gb-source-diagnostics.h"
 #include "gb-string.h"
 #include "gca-diagnostics.h"
 #include "gca-service.h"
-#include "gca-structs.h"
 
 struct _GbSourceCodeAssistantPrivate
 {
-  GtkTextBuffer  *buffer;
-  GcaService     *proxy;
-  GcaDiagnostics *document_proxy;
-  GArray         *diagnostics;
-  gchar          *document_path;
-  GCancellable   *cancellable;
+  GtkTextBuffer       *buffer;
+  GcaService          *proxy;
+  GcaDiagnostics      *document_proxy;
+  GbSourceDiagnostics *diagnostics;
+  gchar               *document_path;
+  GCancellable        *cancellable;
 
-  gchar          *tmpfile_path;
-  int             tmpfile_fd;
+  gchar               *tmpfile_path;
+  int                  tmpfile_fd;
 
-  gulong          changed_handler;
-  gulong          notify_language_handler;
+  gulong               changed_handler;
+  gulong               notify_language_handler;
 
-  guint           parse_timeout;
-  guint           active;
+  guint                parse_timeout;
+  guint                active;
 
-  guint           service_unknown : 1;
+  gint64               parse_begin;
+  gint64               parse_time;
+
+  guint                service_unknown : 1;
+  guint                parse_in_flight : 1;
+  guint                parse_pending : 1;
 };
 
 enum {
   PROP_0,
   PROP_ACTIVE,
   PROP_BUFFER,
+  PROP_PARSE_TIME,
+  PROP_PENDING,
   LAST_PROP
 };
 
@@ -72,7 +82,10 @@ static guint            gSignals [LAST_SIGNAL];
 static GDBusConnection *gDBus;
 static GHashTable      *gLangMappings;
 
-#define PARSE_TIMEOUT_MSEC 350
+#define PARSE_TIMEOUT_MSEC     350
+#define PARSE_TIMEOUT_MIN_MSEC 150
+#define PARSE_TIMEOUT_MAX_MSEC 5000
+#define WRITE_CHUNK_CHARS  (16 * 1024)
 
 static void
 gb_source_code_assistant_queue_parse (GbSourceCodeAssistant *assistant);
@@ -201,18 +214,19 @@ gb_source_code_assistant_load_service (GbSourceCodeAssistant *assistant)
  * gb_source_code_assistant_get_diagnostics:
  * @assistant: (in): A #GbSourceCodeAssistant.
  *
- * Fetches the diagnostics for the buffer. Free the result with
- * g_array_unref().
+ * Fetches the diagnostics snapshot from the most recent parse. The snapshot
+ * is immutable, so it may be kept around while newer parses complete. Free
+ * the result with gb_source_diagnostics_unref().
  *
- * Returns: (transfer full): A #GArray of #GcaDiagnostic.
+ * Returns: (transfer full) (nullable): A #GbSourceDiagnostics.
  */
-GArray *
+GbSourceDiagnostics *
 gb_source_code_assistant_get_diagnostics (GbSourceCodeAssistant *assistant)
 {
   g_return_val_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant), NULL);
 
   if (assistant->priv->diagnostics)
-    return g_array_ref (assistant->priv->diagnostics);
+    return gb_source_diagnostics_ref (assistant->priv->diagnostics);
 
   return NULL;
 }
@@ -243,9 +257,9 @@ gb_source_code_assistant_diag_cb (GObject      *source_object,
       GOTO (failure);
     }
 
-  g_clear_pointer (&priv->diagnostics, g_array_unref);
+  g_clear_pointer (&priv->diagnostics, gb_source_diagnostics_unref);
 
-  priv->diagnostics = gca_diagnostics_from_variant (diags);
+  priv->diagnostics = gb_source_diagnostics_new_from_variant (diags);
 
   /* TODO: update buffer text tags */
 
@@ -298,6 +312,64 @@ failure:
   EXIT;
 }
 
+static void
+gb_source_code_assistant_set_pending (GbSourceCodeAssistant *assistant,
+                                      gboolean               pending)
+{
+  g_return_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant));
+
+  pending = !!pending;
+
+  if (assistant->priv->parse_pending != pending)
+    {
+      assistant->priv->parse_pending = pending;
+      g_object_notify_by_pspec (G_OBJECT (assistant),
+                                gParamSpecs [PROP_PENDING]);
+    }
+}
+
+/*
+ * Records how long the service took to parse the buffer and, if the buffer
+ * changed while it was busy, schedules a single follow-up parse for all of
+ * those changes.
+ */
+static void
+gb_source_code_assistant_parse_finished (GbSourceCodeAssistant *assistant)
+{
+  GbSourceCodeAssistantPrivate *priv;
+  gint64 elapsed;
+
+  g_return_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant));
+
+  priv = assistant->priv;
+
+  if (!priv->parse_in_flight)
+    return;
+
+  priv->parse_in_flight = FALSE;
+
+  elapsed = g_get_monotonic_time () - priv->parse_begin;
+
+  /*
+   * Smooth the measurement so a single slow parse (such as the first one,
+   * which has to load all of the headers) does not stretch the delay for
+   * every following keystroke.
+   */
+  if (priv->parse_time == 0)
+    priv->parse_time = elapsed;
+  else
+    priv->parse_time = (priv->parse_time * 3 + elapsed) / 4;
+
+  g_object_notify_by_pspec (G_OBJECT (assistant),
+                            gParamSpecs [PROP_PARSE_TIME]);
+
+  if (priv->parse_pending && priv->buffer)
+    {
+      gb_source_code_assistant_set_pending (assistant, FALSE);
+      gb_source_code_assistant_queue_parse (assistant);
+    }
+}
+
 static void
 gb_source_code_assistant_parse_cb (GObject      *source_object,
                                    GAsyncResult *result,
@@ -319,6 +391,7 @@ gb_source_code_assistant_parse_cb (GObject      *source_object,
   priv = assistant->priv;
 
   gb_source_code_assistant_inc_active (assistant, -1);
+  gb_source_code_assistant_parse_finished (assistant);
 
   if (!gca_service_call_parse_finish (service, &document_path, result, &error))
     {
@@ -399,6 +472,94 @@ gb_source_code_assistant_get_options (GbSourceCodeAssistant *assistant)
   return options;
 }
 
+static gboolean
+write_all (int           fd,
+           const gchar  *data,
+           gsize         len,
+           goffset       offset,
+           GError      **error)
+{
+  while (len > 0)
+    {
+      gssize n_written;
+
+      n_written = pwrite (fd, data, len, offset);
+
+      if (n_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          g_set_error_literal (error,
+                               G_FILE_ERROR,
+                               g_file_error_from_errno (errno),
+                               g_strerror (errno));
+          return FALSE;
+        }
+
+      data += n_written;
+      len -= n_written;
+      offset += n_written;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Writes the contents of @buffer over the file @fd in place. The
+ * code-assistance service only needs to be able to read the file by the
+ * time the parse request arrives, so there is no need for the atomic
+ * rename (and fsync) performed by g_file_set_contents(). The buffer is
+ * copied out in small slices so we never hold a second copy of a large
+ * file in memory.
+ */
+gboolean
+gb_source_code_assistant_write_buffer (GtkTextBuffer  *buffer,
+                                       int             fd,
+                                       GError        **error)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  goffset offset = 0;
+
+  g_return_val_if_fail (GTK_IS_TEXT_BUFFER (buffer), FALSE);
+  g_return_val_if_fail (fd != -1, FALSE);
+
+  gtk_text_buffer_get_start_iter (buffer, &begin);
+
+  while (!gtk_text_iter_is_end (&begin))
+    {
+      gboolean ret;
+      gchar *slice;
+      gsize len;
+
+      end = begin;
+      gtk_text_iter_forward_chars (&end, WRITE_CHUNK_CHARS);
+
+      slice = gtk_text_buffer_get_text (buffer, &begin, &end, TRUE);
+      len = strlen (slice);
+      ret = write_all (fd, slice, len, offset, error);
+      g_free (slice);
+
+      if (!ret)
+        return FALSE;
+
+      offset += len;
+      begin = end;
+    }
+
+  if (ftruncate (fd, offset) != 0)
+    {
+      g_set_error_literal (error,
+                           G_FILE_ERROR,
+                           g_file_error_from_errno (errno),
+                           g_strerror (errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 gb_source_code_assistant_do_parse (gpointer data)
 {
@@ -407,13 +568,10 @@ gb_source_code_assistant_do_parse (gpointer data)
   GError *error = NULL;
   GtkTextMark *insert;
   GtkTextIter iter;
-  GtkTextIter begin;
-  GtkTextIter end;
   GVariant *cursor;
   GVariant *options;
   GFile *gfile = NULL;
   gchar *path = NULL;
-  gchar *text = NULL;
   gint64 line;
   gint64 line_offset;
 
@@ -481,15 +639,17 @@ gb_source_code_assistant_do_parse (gpointer data)
       priv->tmpfile_fd = fd;
     }
 
-  gtk_text_buffer_get_bounds (priv->buffer, &begin, &end);
-  text = gtk_text_buffer_get_text (priv->buffer, &begin, &end, TRUE);
-  if (!g_file_set_contents (priv->tmpfile_path, text, -1, &error))
+  if (!gb_source_code_assistant_write_buffer (priv->buffer, priv->tmpfile_fd,
+                                              &error))
     {
       g_warning ("%s", error->message);
       g_clear_error (&error);
       GOTO (failure);
     }
 
+  priv->parse_in_flight = TRUE;
+  priv->parse_begin = g_get_monotonic_time ();
+
   gb_source_code_assistant_inc_active (assistant, 1);
   gca_service_call_parse (priv->proxy,
                           path,
@@ -502,21 +662,57 @@ gb_source_code_assistant_do_parse (gpointer data)
 
 failure:
   g_free (path);
-  g_free (text);
 
   RETURN (G_SOURCE_REMOVE);
 }
 
+/*
+ * Until the service has been measured, the delay grows with the size of
+ * the buffer, roughly 100 msec per megabyte. After that we wait about as
+ * long as a parse takes, which keeps the service idle at least half of the
+ * time while typing in a large translation unit.
+ */
+static guint
+gb_source_code_assistant_get_parse_timeout (GbSourceCodeAssistant *assistant)
+{
+  GbSourceCodeAssistantPrivate *priv;
+  gint64 timeout;
+
+  g_return_val_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant), PARSE_TIMEOUT_MSEC);
+
+  priv = assistant->priv;
+
+  timeout = PARSE_TIMEOUT_MSEC;
+
+  if (priv->buffer)
+    timeout += gtk_text_buffer_get_char_count (priv->buffer) / 10000;
+
+  if (priv->parse_time > 0)
+    timeout = MAX (timeout, priv->parse_time / 1000);
+
+  return CLAMP (timeout, PARSE_TIMEOUT_MIN_MSEC, PARSE_TIMEOUT_MAX_MSEC);
+}
+
 static void
 gb_source_code_assistant_queue_parse (GbSourceCodeAssistant *assistant)
 {
   g_return_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant));
 
+  /*
+   * Only one parse is in flight at a time. Changes that arrive in the
+   * meantime are coalesced into a single parse once it completes.
+   */
+  if (assistant->priv->parse_in_flight)
+    {
+      gb_source_code_assistant_set_pending (assistant, TRUE);
+      return;
+    }
+
   if (assistant->priv->parse_timeout)
     g_source_remove (assistant->priv->parse_timeout);
 
   assistant->priv->parse_timeout =
-    g_timeout_add (PARSE_TIMEOUT_MSEC,
+    g_timeout_add (gb_source_code_assistant_get_parse_timeout (assistant),
                    gb_source_code_assistant_do_parse,
                    assistant);
 }
@@ -664,6 +860,40 @@ gb_source_code_assistant_get_active (GbSourceCodeAssistant *assistant)
   return assistant->priv->active;
 }
 
+/**
+ * gb_source_code_assistant_get_pending:
+ * @assistant: (in): A #GbSourceCodeAssistant.
+ *
+ * Fetches the "pending" property, indicating if the buffer has changed
+ * while a parse was in flight and another parse will follow it.
+ *
+ * Returns: %TRUE if a parse is pending.
+ */
+gboolean
+gb_source_code_assistant_get_pending (GbSourceCodeAssistant *assistant)
+{
+  g_return_val_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant), FALSE);
+
+  return assistant->priv->parse_pending;
+}
+
+/**
+ * gb_source_code_assistant_get_parse_time:
+ * @assistant: (in): A #GbSourceCodeAssistant.
+ *
+ * Fetches the "parse-time" property, the smoothed time the code assistance
+ * service has taken to parse the buffer.
+ *
+ * Returns: The parse time in milliseconds, or 0 if nothing was parsed yet.
+ */
+guint
+gb_source_code_assistant_get_parse_time (GbSourceCodeAssistant *assistant)
+{
+  g_return_val_if_fail (GB_IS_SOURCE_CODE_ASSISTANT (assistant), 0);
+
+  return assistant->priv->parse_time / 1000;
+}
+
 static void
 gb_source_code_assistant_finalize (GObject *object)
 {
@@ -694,10 +924,14 @@ gb_source_code_assistant_finalize (GObject *object)
       g_clear_pointer (&priv->tmpfile_path, g_free);
     }
 
-  close (priv->tmpfile_fd);
-  priv->tmpfile_fd = -1;
+  if (priv->tmpfile_fd != -1)
+    {
+      close (priv->tmpfile_fd);
+      priv->tmpfile_fd = -1;
+    }
 
   g_clear_pointer (&priv->document_path, g_free);
+  g_clear_pointer (&priv->diagnostics, gb_source_diagnostics_unref);
   g_clear_object (&priv->document_proxy);
   g_clear_object (&priv->cancellable);
 
@@ -724,6 +958,14 @@ gb_source_code_assistant_get_property (GObject    *object,
       g_value_set_object (value, gb_source_code_assistant_get_buffer (self));
       break;
 
+    case PROP_PARSE_TIME:
+      g_value_set_uint (value, gb_source_code_assistant_get_parse_time (self));
+      break;
+
+    case PROP_PENDING:
+      g_value_set_boolean (value, gb_source_code_assistant_get_pending (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -779,6 +1021,26 @@ gb_source_code_assistant_class_init (GbSourceCodeAssistantClass *klass)
   g_object_class_install_property (object_class, PROP_BUFFER,
                                    gParamSpecs [PROP_BUFFER]);
 
+  gParamSpecs [PROP_PARSE_TIME] =
+    g_param_spec_uint ("parse-time",
+                       _("Parse Time"),
+                       _("The average time in milliseconds to parse the buffer."),
+                       0,
+                       G_MAXUINT,
+                       0,
+                       (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_PARSE_TIME,
+                                   gParamSpecs [PROP_PARSE_TIME]);
+
+  gParamSpecs [PROP_PENDING] =
+    g_param_spec_boolean ("pending",
+                          _("Pending"),
+                          _("If another parse will follow the active one."),
+                          FALSE,
+                          (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_PENDING,
+                                   gParamSpecs [PROP_PENDING]);
+
   gSignals [CHANGED] =
     g_signal_new ("changed",
                   GB_TYPE_SOURCE_CODE_ASSISTANT,
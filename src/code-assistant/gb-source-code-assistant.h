@@ -22,6 +22,8 @@
 #include <gio/gio.h>
 #include <gtk/gtk.h>
 
+#include "gb-source-diagnostics.h"
+
 G_BEGIN_DECLS
 
 #define GB_TYPE_SOURCE_CODE_ASSISTANT            (gb_source_code_assistant_get_type())
@@ -53,7 +55,9 @@ struct _GbSourceCodeAssistantClass
 
 GType                  gb_source_code_assistant_get_type        (void);
 GbSourceCodeAssistant *gb_source_code_assistant_new             (GtkTextBuffer         *buffer);
-GArray                *gb_source_code_assistant_get_diagnostics (GbSourceCodeAssistant *assistant);
+GbSourceDiagnostics   *gb_source_code_assistant_get_diagnostics (GbSourceCodeAssistant *assistant);
+gboolean               gb_source_code_assistant_get_pending     (GbSourceCodeAssistant *assistant);
+guint                  gb_source_code_assistant_get_parse_time  (GbSourceCodeAssistant *assistant);
 
 G_END_DECLS
 
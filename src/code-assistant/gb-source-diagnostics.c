@@ -0,0 +1,500 @@
+/* gb-source-diagnostics.c
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "code-assistant"
+
+#include <stdlib.h>
+
+#include "gb-source-diagnostics.h"
+
+/**
+ * SECTION:gb-source-diagnostics
+ * @title: GbSourceDiagnostics
+ * @short_description: An immutable, indexed snapshot of diagnostics.
+ *
+ * A new snapshot is created from the reply of every parse and shared by
+ * the gutter renderer, the tooltips and diagnostic navigation.
+ *
+ * Each location of each diagnostic becomes one entry. Entries are sorted by
+ * their starting position, so finding the next or previous diagnostic is a
+ * binary search. On top of the sorted array sits an implicit interval tree,
+ * where every entry also stores the largest end line found in its subtree.
+ * That answers overlap queries, such as the highest severity on a line, in
+ * O(log n + k) without expanding ranges line by line. Messages are stored
+ * once each in a single string chunk.
+ */
+
+typedef struct
+{
+  GbSourceDiagnostic diag;
+  guint64            max_end;
+} DiagnosticEntry;
+
+struct _GbSourceDiagnostics
+{
+  volatile gint  ref_count;
+  GStringChunk  *strings;
+  GArray        *entries;
+  gint           max_level;
+};
+
+#define ENTRY_BEGIN(e) ((e)->diag.range.begin.line)
+#define ENTRY_END(e)   ((e)->diag.range.end.line + 1)
+
+G_DEFINE_BOXED_TYPE (GbSourceDiagnostics, gb_source_diagnostics,
+                     gb_source_diagnostics_ref, gb_source_diagnostics_unref)
+
+static gint
+compare_entry (gconstpointer a,
+               gconstpointer b)
+{
+  const GcaSourceRange *ra = &((const DiagnosticEntry *)a)->diag.range;
+  const GcaSourceRange *rb = &((const DiagnosticEntry *)b)->diag.range;
+
+  if (ra->begin.line != rb->begin.line)
+    return (ra->begin.line < rb->begin.line) ? -1 : 1;
+  else if (ra->begin.column != rb->begin.column)
+    return (ra->begin.column < rb->begin.column) ? -1 : 1;
+  else if (ra->end.line != rb->end.line)
+    return (ra->end.line < rb->end.line) ? -1 : 1;
+
+  return 0;
+}
+
+/*
+ * Builds the implicit interval tree over the sorted entries. Leaves are the
+ * even indexes, and a node at level k is an index whose lowest k bits are
+ * all set. Its children are index ± 2^(k-1). This is the layout used by
+ * cgranges and needs no memory beyond max_end.
+ */
+static void
+gb_source_diagnostics_index (GbSourceDiagnostics *self)
+{
+  DiagnosticEntry *entries = (DiagnosticEntry *)(gpointer)self->entries->data;
+  gsize n = self->entries->len;
+  gsize last_i = 0;
+  guint64 last = 0;
+  gsize i;
+  gint k;
+
+  if (n == 0)
+    {
+      self->max_level = -1;
+      return;
+    }
+
+  for (i = 0; i < n; i += 2)
+    {
+      last_i = i;
+      last = entries [i].max_end = ENTRY_END (&entries [i]);
+    }
+
+  for (k = 1; ((gsize)1 << k) <= n; k++)
+    {
+      gsize x = (gsize)1 << (k - 1);
+      gsize i0 = (x << 1) - 1;
+      gsize step = x << 2;
+
+      for (i = i0; i < n; i += step)
+        {
+          guint64 el = entries [i - x].max_end;
+          guint64 er = (i + x < n) ? entries [i + x].max_end : last;
+          guint64 e = ENTRY_END (&entries [i]);
+
+          e = MAX (e, el);
+          e = MAX (e, er);
+          entries [i].max_end = e;
+        }
+
+      last_i = ((last_i >> k) & 1) ? last_i - x : last_i + x;
+      if ((last_i < n) && (entries [last_i].max_end > last))
+        last = entries [last_i].max_end;
+    }
+
+  self->max_level = k - 1;
+}
+
+/**
+ * gb_source_diagnostics_new_from_variant:
+ * @variant: The reply of org.gnome.CodeAssist.v1.Diagnostics.Diagnostics.
+ *
+ * Creates a new snapshot from the diagnostics returned by the
+ * code-assistance service.
+ *
+ * Returns: (transfer full): A #GbSourceDiagnostics.
+ */
+GbSourceDiagnostics *
+gb_source_diagnostics_new_from_variant (GVariant *variant)
+{
+  GbSourceDiagnostics *self;
+  GVariantIter *fixits;
+  GVariantIter *locations;
+  GVariantIter iter;
+  const gchar *message;
+  guint severity;
+
+  self = g_slice_new0 (GbSourceDiagnostics);
+  self->ref_count = 1;
+  self->strings = g_string_chunk_new (4096);
+  self->entries = g_array_new (FALSE, FALSE, sizeof (DiagnosticEntry));
+  self->max_level = -1;
+
+  if (!variant)
+    return self;
+
+  g_variant_iter_init (&iter, variant);
+
+  while (g_variant_iter_next (&iter, "(ua((x(xx)(xx))s)a(x(xx)(xx))&s)",
+                              &severity, &fixits, &locations, &message))
+    {
+      const gchar *interned;
+      gint64 x1, x2, x3, x4, x5;
+
+      interned = g_string_chunk_insert_const (self->strings, message);
+
+      /*
+       * Locations from the service are 1-based. Anything that has no line
+       * information cannot be placed in the buffer, so it is skipped.
+       */
+      while (g_variant_iter_next (locations, "(x(xx)(xx))",
+                                  &x1, &x2, &x3, &x4, &x5))
+        {
+          DiagnosticEntry entry = {{{ 0 }}};
+
+          if ((x2 < 1) || (x4 < 1))
+            continue;
+
+          entry.diag.severity = severity;
+          entry.diag.message = interned;
+          entry.diag.range.file = x1;
+          entry.diag.range.begin.line = x2 - 1;
+          entry.diag.range.begin.column = (x3 > 0) ? x3 - 1 : 0;
+          entry.diag.range.end.line = MAX (x4, x2) - 1;
+          entry.diag.range.end.column = (x5 > 0) ? x5 - 1 : 0;
+
+          g_array_append_val (self->entries, entry);
+        }
+
+      g_variant_iter_free (fixits);
+      g_variant_iter_free (locations);
+    }
+
+  g_array_sort (self->entries, compare_entry);
+  gb_source_diagnostics_index (self);
+
+  return self;
+}
+
+GbSourceDiagnostics *
+gb_source_diagnostics_ref (GbSourceDiagnostics *self)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+gb_source_diagnostics_unref (GbSourceDiagnostics *self)
+{
+  g_return_if_fail (self);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_array_unref (self->entries);
+      g_string_chunk_free (self->strings);
+      g_slice_free (GbSourceDiagnostics, self);
+    }
+}
+
+guint
+gb_source_diagnostics_get_length (GbSourceDiagnostics *self)
+{
+  g_return_val_if_fail (self, 0);
+
+  return self->entries->len;
+}
+
+/**
+ * gb_source_diagnostics_get_nth:
+ * @diagnostics: A #GbSourceDiagnostics.
+ * @nth: The index of the diagnostic.
+ *
+ * Gets a diagnostic by index. Diagnostics are sorted by their starting
+ * position.
+ *
+ * Returns: (transfer none): A #GbSourceDiagnostic owned by @diagnostics.
+ */
+const GbSourceDiagnostic *
+gb_source_diagnostics_get_nth (GbSourceDiagnostics *self,
+                               guint                nth)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (nth < self->entries->len, NULL);
+
+  return &g_array_index (self->entries, DiagnosticEntry, nth).diag;
+}
+
+/**
+ * gb_source_diagnostics_foreach_in_range:
+ * @diagnostics: A #GbSourceDiagnostics.
+ * @begin_line: The first line of the range.
+ * @end_line: The last line of the range, inclusive.
+ * @func: A callback for each diagnostic overlapping the range.
+ * @user_data: User data for @func.
+ *
+ * Calls @func for every diagnostic that overlaps the lines from @begin_line
+ * to @end_line. Iteration stops early if @func returns %TRUE.
+ */
+void
+gb_source_diagnostics_foreach_in_range (GbSourceDiagnostics        *self,
+                                        guint                       begin_line,
+                                        guint                       end_line,
+                                        GbSourceDiagnosticsForeach  func,
+                                        gpointer                    user_data)
+{
+  struct {
+    gsize    x;
+    gint     k;
+    gboolean left_done;
+  } stack [64];
+  DiagnosticEntry *entries;
+  guint64 begin = begin_line;
+  guint64 end = (guint64)end_line + 1;
+  gsize n;
+  gint t = 0;
+
+  g_return_if_fail (self);
+  g_return_if_fail (func);
+
+  if (self->max_level < 0 || begin_line > end_line)
+    return;
+
+  entries = (DiagnosticEntry *)(gpointer)self->entries->data;
+  n = self->entries->len;
+
+  stack [t].x = ((gsize)1 << self->max_level) - 1;
+  stack [t].k = self->max_level;
+  stack [t].left_done = FALSE;
+  t++;
+
+  while (t > 0)
+    {
+      gsize x = stack [t - 1].x;
+      gint k = stack [t - 1].k;
+      gboolean left_done = stack [t - 1].left_done;
+
+      t--;
+
+      if (k <= 3)
+        {
+          gsize i0 = (x >> k) << k;
+          gsize i1 = MIN (i0 + ((gsize)1 << (k + 1)) - 1, n);
+          gsize i;
+
+          /* Small subtrees are cheaper to scan linearly. */
+          for (i = i0; (i < i1) && (ENTRY_BEGIN (&entries [i]) < end); i++)
+            {
+              if ((begin < ENTRY_END (&entries [i])) &&
+                  func (&entries [i].diag, user_data))
+                return;
+            }
+        }
+      else if (!left_done)
+        {
+          gsize y = x - ((gsize)1 << (k - 1));
+
+          stack [t].x = x;
+          stack [t].k = k;
+          stack [t].left_done = TRUE;
+          t++;
+
+          /* The left child may be past the end when n is not a power of 2. */
+          if ((y >= n) || (entries [y].max_end > begin))
+            {
+              stack [t].x = y;
+              stack [t].k = k - 1;
+              stack [t].left_done = FALSE;
+              t++;
+            }
+        }
+      else if ((x < n) && (ENTRY_BEGIN (&entries [x]) < end))
+        {
+          if ((begin < ENTRY_END (&entries [x])) &&
+              func (&entries [x].diag, user_data))
+            return;
+
+          stack [t].x = x + ((gsize)1 << (k - 1));
+          stack [t].k = k - 1;
+          stack [t].left_done = FALSE;
+          t++;
+        }
+    }
+}
+
+static gboolean
+max_severity_cb (const GbSourceDiagnostic *diag,
+                 gpointer                  user_data)
+{
+  GcaSeverity *severity = user_data;
+
+  if (diag->severity > *severity)
+    *severity = diag->severity;
+
+  return (*severity == GCA_SEVERITY_FATAL);
+}
+
+/**
+ * gb_source_diagnostics_get_line_severity:
+ * @diagnostics: A #GbSourceDiagnostics.
+ * @line: A line number, starting from 0.
+ *
+ * Gets the highest severity of the diagnostics that touch @line.
+ *
+ * Returns: A #GcaSeverity, or %GCA_SEVERITY_NONE.
+ */
+GcaSeverity
+gb_source_diagnostics_get_line_severity (GbSourceDiagnostics *self,
+                                         guint                line)
+{
+  GcaSeverity severity = GCA_SEVERITY_NONE;
+
+  g_return_val_if_fail (self, GCA_SEVERITY_NONE);
+
+  gb_source_diagnostics_foreach_in_range (self, line, line, max_severity_cb,
+                                          &severity);
+
+  return severity;
+}
+
+/* Returns the number of entries starting at or before @line:@column. */
+static gsize
+upper_bound (GbSourceDiagnostics *self,
+             guint                line,
+             guint                column)
+{
+  gsize lo = 0;
+  gsize hi = self->entries->len;
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      const GcaSourceLocation *begin;
+
+      begin = &g_array_index (self->entries, DiagnosticEntry, mid).diag.range.begin;
+
+      if ((begin->line < line) ||
+          ((begin->line == line) && (begin->column <= column)))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Returns the number of entries starting before @line:@column. */
+static gsize
+lower_bound (GbSourceDiagnostics *self,
+             guint                line,
+             guint                column)
+{
+  gsize lo = 0;
+  gsize hi = self->entries->len;
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      const GcaSourceLocation *begin;
+
+      begin = &g_array_index (self->entries, DiagnosticEntry, mid).diag.range.begin;
+
+      if ((begin->line < line) ||
+          ((begin->line == line) && (begin->column < column)))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/**
+ * gb_source_diagnostics_get_next:
+ * @diagnostics: A #GbSourceDiagnostics.
+ * @line: A line number, starting from 0.
+ * @column: A column, starting from 0.
+ *
+ * Gets the first diagnostic that starts after @line:@column, wrapping
+ * around to the first diagnostic in the file.
+ *
+ * Returns: (transfer none) (nullable): A #GbSourceDiagnostic or %NULL if
+ *   there are no diagnostics.
+ */
+const GbSourceDiagnostic *
+gb_source_diagnostics_get_next (GbSourceDiagnostics *self,
+                                guint                line,
+                                guint                column)
+{
+  gsize idx;
+
+  g_return_val_if_fail (self, NULL);
+
+  if (self->entries->len == 0)
+    return NULL;
+
+  idx = upper_bound (self, line, column);
+  if (idx == self->entries->len)
+    idx = 0;
+
+  return &g_array_index (self->entries, DiagnosticEntry, idx).diag;
+}
+
+/**
+ * gb_source_diagnostics_get_previous:
+ * @diagnostics: A #GbSourceDiagnostics.
+ * @line: A line number, starting from 0.
+ * @column: A column, starting from 0.
+ *
+ * Gets the last diagnostic that starts before @line:@column, wrapping
+ * around to the last diagnostic in the file.
+ *
+ * Returns: (transfer none) (nullable): A #GbSourceDiagnostic or %NULL if
+ *   there are no diagnostics.
+ */
+const GbSourceDiagnostic *
+gb_source_diagnostics_get_previous (GbSourceDiagnostics *self,
+                                    guint                line,
+                                    guint                column)
+{
+  gsize idx;
+
+  g_return_val_if_fail (self, NULL);
+
+  if (self->entries->len == 0)
+    return NULL;
+
+  idx = lower_bound (self, line, column);
+  if (idx == 0)
+    idx = self->entries->len;
+
+  return &g_array_index (self->entries, DiagnosticEntry, idx - 1).diag;
+}
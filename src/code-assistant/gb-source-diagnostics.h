@@ -0,0 +1,65 @@
+/* gb-source-diagnostics.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_SOURCE_DIAGNOSTICS_H
+#define GB_SOURCE_DIAGNOSTICS_H
+
+#include <glib-object.h>
+
+#include "gca-structs.h"
+
+G_BEGIN_DECLS
+
+#define GB_TYPE_SOURCE_DIAGNOSTICS (gb_source_diagnostics_get_type())
+
+typedef struct _GbSourceDiagnostics GbSourceDiagnostics;
+
+typedef struct
+{
+  GcaSourceRange  range;
+  GcaSeverity     severity;
+  const gchar    *message;
+} GbSourceDiagnostic;
+
+typedef gboolean (*GbSourceDiagnosticsForeach) (const GbSourceDiagnostic *diagnostic,
+                                                gpointer                  user_data);
+
+GType                     gb_source_diagnostics_get_type             (void);
+GbSourceDiagnostics      *gb_source_diagnostics_new_from_variant     (GVariant                   *variant);
+GbSourceDiagnostics      *gb_source_diagnostics_ref                  (GbSourceDiagnostics        *diagnostics);
+void                      gb_source_diagnostics_unref                (GbSourceDiagnostics        *diagnostics);
+guint                     gb_source_diagnostics_get_length           (GbSourceDiagnostics        *diagnostics);
+const GbSourceDiagnostic *gb_source_diagnostics_get_nth              (GbSourceDiagnostics        *diagnostics,
+                                                                      guint                       nth);
+void                      gb_source_diagnostics_foreach_in_range     (GbSourceDiagnostics        *diagnostics,
+                                                                      guint                       begin_line,
+                                                                      guint                       end_line,
+                                                                      GbSourceDiagnosticsForeach  func,
+                                                                      gpointer                    user_data);
+GcaSeverity               gb_source_diagnostics_get_line_severity    (GbSourceDiagnostics        *diagnostics,
+                                                                      guint                       line);
+const GbSourceDiagnostic *gb_source_diagnostics_get_next             (GbSourceDiagnostics        *diagnostics,
+                                                                      guint                       line,
+                                                                      guint                       column);
+const GbSourceDiagnostic *gb_source_diagnostics_get_previous         (GbSourceDiagnostics        *diagnostics,
+                                                                      guint                       line,
+                                                                      guint                       column);
+
+G_END_DECLS
+
+#endif /* GB_SOURCE_DIAGNOSTICS_H */
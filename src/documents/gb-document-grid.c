@@ -691,6 +691,9 @@ gb_document_grid_close_untitled (GbDocumentGrid *grid)
 
   g_return_if_fail (GB_IS_DOCUMENT_GRID (grid));
 
+  if (!gb_document_manager_get_untitled_count (grid->priv->document_manager))
+    return;
+
   documents = gb_document_manager_get_documents (grid->priv->document_manager);
   stacks = gb_document_grid_get_stacks (grid);
 
@@ -24,9 +24,24 @@
 #include "gb-document-manager.h"
 #include "gb-editor-document.h"
 
+typedef struct
+{
+  GbDocumentManager *manager;
+  GbDocument        *document;
+  GtkSourceFile     *source_file;
+  GFile             *location;
+  guint              index;
+  guint              untitled : 1;
+  guint              modified : 1;
+} DocumentInfo;
+
 struct _GbDocumentManagerPrivate
 {
-  GPtrArray *documents;
+  GPtrArray  *documents;
+  GHashTable *infos;
+  GHashTable *by_location;
+  guint       n_untitled;
+  guint       n_unsaved;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GbDocumentManager, gb_document_manager,
@@ -84,35 +99,48 @@ gb_document_manager_find_with_type (GbDocumentManager *manager,
   return NULL;
 }
 
+/**
+ * gb_document_manager_get_untitled_count:
+ *
+ * Fetches the number of documents that have never been saved to a file.
+ *
+ * Returns: The number of untitled documents.
+ */
+guint
+gb_document_manager_get_untitled_count (GbDocumentManager *manager)
+{
+  g_return_val_if_fail (GB_IS_DOCUMENT_MANAGER (manager), 0);
+
+  return manager->priv->n_untitled;
+}
+
+/**
+ * gb_document_manager_get_unsaved_count:
+ *
+ * Fetches the number of documents with unsaved modifications.
+ *
+ * Returns: The number of modified documents.
+ */
+guint
+gb_document_manager_get_unsaved_count (GbDocumentManager *manager)
+{
+  g_return_val_if_fail (GB_IS_DOCUMENT_MANAGER (manager), 0);
+
+  return manager->priv->n_unsaved;
+}
+
 GbDocument *
 gb_document_manager_find_with_file (GbDocumentManager *manager,
                                     GFile             *file)
 {
-  guint i;
+  DocumentInfo *info;
 
   g_return_val_if_fail (GB_IS_DOCUMENT_MANAGER (manager), NULL);
   g_return_val_if_fail (G_IS_FILE (file), NULL);
 
-  for (i = 0; i < manager->priv->documents->len; i++)
-    {
-      GbDocument *document;
-
-      document = g_ptr_array_index (manager->priv->documents, i);
-
-      if (GB_IS_EDITOR_DOCUMENT (document))
-        {
-          GtkSourceFile *sfile;
-          GFile *location;
-
-          sfile = gb_editor_document_get_file (GB_EDITOR_DOCUMENT (document));
-          location = gtk_source_file_get_location (sfile);
-
-          if (location && g_file_equal (location, file))
-            return document;
-        }
-    }
+  info = g_hash_table_lookup (manager->priv->by_location, file);
 
-  return NULL;
+  return info ? info->document : NULL;
 }
 
 /**
@@ -159,6 +187,9 @@ gb_document_manager_get_unsaved_documents (GbDocumentManager *manager)
 
   g_return_val_if_fail (GB_IS_DOCUMENT_MANAGER (manager), NULL);
 
+  if (!manager->priv->n_unsaved)
+    return NULL;
+
   for (i = 0; i < manager->priv->documents->len; i++)
     {
       GbDocument *document;
@@ -172,47 +203,161 @@ gb_document_manager_get_unsaved_documents (GbDocumentManager *manager)
   return list;
 }
 
+/*
+ * Drops @info from the location index. If another document shares the
+ * same location, it takes its place so that lookups by file still find
+ * an open document.
+ */
 static void
-gb_document_manager_document_modified (GbDocumentManager *manager,
-                                       GParamSpec        *pspec,
-                                       GbDocument        *document)
+gb_document_manager_unindex_location (DocumentInfo *info)
+{
+  GbDocumentManagerPrivate *priv = info->manager->priv;
+  guint i;
+
+  if (!info->location ||
+      (g_hash_table_lookup (priv->by_location, info->location) != info))
+    return;
+
+  g_hash_table_remove (priv->by_location, info->location);
+
+  for (i = 0; i < priv->documents->len; i++)
+    {
+      DocumentInfo *other;
+
+      other = g_hash_table_lookup (priv->infos,
+                                   g_ptr_array_index (priv->documents, i));
+
+      if ((other != info) &&
+          other->location &&
+          g_file_equal (other->location, info->location))
+        {
+          g_hash_table_insert (priv->by_location, other->location, other);
+          break;
+        }
+    }
+}
+
+/*
+ * Refreshes the location index and the untitled/unsaved counters for a
+ * document. Called whenever the document's location, title or modified
+ * state changes.
+ */
+static void
+gb_document_manager_update_info (DocumentInfo *info)
+{
+  GbDocumentManagerPrivate *priv = info->manager->priv;
+  GFile *location = NULL;
+  gboolean untitled;
+  gboolean modified;
+
+  if (info->source_file)
+    location = gtk_source_file_get_location (info->source_file);
+
+  if ((location != info->location) &&
+      !(location && info->location && g_file_equal (location, info->location)))
+    {
+      if (info->location)
+        {
+          gb_document_manager_unindex_location (info);
+          g_clear_object (&info->location);
+        }
+
+      if (location)
+        {
+          info->location = g_object_ref (location);
+          if (!g_hash_table_contains (priv->by_location, location))
+            g_hash_table_insert (priv->by_location, info->location, info);
+        }
+    }
+
+  untitled = !!gb_document_is_untitled (info->document);
+  modified = !!gb_document_get_modified (info->document);
+
+  if (untitled != info->untitled)
+    {
+      info->untitled = untitled;
+      if (untitled)
+        priv->n_untitled++;
+      else
+        priv->n_untitled--;
+    }
+
+  if (modified != info->modified)
+    {
+      info->modified = modified;
+      if (modified)
+        priv->n_unsaved++;
+      else
+        priv->n_unsaved--;
+    }
+}
+
+static void
+gb_document_manager_document_changed (GObject      *object,
+                                      GParamSpec   *pspec,
+                                      DocumentInfo *info)
+{
+  gb_document_manager_update_info (info);
+}
+
+static void
+gb_document_manager_document_modified (GbDocument   *document,
+                                       GParamSpec   *pspec,
+                                       DocumentInfo *info)
 {
-  g_return_if_fail (GB_IS_DOCUMENT_MANAGER (manager));
   g_return_if_fail (GB_IS_DOCUMENT (document));
 
-  g_signal_emit (manager, gSignals [DOCUMENT_MODIFIED_CHANGED], 0, document);
+  gb_document_manager_update_info (info);
+
+  g_signal_emit (info->manager, gSignals [DOCUMENT_MODIFIED_CHANGED], 0,
+                 document);
 }
 
 void
 gb_document_manager_add (GbDocumentManager *manager,
                          GbDocument        *document)
 {
-  guint i;
+  DocumentInfo *info;
 
   g_return_if_fail (GB_IS_DOCUMENT_MANAGER (manager));
   g_return_if_fail (GB_IS_DOCUMENT (document));
 
-  for (i = 0; i < manager->priv->documents->len; i++)
+  if (g_hash_table_contains (manager->priv->infos, document))
     {
-      GbDocument *item;
-
-      item = g_ptr_array_index (manager->priv->documents, i);
-
-      if (item == document)
-        {
-          g_warning ("GbDocumentManager already contains document \"%s\"",
-                     gb_document_get_title (document));
-          return;
-        }
+      g_warning ("GbDocumentManager already contains document \"%s\"",
+                 gb_document_get_title (document));
+      return;
     }
 
-  g_signal_connect_object (document,
-                           "notify::modified",
-                           G_CALLBACK (gb_document_manager_document_modified),
-                           manager,
-                           G_CONNECT_SWAPPED);
+  info = g_slice_new0 (DocumentInfo);
+  info->manager = manager;
+  info->document = g_object_ref (document);
+  info->index = manager->priv->documents->len;
+
+  g_signal_connect (document,
+                    "notify::modified",
+                    G_CALLBACK (gb_document_manager_document_modified),
+                    info);
+  g_signal_connect (document,
+                    "notify::title",
+                    G_CALLBACK (gb_document_manager_document_changed),
+                    info);
+
+  if (GB_IS_EDITOR_DOCUMENT (document))
+    {
+      GtkSourceFile *sfile;
+
+      sfile = gb_editor_document_get_file (GB_EDITOR_DOCUMENT (document));
+      info->source_file = g_object_ref (sfile);
+      g_signal_connect (sfile,
+                        "notify::location",
+                        G_CALLBACK (gb_document_manager_document_changed),
+                        info);
+    }
 
-  g_ptr_array_add (manager->priv->documents, g_object_ref (document));
+  g_ptr_array_add (manager->priv->documents, document);
+  g_hash_table_insert (manager->priv->infos, document, info);
+  gb_document_manager_update_info (info);
 
   g_signal_emit (manager, gSignals [DOCUMENT_ADDED], 0, document);
 
@@ -223,27 +368,46 @@ void
 gb_document_manager_remove (GbDocumentManager *manager,
                             GbDocument        *document)
 {
-  guint i;
+  GbDocumentManagerPrivate *priv;
+  DocumentInfo *info;
 
   g_return_if_fail (GB_IS_DOCUMENT_MANAGER (manager));
   g_return_if_fail (GB_IS_DOCUMENT (document));
 
-  for (i = 0; i < manager->priv->documents->len; i++)
+  priv = manager->priv;
+
+  if ((info = g_hash_table_lookup (priv->infos, document)))
     {
-      GbDocument *item;
+      g_signal_handlers_disconnect_by_data (document, info);
+      if (info->source_file)
+        g_signal_handlers_disconnect_by_data (info->source_file, info);
 
-      item = g_ptr_array_index (manager->priv->documents, i);
+      gb_document_manager_unindex_location (info);
 
-      if (item == document)
+      if (info->untitled)
+        priv->n_untitled--;
+      if (info->modified)
+        priv->n_unsaved--;
+
+      g_ptr_array_remove_index_fast (priv->documents, info->index);
+      if (info->index < priv->documents->len)
         {
-          g_signal_handlers_disconnect_by_func (item,
-                                                gb_document_manager_document_modified,
-                                                manager);
-          g_ptr_array_remove_index_fast (manager->priv->documents, i);
-          g_signal_emit (manager, gSignals [DOCUMENT_REMOVED], 0, item);
-          g_object_unref (item);
-          break;
+          DocumentInfo *moved;
+
+          moved = g_hash_table_lookup (priv->infos,
+                                       g_ptr_array_index (priv->documents,
+                                                          info->index));
+          moved->index = info->index;
         }
+
+      g_hash_table_remove (priv->infos, document);
+
+      g_signal_emit (manager, gSignals [DOCUMENT_REMOVED], 0, document);
+
+      g_clear_object (&info->location);
+      g_clear_object (&info->source_file);
+      g_object_unref (info->document);
+      g_slice_free (DocumentInfo, info);
     }
 
   g_object_notify_by_pspec (G_OBJECT (manager), gParamSpecs [PROP_COUNT]);
@@ -264,6 +428,8 @@ gb_document_manager_finalize (GObject *object)
     }
 
   g_clear_pointer (&priv->documents, g_ptr_array_unref);
+  g_clear_pointer (&priv->infos, g_hash_table_unref);
+  g_clear_pointer (&priv->by_location, g_hash_table_unref);
 
   G_OBJECT_CLASS (gb_document_manager_parent_class)->finalize (object);
 }
@@ -349,4 +515,7 @@ gb_document_manager_init (GbDocumentManager *self)
 {
   self->priv = gb_document_manager_get_instance_private (self);
   self->priv->documents = g_ptr_array_new ();
+  self->priv->infos = g_hash_table_new (NULL, NULL);
+  self->priv->by_location = g_hash_table_new ((GHashFunc)g_file_hash,
+                                              (GEqualFunc)g_file_equal);
 }
@@ -66,6 +66,8 @@ void               gb_document_manager_remove                (GbDocumentManager
 GList             *gb_document_manager_get_documents         (GbDocumentManager *manager);
 GList             *gb_document_manager_get_unsaved_documents (GbDocumentManager *manager);
 guint              gb_document_manager_get_count             (GbDocumentManager *manager);
+guint              gb_document_manager_get_untitled_count    (GbDocumentManager *manager);
+guint              gb_document_manager_get_unsaved_count     (GbDocumentManager *manager);
 GbDocument        *gb_document_manager_find_with_file        (GbDocumentManager *manager,
                                                               GFile             *file);
 GbDocument        *gb_document_manager_find_with_type        (GbDocumentManager *manager,
@@ -25,10 +25,17 @@
 #include "gb-doc-seq.h"
 #include "gb-editor-document.h"
 #include "gb-editor-file-marks.h"
+#include "gb-editor-language-cache.h"
 #include "gb-editor-view.h"
 #include "gb-log.h"
 #include "gb-gtk.h"
-#include "gca-structs.h"
+#include "gb-source-diagnostics.h"
+
+/*
+ * Content sniffing only needs the start of the file, so at most this many
+ * characters are copied out of the buffer to guess the language.
+ */
+#define LANGUAGE_SNIFF_CHARS 4096
 
 struct _GbEditorDocumentPrivate
 {
@@ -41,6 +48,7 @@ struct _GbEditorDocumentPrivate
 
   gdouble                progress;
   guint                  doc_seq_id;
+  guint                  language_sequence;
   GTimeVal               mtime;
   GTimeVal               unsaved_ctime;
 
@@ -50,6 +58,16 @@ struct _GbEditorDocumentPrivate
   guint                  trim_trailing_whitespace : 1;
 };
 
+typedef struct
+{
+  GFile    *location;
+  gchar    *name;
+  gchar    *text;
+  GTimeVal  mtime;
+  guint     sequence;
+  guint     mtime_set : 1;
+} GuessLanguage;
+
 enum {
   PROP_0,
   PROP_CHANGE_MONITOR,
@@ -348,10 +366,10 @@ gb_editor_document_changed (GtkTextBuffer *buffer)
 }
 
 static void
-gb_editor_document_add_diagnostic (GbEditorDocument *document,
-                                   GcaDiagnostic    *diag,
-                                   GcaSourceRange   *range)
+gb_editor_document_add_diagnostic (GbEditorDocument         *document,
+                                   const GbSourceDiagnostic *diag)
 {
+  const GcaSourceRange *range;
   GtkTextBuffer *buffer;
   GtkTextIter begin;
   GtkTextIter end;
@@ -359,10 +377,8 @@ gb_editor_document_add_diagnostic (GbEditorDocument *document,
 
   g_assert (GB_IS_EDITOR_DOCUMENT (document));
   g_assert (diag);
-  g_assert (range);
 
-  if (range->begin.line == -1 || range->end.line == -1)
-    return;
+  range = &diag->range;
 
   buffer = GTK_TEXT_BUFFER (document);
 
@@ -495,8 +511,9 @@ gb_editor_document_code_assistant_changed (GbEditorDocument      *document,
 {
   GtkTextIter begin;
   GtkTextIter end;
+  GbSourceDiagnostics *diagnostics;
   GtkTextTag *tag;
-  GArray *ar;
+  guint length;
   guint i;
 
   g_return_if_fail (GB_IS_EDITOR_DOCUMENT (document));
@@ -513,25 +530,17 @@ gb_editor_document_code_assistant_changed (GbEditorDocument      *document,
   gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (document), &begin, &end);
   gtk_text_buffer_remove_tag (GTK_TEXT_BUFFER (document), tag, &begin, &end);
 
-  ar = gb_source_code_assistant_get_diagnostics (code_assistant);
-
-  for (i = 0; i < ar->len; i++)
-    {
-      GcaDiagnostic *diag;
-      guint j;
+  diagnostics = gb_source_code_assistant_get_diagnostics (code_assistant);
+  if (!diagnostics)
+    return;
 
-      diag = &g_array_index (ar, GcaDiagnostic, i);
+  length = gb_source_diagnostics_get_length (diagnostics);
 
-      for (j = 0; j < diag->locations->len; j++)
-        {
-          GcaSourceRange *range;
+  for (i = 0; i < length; i++)
+    gb_editor_document_add_diagnostic (document,
+                                       gb_source_diagnostics_get_nth (diagnostics, i));
 
-          range = &g_array_index (diag->locations, GcaSourceRange, j);
-          gb_editor_document_add_diagnostic (document, diag, range);
-        }
-    }
-
-  g_array_unref (ar);
+  gb_source_diagnostics_unref (diagnostics);
 }
 
 static gboolean
@@ -603,41 +612,175 @@ gb_editor_document_trim (GbEditorDocument *document)
 }
 
 static void
-gb_editor_document_guess_language (GbEditorDocument *document)
+guess_language_free (gpointer data)
+{
+  GuessLanguage *state = data;
+
+  g_clear_object (&state->location);
+  g_free (state->name);
+  g_free (state->text);
+  g_slice_free (GuessLanguage, state);
+}
+
+static void
+gb_editor_document_apply_content_type (GbEditorDocument *document,
+                                       GuessLanguage    *state,
+                                       const gchar      *content_type)
 {
   GtkSourceLanguageManager *manager;
   GtkSourceLanguage *lang;
+
+  /* A newer guess was started since, e.g. the document was reloaded. */
+  if (state->sequence != document->priv->language_sequence)
+    return;
+
+  manager = gtk_source_language_manager_get_default ();
+  lang = gtk_source_language_manager_guess_language (manager, state->name,
+                                                     content_type);
+
+  gtk_source_buffer_set_language (GTK_SOURCE_BUFFER (document), lang);
+
+  if (state->mtime_set)
+    gb_editor_language_cache_insert (gb_editor_language_cache_get_default (),
+                                     state->location,
+                                     &state->mtime,
+                                     lang ? gtk_source_language_get_id (lang) : NULL);
+}
+
+static gchar *
+guess_content_type (GuessLanguage *state)
+{
+  gboolean result_uncertain = TRUE;
+  gchar *content_type;
+
+  content_type = g_content_type_guess (state->name,
+                                       (const guint8 *)state->text,
+                                       strlen (state->text),
+                                       &result_uncertain);
+  if (result_uncertain)
+    g_clear_pointer (&content_type, g_free);
+
+  return content_type;
+}
+
+static void
+gb_editor_document_guess_content_type (GTask        *task,
+                                       gpointer      source_object,
+                                       gpointer      task_data,
+                                       GCancellable *cancellable)
+{
+  g_task_return_pointer (task, guess_content_type (task_data), g_free);
+}
+
+static void
+gb_editor_document_guess_language_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  GbEditorDocument *document = (GbEditorDocument *)object;
+  GError *error = NULL;
+  gchar *content_type;
+  GTask *task = (GTask *)result;
+
+  g_return_if_fail (GB_IS_EDITOR_DOCUMENT (document));
+  g_return_if_fail (G_IS_TASK (task));
+
+  content_type = g_task_propagate_pointer (task, &error);
+
+  if (error)
+    {
+      g_clear_error (&error);
+      return;
+    }
+
+  gb_editor_document_apply_content_type (document,
+                                         g_task_get_task_data (task),
+                                         content_type);
+
+  g_free (content_type);
+}
+
+/*
+ * Guesses the language from the file name and the start of the buffer.
+ * Sniffing the content runs in a thread. When @use_cache is set and the
+ * modification time of the file is known, the result is looked up in and
+ * stored to the language cache so that reopening the file skips sniffing.
+ */
+static void
+gb_editor_document_guess_language (GbEditorDocument *document,
+                                   gboolean          use_cache)
+{
+  GbEditorDocumentPrivate *priv;
+  GuessLanguage *state;
   GtkTextIter begin;
   GtkTextIter end;
-  gboolean result_uncertain = TRUE;
   GFile *location;
-  gchar *name = NULL;
-  gchar *text = NULL;
-  gchar *content_type = NULL;
+  GTask *task;
 
   g_return_if_fail (GB_IS_EDITOR_DOCUMENT (document));
 
-  location = gtk_source_file_get_location (document->priv->file);
+  priv = document->priv;
+
+  state = g_slice_new0 (GuessLanguage);
+  state->sequence = ++priv->language_sequence;
+
+  location = gtk_source_file_get_location (priv->file);
+
   if (location)
-    name = g_file_get_basename (location);
+    {
+      state->location = g_object_ref (location);
+      state->name = g_file_get_basename (location);
 
-  gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (document), &begin, &end);
-  text = gtk_text_iter_get_slice (&begin, &end);
+      if (use_cache && priv->mtime_set)
+        {
+          GbEditorLanguageCache *cache;
+          const gchar *language_id;
 
-  content_type = g_content_type_guess (name,
-                                       (const guint8 *)text, strlen (text),
-                                       &result_uncertain);
-  if (result_uncertain)
-    g_clear_pointer (&content_type, g_free);
+          state->mtime = priv->mtime;
+          state->mtime_set = TRUE;
 
-  manager = gtk_source_language_manager_get_default ();
-  lang = gtk_source_language_manager_guess_language (manager, name, content_type);
+          cache = gb_editor_language_cache_get_default ();
 
-  gtk_source_buffer_set_language (GTK_SOURCE_BUFFER (document), lang);
+          if (gb_editor_language_cache_lookup (cache, location, &priv->mtime,
+                                               &language_id))
+            {
+              GtkSourceLanguageManager *manager;
+              GtkSourceLanguage *lang = NULL;
+
+              manager = gtk_source_language_manager_get_default ();
+              if (language_id)
+                lang = gtk_source_language_manager_get_language (manager,
+                                                                 language_id);
+              gtk_source_buffer_set_language (GTK_SOURCE_BUFFER (document),
+                                              lang);
+              guess_language_free (state);
+              return;
+            }
+        }
+    }
 
-  g_free (content_type);
-  g_free (name);
-  g_free (text);
+  gtk_text_buffer_get_start_iter (GTK_TEXT_BUFFER (document), &begin);
+  gtk_text_buffer_get_iter_at_offset (GTK_TEXT_BUFFER (document), &end,
+                                      LANGUAGE_SNIFF_CHARS);
+  state->text = gtk_text_iter_get_slice (&begin, &end);
+
+  /* With nothing to sniff, only the file name is used, which is cheap. */
+  if (!*state->text)
+    {
+      gchar *content_type;
+
+      content_type = guess_content_type (state);
+      gb_editor_document_apply_content_type (document, state, content_type);
+      g_free (content_type);
+      guess_language_free (state);
+      return;
+    }
+
+  task = g_task_new (document, priv->cancellable,
+                     gb_editor_document_guess_language_cb, NULL);
+  g_task_set_task_data (task, state, guess_language_free);
+  g_task_run_in_thread (task, gb_editor_document_guess_content_type);
+  g_object_unref (task);
 }
 
 static void
@@ -707,7 +850,7 @@ gb_editor_document_notify_file_location (GbEditorDocument *document,
 
   gb_source_change_monitor_set_file (priv->change_monitor, location);
 
-  gb_editor_document_guess_language (document);
+  gb_editor_document_guess_language (document, FALSE);
 }
 
 static void
@@ -728,7 +871,31 @@ gb_editor_document_progress_cb (goffset  current_num_bytes,
 }
 
 static void
-gb_editor_document_load_info_cb (GObject      *object,
+gb_editor_document_apply_info (GbEditorDocument *document,
+                               GFileInfo        *info)
+{
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE))
+    {
+      gboolean read_only;
+
+      read_only = !g_file_info_get_attribute_boolean (info,
+                                                      G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
+      gb_editor_document_set_read_only (document, read_only);
+    }
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    {
+      GTimeVal tv;
+
+      g_file_info_get_modification_time (info, &tv);
+
+      document->priv->mtime = tv;
+      document->priv->mtime_set = TRUE;
+    }
+}
+
+static void
+gb_editor_document_save_info_cb (GObject      *object,
                                  GAsyncResult *result,
                                  gpointer      user_data)
 {
@@ -743,27 +910,36 @@ gb_editor_document_load_info_cb (GObject      *object,
   info = g_file_query_info_finish (file, result, &error);
 
   if (info)
-    {
-      if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE))
-        {
-          gboolean read_only;
+    gb_editor_document_apply_info (document, info);
 
-          read_only = !g_file_info_get_attribute_boolean (info,
-                                                          G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
-          gb_editor_document_set_read_only (document, read_only);
-        }
+  g_clear_error (&error);
+  g_clear_object (&document);
+  g_clear_object (&info);
+}
 
-      if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
-        {
-          GTimeVal tv;
+static void
+gb_editor_document_load_info_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  GbEditorDocument *document = user_data;
+  GFileInfo *info;
+  GError *error = NULL;
+  GFile *file = (GFile *)object;
 
-          g_file_info_get_modification_time (info, &tv);
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (GB_IS_EDITOR_DOCUMENT (document));
 
-          document->priv->mtime = tv;
-          document->priv->mtime_set = TRUE;
-        }
-    }
+  info = g_file_query_info_finish (file, result, &error);
 
+  if (info)
+    gb_editor_document_apply_info (document, info);
+
+  /* The modification time is needed to use the language cache. */
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    gb_editor_document_guess_language (document, TRUE);
+
+  g_clear_error (&error);
   g_clear_object (&document);
   g_clear_object (&info);
 }
@@ -863,7 +1039,7 @@ gb_editor_document_save_cb (GObject      *object,
                            G_FILE_QUERY_INFO_NONE,
                            G_PRIORITY_DEFAULT,
                            document->priv->cancellable,
-                           gb_editor_document_load_info_cb,
+                           gb_editor_document_save_info_cb,
                            g_object_ref (document));
 
   change_monitor = gb_editor_document_get_change_monitor (document);
@@ -1139,7 +1315,6 @@ gb_editor_document_load_cb (GObject      *object,
                            g_object_ref (document));
 
   gb_editor_document_restore_insert (document);
-  gb_editor_document_guess_language (document);
 
   g_task_return_boolean (task, TRUE);
 
@@ -16,19 +16,59 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <errno.h>
+#include <string.h>
 
 #include "gb-editor-file-marks.h"
-#include "gb-string.h"
+
+/*
+ * Marks are kept for the most recently used files only. The marks file is
+ * a journal: every save appends a "line:column uri" record for each mark
+ * that changed, and the last record for a URI wins when loading. Once the
+ * journal grows well beyond the number of live marks it is rewritten with
+ * one record per mark, oldest first, so that the least recently used marks
+ * are the first to go when the cap is reached.
+ *
+ * Writes happen in order on a single worker thread. GbEditorFileMark
+ * objects are only created for files that are actually looked up.
+ */
+#define MAX_MARKS     1024
+#define COMPACT_SLACK 256
+
+typedef struct
+{
+  GbEditorFileMarks *marks;
+  gchar             *uri;
+  GbEditorFileMark  *mark;
+  GList              link;
+  gulong             notify_handler;
+  guint              line;
+  guint              column;
+  guint              dirty : 1;
+  guint              loading : 1;
+} MarkEntry;
+
+typedef struct
+{
+  GFile  *file;
+  GBytes *bytes;
+  guint   replace : 1;
+} WriteJob;
 
 struct _GbEditorFileMarksPrivate
 {
-  GHashTable *marks;
-  guint       save_timeout;
+  GHashTable  *marks;
+  GQueue       lru;
+  GPtrArray   *dirty;
+  GThreadPool *writer;
+  guint        journal_lines;
+  guint        save_timeout;
+  guint        loaded : 1;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GbEditorFileMarks, gb_editor_file_marks, G_TYPE_OBJECT)
 
+static void gb_editor_file_marks_queue_save (GbEditorFileMarks *marks);
+
 GbEditorFileMarks *
 gb_editor_file_marks_new (void)
 {
@@ -46,42 +86,96 @@ gb_editor_file_marks_get_default (void)
   return instance;
 }
 
-static gboolean
-gb_editor_file_marks_save_timeout (gpointer data)
+static void
+on_mark_notify (GbEditorFileMark *mark,
+                GParamSpec       *pspec,
+                MarkEntry        *entry)
 {
-  GbEditorFileMarks *marks = data;
+  GbEditorFileMarks *marks = entry->marks;
 
-  g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), G_SOURCE_REMOVE);
+  g_assert (GB_IS_EDITOR_FILE_MARKS (marks));
 
-  marks->priv->save_timeout = 0;
+  entry->line = gb_editor_file_mark_get_line (mark);
+  entry->column = gb_editor_file_mark_get_column (mark);
 
-  gb_editor_file_marks_save_async (marks, NULL, NULL, NULL);
+  if (!entry->dirty)
+    {
+      entry->dirty = TRUE;
+      g_ptr_array_add (marks->priv->dirty, entry);
+    }
 
-  return G_SOURCE_REMOVE;
+  gb_editor_file_marks_queue_save (marks);
+}
+
+/*
+ * Creates an entry and appends it to @lru, which is either the LRU of
+ * @marks or the queue of entries being loaded.
+ */
+static MarkEntry *
+mark_entry_new (GbEditorFileMarks *marks,
+                GQueue            *lru,
+                gchar             *uri,
+                guint              line,
+                guint              column)
+{
+  MarkEntry *entry;
+
+  entry = g_slice_new0 (MarkEntry);
+  entry->marks = marks;
+  entry->uri = uri;
+  entry->line = line;
+  entry->column = column;
+  entry->link.data = entry;
+
+  g_hash_table_insert (marks->priv->marks, entry->uri, entry);
+  g_queue_push_tail_link (lru, &entry->link);
+
+  return entry;
 }
 
 static void
-gb_editor_file_marks_queue_save (GbEditorFileMarks *marks)
+mark_entry_free (gpointer data)
 {
-  g_return_if_fail (GB_IS_EDITOR_FILE_MARKS (marks));
+  MarkEntry *entry = data;
+  GbEditorFileMarksPrivate *priv = entry->marks->priv;
 
-  if (!marks->priv->save_timeout)
+  if (entry->mark)
     {
-      marks->priv->save_timeout =
-        g_timeout_add_seconds (1, gb_editor_file_marks_save_timeout, marks);
+      g_signal_handler_disconnect (entry->mark, entry->notify_handler);
+      g_object_unref (entry->mark);
+    }
+
+  if (entry->dirty)
+    g_ptr_array_remove_fast (priv->dirty, entry);
+
+  g_queue_unlink (&priv->lru, &entry->link);
+  g_free (entry->uri);
+  g_slice_free (MarkEntry, entry);
+}
+
+static void
+mark_entry_touch (MarkEntry *entry)
+{
+  GQueue *lru = &entry->marks->priv->lru;
+
+  if (lru->tail != &entry->link)
+    {
+      g_queue_unlink (lru, &entry->link);
+      g_queue_push_tail_link (lru, &entry->link);
     }
 }
 
 static void
-on_mark_notify (GbEditorFileMark *mark,
-                GParamSpec       *pspec,
-                gpointer          user_data)
+gb_editor_file_marks_evict (GbEditorFileMarks *marks)
 {
-  GbEditorFileMarks *marks = user_data;
+  GbEditorFileMarksPrivate *priv = marks->priv;
 
-  g_assert (GB_IS_EDITOR_FILE_MARKS (marks));
+  while (priv->lru.length > MAX_MARKS)
+    {
+      MarkEntry *entry = priv->lru.head->data;
 
-  gb_editor_file_marks_queue_save (marks);
+      g_hash_table_remove (priv->marks, entry->uri);
+    }
 }
 
 static GFile *
@@ -116,91 +210,190 @@ GbEditorFileMark *
 gb_editor_file_marks_get_for_file (GbEditorFileMarks *marks,
                                    GFile             *file)
 {
-  GbEditorFileMark *ret;
+  MarkEntry *entry;
   gchar *uri;
 
   g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), NULL);
   g_return_val_if_fail (G_IS_FILE (file), NULL);
 
   uri = g_file_get_uri (file);
-  ret = g_hash_table_lookup (marks->priv->marks, uri);
-  g_free (uri);
+  entry = g_hash_table_lookup (marks->priv->marks, uri);
 
-  if (!ret)
+  if (entry)
+    {
+      g_free (uri);
+      mark_entry_touch (entry);
+    }
+  else
     {
-      ret = gb_editor_file_mark_new (file, 0, 0);
-      g_hash_table_replace (marks->priv->marks, g_file_get_uri (file), ret);
-      g_signal_connect_object (ret, "notify", G_CALLBACK (on_mark_notify),
-                               marks, 0);
+      entry = mark_entry_new (marks, &marks->priv->lru, uri, 0, 0);
+      gb_editor_file_marks_evict (marks);
     }
 
-  return ret;
+  if (!entry->mark)
+    {
+      entry->mark = gb_editor_file_mark_new (file, entry->line, entry->column);
+      entry->notify_handler = g_signal_connect (entry->mark,
+                                                "notify",
+                                                G_CALLBACK (on_mark_notify),
+                                                entry);
+    }
+
+  return entry->mark;
+}
+
+static void
+append_entry (GString   *str,
+              MarkEntry *entry)
+{
+  g_string_append_printf (str, "%u:%u %s\n",
+                          entry->line, entry->column, entry->uri);
 }
 
-static GBytes *
-gb_editor_file_marks_serialize (GbEditorFileMarks *marks)
+/*
+ * Builds the next write for the journal: the changed marks, or all of them
+ * if the journal is due for compaction. Compaction waits until the journal
+ * has been loaded so that it cannot drop marks that were never read.
+ */
+static WriteJob *
+gb_editor_file_marks_prepare_write (GbEditorFileMarks *marks)
 {
-  GbEditorFileMark *mark;
-  GHashTableIter iter;
+  GbEditorFileMarksPrivate *priv = marks->priv;
+  WriteJob *job;
   GString *str;
   gsize len;
-  gchar *data;
-
-  g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), NULL);
+  guint i;
 
   str = g_string_new (NULL);
 
-  g_hash_table_iter_init (&iter, marks->priv->marks);
+  job = g_slice_new0 (WriteJob);
+  job->file = gb_editor_file_marks_get_file (marks);
+  job->replace = (priv->loaded &&
+                  (priv->journal_lines + priv->dirty->len) >
+                  (2 * priv->lru.length + COMPACT_SLACK));
 
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&mark))
+  if (job->replace)
     {
-      guint line;
-      guint column;
-      GFile *file;
-      gchar *uri = NULL;
-
-      g_object_get (mark,
-                    "file", &file,
-                    "line", &line,
-                    "column", &column,
-                    NULL);
+      GList *iter;
 
-      if (!file)
-        continue;
+      for (iter = priv->lru.head; iter; iter = iter->next)
+        append_entry (str, iter->data);
 
-      uri = g_file_get_uri (file);
-
-      g_string_append_printf (str, "%u:%u %s\n", line, column, uri);
+      priv->journal_lines = priv->lru.length;
+    }
+  else
+    {
+      for (i = 0; i < priv->dirty->len; i++)
+        append_entry (str, g_ptr_array_index (priv->dirty, i));
 
-      g_free (uri);
-      g_object_unref (file);
+      priv->journal_lines += priv->dirty->len;
     }
 
+  for (i = 0; i < priv->dirty->len; i++)
+    ((MarkEntry *)g_ptr_array_index (priv->dirty, i))->dirty = FALSE;
+  g_ptr_array_set_size (priv->dirty, 0);
+
   len = str->len;
-  data = g_string_free (str, FALSE);
+  job->bytes = g_bytes_new_take (g_string_free (str, FALSE), len);
 
-  return g_bytes_new_take (data, len);
+  return job;
 }
 
 static void
-gb_editor_file_marks_save_cb (GObject      *source,
-                              GAsyncResult *result,
-                              gpointer      user_data)
+write_job_free (gpointer data)
 {
-  GFile *file = (GFile *)source;
-  GSimpleAsyncResult *simple = user_data;
-  GError *error = NULL;
+  WriteJob *job = data;
+
+  g_clear_object (&job->file);
+  g_clear_pointer (&job->bytes, g_bytes_unref);
+  g_slice_free (WriteJob, job);
+}
+
+static gboolean
+write_job_run (WriteJob      *job,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+  GFileOutputStream *stream;
+  GFile *parent;
+  gboolean ret;
+
+  if (!job->replace && !g_bytes_get_size (job->bytes))
+    return TRUE;
+
+  parent = g_file_get_parent (job->file);
+  g_file_make_directory_with_parents (parent, cancellable, NULL);
+  g_object_unref (parent);
+
+  if (job->replace)
+    return g_file_replace_contents (job->file,
+                                    g_bytes_get_data (job->bytes, NULL),
+                                    g_bytes_get_size (job->bytes),
+                                    NULL,
+                                    FALSE,
+                                    G_FILE_CREATE_REPLACE_DESTINATION,
+                                    NULL,
+                                    cancellable,
+                                    error);
+
+  stream = g_file_append_to (job->file, G_FILE_CREATE_NONE, cancellable, error);
+  if (!stream)
+    return FALSE;
 
-  g_return_if_fail (G_IS_FILE (file));
-  g_return_if_fail (G_IS_ASYNC_RESULT (result));
-  g_return_if_fail (G_IS_SIMPLE_ASYNC_RESULT (simple));
+  ret = (g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                    g_bytes_get_data (job->bytes, NULL),
+                                    g_bytes_get_size (job->bytes),
+                                    NULL,
+                                    cancellable,
+                                    error) &&
+         g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, error));
 
-  if (!g_file_replace_contents_finish (file, result, NULL, &error))
-    g_simple_async_result_take_error (simple, error);
+  g_object_unref (stream);
+
+  return ret;
+}
+
+static void
+gb_editor_file_marks_writer_func (gpointer data,
+                                  gpointer user_data)
+{
+  GTask *task = data;
+  GError *error = NULL;
+
+  if (write_job_run (g_task_get_task_data (task),
+                     g_task_get_cancellable (task),
+                     &error))
+    g_task_return_boolean (task, TRUE);
   else
-    g_simple_async_result_set_op_res_gboolean (simple, TRUE);
+    g_task_return_error (task, error);
 
-  g_simple_async_result_complete_in_idle (simple);
+  g_object_unref (task);
+}
+
+static gboolean
+gb_editor_file_marks_save_timeout (gpointer data)
+{
+  GbEditorFileMarks *marks = data;
+
+  g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), G_SOURCE_REMOVE);
+
+  marks->priv->save_timeout = 0;
+
+  gb_editor_file_marks_save_async (marks, NULL, NULL, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_editor_file_marks_queue_save (GbEditorFileMarks *marks)
+{
+  g_return_if_fail (GB_IS_EDITOR_FILE_MARKS (marks));
+
+  if (!marks->priv->save_timeout)
+    {
+      marks->priv->save_timeout =
+        g_timeout_add_seconds (1, gb_editor_file_marks_save_timeout, marks);
+    }
 }
 
 void
@@ -209,31 +402,15 @@ gb_editor_file_marks_save_async (GbEditorFileMarks   *marks,
                                  GAsyncReadyCallback  callback,
                                  gpointer             user_data)
 {
-  GSimpleAsyncResult *simple;
-  GFile *file = NULL;
-  GBytes *bytes = NULL;
+  GTask *task;
 
   g_return_if_fail (GB_IS_EDITOR_FILE_MARKS (marks));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  file = gb_editor_file_marks_get_file (marks);
-  bytes = gb_editor_file_marks_serialize (marks);
-
-  simple = g_simple_async_result_new (G_OBJECT (marks), callback, user_data,
-                                      gb_editor_file_marks_save_async);
-
-  g_file_replace_contents_bytes_async (file,
-                                       bytes,
-                                       NULL,
-                                       FALSE,
-                                       G_FILE_CREATE_REPLACE_DESTINATION,
-                                       cancellable,
-                                       gb_editor_file_marks_save_cb,
-                                       g_object_ref (simple));
-
-  g_clear_object (&file);
-  g_clear_object (&simple);
-  g_clear_pointer (&bytes, g_bytes_unref);
+  task = g_task_new (marks, cancellable, callback, user_data);
+  g_task_set_task_data (task, gb_editor_file_marks_prepare_write (marks),
+                        write_job_free);
+  g_thread_pool_push (marks->priv->writer, task, NULL);
 }
 
 gboolean
@@ -241,15 +418,27 @@ gb_editor_file_marks_save_finish (GbEditorFileMarks  *marks,
                                   GAsyncResult       *result,
                                   GError            **error)
 {
-  GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
-
   g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), FALSE);
-  g_return_val_if_fail (G_IS_SIMPLE_ASYNC_RESULT (simple), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
 
-  if (g_simple_async_result_propagate_error (simple, error))
-    return FALSE;
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
 
-  return TRUE;
+static GThreadPool *
+gb_editor_file_marks_new_writer (void)
+{
+  return g_thread_pool_new (gb_editor_file_marks_writer_func, NULL, 1, FALSE,
+                            NULL);
+}
+
+/*
+ * Waits for all queued writes to complete.
+ */
+static void
+gb_editor_file_marks_drain (GbEditorFileMarks *marks)
+{
+  g_thread_pool_free (marks->priv->writer, FALSE, TRUE);
+  marks->priv->writer = gb_editor_file_marks_new_writer ();
 }
 
 gboolean
@@ -257,102 +446,194 @@ gb_editor_file_marks_save (GbEditorFileMarks  *marks,
                            GCancellable       *cancellable,
                            GError            **error)
 {
-  GBytes *bytes;
-  GFile *file;
+  WriteJob *job;
   gboolean ret;
 
   g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), FALSE);
 
-  bytes = gb_editor_file_marks_serialize (marks);
-  file = gb_editor_file_marks_get_file (marks);
+  if (marks->priv->save_timeout)
+    {
+      g_source_remove (marks->priv->save_timeout);
+      marks->priv->save_timeout = 0;
+    }
 
-  ret = g_file_replace_contents (file,
-                                 g_bytes_get_data (bytes, NULL),
-                                 g_bytes_get_size (bytes),
-                                 NULL,
-                                 FALSE,
-                                 G_FILE_CREATE_REPLACE_DESTINATION,
-                                 NULL,
-                                 cancellable,
-                                 error);
+  gb_editor_file_marks_drain (marks);
 
-  g_bytes_unref (bytes);
-  g_clear_object (&file);
+  job = gb_editor_file_marks_prepare_write (marks);
+  ret = write_job_run (job, cancellable, error);
+  write_job_free (job);
 
   return ret;
 }
 
+static gboolean
+parse_uint (const gchar **str,
+            const gchar  *end,
+            guint        *value)
+{
+  const gchar *p = *str;
+  guint64 v = 0;
+
+  if ((p >= end) || !g_ascii_isdigit (*p))
+    return FALSE;
+
+  for (; (p < end) && g_ascii_isdigit (*p); p++)
+    {
+      v = (v * 10) + (*p - '0');
+      if (v > G_MAXUINT)
+        return FALSE;
+    }
+
+  *str = p;
+  *value = v;
+
+  return TRUE;
+}
+
+/*
+ * Applies one "line:column uri" journal record to @loaded, which keeps the
+ * records in the order they were last written. Marks that existed before
+ * loading are newer than anything on disk and are left alone.
+ */
+static void
+gb_editor_file_marks_apply (GbEditorFileMarks *marks,
+                            GQueue            *loaded,
+                            const gchar       *line_str,
+                            const gchar       *end,
+                            GString           *uri)
+{
+  MarkEntry *entry;
+  guint line;
+  guint column;
+
+  while ((line_str < end) && g_ascii_isspace (*line_str))
+    line_str++;
+  while ((end > line_str) && g_ascii_isspace (end [-1]))
+    end--;
+
+  if (!parse_uint (&line_str, end, &line) ||
+      (line_str >= end) || (*line_str++ != ':') ||
+      !parse_uint (&line_str, end, &column) ||
+      (line_str >= end) || (*line_str++ != ' ') ||
+      (line_str >= end))
+    return;
+
+  g_string_truncate (uri, 0);
+  g_string_append_len (uri, line_str, end - line_str);
+
+  if ((entry = g_hash_table_lookup (marks->priv->marks, uri->str)))
+    {
+      if (!entry->loading)
+        return;
+
+      g_queue_unlink (loaded, &entry->link);
+      g_queue_push_tail_link (loaded, &entry->link);
+
+      entry->line = line;
+      entry->column = column;
+    }
+  else
+    {
+      entry = mark_entry_new (marks, loaded, g_strndup (uri->str, uri->len),
+                              line, column);
+      entry->loading = TRUE;
+    }
+}
+
+/*
+ * Moves the entries read from the journal in front of the LRU, so that they
+ * are older than every mark created before loading and are evicted first.
+ */
+static void
+gb_editor_file_marks_prepend_loaded (GbEditorFileMarks *marks,
+                                     GQueue            *loaded)
+{
+  GQueue *lru = &marks->priv->lru;
+  GList *iter;
+
+  if (!loaded->head)
+    return;
+
+  for (iter = loaded->head; iter; iter = iter->next)
+    ((MarkEntry *)iter->data)->loading = FALSE;
+
+  loaded->tail->next = lru->head;
+  if (lru->head)
+    lru->head->prev = loaded->tail;
+  else
+    lru->tail = loaded->tail;
+
+  lru->head = loaded->head;
+  lru->length += loaded->length;
+
+  g_queue_init (loaded);
+}
+
 gboolean
 gb_editor_file_marks_load (GbEditorFileMarks  *marks,
                            GError            **error)
 {
-  gchar **parts = NULL;
-  gchar *contents = NULL;
-  GFile *file = NULL;
-  gsize len = 0;
-  gboolean ret;
-  guint i;
+  GMappedFile *mapped;
+  GError *local_error = NULL;
+  const gchar *contents;
+  const gchar *end;
+  GString *uri;
+  GQueue loaded = G_QUEUE_INIT;
+  GFile *file;
+  gchar *path;
+  guint n_lines = 0;
 
   g_return_val_if_fail (GB_IS_EDITOR_FILE_MARKS (marks), FALSE);
 
   file = gb_editor_file_marks_get_file (marks);
+  path = g_file_get_path (file);
+  mapped = g_mapped_file_new (path, FALSE, &local_error);
+  g_free (path);
+  g_object_unref (file);
 
-  ret = g_file_load_contents (file, NULL, &contents, &len, NULL, error);
+  marks->priv->loaded = TRUE;
 
-  if (ret)
+  if (!mapped)
     {
-      parts = g_strsplit (contents, "\n", -1);
-
-      for (i = 0; parts [i]; i++)
+      if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
         {
-          const gchar *str = g_strstrip (parts [i]);
-          GbEditorFileMark *mark;
-          gchar *endptr = NULL;
-          GFile *mark_file;
-          gint64 val;
-          guint line;
-          guint column;
-
-          val = g_ascii_strtoll (str, &endptr, 10);
-          if (((val == G_MAXINT64) || (val == G_MININT64)) && (errno == ERANGE))
-            continue;
-          line = (guint)val;
-
-          if (*endptr != ':')
-            continue;
-
-          str = ++endptr;
-
-          val = g_ascii_strtoll (str, &endptr, 10);
-          if (((val == G_MAXINT64) || (val == G_MININT64)) && (errno == ERANGE))
-            continue;
-          column = (guint)val;
-
-          if (*endptr != ' ')
-            continue;
-
-          str = ++endptr;
-
-          if (gb_str_empty0 (str))
-            continue;
-
-          mark_file = g_file_new_for_uri (str);
-          if (!mark_file)
-            continue;
-
-          mark = gb_editor_file_mark_new (mark_file, line, column);
-          g_hash_table_replace (marks->priv->marks, g_strdup (str), mark);
-          g_signal_connect_object (mark, "notify", G_CALLBACK (on_mark_notify),
-                                   marks, 0);
-          g_object_unref (mark_file);
+          g_clear_error (&local_error);
+          return TRUE;
         }
+
+      g_propagate_error (error, local_error);
+      return FALSE;
     }
 
-  g_clear_object (&file);
-  g_clear_pointer (&parts, g_strfreev);
-  g_clear_pointer (&contents, g_free);
+  contents = g_mapped_file_get_contents (mapped);
+  end = contents + g_mapped_file_get_length (mapped);
+  uri = g_string_new (NULL);
 
-  return ret;
+  while (contents < end)
+    {
+      const gchar *eol;
+
+      if (!(eol = memchr (contents, '\n', end - contents)))
+        eol = end;
+
+      gb_editor_file_marks_apply (marks, &loaded, contents, eol, uri);
+
+      contents = eol + 1;
+      n_lines++;
+    }
+
+  g_string_free (uri, TRUE);
+  g_mapped_file_unref (mapped);
+
+  gb_editor_file_marks_prepend_loaded (marks, &loaded);
+
+  marks->priv->journal_lines += n_lines;
+  gb_editor_file_marks_evict (marks);
+
+  if (marks->priv->journal_lines > (2 * marks->priv->lru.length + COMPACT_SLACK))
+    gb_editor_file_marks_queue_save (marks);
+
+  return TRUE;
 }
 
 static void
@@ -360,14 +641,16 @@ gb_editor_file_marks_finalize (GObject *object)
 {
   GbEditorFileMarksPrivate *priv = GB_EDITOR_FILE_MARKS (object)->priv;
 
-  g_clear_pointer (&priv->marks, g_hash_table_unref);
-
   if (priv->save_timeout)
     {
       g_source_remove (priv->save_timeout);
       priv->save_timeout = 0;
     }
 
+  g_thread_pool_free (priv->writer, FALSE, TRUE);
+  g_clear_pointer (&priv->marks, g_hash_table_unref);
+  g_clear_pointer (&priv->dirty, g_ptr_array_unref);
+
   G_OBJECT_CLASS (gb_editor_file_marks_parent_class)->finalize (object);
 }
 
@@ -384,5 +667,8 @@ gb_editor_file_marks_init (GbEditorFileMarks *self)
 {
   self->priv = gb_editor_file_marks_get_instance_private (self);
   self->priv->marks = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                             g_free, g_object_unref);
+                                             NULL, mark_entry_free);
+  self->priv->dirty = g_ptr_array_new ();
+  self->priv->writer = gb_editor_file_marks_new_writer ();
+  g_queue_init (&self->priv->lru);
 }
@@ -1005,6 +1005,17 @@ gb_editor_frame_find_activate (GSimpleAction *action,
   gb_editor_frame_find (self, NULL);
 }
 
+static gboolean
+gb_editor_frame_tooltip_cb (const GbSourceDiagnostic *diag,
+                            gpointer                  user_data)
+{
+  const gchar **message = user_data;
+
+  *message = diag->message;
+
+  return TRUE;
+}
+
 static gboolean
 gb_editor_frame_on_query_tooltip (GbEditorFrame *self,
                                   gint           x,
@@ -1015,11 +1026,10 @@ gb_editor_frame_on_query_tooltip (GbEditorFrame *self,
 {
   GbEditorFramePrivate *priv;
   GbSourceCodeAssistant *code_assistant;
+  GbSourceDiagnostics *diagnostics;
+  const gchar *message = NULL;
   GtkTextIter iter;
-  GArray *ar;
-  gboolean ret = FALSE;
   guint line;
-  guint i;
 
   g_assert (GB_IS_SOURCE_VIEW (source_view));
   g_assert (GB_IS_EDITOR_FRAME (self));
@@ -1030,8 +1040,8 @@ gb_editor_frame_on_query_tooltip (GbEditorFrame *self,
   if (!code_assistant)
     return FALSE;
 
-  ar = gb_source_code_assistant_get_diagnostics (code_assistant);
-  if (!ar)
+  diagnostics = gb_source_code_assistant_get_diagnostics (code_assistant);
+  if (!diagnostics)
     return FALSE;
 
   gtk_text_view_window_to_buffer_coords (GTK_TEXT_VIEW (source_view),
@@ -1043,32 +1053,16 @@ gb_editor_frame_on_query_tooltip (GbEditorFrame *self,
 
   line = gtk_text_iter_get_line (&iter);
 
-  for (i = 0; i < ar->len; i++)
-    {
-      GcaDiagnostic *diag;
-      guint j;
-
-      diag = &g_array_index (ar, GcaDiagnostic, i);
-
-      for (j = 0; j < diag->locations->len; j++)
-        {
-          GcaSourceRange *loc;
-
-          loc = &g_array_index (diag->locations, GcaSourceRange, j);
+  gb_source_diagnostics_foreach_in_range (diagnostics, line, line,
+                                          gb_editor_frame_tooltip_cb,
+                                          &message);
 
-          if ((loc->begin.line <= line) && (loc->end.line >= line))
-            {
-              gtk_tooltip_set_text (tooltip, diag->message);
-              ret = TRUE;
-              goto cleanup;
-            }
-        }
-    }
+  if (message)
+    gtk_tooltip_set_text (tooltip, message);
 
-cleanup:
-  g_array_unref (ar);
+  gb_source_diagnostics_unref (diagnostics);
 
-  return ret;
+  return (message != NULL);
 }
 
 static void
@@ -1202,135 +1196,56 @@ gb_editor_frame_scroll_to_line (GbEditorFrame *self,
 }
 
 static void
-gb_editor_frame_next_diagnostic (GbEditorFrame *self)
+gb_editor_frame_move_to_diagnostic (GbEditorFrame *self,
+                                    gboolean       backward)
 {
+  const GbSourceDiagnostic *diag;
   GbSourceCodeAssistant *assistant;
+  GbSourceDiagnostics *diagnostics;
   GtkTextMark *mark;
   GtkTextIter iter;
-  guint current_line;
-  GArray *ar;
-  guint i;
+  guint line;
+  guint column;
 
   g_return_if_fail (GB_IS_EDITOR_FRAME (self));
 
   assistant = gb_editor_document_get_code_assistant (self->priv->document);
-  ar = gb_source_code_assistant_get_diagnostics (assistant);
+  if (!assistant)
+    return;
+
+  diagnostics = gb_source_code_assistant_get_diagnostics (assistant);
+  if (!diagnostics)
+    return;
+
   mark = gtk_text_buffer_get_insert (GTK_TEXT_BUFFER (self->priv->document));
   gtk_text_buffer_get_iter_at_mark (GTK_TEXT_BUFFER (self->priv->document),
                                     &iter, mark);
-  current_line = gtk_text_iter_get_line (&iter);
-
-  if (ar)
-    {
-      for (i = 0; i < ar->len; i++)
-        {
-          GcaDiagnostic *diag;
-          guint j;
-
-          diag = &g_array_index (ar, GcaDiagnostic, i);
-
-          for (j = 0; j < diag->locations->len; j++)
-            {
-              GcaSourceRange *range;
-
-              range = &g_array_index (diag->locations, GcaSourceRange, j);
-
-              if (range->begin.line > current_line)
-                {
-                  gb_editor_frame_scroll_to_line (self,
-                                                  range->begin.line,
-                                                  range->begin.column);
-                  goto cleanup;
-                }
-            }
-        }
-
-      /* wrap around to first diagnostic */
-      if (ar->len > 0)
-        {
-          GcaDiagnostic *diag;
+  line = gtk_text_iter_get_line (&iter);
+  column = gtk_text_iter_get_line_offset (&iter);
 
-          diag = &g_array_index (ar, GcaDiagnostic, 0);
+  /* both directions wrap around at the ends of the buffer */
+  if (backward)
+    diag = gb_source_diagnostics_get_previous (diagnostics, line, column);
+  else
+    diag = gb_source_diagnostics_get_next (diagnostics, line, column);
 
-          if (diag->locations->len > 0)
-            {
-              GcaSourceRange *range;
+  if (diag)
+    gb_editor_frame_scroll_to_line (self, diag->range.begin.line,
+                                    diag->range.begin.column);
 
-              range = &g_array_index (diag->locations, GcaSourceRange, 0);
-              gb_editor_frame_scroll_to_line (self, range->begin.line,
-                                              range->begin.column);
-            }
-        }
+  gb_source_diagnostics_unref (diagnostics);
+}
 
-cleanup:
-      g_array_unref (ar);
-    }
+static void
+gb_editor_frame_next_diagnostic (GbEditorFrame *self)
+{
+  gb_editor_frame_move_to_diagnostic (self, FALSE);
 }
 
 static void
 gb_editor_frame_previous_diagnostic (GbEditorFrame *self)
 {
-  GbSourceCodeAssistant *assistant;
-  GtkTextMark *mark;
-  GtkTextIter iter;
-  guint current_line;
-  GArray *ar;
-  gint i;
-
-  g_return_if_fail (GB_IS_EDITOR_FRAME (self));
-
-  assistant = gb_editor_document_get_code_assistant (self->priv->document);
-  ar = gb_source_code_assistant_get_diagnostics (assistant);
-  mark = gtk_text_buffer_get_insert (GTK_TEXT_BUFFER (self->priv->document));
-  gtk_text_buffer_get_iter_at_mark (GTK_TEXT_BUFFER (self->priv->document),
-                                    &iter, mark);
-  current_line = gtk_text_iter_get_line (&iter);
-
-  if (ar)
-    {
-      for (i = 0; i < ar->len; i++)
-        {
-          GcaDiagnostic *diag;
-          guint j;
-
-          diag = &g_array_index (ar, GcaDiagnostic, ar->len-i-1);
-
-          for (j = 0; j < diag->locations->len; j++)
-            {
-              GcaSourceRange *range;
-
-              range = &g_array_index (diag->locations, GcaSourceRange, j);
-
-              if (range->begin.line < current_line)
-                {
-                  gb_editor_frame_scroll_to_line (self,
-                                                  range->begin.line,
-                                                  range->begin.column);
-                  goto cleanup;
-                }
-            }
-        }
-
-      /* wrap around to last diagnostic */
-      if (ar->len > 0)
-        {
-          GcaDiagnostic *diag;
-
-          diag = &g_array_index (ar, GcaDiagnostic, ar->len-1);
-
-          if (diag->locations->len > 0)
-            {
-              GcaSourceRange *range;
-
-              range = &g_array_index (diag->locations, GcaSourceRange, 0);
-              gb_editor_frame_scroll_to_line (self, range->begin.line,
-                                              range->begin.column);
-            }
-        }
-    }
-
-cleanup:
-  g_clear_pointer (&ar, g_array_unref);
+  gb_editor_frame_move_to_diagnostic (self, TRUE);
 }
 
 static void
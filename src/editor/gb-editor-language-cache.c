@@ -0,0 +1,523 @@
+/* gb-editor-language-cache.c
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "language-cache"
+
+#include "gb-editor-language-cache.h"
+
+/*
+ * Remembers the language detected for a file, keyed by URI and checked
+ * against the file's modification time, so that reopening a file does not
+ * sniff its contents again. The map is stored as "mtime language uri"
+ * lines in the user cache directory, with "-" for files that had no
+ * language. Only the most recently used entries are kept.
+ *
+ * The file is read and parsed in a worker thread. Until that finishes,
+ * lookups miss and the language is sniffed as usual.
+ */
+#define MAX_ENTRIES        1024
+#define SAVE_TIMEOUT_SECS  5
+
+typedef struct
+{
+  gchar  *uri;
+  gchar  *language_id;
+  gint64  mtime;
+  GList   link;
+} CacheEntry;
+
+struct _GbEditorLanguageCachePrivate
+{
+  GHashTable *entries;
+  GQueue      lru;
+  guint       save_timeout;
+  guint       loaded : 1;
+  guint       loading : 1;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (GbEditorLanguageCache, gb_editor_language_cache,
+                            G_TYPE_OBJECT)
+
+GbEditorLanguageCache *
+gb_editor_language_cache_get_default (void)
+{
+  static GbEditorLanguageCache *instance;
+
+  if (!instance)
+    instance = g_object_new (GB_TYPE_EDITOR_LANGUAGE_CACHE, NULL);
+
+  return instance;
+}
+
+static GFile *
+gb_editor_language_cache_get_file (void)
+{
+  gchar *path;
+  GFile *file;
+
+  path = g_build_filename (g_get_user_cache_dir (),
+                           "gnome-builder",
+                           "languages",
+                           NULL);
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  return file;
+}
+
+static gint64
+timeval_to_usec (const GTimeVal *tv)
+{
+  return ((gint64)tv->tv_sec * G_USEC_PER_SEC) + tv->tv_usec;
+}
+
+static void
+cache_entry_free (gpointer data)
+{
+  CacheEntry *entry = data;
+
+  if (!entry)
+    return;
+
+  g_free (entry->uri);
+  g_free (entry->language_id);
+  g_slice_free (CacheEntry, entry);
+}
+
+static void
+gb_editor_language_cache_remove_entry (GbEditorLanguageCache *cache,
+                                       CacheEntry            *entry)
+{
+  g_queue_unlink (&cache->priv->lru, &entry->link);
+  g_hash_table_remove (cache->priv->entries, entry->uri);
+}
+
+static void
+gb_editor_language_cache_add_entry (GbEditorLanguageCache *cache,
+                                    const gchar           *uri,
+                                    gint64                 mtime,
+                                    const gchar           *language_id)
+{
+  GbEditorLanguageCachePrivate *priv = cache->priv;
+  CacheEntry *entry;
+
+  if ((entry = g_hash_table_lookup (priv->entries, uri)))
+    gb_editor_language_cache_remove_entry (cache, entry);
+
+  entry = g_slice_new0 (CacheEntry);
+  entry->uri = g_strdup (uri);
+  entry->language_id = g_strdup (language_id);
+  entry->mtime = mtime;
+  entry->link.data = entry;
+
+  g_hash_table_insert (priv->entries, entry->uri, entry);
+  g_queue_push_tail_link (&priv->lru, &entry->link);
+
+  while (priv->lru.length > MAX_ENTRIES)
+    gb_editor_language_cache_remove_entry (cache, priv->lru.head->data);
+}
+
+static GPtrArray *
+gb_editor_language_cache_parse (const gchar *path)
+{
+  GPtrArray *ar;
+  gchar **lines;
+  gchar *contents = NULL;
+  guint i;
+
+  ar = g_ptr_array_new_with_free_func (cache_entry_free);
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return ar;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; lines [i]; i++)
+    {
+      gchar **parts;
+
+      parts = g_strsplit (lines [i], " ", 3);
+
+      if (g_strv_length (parts) == 3)
+        {
+          CacheEntry *entry;
+          gint64 mtime;
+          gchar *end = NULL;
+
+          mtime = g_ascii_strtoll (parts [0], &end, 10);
+
+          if (end && !*end)
+            {
+              entry = g_slice_new0 (CacheEntry);
+              entry->uri = g_strdup (parts [2]);
+              if (!g_str_equal (parts [1], "-"))
+                entry->language_id = g_strdup (parts [1]);
+              entry->mtime = mtime;
+              entry->link.data = entry;
+              g_ptr_array_add (ar, entry);
+            }
+        }
+
+      g_strfreev (parts);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return ar;
+}
+
+/*
+ * Adds the entries read from disk as the least recently used ones. Entries
+ * inserted while the file was being read are newer and win.
+ */
+static void
+gb_editor_language_cache_merge (GbEditorLanguageCache *cache,
+                                GPtrArray             *ar)
+{
+  GbEditorLanguageCachePrivate *priv = cache->priv;
+  guint i;
+
+  priv->loaded = TRUE;
+  priv->loading = FALSE;
+
+  for (i = ar->len; i > 0 && priv->lru.length < MAX_ENTRIES; i--)
+    {
+      CacheEntry *entry = g_ptr_array_index (ar, i - 1);
+
+      if (g_hash_table_contains (priv->entries, entry->uri))
+        continue;
+
+      g_hash_table_insert (priv->entries, entry->uri, entry);
+      g_queue_push_head_link (&priv->lru, &entry->link);
+      g_ptr_array_index (ar, i - 1) = NULL;
+    }
+}
+
+static void
+gb_editor_language_cache_load_worker (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  const gchar *path = task_data;
+
+  g_task_return_pointer (task,
+                         gb_editor_language_cache_parse (path),
+                         (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+gb_editor_language_cache_load_cb (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  GbEditorLanguageCache *cache = (GbEditorLanguageCache *)object;
+  GPtrArray *ar;
+
+  g_return_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache));
+
+  ar = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  /* A flush may have loaded the file synchronously in the meantime. */
+  if (!cache->priv->loaded)
+    gb_editor_language_cache_merge (cache, ar);
+
+  g_ptr_array_unref (ar);
+}
+
+static gchar *
+gb_editor_language_cache_get_path (void)
+{
+  GFile *file;
+  gchar *path;
+
+  file = gb_editor_language_cache_get_file ();
+  path = g_file_get_path (file);
+  g_object_unref (file);
+
+  return path;
+}
+
+/**
+ * gb_editor_language_cache_preload:
+ *
+ * Starts reading the cache from disk in a worker thread. This is called
+ * during startup, and by the first lookup if startup has not gotten to it
+ * yet.
+ */
+void
+gb_editor_language_cache_preload (GbEditorLanguageCache *cache)
+{
+  GTask *task;
+
+  g_return_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache));
+
+  if (cache->priv->loaded || cache->priv->loading)
+    return;
+
+  cache->priv->loading = TRUE;
+
+  task = g_task_new (cache, NULL, gb_editor_language_cache_load_cb, NULL);
+  g_task_set_task_data (task, gb_editor_language_cache_get_path (), g_free);
+  g_task_run_in_thread (task, gb_editor_language_cache_load_worker);
+  g_object_unref (task);
+}
+
+static void
+gb_editor_language_cache_save_cb (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  GFile *file = (GFile *)object;
+  GError *error = NULL;
+
+  g_return_if_fail (G_IS_FILE (file));
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error))
+    {
+      g_message ("Failed to save language cache: %s", error->message);
+      g_clear_error (&error);
+    }
+}
+
+static GBytes *
+gb_editor_language_cache_serialize (GbEditorLanguageCache *cache)
+{
+  GString *str;
+  GList *iter;
+  gsize len;
+
+  str = g_string_new (NULL);
+
+  for (iter = cache->priv->lru.head; iter; iter = iter->next)
+    {
+      CacheEntry *entry = iter->data;
+
+      g_string_append_printf (str, "%"G_GINT64_FORMAT" %s %s\n",
+                              entry->mtime,
+                              entry->language_id ? entry->language_id : "-",
+                              entry->uri);
+    }
+
+  len = str->len;
+
+  return g_bytes_new_take (g_string_free (str, FALSE), len);
+}
+
+static gboolean
+gb_editor_language_cache_save_timeout (gpointer data)
+{
+  GbEditorLanguageCache *cache = data;
+  GBytes *bytes;
+  GFile *parent;
+  GFile *file;
+
+  g_return_val_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache), G_SOURCE_REMOVE);
+
+  /* Writing now would drop the entries that are still being read. */
+  if (cache->priv->loading)
+    return G_SOURCE_CONTINUE;
+
+  cache->priv->save_timeout = 0;
+
+  bytes = gb_editor_language_cache_serialize (cache);
+
+  file = gb_editor_language_cache_get_file ();
+  parent = g_file_get_parent (file);
+  g_file_make_directory_with_parents (parent, NULL, NULL);
+
+  g_file_replace_contents_bytes_async (file,
+                                       bytes,
+                                       NULL,
+                                       FALSE,
+                                       G_FILE_CREATE_REPLACE_DESTINATION,
+                                       NULL,
+                                       gb_editor_language_cache_save_cb,
+                                       NULL);
+
+  g_bytes_unref (bytes);
+  g_object_unref (parent);
+  g_object_unref (file);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gb_editor_language_cache_flush:
+ *
+ * Writes pending changes to disk right away instead of waiting for the
+ * save timeout. This blocks, and is meant to be called on shutdown.
+ *
+ * Returns: %TRUE if there was nothing to write or the write succeeded.
+ */
+gboolean
+gb_editor_language_cache_flush (GbEditorLanguageCache  *cache,
+                                GError                **error)
+{
+  GbEditorLanguageCachePrivate *priv;
+  GBytes *bytes;
+  gboolean ret;
+  gchar *dirname;
+  gchar *path;
+
+  g_return_val_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache), FALSE);
+
+  priv = cache->priv;
+
+  if (!priv->save_timeout)
+    return TRUE;
+
+  g_source_remove (priv->save_timeout);
+  priv->save_timeout = 0;
+
+  path = gb_editor_language_cache_get_path ();
+
+  if (!priv->loaded)
+    {
+      GPtrArray *ar;
+
+      ar = gb_editor_language_cache_parse (path);
+      gb_editor_language_cache_merge (cache, ar);
+      g_ptr_array_unref (ar);
+    }
+
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0750);
+
+  bytes = gb_editor_language_cache_serialize (cache);
+  ret = g_file_set_contents (path,
+                             g_bytes_get_data (bytes, NULL),
+                             g_bytes_get_size (bytes),
+                             error);
+
+  g_bytes_unref (bytes);
+  g_free (dirname);
+  g_free (path);
+
+  return ret;
+}
+
+/**
+ * gb_editor_language_cache_lookup:
+ * @language_id: (out) (transfer none): A location for the language id.
+ *
+ * Looks up the language previously detected for @file. The entry is only
+ * used if @file has not been modified since, according to @mtime.
+ * @language_id is set to %NULL if no language was detected for @file.
+ *
+ * This never blocks on disk. If the cache has not been read yet, reading
+ * it is started and the lookup misses.
+ *
+ * Returns: %TRUE if a cached result was found.
+ */
+gboolean
+gb_editor_language_cache_lookup (GbEditorLanguageCache  *cache,
+                                 GFile                  *file,
+                                 const GTimeVal         *mtime,
+                                 const gchar           **language_id)
+{
+  CacheEntry *entry;
+  gchar *uri;
+
+  g_return_val_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache), FALSE);
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (mtime, FALSE);
+  g_return_val_if_fail (language_id, FALSE);
+
+  if (!cache->priv->loaded)
+    {
+      gb_editor_language_cache_preload (cache);
+      return FALSE;
+    }
+
+  uri = g_file_get_uri (file);
+  entry = g_hash_table_lookup (cache->priv->entries, uri);
+  g_free (uri);
+
+  if (!entry || (entry->mtime != timeval_to_usec (mtime)))
+    return FALSE;
+
+  g_queue_unlink (&cache->priv->lru, &entry->link);
+  g_queue_push_tail_link (&cache->priv->lru, &entry->link);
+
+  *language_id = entry->language_id;
+
+  return TRUE;
+}
+
+void
+gb_editor_language_cache_insert (GbEditorLanguageCache *cache,
+                                 GFile                 *file,
+                                 const GTimeVal        *mtime,
+                                 const gchar           *language_id)
+{
+  gchar *uri;
+
+  g_return_if_fail (GB_IS_EDITOR_LANGUAGE_CACHE (cache));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (mtime);
+
+  gb_editor_language_cache_preload (cache);
+
+  uri = g_file_get_uri (file);
+  gb_editor_language_cache_add_entry (cache, uri, timeval_to_usec (mtime),
+                                      language_id);
+  g_free (uri);
+
+  if (!cache->priv->save_timeout)
+    cache->priv->save_timeout =
+      g_timeout_add_seconds (SAVE_TIMEOUT_SECS,
+                             gb_editor_language_cache_save_timeout,
+                             cache);
+}
+
+static void
+gb_editor_language_cache_finalize (GObject *object)
+{
+  GbEditorLanguageCache *cache = (GbEditorLanguageCache *)object;
+  GbEditorLanguageCachePrivate *priv = cache->priv;
+  GError *error = NULL;
+
+  if (!gb_editor_language_cache_flush (cache, &error))
+    {
+      g_message ("Failed to save language cache: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_clear_pointer (&priv->entries, g_hash_table_unref);
+
+  G_OBJECT_CLASS (gb_editor_language_cache_parent_class)->finalize (object);
+}
+
+static void
+gb_editor_language_cache_class_init (GbEditorLanguageCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gb_editor_language_cache_finalize;
+}
+
+static void
+gb_editor_language_cache_init (GbEditorLanguageCache *self)
+{
+  self->priv = gb_editor_language_cache_get_instance_private (self);
+  self->priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               NULL, cache_entry_free);
+  g_queue_init (&self->priv->lru);
+}
@@ -0,0 +1,67 @@
+/* gb-editor-language-cache.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_EDITOR_LANGUAGE_CACHE_H
+#define GB_EDITOR_LANGUAGE_CACHE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GB_TYPE_EDITOR_LANGUAGE_CACHE            (gb_editor_language_cache_get_type())
+#define GB_EDITOR_LANGUAGE_CACHE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_EDITOR_LANGUAGE_CACHE, GbEditorLanguageCache))
+#define GB_EDITOR_LANGUAGE_CACHE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_EDITOR_LANGUAGE_CACHE, GbEditorLanguageCache const))
+#define GB_EDITOR_LANGUAGE_CACHE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GB_TYPE_EDITOR_LANGUAGE_CACHE, GbEditorLanguageCacheClass))
+#define GB_IS_EDITOR_LANGUAGE_CACHE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GB_TYPE_EDITOR_LANGUAGE_CACHE))
+#define GB_IS_EDITOR_LANGUAGE_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GB_TYPE_EDITOR_LANGUAGE_CACHE))
+#define GB_EDITOR_LANGUAGE_CACHE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GB_TYPE_EDITOR_LANGUAGE_CACHE, GbEditorLanguageCacheClass))
+
+typedef struct _GbEditorLanguageCache        GbEditorLanguageCache;
+typedef struct _GbEditorLanguageCacheClass   GbEditorLanguageCacheClass;
+typedef struct _GbEditorLanguageCachePrivate GbEditorLanguageCachePrivate;
+
+struct _GbEditorLanguageCache
+{
+  GObject parent;
+
+  /*< private >*/
+  GbEditorLanguageCachePrivate *priv;
+};
+
+struct _GbEditorLanguageCacheClass
+{
+  GObjectClass parent;
+};
+
+GType                  gb_editor_language_cache_get_type    (void);
+GbEditorLanguageCache *gb_editor_language_cache_get_default (void);
+void                   gb_editor_language_cache_preload     (GbEditorLanguageCache  *cache);
+gboolean               gb_editor_language_cache_flush       (GbEditorLanguageCache  *cache,
+                                                             GError                **error);
+gboolean               gb_editor_language_cache_lookup      (GbEditorLanguageCache  *cache,
+                                                             GFile                  *file,
+                                                             const GTimeVal         *mtime,
+                                                             const gchar           **language_id);
+void                   gb_editor_language_cache_insert      (GbEditorLanguageCache  *cache,
+                                                             GFile                  *file,
+                                                             const GTimeVal         *mtime,
+                                                             const gchar            *language_id);
+
+G_END_DECLS
+
+#endif /* GB_EDITOR_LANGUAGE_CACHE_H */
@@ -32,11 +32,30 @@
 #include "gb-workbench.h"
 #include "gb-dnd.h"
 
+/*
+ * Number of documents loaded at once when opening a batch of files. The
+ * remaining files wait in a queue so that the main loop is not flooded
+ * with completions from hundreds of loads at the same time.
+ */
+#define MAX_CONCURRENT_LOADS 4
+
 enum
 {
   TARGET_URI_LIST = 100
 };
 
+typedef struct
+{
+  GFile *file;
+  guint  focus : 1;
+} PendingLoad;
+
+enum {
+  PROP_0,
+  PROP_OPEN_PROGRESS,
+  LAST_PROP
+};
+
 static const GtkTargetEntry drop_types [] = {
   { "text/uri-list", 0, TARGET_URI_LIST}
 };
@@ -47,87 +66,261 @@ struct _GbEditorWorkspacePrivate
   GtkPaned           *paned;
   GbDocumentGrid     *document_grid;
   gchar              *current_folder_uri;
+
+  /* Files waiting for a load slot, and batch progress counters. */
+  GQueue              pending_loads;
+  guint               n_loading;
+  guint               n_opened;
+  guint               n_to_open;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GbEditorWorkspace, gb_editor_workspace,
                             GB_TYPE_WORKSPACE)
 
-void
-gb_editor_workspace_open (GbEditorWorkspace *workspace,
-                          GFile             *file)
+static GParamSpec *gParamSpecs [LAST_PROP];
+
+static void gb_editor_workspace_dispatch_loads (GbEditorWorkspace *workspace);
+
+/**
+ * gb_editor_workspace_get_open_progress:
+ *
+ * Fetches the progress of the files being opened with
+ * gb_editor_workspace_open_files(), from 0.0 to 1.0. This is 1.0 when no
+ * files are being opened.
+ *
+ * Returns: A #gdouble between 0.0 and 1.0.
+ */
+gdouble
+gb_editor_workspace_get_open_progress (GbEditorWorkspace *workspace)
 {
   GbEditorWorkspacePrivate *priv;
-  GbDocumentManager *manager;
-  GbWorkbench *workbench;
-  GbDocument *document;
 
+  g_return_val_if_fail (GB_IS_EDITOR_WORKSPACE (workspace), 1.0);
+
+  priv = workspace->priv;
+
+  if (!priv->n_to_open)
+    return 1.0;
+
+  return (gdouble)priv->n_opened / (gdouble)priv->n_to_open;
+}
+
+static void
+pending_load_free (gpointer data)
+{
+  PendingLoad *pending = data;
+
+  g_object_unref (pending->file);
+  g_slice_free (PendingLoad, pending);
+}
+
+static void
+gb_editor_workspace_update_open_progress (GbEditorWorkspace *workspace)
+{
+  GbEditorWorkspacePrivate *priv = workspace->priv;
+
+  if (!priv->n_loading && !priv->pending_loads.length)
+    priv->n_opened = priv->n_to_open = 0;
+
+  g_object_notify_by_pspec (G_OBJECT (workspace),
+                            gParamSpecs [PROP_OPEN_PROGRESS]);
+}
+
+static void
+gb_editor_workspace_load_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  GbEditorDocument *document = (GbEditorDocument *)object;
+  GbEditorWorkspace *workspace = user_data;
+  GbEditorWorkspacePrivate *priv;
+
+  g_return_if_fail (GB_IS_EDITOR_DOCUMENT (document));
   g_return_if_fail (GB_IS_EDITOR_WORKSPACE (workspace));
 
   priv = workspace->priv;
 
+  /* Errors are recorded on the document and shown by its views. */
+  gb_editor_document_load_finish (document, result, NULL);
+
+  priv->n_loading--;
+  priv->n_opened++;
+
+  gb_editor_workspace_dispatch_loads (workspace);
+  gb_editor_workspace_update_open_progress (workspace);
+
+  g_object_unref (workspace);
+}
+
+/*
+ * Starts queued loads while there are free slots. The document is only
+ * created, given its location and added to the document manager here, so
+ * that the per-document work triggered by setting a location, such as
+ * repository discovery, is bounded along with the loads.
+ */
+static void
+gb_editor_workspace_dispatch_loads (GbEditorWorkspace *workspace)
+{
+  GbEditorWorkspacePrivate *priv = workspace->priv;
+  GbDocumentManager *manager;
+  GbWorkbench *workbench;
+
   workbench = gb_widget_get_workbench (GTK_WIDGET (workspace));
+  if (!workbench)
+    return;
+
   manager = gb_workbench_get_document_manager (workbench);
-  document = gb_document_manager_find_with_file (manager, file);
 
-  if (!document)
+  while ((priv->n_loading < MAX_CONCURRENT_LOADS) &&
+         priv->pending_loads.length)
     {
+      PendingLoad *pending;
+      GbDocument *document;
       gboolean close_untitled = FALSE;
-      GList *list;
+
+      pending = g_queue_pop_head (&priv->pending_loads);
+
+      /* The file may have been queued twice or opened in the meantime. */
+      document = gb_document_manager_find_with_file (manager, pending->file);
+
+      if (document)
+        {
+          if (pending->focus)
+            gb_document_grid_focus_document (priv->document_grid, document);
+          priv->n_opened++;
+          pending_load_free (pending);
+          continue;
+        }
 
       /*
        * If we have a single document open, and it is an untitled document,
-       * we want to close it so that it appears that this new document opens
-       * in its place.
+       * we want to close it so that it appears that the focused document
+       * opens in its place.
        */
-      list = gb_document_manager_get_documents (manager);
-      if ((g_list_length (list) == 1) &&
-          gb_document_is_untitled (list->data) &&
-          !gb_document_get_modified (list->data))
-        close_untitled = TRUE;
-      g_list_free (list);
+      if (pending->focus)
+        close_untitled =
+          ((gb_document_manager_get_count (manager) == 1) &&
+           (gb_document_manager_get_untitled_count (manager) == 1) &&
+           (gb_document_manager_get_unsaved_count (manager) == 0));
 
-      /*
-       * Now open the new document.
-       */
       document = GB_DOCUMENT (gb_editor_document_new ());
       gb_editor_document_load_async (GB_EDITOR_DOCUMENT (document),
-                                     file, NULL, NULL, NULL);
+                                     pending->file, NULL,
+                                     gb_editor_workspace_load_cb,
+                                     g_object_ref (workspace));
       gb_document_manager_add (manager, document);
-      gb_document_grid_focus_document (priv->document_grid, document);
+      priv->n_loading++;
+
+      if (pending->focus)
+        {
+          gb_document_grid_focus_document (priv->document_grid, document);
+          if (close_untitled)
+            gb_document_grid_close_untitled (priv->document_grid);
+        }
+
       g_object_unref (document);
+      pending_load_free (pending);
+    }
+}
 
-      /*
-       * Now close the existing views if necessary.
-       */
-      if (close_untitled)
-        gb_document_grid_close_untitled (priv->document_grid);
+/**
+ * gb_editor_workspace_open_files:
+ * @files: (array length=n_files): The files to open.
+ *
+ * Opens a batch of files. Only the first file is focused; the other
+ * documents are added to the document manager as their loads start and
+ * get a view when they are selected. Loads are queued so that only a few
+ * run at once, and the overall progress is available from the
+ * "open-progress" property.
+ */
+void
+gb_editor_workspace_open_files (GbEditorWorkspace  *workspace,
+                                GFile             **files,
+                                guint               n_files)
+{
+  GbEditorWorkspacePrivate *priv;
+  GbDocumentManager *manager;
+  GbWorkbench *workbench;
+  guint i;
+
+  g_return_if_fail (GB_IS_EDITOR_WORKSPACE (workspace));
+  g_return_if_fail (files || !n_files);
+
+  for (i = 0; i < n_files; i++)
+    g_return_if_fail (G_IS_FILE (files [i]));
+
+  priv = workspace->priv;
+
+  workbench = gb_widget_get_workbench (GTK_WIDGET (workspace));
+  manager = gb_workbench_get_document_manager (workbench);
+
+  for (i = 0; i < n_files; i++)
+    {
+      PendingLoad *pending;
+      GbDocument *document;
+
+      document = gb_document_manager_find_with_file (manager, files [i]);
+
+      if (document)
+        {
+          if (i == 0)
+            gb_document_grid_focus_document (priv->document_grid, document);
+          continue;
+        }
+
+      pending = g_slice_new0 (PendingLoad);
+      pending->file = g_object_ref (files [i]);
+      pending->focus = (i == 0);
+      priv->n_to_open++;
+
+      /* The focused file goes ahead of loads left from earlier batches. */
+      if (pending->focus)
+        g_queue_push_head (&priv->pending_loads, pending);
+      else
+        g_queue_push_tail (&priv->pending_loads, pending);
     }
-  else
-    gb_document_grid_focus_document (priv->document_grid, document);
+
+  gb_editor_workspace_dispatch_loads (workspace);
+  gb_editor_workspace_update_open_progress (workspace);
+}
+
+void
+gb_editor_workspace_open (GbEditorWorkspace *workspace,
+                          GFile             *file)
+{
+  g_return_if_fail (GB_IS_EDITOR_WORKSPACE (workspace));
+  g_return_if_fail (G_IS_FILE (file));
+
+  gb_editor_workspace_open_files (workspace, &file, 1);
 }
 
 static void
 gb_editor_workspace_open_uri_list (GbEditorWorkspace  *workspace,
                                    const gchar       **uri_list)
 {
+  GPtrArray *files;
   GFile *file;
   guint i;
 
   g_return_if_fail (GB_IS_EDITOR_WORKSPACE (workspace));
   g_return_if_fail (uri_list);
 
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+
   for (i = 0; uri_list [i]; i++)
     {
       file = g_file_new_for_commandline_arg (uri_list [i]);
 
       if (file)
-        {
-          gb_editor_workspace_open (workspace, file);
-          g_clear_object (&file);
-        }
+        g_ptr_array_add (files, file);
       else
         g_warning ("Received invalid URI target");
     }
+
+  gb_editor_workspace_open_files (workspace, (GFile **)files->pdata,
+                                  files->len);
+
+  g_ptr_array_unref (files);
 }
 
 static void
@@ -299,6 +492,7 @@ gb_editor_workspace_action_open (GSimpleAction *action,
 
   if (response == GTK_RESPONSE_OK)
     {
+      GPtrArray *array;
       GSList *files;
       GSList *iter;
       gchar *file_uri;
@@ -316,13 +510,15 @@ gb_editor_workspace_action_open (GSimpleAction *action,
       g_free (file_uri);
 
       files = gtk_file_chooser_get_files (GTK_FILE_CHOOSER (dialog));
+      array = g_ptr_array_new_with_free_func (g_object_unref);
 
       for (iter = files; iter; iter = iter->next)
-        {
-          gb_editor_workspace_open (workspace, G_FILE (iter->data));
-          g_clear_object (&iter->data);
-        }
+        g_ptr_array_add (array, iter->data);
 
+      gb_editor_workspace_open_files (workspace, (GFile **)array->pdata,
+                                      array->len);
+
+      g_ptr_array_unref (array);
       g_slist_free (files);
     }
 
@@ -369,10 +565,32 @@ gb_editor_workspace_finalize (GObject *object)
 
   g_clear_pointer (&priv->command_map, g_hash_table_unref);
   g_clear_pointer (&priv->current_folder_uri, g_free);
+  g_queue_foreach (&priv->pending_loads, (GFunc)pending_load_free, NULL);
+  g_queue_clear (&priv->pending_loads);
 
   G_OBJECT_CLASS (gb_editor_workspace_parent_class)->finalize (object);
 }
 
+static void
+gb_editor_workspace_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+  GbEditorWorkspace *workspace = GB_EDITOR_WORKSPACE (object);
+
+  switch (prop_id)
+    {
+    case PROP_OPEN_PROGRESS:
+      g_value_set_double (value,
+                          gb_editor_workspace_get_open_progress (workspace));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
 static void
 gb_editor_workspace_class_init (GbEditorWorkspaceClass *klass)
 {
@@ -380,6 +598,18 @@ gb_editor_workspace_class_init (GbEditorWorkspaceClass *klass)
   GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
   object_class->finalize = gb_editor_workspace_finalize;
+  object_class->get_property = gb_editor_workspace_get_property;
+
+  gParamSpecs [PROP_OPEN_PROGRESS] =
+    g_param_spec_double ("open-progress",
+                         _("Open Progress"),
+                         _("The progress of the files being opened."),
+                         0.0,
+                         1.0,
+                         1.0,
+                         (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_OPEN_PROGRESS,
+                                   gParamSpecs [PROP_OPEN_PROGRESS]);
 
   widget_class->grab_focus = gb_editor_workspace_grab_focus;
   widget_class->map = gb_editor_workspace_map;
@@ -407,6 +637,7 @@ gb_editor_workspace_init (GbEditorWorkspace *workspace)
 
   workspace->priv->command_map = g_hash_table_new (g_str_hash, g_str_equal);
   workspace->priv->current_folder_uri = NULL;
+  g_queue_init (&workspace->priv->pending_loads);
 
   gtk_widget_init_template (GTK_WIDGET (workspace));
 
@@ -48,10 +48,14 @@ struct _GbEditorWorkspaceClass
   GbWorkspaceClass parent_class;
 };
 
-GType gb_editor_workspace_get_type     (void);
-void  gb_editor_workspace_new_document (GbEditorWorkspace *workspace);
-void  gb_editor_workspace_open         (GbEditorWorkspace *workspace,
-                                        GFile             *file);
+GType   gb_editor_workspace_get_type          (void);
+void    gb_editor_workspace_new_document      (GbEditorWorkspace  *workspace);
+void    gb_editor_workspace_open              (GbEditorWorkspace  *workspace,
+                                               GFile              *file);
+void    gb_editor_workspace_open_files        (GbEditorWorkspace  *workspace,
+                                               GFile             **files,
+                                               guint               n_files);
+gdouble gb_editor_workspace_get_open_progress (GbEditorWorkspace  *workspace);
 
 G_END_DECLS
 
@@ -0,0 +1,54 @@
+/* gb-source-change-monitor-private.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_SOURCE_CHANGE_MONITOR_PRIVATE_H
+#define GB_SOURCE_CHANGE_MONITOR_PRIVATE_H
+
+#include "gb-source-change-monitor.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  guint  hash;
+  guint  len;
+  gchar *text;
+} GbSourceChangeLine;
+
+typedef struct
+{
+  guint line;
+  guint len;
+  guint flags;
+} GbSourceChangeRun;
+
+GArray *gb_source_change_lines_new                (guint                     reserved) G_GNUC_INTERNAL;
+void    gb_source_change_lines_split              (GArray                   *lines,
+                                                   const gchar              *text,
+                                                   gsize                     len) G_GNUC_INTERNAL;
+GArray *gb_source_change_diff                     (const GbSourceChangeLine *old_lines,
+                                                   guint                     n_old,
+                                                   const GbSourceChangeLine *new_lines,
+                                                   guint                     n_new,
+                                                   guint                     first_line) G_GNUC_INTERNAL;
+void    gb_source_change_monitor_update_lines     (GbSourceChangeMonitor    *monitor) G_GNUC_INTERNAL;
+GArray *gb_source_change_monitor_get_buffer_lines (GbSourceChangeMonitor    *monitor) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* GB_SOURCE_CHANGE_MONITOR_PRIVATE_H */
@@ -21,13 +21,43 @@
 #include <glib/gi18n.h>
 #include <gtksourceview/gtksource.h>
 #include <libgit2-glib/ggit.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "gb-log.h"
-#include "gb-source-change-monitor.h"
+#include "gb-source-change-monitor-private.h"
 
 #define PARSE_TIMEOUT_MSEC       25
-#define GB_SOURCE_CHANGE_DELETED (1 << 3)
-#define GB_SOURCE_CHANGE_MASK    (0x7)
+#define DIFF_MIN_COST_LIMIT      256
+#define DISCOVERY_CACHE_USEC     (60 * G_USEC_PER_SEC)
+#define DISCOVERY_FAILURE_USEC   (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  GArray *old_lines;
+  GArray *new_lines;
+  guint   old_begin;
+  guint   old_end;
+  guint   new_begin;
+  guint   new_end;
+  guint   sequence;
+} DiffState;
+
+typedef struct
+{
+  gint old_begin;
+  gint old_len;
+  gint new_begin;
+  gint new_len;
+} DiffBlock;
+
+typedef struct
+{
+  GFile  *repo_dir;
+  GError *error;
+  gint64  expires_at;
+  guint   in_flight : 1;
+} DiscoveryEntry;
 
 struct _GbSourceChangeMonitorPrivate
 {
@@ -36,10 +66,26 @@ struct _GbSourceChangeMonitorPrivate
   GgitRepository *repo;
   GgitBlob       *blob;
   gchar          *relative_path;
-  GHashTable     *state;
   GCancellable   *cancellable;
 
+  /*
+   * GbSourceChangeLine for each line in the HEAD blob, and for each line in
+   * the buffer. The buffer lines are kept in sync with insert-text and
+   * delete-range so that only the lines in [dirty_begin, dirty_end) need to
+   * be fetched from the buffer again before the next diff.
+   */
+  GArray         *blob_lines;
+  GArray         *buffer_lines;
+  guint           dirty_begin;
+  guint           dirty_end;
+
+  /* Sorted, non-overlapping runs of GbSourceChangeRun. */
+  GArray         *runs;
+  guint           sequence;
+
   guint           changed_handler;
+  guint           insert_text_handler;
+  guint           delete_range_handler;
   guint           parse_timeout;
 
   gint            found_blob;
@@ -74,19 +120,38 @@ gb_source_change_monitor_new (GtkTextBuffer *buffer)
                        NULL);
 }
 
+static gint
+compare_run (gconstpointer a,
+             gconstpointer b)
+{
+  guint lineno = *(const guint *)a;
+  const GbSourceChangeRun *run = b;
+
+  if (lineno < run->line)
+    return -1;
+  else if (lineno >= (run->line + run->len))
+    return 1;
+
+  return 0;
+}
+
 GbSourceChangeFlags
 gb_source_change_monitor_get_line (GbSourceChangeMonitor *monitor,
                                    guint                  lineno)
 {
   g_return_val_if_fail (GB_IS_SOURCE_CHANGE_MONITOR (monitor), 0);
 
-  if (monitor->priv->state)
+  if (monitor->priv->runs)
     {
-      gpointer value;
+      GbSourceChangeRun *run;
 
-      value = g_hash_table_lookup (monitor->priv->state,
-                                   GINT_TO_POINTER (lineno + 1));
-      return (GPOINTER_TO_INT (value) & GB_SOURCE_CHANGE_MASK);
+      run = bsearch (&lineno,
+                     monitor->priv->runs->data,
+                     monitor->priv->runs->len,
+                     sizeof (GbSourceChangeRun),
+                     compare_run);
+
+      return run ? run->flags : GB_SOURCE_CHANGE_NONE;
     }
 
   /*
@@ -100,149 +165,678 @@ gb_source_change_monitor_get_line (GbSourceChangeMonitor *monitor,
   return GB_SOURCE_CHANGE_NONE;
 }
 
-static gint
-diff_line_cb (GgitDiffDelta *delta,
-              GgitDiffHunk  *hunk,
-              GgitDiffLine  *line,
-              gpointer       user_data)
+static void
+gb_source_change_line_clear (gpointer data)
 {
-  GgitDiffLineType type;
-  GHashTable *hash = user_data;
-  gint new_lineno;
-  gint old_lineno;
-  gint adjust;
+  GbSourceChangeLine *line = data;
+
+  g_free (line->text);
+  line->text = NULL;
+}
 
-  g_return_val_if_fail (delta, GGIT_ERROR_GIT_ERROR);
-  g_return_val_if_fail (hunk, GGIT_ERROR_GIT_ERROR);
-  g_return_val_if_fail (line, GGIT_ERROR_GIT_ERROR);
-  g_return_val_if_fail (hash, GGIT_ERROR_GIT_ERROR);
+/*
+ * The hash only makes mismatches cheap to find. Lines whose hashes collide
+ * are told apart by their text.
+ */
+static inline gboolean
+gb_source_change_line_equal (const GbSourceChangeLine *a,
+                             const GbSourceChangeLine *b)
+{
+  return ((a->hash == b->hash) &&
+          (a->len == b->len) &&
+          (memcmp (a->text, b->text, a->len) == 0));
+}
 
-  type = ggit_diff_line_get_origin (line);
+/*
+ * Creates an array of GbSourceChangeLine that owns the text of its lines.
+ * New elements are zeroed.
+ */
+GArray *
+gb_source_change_lines_new (guint reserved)
+{
+  GArray *lines;
+
+  lines = g_array_sized_new (FALSE, TRUE, sizeof (GbSourceChangeLine),
+                             reserved);
+  g_array_set_clear_func (lines, gb_source_change_line_clear);
+
+  return lines;
+}
+
+static void
+gb_source_change_lines_append (GArray      *lines,
+                               const gchar *text,
+                               gsize        len,
+                               guint        hash)
+{
+  GbSourceChangeLine line = { hash, len, g_strndup (text, len) };
 
-  if ((type != GGIT_DIFF_LINE_ADDITION) && (type != GGIT_DIFF_LINE_DELETION))
-    return 0;
+  g_array_append_val (lines, line);
+}
 
-  new_lineno = ggit_diff_line_get_new_lineno (line);
-  old_lineno = ggit_diff_line_get_old_lineno (line);
+/*
+ * Splits @text into lines the same way GtkTextBuffer does ("\n", "\r\n",
+ * "\r" and U+2029) and appends each of them to @lines. Like the text
+ * buffer, there is always one more line than line separators.
+ */
+void
+gb_source_change_lines_split (GArray      *lines,
+                              const gchar *text,
+                              gsize        len)
+{
+  const gchar *end = text + len;
+  const gchar *begin = text;
+  guint hash = 2166136261U;
 
-  switch (type)
+  while (text < end)
     {
-    case GGIT_DIFF_LINE_ADDITION:
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (new_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (new_lineno),
-                              GINT_TO_POINTER (GB_SOURCE_CHANGE_CHANGED));
+      const gchar *eol = text;
+
+      if (*text == '\n' || *text == '\r')
+        {
+          if ((text[0] == '\r') && ((text + 1) < end) && (text[1] == '\n'))
+            text++;
+        }
+      else if (((guchar)text[0] == 0xE2) && ((text + 2) < end) &&
+               ((guchar)text[1] == 0x80) && ((guchar)text[2] == 0xA9))
+        {
+          text += 2;
+        }
       else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (new_lineno),
-                             GINT_TO_POINTER (GB_SOURCE_CHANGE_ADDED));
-      break;
+        {
+          hash = (hash ^ (guchar)*text) * 16777619U;
+          text++;
+          continue;
+        }
+
+      gb_source_change_lines_append (lines, begin, eol - begin, hash);
+      hash = 2166136261U;
+      begin = ++text;
+    }
 
-    case GGIT_DIFF_LINE_DELETION:
-      adjust = (ggit_diff_hunk_get_new_start (hunk) -
-                ggit_diff_hunk_get_old_start (hunk));
-      old_lineno += adjust;
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (old_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (old_lineno),
-                              GINT_TO_POINTER (GB_SOURCE_CHANGE_CHANGED));
-      else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (old_lineno),
-                             GINT_TO_POINTER (GB_SOURCE_CHANGE_DELETED));
-      break;
+  gb_source_change_lines_append (lines, begin, end - begin, hash);
+}
 
-    case GGIT_DIFF_LINE_CONTEXT:
-    case GGIT_DIFF_LINE_CONTEXT_EOFNL:
-    case GGIT_DIFF_LINE_ADD_EOFNL:
-    case GGIT_DIFF_LINE_DEL_EOFNL:
-    case GGIT_DIFF_LINE_FILE_HDR:
-    case GGIT_DIFF_LINE_HUNK_HDR:
-    case GGIT_DIFF_LINE_BINARY:
-    default:
-      break;
+static void
+diff_add_block (GArray *blocks,
+                gint    old_begin,
+                gint    old_len,
+                gint    new_begin,
+                gint    new_len)
+{
+  DiffBlock block = { old_begin, old_len, new_begin, new_len };
+
+  if (blocks->len)
+    {
+      DiffBlock *last = &g_array_index (blocks, DiffBlock, blocks->len - 1);
+
+      if (((last->old_begin + last->old_len) == old_begin) &&
+          ((last->new_begin + last->new_len) == new_begin))
+        {
+          last->old_len += old_len;
+          last->new_len += new_len;
+          return;
+        }
     }
 
-  return 0;
+  g_array_append_val (blocks, block);
+}
+
+#define DIAG_MIN(d,n,m) (-(d) + 2 * MAX (0, (d) - (m)))
+#define DIAG_MAX(d,n,m) ((d) - 2 * MAX (0, (d) - (n)))
+
+/*
+ * Finds the middle snake of the shortest edit script between @a and @b
+ * using the linear space variant of Myers' algorithm. @vf and @vb must be
+ * centered on diagonal zero and have room for diagonals -(n+m)..(n+m).
+ *
+ * If the edit distance grows beyond @max_cost, we give up on finding an
+ * optimal split and use the furthest reaching forward path instead, so
+ * that pathological inputs still finish in bounded time.
+ */
+static void
+diff_split (const GbSourceChangeLine *a,
+            gint                      n,
+            const GbSourceChangeLine *b,
+            gint                      m,
+            gint                     *vf,
+            gint                     *vb,
+            gint                      max_cost,
+            gint                     *sx,
+            gint                     *sy,
+            gint                     *ex,
+            gint                     *ey)
+{
+  gint delta = n - m;
+  gboolean odd = (delta & 1) != 0;
+  gint d;
+  gint k;
+
+  vf [1] = 0;
+  vb [1] = 0;
+
+  for (d = 0; d <= ((n + m + 1) / 2); d++)
+    {
+      for (k = DIAG_MIN (d, n, m); k <= DIAG_MAX (d, n, m); k += 2)
+        {
+          gint x;
+          gint y;
+          gint x0;
+          gint y0;
+
+          if ((k == -d) || ((k != d) && (vf [k - 1] < vf [k + 1])))
+            x = vf [k + 1];
+          else
+            x = vf [k - 1] + 1;
+
+          y = x - k;
+          x0 = x;
+          y0 = y;
+
+          while ((x < n) && (y < m) &&
+                 gb_source_change_line_equal (&a [x], &b [y]))
+            x++, y++;
+
+          vf [k] = x;
+
+          if (odd &&
+              ((delta - k) >= DIAG_MIN (d - 1, n, m)) &&
+              ((delta - k) <= DIAG_MAX (d - 1, n, m)) &&
+              ((vf [k] + vb [delta - k]) >= n))
+            {
+              *sx = x0;
+              *sy = y0;
+              *ex = x;
+              *ey = y;
+              return;
+            }
+        }
+
+      for (k = DIAG_MIN (d, n, m); k <= DIAG_MAX (d, n, m); k += 2)
+        {
+          gint x;
+          gint y;
+          gint x0;
+          gint y0;
+
+          if ((k == -d) || ((k != d) && (vb [k - 1] < vb [k + 1])))
+            x = vb [k + 1];
+          else
+            x = vb [k - 1] + 1;
+
+          y = x - k;
+          x0 = x;
+          y0 = y;
+
+          while ((x < n) && (y < m) &&
+                 gb_source_change_line_equal (&a [n - x - 1], &b [m - y - 1]))
+            x++, y++;
+
+          vb [k] = x;
+
+          if (!odd &&
+              ((delta - k) >= DIAG_MIN (d, n, m)) &&
+              ((delta - k) <= DIAG_MAX (d, n, m)) &&
+              ((vb [k] + vf [delta - k]) >= n))
+            {
+              *sx = n - x;
+              *sy = m - y;
+              *ex = n - x0;
+              *ey = m - y0;
+              return;
+            }
+        }
+
+      if (d >= max_cost)
+        {
+          gint best = -1;
+
+          *sx = *sy = *ex = *ey = 0;
+
+          for (k = DIAG_MIN (d, n, m); k <= DIAG_MAX (d, n, m); k += 2)
+            {
+              if ((vf [k] <= n) && ((vf [k] - k) >= 0) &&
+                  ((vf [k] - k) <= m) && ((2 * vf [k] - k) > best))
+                {
+                  best = 2 * vf [k] - k;
+                  *sx = *ex = vf [k];
+                  *sy = *ey = vf [k] - k;
+                }
+            }
+
+          return;
+        }
+    }
+
+  g_assert_not_reached ();
+}
+
+static void
+diff_recurse (const GbSourceChangeLine *a,
+              gint                      a_begin,
+              gint                      n,
+              const GbSourceChangeLine *b,
+              gint                      b_begin,
+              gint                      m,
+              gint                     *vf,
+              gint                     *vb,
+              gint                      max_cost,
+              GArray                   *blocks)
+{
+  gint sx;
+  gint sy;
+  gint ex;
+  gint ey;
+
+  while ((n > 0) && (m > 0) && gb_source_change_line_equal (&a [0], &b [0]))
+    {
+      a++, a_begin++, n--;
+      b++, b_begin++, m--;
+    }
+
+  while ((n > 0) && (m > 0) &&
+         gb_source_change_line_equal (&a [n - 1], &b [m - 1]))
+    n--, m--;
+
+  if ((n == 0) || (m == 0))
+    {
+      if (n || m)
+        diff_add_block (blocks, a_begin, n, b_begin, m);
+      return;
+    }
+
+  diff_split (a, n, b, m, vf, vb, max_cost, &sx, &sy, &ex, &ey);
+
+  if (((sx == 0) && (sy == 0) && (ex == n) && (ey == m)) ||
+      ((ex == 0) && (ey == 0)) ||
+      ((sx == n) && (sy == m)))
+    {
+      diff_add_block (blocks, a_begin, n, b_begin, m);
+      return;
+    }
+
+  diff_recurse (a, a_begin, sx, b, b_begin, sy,
+                vf, vb, max_cost, blocks);
+  diff_recurse (a + ex, a_begin + ex, n - ex, b + ey, b_begin + ey, m - ey,
+                vf, vb, max_cost, blocks);
+}
+
+/*
+ * Converts the edit script into runs of line state. Within each changed
+ * block, lines that replace removed lines are marked as changed and any
+ * remaining lines as added. Pure deletions are not shown.
+ */
+static void
+diff_blocks_to_runs (GArray *blocks,
+                     GArray *runs)
+{
+  guint i;
+
+  for (i = 0; i < blocks->len; i++)
+    {
+      DiffBlock *block = &g_array_index (blocks, DiffBlock, i);
+      GbSourceChangeRun run;
+      gint changed;
+
+      changed = MIN (block->old_len, block->new_len);
+
+      if (changed)
+        {
+          run.line = block->new_begin;
+          run.len = changed;
+          run.flags = GB_SOURCE_CHANGE_CHANGED;
+          g_array_append_val (runs, run);
+        }
+
+      if (block->new_len > changed)
+        {
+          run.line = block->new_begin + changed;
+          run.len = block->new_len - changed;
+          run.flags = GB_SOURCE_CHANGE_ADDED;
+          g_array_append_val (runs, run);
+        }
+    }
+}
+
+/*
+ * Diffs @old_lines against @new_lines and returns the state of each changed
+ * line as an array of GbSourceChangeRun. Both slices start at @first_line
+ * of their file.
+ */
+GArray *
+gb_source_change_diff (const GbSourceChangeLine *old_lines,
+                       guint                     n_old,
+                       const GbSourceChangeLine *new_lines,
+                       guint                     n_new,
+                       guint                     first_line)
+{
+  GArray *blocks;
+  GArray *runs;
+  gint n = n_old;
+  gint m = n_new;
+  gint max_cost;
+  gint *vf;
+  gint *vb;
+
+  /* Same limit as xdiff: the square root of the input, at least 256. */
+  max_cost = DIFF_MIN_COST_LIMIT;
+  while ((max_cost * max_cost) < (n + m))
+    max_cost++;
+
+  vf = g_new (gint, 2 * (n + m) + 3);
+  vb = g_new (gint, 2 * (n + m) + 3);
+
+  blocks = g_array_new (FALSE, FALSE, sizeof (DiffBlock));
+  diff_recurse (old_lines, first_line, n,
+                new_lines, first_line, m,
+                vf + (n + m + 1), vb + (n + m + 1),
+                max_cost,
+                blocks);
+
+  runs = g_array_new (FALSE, FALSE, sizeof (GbSourceChangeRun));
+  diff_blocks_to_runs (blocks, runs);
+
+  g_array_unref (blocks);
+  g_free (vf);
+  g_free (vb);
+
+  return runs;
+}
+
+static void
+diff_state_free (gpointer data)
+{
+  DiffState *state = data;
+
+  g_array_unref (state->old_lines);
+  g_array_unref (state->new_lines);
+  g_free (state);
+}
+
+static void
+gb_source_change_monitor_diff_worker (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  DiffState *state = task_data;
+  GArray *runs;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (state);
+  g_assert (state->old_begin == state->new_begin);
+
+  runs = gb_source_change_diff (&g_array_index (state->old_lines,
+                                                GbSourceChangeLine,
+                                                state->old_begin),
+                                state->old_end - state->old_begin,
+                                (const GbSourceChangeLine *)(gpointer)state->new_lines->data,
+                                state->new_lines->len,
+                                state->new_begin);
+
+  g_task_return_pointer (task, runs, (GDestroyNotify)g_array_unref);
 }
 
 static void
-gb_source_change_monitor_parse_cb (GObject      *source,
-                                   GAsyncResult *result,
-                                   gpointer      user_data)
+gb_source_change_monitor_diff_cb (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
 {
-  GbSourceChangeMonitor *monitor = (GbSourceChangeMonitor *)source;
-  GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
-  GHashTable *ret;
+  GbSourceChangeMonitor *monitor = (GbSourceChangeMonitor *)object;
+  DiffState *state;
+  GArray *runs;
 
   g_return_if_fail (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
-  g_return_if_fail (G_IS_SIMPLE_ASYNC_RESULT (simple));
+  g_return_if_fail (G_IS_TASK (result));
 
-  ret = g_simple_async_result_get_op_res_gpointer (simple);
+  state = g_task_get_task_data (G_TASK (result));
+  runs = g_task_propagate_pointer (G_TASK (result), NULL);
 
-  if (ret)
+  /* Drop results that were superseded by a newer diff. */
+  if (runs && (state->sequence == monitor->priv->sequence))
     {
-      g_clear_pointer (&monitor->priv->state, g_hash_table_unref);
-      monitor->priv->state = g_hash_table_ref (ret);
+      g_clear_pointer (&monitor->priv->runs, g_array_unref);
+      monitor->priv->runs = g_array_ref (runs);
       g_signal_emit (monitor, gSignals [CHANGED], 0);
     }
+
+  g_clear_pointer (&runs, g_array_unref);
 }
 
 static void
-gb_source_change_monitor_worker (GSimpleAsyncResult *async,
-                                 GObject            *object,
-                                 GCancellable       *cancellable)
+gb_source_change_monitor_mark_dirty (GbSourceChangeMonitor *monitor,
+                                     guint                  begin,
+                                     guint                  end)
 {
-  GHashTable *state;
-  GgitBlob *blob;
-  GError *error = NULL;
-  const guint8 *text;
-  const gchar *relative_path;
+  GbSourceChangeMonitorPrivate *priv = monitor->priv;
 
-  g_return_if_fail (G_IS_SIMPLE_ASYNC_RESULT (async));
-  g_return_if_fail (GB_IS_SOURCE_CHANGE_MONITOR (object));
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+  if (priv->dirty_begin == priv->dirty_end)
+    {
+      priv->dirty_begin = begin;
+      priv->dirty_end = end;
+    }
+  else
+    {
+      priv->dirty_begin = MIN (priv->dirty_begin, begin);
+      priv->dirty_end = MAX (priv->dirty_end, end);
+    }
+}
 
-  text = g_object_get_data (G_OBJECT (async), "text");
-  relative_path = g_object_get_data (G_OBJECT (async), "path");
-  blob = g_object_get_data (G_OBJECT (async), "blob");
+static void
+on_insert_text_after_cb (GbSourceChangeMonitor *monitor,
+                         GtkTextIter           *location,
+                         const gchar           *text,
+                         gint                   len,
+                         GtkTextBuffer         *buffer)
+{
+  GbSourceChangeMonitorPrivate *priv;
+  guint n_lines;
+  guint n_added;
+  guint line;
 
-  g_return_if_fail (text);
-  g_return_if_fail (relative_path);
-  g_return_if_fail (GGIT_IS_BLOB (blob));
+  g_assert (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
 
-  state = g_hash_table_new (g_direct_hash, g_direct_equal);
-  ggit_diff_blob_to_buffer (blob, relative_path, text, -1, relative_path,
-                            NULL, NULL, NULL, diff_line_cb, (gpointer)state,
-                            &error);
+  priv = monitor->priv;
 
-  if (error)
-    g_simple_async_result_take_error (async, error);
-  else
-    g_simple_async_result_set_op_res_gpointer (async,
-                                               g_hash_table_ref (state),
-                                               (GDestroyNotify)g_hash_table_unref);
+  if (!priv->buffer_lines)
+    return;
+
+  /*
+   * @location now points at the end of the inserted text. Comparing the
+   * line count against our hashes tells us how many lines were inserted
+   * without having to scan @text for line separators.
+   */
+  n_lines = gtk_text_buffer_get_line_count (buffer);
 
-  g_hash_table_unref (state);
+  if (n_lines < priv->buffer_lines->len)
+    {
+      g_clear_pointer (&priv->buffer_lines, g_array_unref);
+      return;
+    }
 
-  g_simple_async_result_complete_in_idle (async);
+  n_added = n_lines - priv->buffer_lines->len;
+  line = gtk_text_iter_get_line (location) - n_added;
+
+  if (n_added)
+    {
+      guint old_len = priv->buffer_lines->len;
+
+      g_array_set_size (priv->buffer_lines, old_len + n_added);
+      memmove (&g_array_index (priv->buffer_lines, GbSourceChangeLine,
+                               line + 1 + n_added),
+               &g_array_index (priv->buffer_lines, GbSourceChangeLine,
+                               line + 1),
+               (old_len - line - 1) * sizeof (GbSourceChangeLine));
+      /* The gap still points at the text of the lines that were moved. */
+      memset (&g_array_index (priv->buffer_lines, GbSourceChangeLine,
+                              line + 1),
+              0, n_added * sizeof (GbSourceChangeLine));
+
+      if (priv->dirty_begin > line)
+        priv->dirty_begin += n_added;
+      if (priv->dirty_end > line + 1)
+        priv->dirty_end += n_added;
+    }
+
+  gb_source_change_monitor_mark_dirty (monitor, line, line + 1 + n_added);
+}
+
+static void
+on_delete_range_after_cb (GbSourceChangeMonitor *monitor,
+                          GtkTextIter           *begin,
+                          GtkTextIter           *end,
+                          GtkTextBuffer         *buffer)
+{
+  GbSourceChangeMonitorPrivate *priv;
+  guint n_lines;
+  guint n_removed;
+  guint line;
+
+  g_assert (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
+
+  priv = monitor->priv;
+
+  if (!priv->buffer_lines)
+    return;
+
+  n_lines = gtk_text_buffer_get_line_count (buffer);
+
+  if (n_lines > priv->buffer_lines->len)
+    {
+      g_clear_pointer (&priv->buffer_lines, g_array_unref);
+      return;
+    }
+
+  n_removed = priv->buffer_lines->len - n_lines;
+  line = gtk_text_iter_get_line (begin);
+
+  if (n_removed)
+    {
+      g_array_remove_range (priv->buffer_lines, line + 1, n_removed);
+
+      if (priv->dirty_begin > line + n_removed)
+        priv->dirty_begin -= n_removed;
+      else if (priv->dirty_begin > line)
+        priv->dirty_begin = line;
+
+      if (priv->dirty_end > line + n_removed)
+        priv->dirty_end -= n_removed;
+      else if (priv->dirty_end > line)
+        priv->dirty_end = line + 1;
+    }
+
+  gb_source_change_monitor_mark_dirty (monitor, line, line + 1);
+}
+
+/*
+ * Brings the buffer lines up to date. The first time through we split the
+ * whole buffer, after that only the lines touched since the last parse.
+ */
+void
+gb_source_change_monitor_update_lines (GbSourceChangeMonitor *monitor)
+{
+  GbSourceChangeMonitorPrivate *priv = monitor->priv;
+  GtkTextIter begin;
+  GtkTextIter end;
+  GArray *lines;
+  gchar *text;
+  guint n_lines;
+
+  n_lines = gtk_text_buffer_get_line_count (priv->buffer);
+
+  if (priv->buffer_lines && (priv->buffer_lines->len != n_lines))
+    g_clear_pointer (&priv->buffer_lines, g_array_unref);
+
+  if (!priv->buffer_lines)
+    {
+      gtk_text_buffer_get_bounds (priv->buffer, &begin, &end);
+      text = gtk_text_buffer_get_text (priv->buffer, &begin, &end, TRUE);
+      priv->buffer_lines = gb_source_change_lines_new (n_lines + 1);
+      gb_source_change_lines_split (priv->buffer_lines, text, strlen (text));
+      g_free (text);
+    }
+  else if (priv->dirty_begin < priv->dirty_end)
+    {
+      guint dirty_end = MIN (priv->dirty_end, n_lines);
+
+      gtk_text_buffer_get_iter_at_line (priv->buffer, &begin,
+                                        priv->dirty_begin);
+      if (dirty_end < n_lines)
+        gtk_text_buffer_get_iter_at_line (priv->buffer, &end, dirty_end);
+      else
+        gtk_text_buffer_get_end_iter (priv->buffer, &end);
+
+      text = gtk_text_buffer_get_text (priv->buffer, &begin, &end, TRUE);
+      lines = gb_source_change_lines_new (dirty_end - priv->dirty_begin + 1);
+      gb_source_change_lines_split (lines, text, strlen (text));
+
+      if (lines->len >= (dirty_end - priv->dirty_begin))
+        {
+          guint i;
+
+          /* Move the new lines over, leaving nothing for @lines to free. */
+          for (i = 0; i < (dirty_end - priv->dirty_begin); i++)
+            {
+              GbSourceChangeLine *dst;
+              GbSourceChangeLine *src;
+
+              dst = &g_array_index (priv->buffer_lines, GbSourceChangeLine,
+                                    priv->dirty_begin + i);
+              src = &g_array_index (lines, GbSourceChangeLine, i);
+
+              g_free (dst->text);
+              *dst = *src;
+              src->text = NULL;
+            }
+        }
+      else
+        g_clear_pointer (&priv->buffer_lines, g_array_unref);
+
+      g_array_unref (lines);
+      g_free (text);
+
+      if (!priv->buffer_lines)
+        {
+          priv->dirty_begin = priv->dirty_end = 0;
+          gb_source_change_monitor_update_lines (monitor);
+          return;
+        }
+    }
+
+  priv->dirty_begin = 0;
+  priv->dirty_end = 0;
+}
+
+GArray *
+gb_source_change_monitor_get_buffer_lines (GbSourceChangeMonitor *monitor)
+{
+  g_return_val_if_fail (GB_IS_SOURCE_CHANGE_MONITOR (monitor), NULL);
+
+  return monitor->priv->buffer_lines;
 }
 
 static gboolean
 on_parse_timeout (GbSourceChangeMonitor *monitor)
 {
   GbSourceChangeMonitorPrivate *priv;
-  GSimpleAsyncResult *async;
   GtkSourceBuffer *gsb;
-  GtkTextIter begin;
   GtkTextIter end;
-  gchar *text = NULL;
+  DiffState *state;
+  const GbSourceChangeLine *a;
+  const GbSourceChangeLine *b;
+  GTask *task;
+  guint n_old;
+  guint n_new;
+  guint prefix = 0;
+  guint suffix = 0;
+  guint i;
 
   g_assert (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
 
   priv = monitor->priv;
 
-  if (!priv->blob || !priv->relative_path || !priv->buffer || !priv->file)
+  if (!priv->blob_lines || !priv->relative_path || !priv->buffer ||
+      !priv->file)
     return G_SOURCE_REMOVE;
 
   /*
@@ -250,55 +844,59 @@ on_parse_timeout (GbSourceChangeMonitor *monitor)
    */
   priv->parse_timeout = 0;
 
-  /*
-   * Create an async handle for the context. When our callback is executed
-   * in the main thread (after diff'ing in a worker thread), we will notify
-   * listeners of the changes after applying new state.
-   */
-  async = g_simple_async_result_new (G_OBJECT (monitor),
-                                     gb_source_change_monitor_parse_cb,
-                                     NULL,
-                                     on_parse_timeout);
-
-  /*
-   * Fetch the contents of the text buffer.
-   */
-  gtk_text_buffer_get_bounds (priv->buffer, &begin, &end);
-  text = gtk_text_buffer_get_text (priv->buffer, &begin, &end, TRUE);
+  gb_source_change_monitor_update_lines (monitor);
 
   /*
-   * If the buffer has the trailing newline hidden, go ahead and add one back.
+   * The HEAD blob lines do not include the empty line following a trailing
+   * newline. Do the same for the buffer, unless the trailing newline is
+   * hidden, in which case the last line of the buffer is a real line.
    */
+  n_new = priv->buffer_lines->len;
   gsb = GTK_SOURCE_BUFFER (priv->buffer);
-  if (gtk_source_buffer_get_implicit_trailing_newline (gsb))
-    {
-      gchar *tmp = text;
+  gtk_text_buffer_get_end_iter (priv->buffer, &end);
+  if (!gtk_source_buffer_get_implicit_trailing_newline (gsb) &&
+      gtk_text_iter_starts_line (&end))
+    n_new--;
 
-      text = g_strconcat (text, "\n", NULL);
-      g_free (tmp);
-    }
+  n_old = priv->blob_lines->len;
+  a = (const GbSourceChangeLine *)(gpointer)priv->blob_lines->data;
+  b = (const GbSourceChangeLine *)(gpointer)priv->buffer_lines->data;
 
   /*
-   * Set the required fields for our worker.
+   * Edits are usually clustered, so only the region between the common
+   * prefix and suffix needs to be diffed. The worker gets its own copy of
+   * that slice of the buffer lines.
    */
-  g_object_set_data_full (G_OBJECT (async), "text", text, g_free);
-  g_object_set_data_full (G_OBJECT (async), "blob", g_object_ref (priv->blob),
-                          g_object_unref);
-  g_object_set_data_full (G_OBJECT (async), "path",
-                          g_strdup (priv->relative_path), g_free);
+  while ((prefix < n_old) && (prefix < n_new) &&
+         gb_source_change_line_equal (&a [prefix], &b [prefix]))
+    prefix++;
+
+  while (((prefix + suffix) < n_old) && ((prefix + suffix) < n_new) &&
+         gb_source_change_line_equal (&a [n_old - suffix - 1],
+                                      &b [n_new - suffix - 1]))
+    suffix++;
+
+  state = g_new0 (DiffState, 1);
+  state->old_lines = g_array_ref (priv->blob_lines);
+  state->old_begin = prefix;
+  state->old_end = n_old - suffix;
+  state->new_begin = prefix;
+  state->new_end = n_new - suffix;
+  state->new_lines = gb_source_change_lines_new (state->new_end -
+                                                state->new_begin);
+  for (i = state->new_begin; i < state->new_end; i++)
+    {
+      GbSourceChangeLine line = b [i];
 
-  /*
-   * Run the async operation in a worker thread.
-   */
-  g_simple_async_result_run_in_thread (async,
-                                       gb_source_change_monitor_worker,
-                                       G_PRIORITY_DEFAULT,
-                                       NULL);
+      line.text = g_strndup (line.text, line.len);
+      g_array_append_val (state->new_lines, line);
+    }
+  state->sequence = ++priv->sequence;
 
-  /*
-   * We are all done with our reference in this thread.
-   */
-  g_object_unref (async);
+  task = g_task_new (monitor, NULL, gb_source_change_monitor_diff_cb, NULL);
+  g_task_set_task_data (task, state, diff_state_free);
+  g_task_run_in_thread (task, gb_source_change_monitor_diff_worker);
+  g_object_unref (task);
 
   return G_SOURCE_REMOVE;
 }
@@ -312,7 +910,7 @@ gb_source_change_monitor_queue_parse (GbSourceChangeMonitor *monitor)
 
   priv = monitor->priv;
 
-  if (!priv->repo || !priv->blob || !priv->file)
+  if (!priv->repo || !priv->blob_lines || !priv->file)
     return;
 
   if (priv->parse_timeout)
@@ -355,6 +953,9 @@ gb_source_change_monitor_load_blob (GTask        *task,
   GFile *file;
   GFile *workdir = NULL;
   GError *error = NULL;
+  GArray *lines;
+  const gchar *content;
+  gsize content_len = 0;
   gchar *relpath = NULL;
 
   g_assert (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
@@ -404,9 +1005,26 @@ gb_source_change_monitor_load_blob (GTask        *task,
   if (!blob)
     GOTO (cleanup);
 
-  g_task_return_pointer (task, g_object_ref (blob), g_object_unref);
+  /*
+   * Split the HEAD contents into hashed lines once, here in the worker, so
+   * that each parse mostly compares integers against the buffer. The empty
+   * line following a trailing newline is not a line of the file.
+   */
+  content = (const gchar *)ggit_blob_get_raw_content (GGIT_BLOB (blob),
+                                                      &content_len);
+  lines = gb_source_change_lines_new (0);
+  gb_source_change_lines_split (lines, content ? content : "",
+                                content ? content_len : 0);
+  if ((content_len == 0) ||
+      (content [content_len - 1] == '\n') ||
+      (content [content_len - 1] == '\r'))
+    g_array_set_size (lines, lines->len - 1);
+
   g_object_set_data_full (G_OBJECT (task), "relpath",
                           g_strdup (relpath), g_free);
+  g_object_set_data_full (G_OBJECT (task), "lines",
+                          lines, (GDestroyNotify)g_array_unref);
+  g_task_return_pointer (task, g_object_ref (blob), g_object_unref);
   success = TRUE;
 
 cleanup:
@@ -434,6 +1052,7 @@ static GgitBlob *
 gb_source_change_monitor_load_blob_finish (GbSourceChangeMonitor  *monitor,
                                            GAsyncResult           *result,
                                            gchar                 **relpath,
+                                           GArray                **lines,
                                            GError                **error)
 {
   GgitBlob *blob;
@@ -447,6 +1066,9 @@ gb_source_change_monitor_load_blob_finish (GbSourceChangeMonitor  *monitor,
   if (blob && relpath)
     *relpath = g_strdup (g_object_get_data (G_OBJECT (task), "relpath"));
 
+  if (blob && lines)
+    *lines = g_array_ref (g_object_get_data (G_OBJECT (task), "lines"));
+
   return blob;
 }
 
@@ -491,6 +1113,120 @@ gb_source_change_monitor_load_blob_async (GbSourceChangeMonitor *monitor,
   g_object_unref (task);
 }
 
+/*
+ * Repository discovery walks up the directory tree looking for .git. The
+ * result is cached for a while per directory, and shared by all monitors,
+ * so that opening many files from one directory only walks the tree once.
+ * Lookups for a directory that is being discovered wait for that result
+ * instead of repeating it. Failures are only cached briefly, so that a
+ * freshly created repository is noticed soon.
+ */
+static GMutex      gDiscoveryMutex;
+static GCond       gDiscoveryCond;
+static GHashTable *gDiscoveryCache;
+
+static void
+discovery_entry_free (gpointer data)
+{
+  DiscoveryEntry *entry = data;
+
+  g_clear_object (&entry->repo_dir);
+  g_clear_error (&entry->error);
+  g_slice_free (DiscoveryEntry, entry);
+}
+
+static gboolean
+discovery_entry_expired (gpointer key,
+                         gpointer value,
+                         gpointer user_data)
+{
+  DiscoveryEntry *entry = value;
+  gint64 *now = user_data;
+
+  return (!entry->in_flight && (entry->expires_at <= *now));
+}
+
+static GFile *
+gb_source_change_monitor_discover_repo_dir (GFile   *file,
+                                            GError **error)
+{
+  DiscoveryEntry *entry;
+  GError *local_error = NULL;
+  GFile *parent;
+  GFile *repo_dir = NULL;
+  gchar *key;
+  gint64 now;
+
+  g_assert (G_IS_FILE (file));
+
+  parent = g_file_get_parent (file);
+  key = parent ? g_file_get_path (parent) : NULL;
+  g_clear_object (&parent);
+
+  if (!key)
+    return ggit_repository_discover (file, error);
+
+  g_mutex_lock (&gDiscoveryMutex);
+
+  if (!gDiscoveryCache)
+    gDiscoveryCache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, discovery_entry_free);
+
+  while ((entry = g_hash_table_lookup (gDiscoveryCache, key)) &&
+         entry->in_flight)
+    g_cond_wait (&gDiscoveryCond, &gDiscoveryMutex);
+
+  now = g_get_monotonic_time ();
+
+  if (entry && (entry->expires_at > now))
+    {
+      if (entry->repo_dir)
+        repo_dir = g_object_ref (entry->repo_dir);
+      else
+        g_propagate_error (error, g_error_copy (entry->error));
+
+      g_mutex_unlock (&gDiscoveryMutex);
+      g_free (key);
+
+      return repo_dir;
+    }
+
+  g_hash_table_foreach_remove (gDiscoveryCache, discovery_entry_expired, &now);
+
+  entry = g_slice_new0 (DiscoveryEntry);
+  entry->in_flight = TRUE;
+  g_hash_table_insert (gDiscoveryCache, key, entry);
+
+  g_mutex_unlock (&gDiscoveryMutex);
+
+  repo_dir = ggit_repository_discover (file, &local_error);
+
+  g_mutex_lock (&gDiscoveryMutex);
+
+  entry->in_flight = FALSE;
+  entry->expires_at = g_get_monotonic_time ();
+
+  if (repo_dir)
+    {
+      entry->repo_dir = g_object_ref (repo_dir);
+      entry->expires_at += DISCOVERY_CACHE_USEC;
+    }
+  else
+    {
+      if (!local_error)
+        local_error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                   _("No repository was found."));
+      entry->error = g_error_copy (local_error);
+      entry->expires_at += DISCOVERY_FAILURE_USEC;
+      g_propagate_error (error, local_error);
+    }
+
+  g_cond_broadcast (&gDiscoveryCond);
+  g_mutex_unlock (&gDiscoveryMutex);
+
+  return repo_dir;
+}
+
 static void
 gb_source_change_monitor_discover (GTask        *task,
                                    gpointer      source_object,
@@ -520,7 +1256,7 @@ gb_source_change_monitor_discover (GTask        *task,
     }
 
   /* Discover the .git repository for working directory containing @file. */
-  repo_dir = ggit_repository_discover (file, &error);
+  repo_dir = gb_source_change_monitor_discover_repo_dir (file, &error);
 
   if (!repo_dir)
     {
@@ -619,7 +1355,11 @@ gb_source_change_monitor_set_buffer (GbSourceChangeMonitor *monitor,
   if (priv->buffer)
     {
       g_signal_handler_disconnect (priv->buffer, priv->changed_handler);
+      g_signal_handler_disconnect (priv->buffer, priv->insert_text_handler);
+      g_signal_handler_disconnect (priv->buffer, priv->delete_range_handler);
       priv->changed_handler = 0;
+      priv->insert_text_handler = 0;
+      priv->delete_range_handler = 0;
       g_object_remove_weak_pointer (G_OBJECT (priv->buffer),
                                     (gpointer *)&priv->buffer);
     }
@@ -636,8 +1376,25 @@ gb_source_change_monitor_set_buffer (GbSourceChangeMonitor *monitor,
                                  G_CALLBACK (on_change_cb),
                                  monitor,
                                  G_CONNECT_SWAPPED);
+      priv->insert_text_handler =
+        g_signal_connect_object (priv->buffer,
+                                 "insert-text",
+                                 G_CALLBACK (on_insert_text_after_cb),
+                                 monitor,
+                                 G_CONNECT_SWAPPED | G_CONNECT_AFTER);
+      priv->delete_range_handler =
+        g_signal_connect_object (priv->buffer,
+                                 "delete-range",
+                                 G_CALLBACK (on_delete_range_after_cb),
+                                 monitor,
+                                 G_CONNECT_SWAPPED | G_CONNECT_AFTER);
     }
 
+  /* Hash the new buffer from scratch on the next parse. */
+  g_clear_pointer (&priv->buffer_lines, g_array_unref);
+  priv->dirty_begin = 0;
+  priv->dirty_end = 0;
+
   gb_source_change_monitor_queue_parse (monitor);
 
   EXIT;
@@ -658,13 +1415,14 @@ gb_source_change_monitor_load_blob_cb (GObject      *object,
 {
   GbSourceChangeMonitor *monitor = (GbSourceChangeMonitor *)object;
   GgitBlob *blob;
+  GArray *lines = NULL;
   GError *error = NULL;
   gchar *relpath = NULL;
 
   g_return_if_fail (GB_IS_SOURCE_CHANGE_MONITOR (monitor));
 
   blob = gb_source_change_monitor_load_blob_finish (monitor, result, &relpath,
-                                                    &error);
+                                                    &lines, &error);
 
   if (blob)
     {
@@ -672,6 +1430,8 @@ gb_source_change_monitor_load_blob_cb (GObject      *object,
       monitor->priv->blob = blob;
       g_clear_pointer (&monitor->priv->relative_path, g_free);
       monitor->priv->relative_path = relpath;
+      g_clear_pointer (&monitor->priv->blob_lines, g_array_unref);
+      monitor->priv->blob_lines = lines;
 
       gb_source_change_monitor_queue_parse (monitor);
     }
@@ -748,6 +1508,7 @@ gb_source_change_monitor_set_file (GbSourceChangeMonitor *monitor,
   g_clear_object (&priv->file);
   g_clear_object (&priv->blob);
   g_clear_object (&priv->repo);
+  g_clear_pointer (&priv->blob_lines, g_array_unref);
 
   if (file)
     {
@@ -796,7 +1557,9 @@ gb_source_change_monitor_finalize (GObject *object)
 {
   GbSourceChangeMonitorPrivate *priv = GB_SOURCE_CHANGE_MONITOR (object)->priv;
 
-  g_clear_pointer (&priv->state, g_hash_table_unref);
+  g_clear_pointer (&priv->runs, g_array_unref);
+  g_clear_pointer (&priv->blob_lines, g_array_unref);
+  g_clear_pointer (&priv->buffer_lines, g_array_unref);
   g_clear_pointer (&priv->relative_path, g_free);
 
   G_OBJECT_CLASS (gb_source_change_monitor_parent_class)->finalize (object);
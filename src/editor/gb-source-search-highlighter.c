@@ -17,16 +17,36 @@
  */
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #include "gb-cairo.h"
 #include "gb-rgba.h"
 #include "gb-source-search-highlighter.h"
 
+/*
+ * Match rectangles are cached per buffer line in buffer coordinates,
+ * relative to the top of their line. Scrolling only needs to compute the
+ * lines that were not drawn before. Buffer edits drop the lines they touch
+ * and renumber the lines after them, while changes to the search settings,
+ * the wrap mode or the font drop the whole cache.
+ */
+#define MAX_CACHED_LINES 4096
+
 struct _GbSourceSearchHighlighterPrivate
 {
   GtkSourceView           *source_view;
   GtkSourceSearchSettings *search_settings;
   GtkSourceSearchContext  *search_context;
+
+  GtkTextBuffer           *buffer;
+  GtkTextView             *text_view;
+  GHashTable              *lines;
+  gint                     line_count;
+  gint                     cached_width;
+
+  GtkSourceStyleScheme    *scheme;
+  GdkRGBA                  color1;
+  GdkRGBA                  color2;
 };
 
 enum {
@@ -50,17 +70,236 @@ static GParamSpec * gParamSpecs[LAST_PROP];
 static guint gSignals[LAST_SIGNAL];
 
 static void
-add_match (GtkTextView       *text_view,
-           cairo_region_t    *region,
-           const GtkTextIter *begin,
-           const GtkTextIter *end)
+free_rects (gpointer data)
+{
+  if (data)
+    g_array_unref (data);
+}
+
+static void
+gb_source_search_highlighter_invalidate (GbSourceSearchHighlighter *highlighter)
+{
+  g_assert (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
+
+  g_hash_table_remove_all (highlighter->priv->lines);
+  g_signal_emit (highlighter, gSignals [CHANGED], 0);
+}
+
+/*
+ * Drops the cached lines from @line through @last, which were modified,
+ * and moves the lines after @last by @delta.
+ */
+static void
+gb_source_search_highlighter_shift (GbSourceSearchHighlighter *highlighter,
+                                    guint                      line,
+                                    guint                      last,
+                                    gint                       delta)
+{
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+  GHashTableIter iter;
+  GHashTable *lines;
+  gpointer key;
+  gpointer value;
+
+  if (delta == 0)
+    {
+      for (; line <= last; line++)
+        g_hash_table_remove (priv->lines, GUINT_TO_POINTER (line));
+      return;
+    }
+
+  lines = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                 free_rects);
+
+  g_hash_table_iter_init (&iter, priv->lines);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint key_line = GPOINTER_TO_UINT (key);
+
+      if (key_line < line)
+        g_hash_table_insert (lines, key, value);
+      else if (key_line > last)
+        g_hash_table_insert (lines, GUINT_TO_POINTER (key_line + delta), value);
+      else
+        continue;
+
+      g_hash_table_iter_steal (&iter);
+    }
+
+  g_hash_table_unref (priv->lines);
+  priv->lines = lines;
+}
+
+/*
+ * Edits can change matches on lines other than their own when the search
+ * can span lines, so the whole cache is dropped in that case.
+ */
+static gboolean
+gb_source_search_highlighter_is_multiline (GbSourceSearchHighlighter *highlighter)
+{
+  GtkSourceSearchSettings *settings;
+  const gchar *text;
+
+  settings = gtk_source_search_context_get_settings (highlighter->priv->search_context);
+  text = gtk_source_search_settings_get_search_text (settings);
+
+  return (gtk_source_search_settings_get_regex_enabled (settings) ||
+          (text && strchr (text, '\n')));
+}
+
+static void
+on_buffer_insert_text (GbSourceSearchHighlighter *highlighter,
+                       GtkTextIter               *location,
+                       const gchar               *text,
+                       gint                       len,
+                       GtkTextBuffer             *buffer)
+{
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+  gint line_count;
+  guint line;
+
+  g_assert (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
+
+  line_count = gtk_text_buffer_get_line_count (buffer);
+
+  if (gb_source_search_highlighter_is_multiline (highlighter))
+    {
+      g_hash_table_remove_all (priv->lines);
+    }
+  else
+    {
+      /* @location has been moved to the end of the inserted text. */
+      line = gtk_text_iter_get_line (location) - (line_count - priv->line_count);
+      gb_source_search_highlighter_shift (highlighter, line, line,
+                                          line_count - priv->line_count);
+    }
+
+  priv->line_count = line_count;
+}
+
+static void
+on_buffer_delete_range (GbSourceSearchHighlighter *highlighter,
+                        GtkTextIter               *begin,
+                        GtkTextIter               *end,
+                        GtkTextBuffer             *buffer)
+{
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+  gint line_count;
+  guint line;
+
+  g_assert (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
+
+  line_count = gtk_text_buffer_get_line_count (buffer);
+
+  if (gb_source_search_highlighter_is_multiline (highlighter))
+    {
+      g_hash_table_remove_all (priv->lines);
+    }
+  else
+    {
+      line = gtk_text_iter_get_line (begin);
+      gb_source_search_highlighter_shift (highlighter, line,
+                                          line + (priv->line_count - line_count),
+                                          line_count - priv->line_count);
+    }
+
+  priv->line_count = line_count;
+}
+
+static void
+add_rect (GArray *rects,
+          gint    x,
+          gint    y,
+          gint    width,
+          gint    height)
+{
+  cairo_rectangle_int_t rect;
+
+  if (width <= 0)
+    return;
+
+  rect.x = x;
+  rect.y = y;
+  rect.width = width;
+  rect.height = height;
+
+  g_array_append_val (rects, rect);
+}
+
+/*
+ * Adds the rectangles for the part of a match that lies on a single buffer
+ * line, from @begin to @end. If the match continues onto the next line, the
+ * newline is covered as well. Wrapped lines get one rectangle per display
+ * line.
+ */
+static void
+add_line_match (GtkTextView       *text_view,
+                GArray            *rects,
+                const GtkTextIter *begin,
+                const GtkTextIter *end,
+                gboolean           continues)
 {
   GdkRectangle begin_rect;
   GdkRectangle end_rect;
-  cairo_rectangle_int_t rect;
+  GtkTextIter line_start;
+  GtkTextIter iter;
+  gint line_y;
+
+  gtk_text_iter_assign (&line_start, begin);
+  gtk_text_iter_set_line_offset (&line_start, 0);
+  gtk_text_view_get_line_yrange (text_view, &line_start, &line_y, NULL);
+
+  gtk_text_iter_assign (&iter, begin);
+
+  for (;;)
+    {
+      GtkTextIter next;
 
+      gtk_text_view_get_iter_location (text_view, &iter, &begin_rect);
+      gtk_text_iter_assign (&next, &iter);
+
+      if (gtk_text_view_forward_display_line (text_view, &next) &&
+          (gtk_text_iter_get_line (&next) == gtk_text_iter_get_line (begin)) &&
+          (gtk_text_iter_compare (&next, end) < 0))
+        {
+          GtkTextIter last_char = next;
+
+          gtk_text_iter_backward_char (&last_char);
+          gtk_text_view_get_iter_location (text_view, &last_char, &end_rect);
+          add_rect (rects,
+                    begin_rect.x,
+                    begin_rect.y - line_y,
+                    end_rect.x + end_rect.width - begin_rect.x,
+                    begin_rect.height);
+          gtk_text_iter_assign (&iter, &next);
+          continue;
+        }
+
+      gtk_text_view_get_iter_location (text_view, end, &end_rect);
+      add_rect (rects,
+                begin_rect.x,
+                begin_rect.y - line_y,
+                end_rect.x + (continues ? end_rect.width : 0) - begin_rect.x,
+                MAX (begin_rect.height, end_rect.height));
+      break;
+    }
+}
+
+static void
+add_match (GbSourceSearchHighlighter *highlighter,
+           GtkTextView               *text_view,
+           const GtkTextIter         *begin,
+           const GtkTextIter         *end,
+           guint                      first_line,
+           guint                      last_line)
+{
+  guint begin_line;
+  guint end_line;
+  guint line;
+
+  g_assert (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
   g_assert (GTK_IS_TEXT_VIEW (text_view));
-  g_assert (region);
   g_assert (begin);
   g_assert (end);
 
@@ -68,73 +307,115 @@ add_match (GtkTextView       *text_view,
    * NOTE: @end is not inclusive of the match.
    */
 
-  if (gtk_text_iter_get_line (begin) == gtk_text_iter_get_line (end))
+  begin_line = gtk_text_iter_get_line (begin);
+  end_line = gtk_text_iter_get_line (end);
+
+  for (line = MAX (begin_line, first_line);
+       line <= MIN (end_line, last_line);
+       line++)
     {
-      gtk_text_view_get_iter_location (text_view, begin, &begin_rect);
-      gtk_text_view_buffer_to_window_coords (text_view, GTK_TEXT_WINDOW_TEXT,
-                                             begin_rect.x, begin_rect.y,
-                                             &begin_rect.x, &begin_rect.y);
-      gtk_text_view_get_iter_location (text_view, end, &end_rect);
-      gtk_text_view_buffer_to_window_coords (text_view, GTK_TEXT_WINDOW_TEXT,
-                                             end_rect.x, end_rect.y,
-                                             &end_rect.x, &end_rect.y);
-      rect.x = begin_rect.x;
-      rect.y = begin_rect.y;
-      rect.width = end_rect.x - begin_rect.x;
-      rect.height = MAX (begin_rect.height, end_rect.height);
-      cairo_region_union_rectangle (region, &rect);
-      return;
-    }
+      GtkTextIter line_begin;
+      GtkTextIter line_end;
+      GArray *rects;
 
-  /*
-   * TODO: Complex matches.
-   */
+      if (line == begin_line)
+        gtk_text_iter_assign (&line_begin, begin);
+      else
+        gtk_text_buffer_get_iter_at_line (highlighter->priv->buffer,
+                                          &line_begin, line);
+
+      if (line == end_line)
+        {
+          gtk_text_iter_assign (&line_end, end);
+        }
+      else
+        {
+          gtk_text_iter_assign (&line_end, &line_begin);
+          if (!gtk_text_iter_ends_line (&line_end))
+            gtk_text_iter_forward_to_line_end (&line_end);
+        }
+
+      rects = g_hash_table_lookup (highlighter->priv->lines,
+                                   GUINT_TO_POINTER (line));
 
-  g_warning ("Need to support complex matches (multi-line)");
+      if (!rects)
+        {
+          rects = g_array_new (FALSE, FALSE, sizeof (cairo_rectangle_int_t));
+          g_hash_table_insert (highlighter->priv->lines,
+                               GUINT_TO_POINTER (line), rects);
+        }
+
+      add_line_match (text_view, rects, &line_begin, &line_end,
+                      (line != end_line));
+    }
 }
 
+/*
+ * Finds the matches touching the lines @first_line through @last_line,
+ * none of which are in the cache yet. Every line in the range is marked as
+ * cached afterwards, even those without matches.
+ */
 static void
-add_matches (GtkTextView            *text_view,
-             cairo_region_t         *region,
-             GtkSourceSearchContext *search_context,
-             const GtkTextIter      *begin,
-             const GtkTextIter      *end)
+add_matches (GbSourceSearchHighlighter *highlighter,
+             GtkTextView               *text_view,
+             guint                      first_line,
+             guint                      last_line)
 {
-  GtkTextIter first_begin;
-  GtkTextIter new_begin;
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+  GtkTextIter begin;
+  GtkTextIter end;
+  GtkTextIter iter;
   GtkTextIter match_begin;
   GtkTextIter match_end;
+  guint line;
 
+  g_assert (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
   g_assert (GTK_IS_TEXT_VIEW (text_view));
-  g_assert (region);
-  g_assert (GTK_SOURCE_IS_SEARCH_CONTEXT (search_context));
-  g_assert (begin);
-  g_assert (end);
 
-  if (!gtk_source_search_context_forward (search_context,
-                                          begin,
-                                          &first_begin,
-                                          &match_end))
-    return;
+  for (line = first_line; line <= last_line; line++)
+    g_hash_table_insert (priv->lines, GUINT_TO_POINTER (line), NULL);
 
-  add_match (text_view, region, &first_begin, &match_end);
+  gtk_text_buffer_get_iter_at_line (priv->buffer, &begin, first_line);
+  gtk_text_buffer_get_iter_at_line (priv->buffer, &end, last_line);
+  if (!gtk_text_iter_ends_line (&end))
+    gtk_text_iter_forward_to_line_end (&end);
 
-  for (;; )
+  /*
+   * A match spanning lines may have started above the range.
+   */
+  if ((first_line > 0) &&
+      gb_source_search_highlighter_is_multiline (highlighter) &&
+      gtk_source_search_context_backward (priv->search_context, &begin,
+                                          &match_begin, &match_end) &&
+      (gtk_text_iter_compare (&match_begin, &begin) < 0) &&
+      (gtk_text_iter_compare (&match_end, &begin) > 0))
+    add_match (highlighter, text_view, &match_begin, &match_end,
+               first_line, last_line);
+
+  gtk_text_iter_assign (&iter, &begin);
+
+  while (gtk_source_search_context_forward (priv->search_context, &iter,
+                                            &match_begin, &match_end))
     {
-      gtk_text_iter_assign (&new_begin, &match_end);
-
-      if (gtk_source_search_context_forward (search_context,
-                                             &new_begin,
-                                             &match_begin,
-                                             &match_end) &&
-          (gtk_text_iter_compare (&match_begin, end) < 0) &&
-          (gtk_text_iter_compare (&first_begin, &match_begin) != 0))
-        {
-          add_match (text_view, region, &match_begin, &match_end);
-          continue;
-        }
+      /*
+       * The search wraps around, so a match before @iter means there are
+       * no more matches below it.
+       */
+      if ((gtk_text_iter_compare (&match_begin, &iter) < 0) ||
+          (gtk_text_iter_compare (&match_begin, &end) > 0))
+        break;
 
-      break;
+      add_match (highlighter, text_view, &match_begin, &match_end,
+                 first_line, last_line);
+
+      gtk_text_iter_assign (&iter, &match_end);
+
+      if (gtk_text_iter_equal (&match_begin, &match_end) &&
+          !gtk_text_iter_forward_char (&iter))
+        break;
+
+      if (gtk_text_iter_compare (&iter, &end) > 0)
+        break;
     }
 }
 
@@ -156,6 +437,81 @@ draw_bezel (cairo_t                     *cr,
   cairo_fill (cr);
 }
 
+static void
+gb_source_search_highlighter_update_colors (GbSourceSearchHighlighter *highlighter,
+                                            GtkSourceStyleScheme      *scheme)
+{
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+  GtkSourceStyle *style = NULL;
+
+  if (priv->scheme == scheme)
+    return;
+
+  if (priv->scheme)
+    g_object_remove_weak_pointer (G_OBJECT (priv->scheme),
+                                  (gpointer *)&priv->scheme);
+
+  priv->scheme = scheme;
+
+  if (scheme)
+    {
+      g_object_add_weak_pointer (G_OBJECT (scheme), (gpointer *)&priv->scheme);
+      style = gtk_source_style_scheme_get_style (scheme, "search-match");
+    }
+
+  if (style)
+    {
+      gchar *background = NULL;
+      GdkRGBA color;
+
+      g_object_get (style, "background", &background, NULL);
+      gdk_rgba_parse (&color, background);
+      gb_rgba_shade (&color, &priv->color1, 0.8);
+      gb_rgba_shade (&color, &priv->color2, 1.1);
+      g_free (background);
+    }
+  else
+    {
+      gdk_rgba_parse (&priv->color1, "#edd400");
+      gdk_rgba_parse (&priv->color2, "#fce94f");
+    }
+}
+
+static void
+gb_source_search_highlighter_set_text_view (GbSourceSearchHighlighter *highlighter,
+                                            GtkTextView               *text_view)
+{
+  GbSourceSearchHighlighterPrivate *priv = highlighter->priv;
+
+  if (priv->text_view == text_view)
+    return;
+
+  if (priv->text_view)
+    {
+      g_signal_handlers_disconnect_by_func (priv->text_view,
+                                            G_CALLBACK (gb_source_search_highlighter_invalidate),
+                                            highlighter);
+      g_object_remove_weak_pointer (G_OBJECT (priv->text_view),
+                                    (gpointer *)&priv->text_view);
+    }
+
+  priv->text_view = text_view;
+  g_object_add_weak_pointer (G_OBJECT (text_view), (gpointer *)&priv->text_view);
+
+  g_signal_connect_object (text_view,
+                           "style-updated",
+                           G_CALLBACK (gb_source_search_highlighter_invalidate),
+                           highlighter,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (text_view,
+                           "notify::wrap-mode",
+                           G_CALLBACK (gb_source_search_highlighter_invalidate),
+                           highlighter,
+                           G_CONNECT_SWAPPED);
+
+  g_hash_table_remove_all (priv->lines);
+}
+
 void
 gb_source_search_highlighter_draw (GbSourceSearchHighlighter *highlighter,
                                    GtkTextView               *text_view,
@@ -165,14 +521,14 @@ gb_source_search_highlighter_draw (GbSourceSearchHighlighter *highlighter,
   GtkSourceStyleScheme *scheme;
   cairo_region_t *clip_region;
   cairo_region_t *match_region;
-  GtkSourceStyle *style;
   GtkTextBuffer *buffer;
   GdkRectangle area;
   GtkTextIter begin;
   GtkTextIter end;
-  GdkRGBA color;
-  GdkRGBA color1;
-  GdkRGBA color2;
+  guint first_line;
+  guint last_line;
+  guint line;
+  gint width;
 
   g_return_if_fail (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
   g_return_if_fail (GTK_IS_TEXT_VIEW (text_view));
@@ -185,47 +541,94 @@ gb_source_search_highlighter_draw (GbSourceSearchHighlighter *highlighter,
     return;
 
   buffer = gtk_text_view_get_buffer (text_view);
+  if (buffer != priv->buffer)
+    return;
+
   scheme = gtk_source_buffer_get_style_scheme (GTK_SOURCE_BUFFER (buffer));
-  style = gtk_source_style_scheme_get_style (scheme, "search-match");
+  gb_source_search_highlighter_update_colors (highlighter, scheme);
 
-  if (style)
-    {
-      gchar *background;
+  gb_source_search_highlighter_set_text_view (highlighter, text_view);
 
-      /*
-       * TODO: We should probably cache this.
-       */
-
-      g_object_get (style, "background", &background, NULL);
-      gdk_rgba_parse (&color, background);
-      gb_rgba_shade (&color, &color1, 0.8);
-      gb_rgba_shade (&color, &color2, 1.1);
-      g_free (background);
-    }
-  else
+  width = gtk_widget_get_allocated_width (GTK_WIDGET (text_view));
+  if ((width != priv->cached_width) ||
+      (g_hash_table_size (priv->lines) > MAX_CACHED_LINES))
     {
-      gdk_rgba_parse (&color1, "#edd400");
-      gdk_rgba_parse (&color2, "#fce94f");
+      g_hash_table_remove_all (priv->lines);
+      priv->cached_width = width;
     }
 
-  gdk_cairo_get_clip_rectangle (cr, &area);
+  if (!gdk_cairo_get_clip_rectangle (cr, &area))
+    return;
+
   gtk_text_view_window_to_buffer_coords (text_view,
                                          GTK_TEXT_WINDOW_TEXT,
                                          area.x,
                                          area.y,
                                          &area.x,
                                          &area.y);
-  gtk_text_view_get_iter_at_location (text_view, &begin, area.x, area.y);
-  gtk_text_view_get_iter_at_location (text_view, &end,
-                                      area.x + area.width,
-                                      area.y + area.height);
+  gtk_text_view_get_line_at_y (text_view, &begin, area.y, NULL);
+  gtk_text_view_get_line_at_y (text_view, &end, area.y + area.height, NULL);
+
+  first_line = gtk_text_iter_get_line (&begin);
+  last_line = gtk_text_iter_get_line (&end);
+
+  /*
+   * Only lines that were not drawn before need to be searched.
+   */
+  for (line = first_line; line <= last_line; line++)
+    {
+      guint run_end;
+
+      if (g_hash_table_contains (priv->lines, GUINT_TO_POINTER (line)))
+        continue;
+
+      for (run_end = line;
+           (run_end < last_line) &&
+           !g_hash_table_contains (priv->lines, GUINT_TO_POINTER (run_end + 1));
+           run_end++)
+        {
+          /* Do Nothing */
+        }
+
+      add_matches (highlighter, text_view, line, run_end);
+      line = run_end;
+    }
+
+  match_region = cairo_region_create ();
+
+  for (line = first_line; line <= last_line; line++)
+    {
+      GtkTextIter iter;
+      GArray *rects;
+      gint line_y;
+      guint i;
+
+      rects = g_hash_table_lookup (priv->lines, GUINT_TO_POINTER (line));
+      if (!rects)
+        continue;
+
+      gtk_text_buffer_get_iter_at_line (buffer, &iter, line);
+      gtk_text_view_get_line_yrange (text_view, &iter, &line_y, NULL);
+
+      for (i = 0; i < rects->len; i++)
+        {
+          cairo_rectangle_int_t rect;
+
+          rect = g_array_index (rects, cairo_rectangle_int_t, i);
+          gtk_text_view_buffer_to_window_coords (text_view,
+                                                 GTK_TEXT_WINDOW_TEXT,
+                                                 rect.x,
+                                                 line_y + rect.y,
+                                                 &rect.x,
+                                                 &rect.y);
+          cairo_region_union_rectangle (match_region, &rect);
+        }
+    }
 
   if (!gdk_cairo_get_clip_rectangle (cr, &area))
     g_assert_not_reached ();
 
   clip_region = cairo_region_create_rectangle (&area);
-  match_region = cairo_region_create ();
-  add_matches (text_view, match_region, priv->search_context, &begin, &end);
 
   cairo_region_subtract (clip_region, match_region);
 
@@ -249,8 +652,8 @@ gb_source_search_highlighter_draw (GbSourceSearchHighlighter *highlighter,
       {
         cairo_region_get_rectangle (match_region, i, &r);
 
-        draw_bezel (cr, &r, 3, &color1);
-        draw_bezel (cr, &r, 2, &color2);
+        draw_bezel (cr, &r, 3, &priv->color1);
+        draw_bezel (cr, &r, 2, &priv->color2);
       }
   }
 
@@ -269,8 +672,61 @@ gb_source_search_highlighter_set_search_context (GbSourceSearchHighlighter *high
 
   priv = highlighter->priv;
 
-  g_clear_object (&priv->search_context);
-  priv->search_context = search_context ? g_object_ref (search_context) : NULL;
+  if (search_context == priv->search_context)
+    return;
+
+  if (priv->search_context)
+    {
+      g_signal_handlers_disconnect_by_func (priv->search_context,
+                                            G_CALLBACK (gb_source_search_highlighter_invalidate),
+                                            highlighter);
+      g_signal_handlers_disconnect_by_func (gtk_source_search_context_get_settings (priv->search_context),
+                                            G_CALLBACK (gb_source_search_highlighter_invalidate),
+                                            highlighter);
+      g_signal_handlers_disconnect_by_func (priv->buffer,
+                                            G_CALLBACK (on_buffer_insert_text),
+                                            highlighter);
+      g_signal_handlers_disconnect_by_func (priv->buffer,
+                                            G_CALLBACK (on_buffer_delete_range),
+                                            highlighter);
+      g_clear_object (&priv->buffer);
+      g_clear_object (&priv->search_context);
+    }
+
+  g_hash_table_remove_all (priv->lines);
+
+  if (search_context)
+    {
+      priv->search_context = g_object_ref (search_context);
+      priv->buffer = g_object_ref (gtk_source_search_context_get_buffer (search_context));
+      priv->line_count = gtk_text_buffer_get_line_count (priv->buffer);
+
+      g_signal_connect_object (priv->buffer,
+                               "insert-text",
+                               G_CALLBACK (on_buffer_insert_text),
+                               highlighter,
+                               G_CONNECT_SWAPPED | G_CONNECT_AFTER);
+      g_signal_connect_object (priv->buffer,
+                               "delete-range",
+                               G_CALLBACK (on_buffer_delete_range),
+                               highlighter,
+                               G_CONNECT_SWAPPED | G_CONNECT_AFTER);
+      g_signal_connect_object (search_context,
+                               "notify::settings",
+                               G_CALLBACK (gb_source_search_highlighter_invalidate),
+                               highlighter,
+                               G_CONNECT_SWAPPED);
+      g_signal_connect_object (search_context,
+                               "notify::highlight",
+                               G_CALLBACK (gb_source_search_highlighter_invalidate),
+                               highlighter,
+                               G_CONNECT_SWAPPED);
+      g_signal_connect_object (gtk_source_search_context_get_settings (search_context),
+                               "notify",
+                               G_CALLBACK (gb_source_search_highlighter_invalidate),
+                               highlighter,
+                               G_CONNECT_SWAPPED);
+    }
 }
 
 void
@@ -295,8 +751,18 @@ gb_source_search_highlighter_finalize (GObject *object)
 
   priv = GB_SOURCE_SEARCH_HIGHLIGHTER (object)->priv;
 
+  if (priv->text_view)
+    g_object_remove_weak_pointer (G_OBJECT (priv->text_view),
+                                  (gpointer *)&priv->text_view);
+
+  if (priv->scheme)
+    g_object_remove_weak_pointer (G_OBJECT (priv->scheme),
+                                  (gpointer *)&priv->scheme);
+
+  g_clear_object (&priv->buffer);
   g_clear_object (&priv->search_context);
   g_clear_object (&priv->search_settings);
+  g_clear_pointer (&priv->lines, g_hash_table_unref);
 
   G_OBJECT_CLASS (gb_source_search_highlighter_parent_class)->finalize (object);
 }
@@ -366,4 +832,9 @@ static void
 gb_source_search_highlighter_init (GbSourceSearchHighlighter *highlighter)
 {
   highlighter->priv = gb_source_search_highlighter_get_instance_private (highlighter);
+  highlighter->priv->lines = g_hash_table_new_full (g_direct_hash,
+                                                    g_direct_equal,
+                                                    NULL,
+                                                    free_rects);
+  highlighter->priv->cached_width = -1;
 }
@@ -371,6 +371,9 @@ on_search_highlighter_changed (GbSourceSearchHighlighter *highlighter,
   g_return_if_fail (GB_IS_SOURCE_VIEW (view));
   g_return_if_fail (GB_IS_SOURCE_SEARCH_HIGHLIGHTER (highlighter));
 
+  if (view->priv->show_shadow)
+    gtk_widget_queue_draw (GTK_WIDGET (view));
+
   EXIT;
 }
 
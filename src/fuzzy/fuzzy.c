@@ -18,7 +18,11 @@
 
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "fuzzy.h"
 
@@ -28,12 +32,57 @@
 #endif
 
 
+/*
+ * Characters below this codepoint are indexed in a dense array of
+ * tables. Anything above it lives in a sparse hashtable that is only
+ * created once such a character is inserted.
+ */
+#define FUZZY_N_CHAR_TABLES 256
+
+
+/*
+ * FuzzyItem packs both the id and the position into 32 bits, which limits
+ * the number of keys and the number of characters indexed per key.
+ */
+#define FUZZY_PACKED_MAX_POS ((1 << 12) - 1)
+#define FUZZY_WIDE_MAX_POS   G_MAXUINT16
+
+
+/*
+ * Removed ids keep their slot so that ids handed out by fuzzy_insert()
+ * stay valid. Their text offset is replaced with this marker.
+ */
+#define FUZZY_TOMBSTONE G_MAXSIZE
+
+
+/*
+ * Every this many postings of a FUZZY_LAYOUT_WIDE table, the offset of
+ * the encoded id is recorded so that a cursor can seek without decoding
+ * everything in front of it.
+ */
+#define FUZZY_SKIP_INTERVAL 128
+#define FUZZY_N_SKIPS(len)  (((len) + FUZZY_SKIP_INTERVAL - 1) / FUZZY_SKIP_INTERVAL)
+
+
+/*
+ * Version of the on-disk format written by fuzzy_save(). Bump this
+ * whenever the layout of FuzzyFileHeader or of the sections changes.
+ */
+#define FUZZY_FILE_MAGIC      "GBFUZZY"
+#define FUZZY_FILE_VERSION    2
+#define FUZZY_FILE_BYTE_ORDER 0x01020304
+#define FUZZY_FILE_NO_VALUE   G_MAXUINT64
+
+
 /**
  * SECTION:fuzzy
  * @title: Fuzzy Matching
  * @short_description: Fuzzy matching for GLib based programs.
  *
- * TODO:
+ * Keys and needles are UTF-8 and are indexed by (case-folded) codepoint.
+ * Latin-1 codepoints use a dense array of tables indexed by value, so
+ * an index of ASCII keys costs exactly the same as a byte based one.
+ * Other codepoints are stored in a sparse table created on demand.
  *
  * It is a programming error to modify #Fuzzy while holding onto an array
  * of #FuzzyMatch elements. The position of strings within the FuzzyMatch
@@ -41,8 +90,13 @@
  */
 
 
-typedef struct _FuzzyItem   FuzzyItem;
-typedef struct _FuzzyLookup FuzzyLookup;
+typedef struct _FuzzyItem       FuzzyItem;
+typedef struct _FuzzyTable      FuzzyTable;
+typedef struct _FuzzySkip       FuzzySkip;
+typedef struct _FuzzyCursor     FuzzyCursor;
+typedef struct _FuzzyLookup     FuzzyLookup;
+typedef struct _FuzzyFileHeader FuzzyFileHeader;
+typedef struct _FuzzyFileTable  FuzzyFileTable;
 
 
 struct _Fuzzy
@@ -54,8 +108,23 @@ struct _Fuzzy
    GArray         *id_to_text_offset;
    GPtrArray      *id_to_value;
    GPtrArray      *char_tables;
+   GHashTable     *unichar_tables;
+   FuzzyLayout     layout;
+   GDestroyNotify  free_func;
+   guint           n_removed;
    gboolean        in_bulk_insert;
    gboolean        case_sensitive;
+
+   /*
+    * When loaded with fuzzy_new_from_file(), heap points into the mapped
+    * file and the arrays above are not used until the first modification.
+    */
+   GMappedFile    *mapped;
+   const guint64  *mapped_text_offsets;
+   const guint64  *mapped_value_offsets;
+   const gchar    *mapped_values;
+   gsize           mapped_values_length;
+   guint           mapped_n_ids;
 };
 
 
@@ -69,33 +138,138 @@ struct _FuzzyItem
 G_STATIC_ASSERT(sizeof(FuzzyItem) == 4);
 
 
-struct _FuzzyLookup
+/**
+ * FuzzySkip:
+ * @offset: The offset of the encoded id of the posting.
+ * @id: The id of the posting before it, which its delta is relative to.
+ *
+ * Describes every %FUZZY_SKIP_INTERVAL posting of a %FUZZY_LAYOUT_WIDE
+ * table, starting with the first one.
+ */
+struct _FuzzySkip
 {
-   Fuzzy        *fuzzy;
-   GArray      **tables;
-   gint         *state;
-   guint         n_tables;
-   gsize         max_matches;
-   const gchar  *needle;
-   GHashTable   *matches;
+   guint64 offset;
+   guint32 id;
+   guint32 reserved;
 };
 
 
-static gint
-fuzzy_item_compare (gconstpointer a,
-                    gconstpointer b)
+G_STATIC_ASSERT(sizeof(FuzzySkip) == 16);
+
+
+/**
+ * FuzzyTable:
+ * @items: The #FuzzyItem postings when using %FUZZY_LAYOUT_PACKED.
+ * @ids: The ids of the postings when using %FUZZY_LAYOUT_WIDE. Each id is
+ *   stored as a LEB128 encoded delta from the previous posting's id.
+ * @positions: The #guint16 positions of the postings when using
+ *   %FUZZY_LAYOUT_WIDE, in the same order as @ids.
+ * @skips: The #FuzzySkip entries of @ids.
+ * @last_id: The id of the last posting in @ids.
+ * @mapped_data: The #FuzzyItem postings or encoded ids within a mapped
+ *   file, used instead of @items or @ids.
+ * @mapped_data_len: The length of @mapped_data in bytes.
+ * @mapped_positions: The positions within a mapped file.
+ * @mapped_skips: The skip entries within a mapped file.
+ * @mapped_len: The number of postings in the mapped file.
+ *
+ * The postings for a single character, sorted by id and then position.
+ * Keys are assigned increasing ids, so a key with many occurrences of the
+ * same character encodes each extra occurrence with a single zero byte.
+ */
+struct _FuzzyTable
 {
-   gint ret;
+   GArray          *items;
+   GByteArray      *ids;
+   GArray          *positions;
+   GArray          *skips;
+   guint            last_id;
+   const guint8    *mapped_data;
+   gsize            mapped_data_len;
+   const guint16   *mapped_positions;
+   const FuzzySkip *mapped_skips;
+   guint            mapped_len;
+};
 
-   const FuzzyItem *fa = a;
-   const FuzzyItem *fb = b;
 
-   if ((ret = fa->id - fb->id) == 0) {
-      ret = fa->pos - fb->pos;
-   }
+/**
+ * FuzzyCursor:
+ *
+ * Walks the postings of a #FuzzyTable in order regardless of layout.
+ * @id and @pos hold the current posting while @index is below @len.
+ */
+struct _FuzzyCursor
+{
+   const FuzzyItem *items;
+   const guint8    *ids;
+   const guint16   *positions;
+   const FuzzySkip *skips;
+   guint            index;
+   guint            len;
+   gsize            offset;
+   guint            id;
+   guint            pos;
+};
 
-   return ret;
-}
+
+/**
+ * FuzzyFileHeader:
+ *
+ * The header of a file written by fuzzy_save(). All offsets are relative
+ * to the start of the file and every section is aligned to 8 bytes, so
+ * the file can be used in place once mapped.
+ */
+struct _FuzzyFileHeader
+{
+   gchar   magic[8];
+   guint32 version;
+   guint32 byte_order;
+   guint32 layout;
+   guint32 case_sensitive;
+   guint32 n_ids;
+   guint32 n_tables;
+   guint64 tag_offset;
+   guint64 text_offsets_offset;
+   guint64 value_offsets_offset;
+   guint64 heap_offset;
+   guint64 heap_length;
+   guint64 values_offset;
+   guint64 values_length;
+   guint64 tables_offset;
+};
+
+
+/**
+ * FuzzyFileTable:
+ *
+ * Describes the postings of one character within a file written by
+ * fuzzy_save(). @positions_offset and @skips_offset are only used by
+ * %FUZZY_LAYOUT_WIDE.
+ */
+struct _FuzzyFileTable
+{
+   guint32 ch;
+   guint32 len;
+   guint64 data_offset;
+   guint64 data_length;
+   guint64 positions_offset;
+   guint64 skips_offset;
+};
+
+
+G_STATIC_ASSERT(sizeof(FuzzyFileHeader) == 96);
+G_STATIC_ASSERT(sizeof(FuzzyFileTable) == 40);
+
+
+struct _FuzzyLookup
+{
+   Fuzzy        *fuzzy;
+   FuzzyCursor  *cursors;
+   guint         n_tables;
+   gsize         max_matches;
+   const gchar  *needle;
+   GArray       *matches;
+};
 
 
 static gint
@@ -115,6 +289,319 @@ fuzzy_match_compare (gconstpointer a,
 }
 
 
+static FuzzyTable *
+fuzzy_table_new (FuzzyLayout layout)
+{
+   FuzzyTable *table;
+
+   table = g_slice_new0(FuzzyTable);
+
+   if (layout == FUZZY_LAYOUT_WIDE) {
+      table->ids = g_byte_array_new();
+      table->positions = g_array_new(FALSE, FALSE, sizeof(guint16));
+      table->skips = g_array_new(FALSE, FALSE, sizeof(FuzzySkip));
+   } else {
+      table->items = g_array_new(FALSE, FALSE, sizeof(FuzzyItem));
+   }
+
+   return table;
+}
+
+
+static void
+fuzzy_table_free (gpointer data)
+{
+   FuzzyTable *table = data;
+
+   if (table) {
+      g_clear_pointer(&table->items, g_array_unref);
+      g_clear_pointer(&table->ids, g_byte_array_unref);
+      g_clear_pointer(&table->positions, g_array_unref);
+      g_clear_pointer(&table->skips, g_array_unref);
+      g_slice_free(FuzzyTable, table);
+   }
+}
+
+
+static void
+fuzzy_table_append_id (FuzzyTable *table,
+                       guint       index,
+                       guint       id)
+{
+   FuzzySkip skip = { 0 };
+   guint8 byte;
+   guint delta;
+
+   /*
+    * Ids are handed out in increasing order, so appending keeps the
+    * table sorted and the delta is never negative.
+    */
+   g_assert(id >= table->last_id);
+
+   if (!(index % FUZZY_SKIP_INTERVAL)) {
+      skip.offset = table->ids->len;
+      skip.id = table->last_id;
+      g_array_append_val(table->skips, skip);
+   }
+
+   delta = id - table->last_id;
+   table->last_id = id;
+
+   do {
+      byte = delta & 0x7F;
+      delta >>= 7;
+      if (delta) {
+         byte |= 0x80;
+      }
+      g_byte_array_append(table->ids, &byte, 1);
+   } while (delta);
+}
+
+
+static void
+fuzzy_table_append (FuzzyTable *table,
+                    guint       id,
+                    guint       pos)
+{
+   FuzzyItem item;
+   guint16 pos16;
+
+   if (table->items) {
+      item.id = id;
+      item.pos = pos;
+      g_array_append_val(table->items, item);
+      return;
+   }
+
+   fuzzy_table_append_id(table, table->positions->len, id);
+
+   pos16 = pos;
+   g_array_append_val(table->positions, pos16);
+}
+
+
+static inline void
+fuzzy_cursor_load (FuzzyCursor *cursor)
+{
+   guint shift = 0;
+   guint delta = 0;
+
+   if (cursor->index >= cursor->len) {
+      return;
+   }
+
+   if (cursor->items) {
+      cursor->id = cursor->items[cursor->index].id;
+      cursor->pos = cursor->items[cursor->index].pos;
+      return;
+   }
+
+   do {
+      delta |= (cursor->ids[cursor->offset] & 0x7F) << shift;
+      shift += 7;
+   } while (cursor->ids[cursor->offset++] & 0x80);
+
+   cursor->id += delta;
+   cursor->pos = cursor->positions[cursor->index];
+}
+
+
+static void
+fuzzy_cursor_init (FuzzyCursor *cursor,
+                   FuzzyLayout  layout,
+                   FuzzyTable  *table)
+{
+   cursor->items = NULL;
+   cursor->ids = NULL;
+   cursor->positions = NULL;
+   cursor->skips = NULL;
+   cursor->index = 0;
+   cursor->offset = 0;
+   cursor->id = 0;
+   cursor->pos = 0;
+
+   if (table->items) {
+      cursor->items = (const FuzzyItem *)(gpointer)table->items->data;
+      cursor->len = table->items->len;
+   } else if (table->ids) {
+      cursor->ids = table->ids->data;
+      cursor->positions = (const guint16 *)(gpointer)table->positions->data;
+      cursor->skips = (const FuzzySkip *)(gpointer)table->skips->data;
+      cursor->len = table->positions->len;
+   } else if (layout == FUZZY_LAYOUT_PACKED) {
+      cursor->items = (const FuzzyItem *)(gconstpointer)table->mapped_data;
+      cursor->len = table->mapped_len;
+   } else {
+      cursor->ids = table->mapped_data;
+      cursor->positions = table->mapped_positions;
+      cursor->skips = table->mapped_skips;
+      cursor->len = table->mapped_len;
+   }
+
+   fuzzy_cursor_load(cursor);
+}
+
+
+static inline gboolean
+fuzzy_cursor_is_valid (FuzzyCursor *cursor)
+{
+   return (cursor->index < cursor->len);
+}
+
+
+static inline void
+fuzzy_cursor_next (FuzzyCursor *cursor)
+{
+   cursor->index++;
+   fuzzy_cursor_load(cursor);
+}
+
+
+/**
+ * fuzzy_cursor_seek:
+ * @cursor: A #FuzzyCursor.
+ * @id: The id to seek to.
+ *
+ * Moves @cursor to the first posting with an id of at least @id. The
+ * packed layout is searched directly. The wide layout is searched by its
+ * skip entries and then decoded from the closest one.
+ */
+static void
+fuzzy_cursor_seek (FuzzyCursor *cursor,
+                   guint        id)
+{
+   const FuzzySkip *skip;
+   guint lo = 0;
+   guint hi;
+   guint mid;
+
+   if (!fuzzy_cursor_is_valid(cursor) || (cursor->id >= id)) {
+      return;
+   }
+
+   if (cursor->items) {
+      hi = cursor->len;
+      while (lo < hi) {
+         mid = lo + ((hi - lo) / 2);
+         if (cursor->items[mid].id < id) {
+            lo = mid + 1;
+         } else {
+            hi = mid;
+         }
+      }
+      cursor->index = lo;
+      fuzzy_cursor_load(cursor);
+      return;
+   }
+
+   /*
+    * Find the last skip entry whose preceding id is below @id. Nothing in
+    * front of it can be at or after @id.
+    */
+   hi = ((cursor->len - 1) / FUZZY_SKIP_INTERVAL) + 1;
+   while ((hi - lo) > 1) {
+      mid = lo + ((hi - lo) / 2);
+      if (cursor->skips[mid].id < id) {
+         lo = mid;
+      } else {
+         hi = mid;
+      }
+   }
+
+   skip = &cursor->skips[lo];
+
+   if ((lo * FUZZY_SKIP_INTERVAL) > cursor->index) {
+      cursor->index = lo * FUZZY_SKIP_INTERVAL;
+      cursor->offset = skip->offset;
+      cursor->id = skip->id;
+      fuzzy_cursor_load(cursor);
+   }
+
+   while (fuzzy_cursor_is_valid(cursor) && (cursor->id < id)) {
+      fuzzy_cursor_next(cursor);
+   }
+}
+
+
+static void
+fuzzy_cursor_skip_id (FuzzyCursor *cursor,
+                      guint        id)
+{
+   while (fuzzy_cursor_is_valid(cursor) && (cursor->id == id)) {
+      fuzzy_cursor_next(cursor);
+   }
+}
+
+
+G_DEFINE_QUARK(fuzzy-error-quark, fuzzy_error)
+
+
+static inline guint
+fuzzy_get_n_ids (Fuzzy *fuzzy)
+{
+   if (G_UNLIKELY(fuzzy->mapped)) {
+      return fuzzy->mapped_n_ids;
+   }
+
+   return fuzzy->id_to_text_offset->len;
+}
+
+
+/**
+ * fuzzy_get_text_offset:
+ * @fuzzy: A #Fuzzy.
+ * @id: The id of a key.
+ *
+ * Gets the offset of the key for @id within the heap. Offsets outside of
+ * the heap of a mapped file are treated as removed keys so that a
+ * damaged cache file cannot make us read past the mapping.
+ *
+ * Returns: An offset within the heap or %FUZZY_TOMBSTONE.
+ */
+static inline gsize
+fuzzy_get_text_offset (Fuzzy *fuzzy,
+                       guint  id)
+{
+   guint64 offset;
+
+   if (G_UNLIKELY(fuzzy->mapped)) {
+      if (id >= fuzzy->mapped_n_ids) {
+         return FUZZY_TOMBSTONE;
+      }
+
+      offset = fuzzy->mapped_text_offsets[id];
+
+      return (offset < fuzzy->heap_offset) ? offset : FUZZY_TOMBSTONE;
+   }
+
+   return g_array_index(fuzzy->id_to_text_offset, gsize, id);
+}
+
+
+static inline gpointer
+fuzzy_get_value (Fuzzy *fuzzy,
+                 guint  id)
+{
+   guint64 offset;
+
+   if (G_UNLIKELY(fuzzy->mapped)) {
+      if (!fuzzy->mapped_value_offsets) {
+         return NULL;
+      }
+
+      offset = fuzzy->mapped_value_offsets[id];
+
+      if (offset >= fuzzy->mapped_values_length) {
+         return NULL;
+      }
+
+      return (gpointer)(fuzzy->mapped_values + offset);
+   }
+
+   return g_ptr_array_index(fuzzy->id_to_value, id);
+}
+
+
 Fuzzy *
 fuzzy_ref (Fuzzy *fuzzy)
 {
@@ -131,17 +618,42 @@ fuzzy_ref (Fuzzy *fuzzy)
  * fuzzy_new:
  * @case_sensitive: %TRUE if case should be preserved.
  *
- * Create a new #Fuzzy for fuzzy matching strings.
+ * Create a new #Fuzzy for fuzzy matching strings using the
+ * %FUZZY_LAYOUT_PACKED layout.
  *
  * Returns: A newly allocated #Fuzzy that should be freed with fuzzy_unref().
  */
 Fuzzy *
 fuzzy_new (gboolean case_sensitive)
 {
-   GArray *table;
+   return fuzzy_new_with_layout(case_sensitive, FUZZY_LAYOUT_PACKED);
+}
+
+
+/**
+ * fuzzy_new_with_layout:
+ * @case_sensitive: %TRUE if case should be preserved.
+ * @layout: A #FuzzyLayout.
+ *
+ * Create a new #Fuzzy for fuzzy matching strings, storing the index
+ * using @layout.
+ *
+ * %FUZZY_LAYOUT_PACKED is the fastest to query but is limited to
+ * %FUZZY_PACKED_MAX_KEYS keys. %FUZZY_LAYOUT_WIDE has no practical limit
+ * on the number of keys and uses less memory per indexed character.
+ *
+ * Returns: A newly allocated #Fuzzy that should be freed with fuzzy_unref().
+ */
+Fuzzy *
+fuzzy_new_with_layout (gboolean    case_sensitive,
+                       FuzzyLayout layout)
+{
    Fuzzy *fuzzy;
    gint i;
 
+   g_return_val_if_fail(layout == FUZZY_LAYOUT_PACKED ||
+                        layout == FUZZY_LAYOUT_WIDE, NULL);
+
    fuzzy = g_new0(Fuzzy, 1);
    fuzzy->ref_count = 1;
    fuzzy->heap_length = FUZZY_GROW_HEAP_BY;
@@ -151,18 +663,34 @@ fuzzy_new (gboolean case_sensitive)
    fuzzy->id_to_text_offset = g_array_new(FALSE, FALSE, sizeof(gsize));
    fuzzy->char_tables = g_ptr_array_new();
    fuzzy->case_sensitive = case_sensitive;
-   g_ptr_array_set_free_func(fuzzy->char_tables,
-                             (GDestroyNotify)g_array_unref);
+   fuzzy->layout = layout;
+   g_ptr_array_set_free_func(fuzzy->char_tables, fuzzy_table_free);
 
-   for (i = 0; i < 256; i++) {
-      table = g_array_new(FALSE, FALSE, sizeof(FuzzyItem));
-      g_ptr_array_add(fuzzy->char_tables, table);
+   for (i = 0; i < FUZZY_N_CHAR_TABLES; i++) {
+      g_ptr_array_add(fuzzy->char_tables, fuzzy_table_new(layout));
    }
 
    return fuzzy;
 }
 
 
+/**
+ * fuzzy_get_layout:
+ * @fuzzy: A #Fuzzy.
+ *
+ * Gets the layout used to store the index of @fuzzy.
+ *
+ * Returns: A #FuzzyLayout.
+ */
+FuzzyLayout
+fuzzy_get_layout (Fuzzy *fuzzy)
+{
+   g_return_val_if_fail(fuzzy, FUZZY_LAYOUT_PACKED);
+
+   return fuzzy->layout;
+}
+
+
 Fuzzy *
 fuzzy_new_with_free_func (gboolean       case_sensitive,
                           GDestroyNotify free_func)
@@ -181,7 +709,9 @@ fuzzy_set_free_func (Fuzzy          *fuzzy,
                      GDestroyNotify  free_func)
 {
    g_return_if_fail(fuzzy);
+   g_return_if_fail(!fuzzy->mapped);
 
+   fuzzy->free_func = free_func;
    g_ptr_array_set_free_func(fuzzy->id_to_value, free_func);
 }
 
@@ -215,83 +745,407 @@ fuzzy_heap_insert (Fuzzy       *fuzzy,
 
 
 /**
- * fuzzy_begin_bulk_insert:
- * @fuzzy: (in): A #Fuzzy.
+ * fuzzy_get_table:
+ * @fuzzy: A #Fuzzy.
+ * @ch: The codepoint to lookup.
+ * @create: If the table should be created when missing.
  *
- * Start a bulk insertion. @fuzzy is not ready for searching until
- * fuzzy_end_bulk_insert() has been called.
+ * Fetches the table of postings for @ch.
  *
- * This allows for inserting large numbers of strings and deferring
- * the final sort until fuzzy_end_bulk_insert().
+ * Returns: (transfer none): A #FuzzyTable or %NULL if @ch has never been
+ *   inserted and @create is %FALSE.
  */
-void
-fuzzy_begin_bulk_insert (Fuzzy *fuzzy)
+static FuzzyTable *
+fuzzy_get_table (Fuzzy    *fuzzy,
+                 gunichar  ch,
+                 gboolean  create)
 {
-   g_return_if_fail(fuzzy);
-   g_return_if_fail(!fuzzy->in_bulk_insert);
+   FuzzyTable *table;
 
-   fuzzy->in_bulk_insert = TRUE;
+   g_assert(fuzzy);
+
+   if (G_LIKELY(ch < FUZZY_N_CHAR_TABLES)) {
+      return g_ptr_array_index(fuzzy->char_tables, ch);
+   }
+
+   if (!fuzzy->unichar_tables) {
+      if (!create) {
+         return NULL;
+      }
+      fuzzy->unichar_tables =
+         g_hash_table_new_full(NULL, NULL, NULL, fuzzy_table_free);
+   }
+
+   table = g_hash_table_lookup(fuzzy->unichar_tables, GUINT_TO_POINTER(ch));
+
+   if (!table && create) {
+      table = fuzzy_table_new(fuzzy->layout);
+      g_hash_table_insert(fuzzy->unichar_tables, GUINT_TO_POINTER(ch), table);
+   }
+
+   return table;
 }
 
 
 /**
- * fuzzy_end_bulk_insert:
- * @fuzzy: (in): A #Fuzzy.
+ * fuzzy_fold:
+ * @fuzzy: A #Fuzzy.
+ * @str: A UTF-8 encoded string.
  *
- * Complete a bulk insert and resort the index.
+ * Folds the case of @str if @fuzzy is case insensitive. ASCII strings
+ * take the cheaper g_ascii_strdown() path.
+ *
+ * Returns: A newly allocated string or %NULL if @str should be used as is.
  */
-void
-fuzzy_end_bulk_insert (Fuzzy *fuzzy)
+static gchar *
+fuzzy_fold (Fuzzy       *fuzzy,
+            const gchar *str)
 {
-   GArray *table;
-   gint i;
-
-   g_return_if_fail(fuzzy);
-   g_return_if_fail(fuzzy->in_bulk_insert);
-
-   fuzzy->in_bulk_insert = FALSE;
-
-   for (i = 0; i < fuzzy->char_tables->len; i++) {
-      table = g_ptr_array_index(fuzzy->char_tables, i);
-      g_array_sort(table, fuzzy_item_compare);
+   if (fuzzy->case_sensitive) {
+      return NULL;
+   } else if (g_str_is_ascii(str)) {
+      return g_ascii_strdown(str, -1);
    }
+
+   return g_utf8_casefold(str, -1);
 }
 
 
 /**
- * fuzzy_insert:
- * @fuzzy: (in): A #Fuzzy.
- * @key: (in): An ASCII string.
- * @value: (in): A value to associate with key.
+ * fuzzy_next_char:
+ * @str: (inout): A location of a UTF-8 string.
  *
- * Inserts a string into the fuzzy matcher.
+ * Reads the next codepoint from @str and advances it past the character.
  *
- * Note that @key MUST be an ascii string. UTF-8 is not supported.
+ * Returns: A #gunichar.
+ */
+static inline gunichar
+fuzzy_next_char (const gchar **str)
+{
+   gunichar ch = (guchar)**str;
+
+   if (G_LIKELY(ch < 0x80)) {
+      (*str)++;
+   } else {
+      ch = g_utf8_get_char(*str);
+      *str = g_utf8_next_char(*str);
+   }
+
+   return ch;
+}
+
+
+static inline gboolean
+fuzzy_id_is_removed (Fuzzy *fuzzy,
+                     guint  id)
+{
+   return (fuzzy_get_text_offset(fuzzy, id) == FUZZY_TOMBSTONE);
+}
+
+
+/**
+ * fuzzy_table_compact:
+ * @fuzzy: A #Fuzzy.
+ * @table: A #FuzzyTable.
+ *
+ * Drops the postings of removed ids from @table in a single pass. The
+ * remaining postings keep their relative order, so no sorting is needed.
+ */
+static void
+fuzzy_table_compact (Fuzzy      *fuzzy,
+                     FuzzyTable *table)
+{
+   FuzzyCursor cursor;
+   FuzzyTable old;
+   FuzzyItem *items;
+   guint16 *positions;
+   guint i;
+   guint j;
+
+   if (table->items) {
+      items = (FuzzyItem *)(gpointer)table->items->data;
+
+      for (i = 0, j = 0; i < table->items->len; i++) {
+         if (!fuzzy_id_is_removed(fuzzy, items[i].id)) {
+            items[j++] = items[i];
+         }
+      }
+
+      g_array_set_size(table->items, j);
+      return;
+   }
+
+   /*
+    * Deltas can grow when postings in between are dropped, so the id
+    * column is encoded into a new array. Positions shrink in place.
+    */
+   old = *table;
+   positions = (guint16 *)(gpointer)table->positions->data;
+
+   fuzzy_cursor_init(&cursor, FUZZY_LAYOUT_WIDE, &old);
+   table->ids = g_byte_array_sized_new(old.ids->len);
+   table->last_id = 0;
+   g_array_set_size(table->skips, 0);
+
+   for (j = 0; fuzzy_cursor_is_valid(&cursor); fuzzy_cursor_next(&cursor)) {
+      if (!fuzzy_id_is_removed(fuzzy, cursor.id)) {
+         fuzzy_table_append_id(table, j, cursor.id);
+         positions[j++] = cursor.pos;
+      }
+   }
+
+   g_array_set_size(table->positions, j);
+   g_byte_array_unref(old.ids);
+}
+
+
+/**
+ * fuzzy_compact:
+ * @fuzzy: A #Fuzzy.
+ *
+ * Removes the postings and text of removed ids from the index. Ids of
+ * the remaining keys do not change.
+ */
+static void
+fuzzy_compact (Fuzzy *fuzzy)
+{
+   GHashTableIter iter;
+   FuzzyTable *table;
+   gchar *old_heap;
+   gsize *offsets;
+   guint i;
+
+   g_assert(fuzzy);
+
+   for (i = 0; i < fuzzy->char_tables->len; i++) {
+      fuzzy_table_compact(fuzzy, g_ptr_array_index(fuzzy->char_tables, i));
+   }
+
+   if (fuzzy->unichar_tables) {
+      g_hash_table_iter_init(&iter, fuzzy->unichar_tables);
+      while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&table)) {
+         fuzzy_table_compact(fuzzy, table);
+      }
+   }
+
+   old_heap = fuzzy->heap;
+   offsets = (gsize *)(gpointer)fuzzy->id_to_text_offset->data;
+
+   fuzzy->heap = g_malloc(fuzzy->heap_length);
+   fuzzy->heap_offset = 0;
+
+   for (i = 0; i < fuzzy->id_to_text_offset->len; i++) {
+      if (offsets[i] != FUZZY_TOMBSTONE) {
+         offsets[i] = fuzzy_heap_insert(fuzzy, old_heap + offsets[i]);
+      }
+   }
+
+   g_free(old_heap);
+
+   fuzzy->n_removed = 0;
+}
+
+
+static void
+fuzzy_maybe_compact (Fuzzy *fuzzy)
+{
+   /*
+    * Compacting is linear in the size of the index, so only do it once a
+    * quarter of the keys are dead to keep removals amortized O(1).
+    */
+   if (!fuzzy->in_bulk_insert &&
+       (fuzzy->n_removed > (fuzzy_get_n_ids(fuzzy) / 4))) {
+      fuzzy_compact(fuzzy);
+   }
+}
+
+
+static void
+fuzzy_table_thaw (FuzzyTable  *table,
+                  FuzzyLayout  layout)
+{
+   FuzzyCursor cursor;
+
+   if (table->items || table->ids) {
+      return;
+   }
+
+   if (layout == FUZZY_LAYOUT_PACKED) {
+      table->items = g_array_sized_new(FALSE, FALSE, sizeof(FuzzyItem),
+                                       table->mapped_len);
+      g_array_append_vals(table->items, table->mapped_data,
+                          table->mapped_len);
+   } else {
+      fuzzy_cursor_init(&cursor, layout, table);
+      while (fuzzy_cursor_is_valid(&cursor)) {
+         table->last_id = cursor.id;
+         fuzzy_cursor_next(&cursor);
+      }
+
+      table->ids = g_byte_array_sized_new(table->mapped_data_len);
+      g_byte_array_append(table->ids, table->mapped_data,
+                          table->mapped_data_len);
+      table->positions = g_array_sized_new(FALSE, FALSE, sizeof(guint16),
+                                           table->mapped_len);
+      g_array_append_vals(table->positions, table->mapped_positions,
+                          table->mapped_len);
+      table->skips = g_array_sized_new(FALSE, FALSE, sizeof(FuzzySkip),
+                                       FUZZY_N_SKIPS(table->mapped_len));
+      g_array_append_vals(table->skips, table->mapped_skips,
+                          FUZZY_N_SKIPS(table->mapped_len));
+   }
+
+   table->mapped_data = NULL;
+   table->mapped_data_len = 0;
+   table->mapped_positions = NULL;
+   table->mapped_skips = NULL;
+   table->mapped_len = 0;
+}
+
+
+/**
+ * fuzzy_thaw:
+ * @fuzzy: A #Fuzzy.
+ *
+ * Copies the contents of a #Fuzzy loaded with fuzzy_new_from_file() out
+ * of the mapped file so that it can be modified. Values are copied as
+ * strings and freed with g_free().
+ */
+static void
+fuzzy_thaw (Fuzzy *fuzzy)
+{
+   GHashTableIter iter;
+   FuzzyTable *table;
+   const gchar *heap;
+   gsize offset;
+   guint n_ids;
+   guint i;
+
+   if (G_LIKELY(!fuzzy->mapped)) {
+      return;
+   }
+
+   n_ids = fuzzy->mapped_n_ids;
+
+   fuzzy->id_to_text_offset = g_array_sized_new(FALSE, FALSE, sizeof(gsize),
+                                                n_ids);
+   fuzzy->id_to_value = g_ptr_array_new_full(n_ids, g_free);
+   fuzzy->free_func = g_free;
+
+   for (i = 0; i < n_ids; i++) {
+      offset = fuzzy_get_text_offset(fuzzy, i);
+      g_array_append_val(fuzzy->id_to_text_offset, offset);
+      g_ptr_array_add(fuzzy->id_to_value, g_strdup(fuzzy_get_value(fuzzy, i)));
+   }
+
+   heap = fuzzy->heap;
+   fuzzy->heap_length = (((fuzzy->heap_offset / FUZZY_GROW_HEAP_BY) + 1) *
+                         FUZZY_GROW_HEAP_BY);
+   fuzzy->heap = g_malloc(fuzzy->heap_length);
+   memcpy(fuzzy->heap, heap, fuzzy->heap_offset);
+
+   for (i = 0; i < fuzzy->char_tables->len; i++) {
+      fuzzy_table_thaw(g_ptr_array_index(fuzzy->char_tables, i),
+                       fuzzy->layout);
+   }
+
+   if (fuzzy->unichar_tables) {
+      g_hash_table_iter_init(&iter, fuzzy->unichar_tables);
+      while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&table)) {
+         fuzzy_table_thaw(table, fuzzy->layout);
+      }
+   }
+
+   fuzzy->mapped_text_offsets = NULL;
+   fuzzy->mapped_value_offsets = NULL;
+   fuzzy->mapped_values = NULL;
+   fuzzy->mapped_values_length = 0;
+   fuzzy->mapped_n_ids = 0;
+
+   g_clear_pointer(&fuzzy->mapped, g_mapped_file_unref);
+}
+
+
+/**
+ * fuzzy_begin_bulk_insert:
+ * @fuzzy: (in): A #Fuzzy.
+ *
+ * Start a bulk insertion. @fuzzy is not ready for searching until
+ * fuzzy_end_bulk_insert() has been called.
+ *
+ * Inserting never requires sorting the index, but compaction after
+ * fuzzy_remove() is deferred until fuzzy_end_bulk_insert().
+ */
+void
+fuzzy_begin_bulk_insert (Fuzzy *fuzzy)
+{
+   g_return_if_fail(fuzzy);
+   g_return_if_fail(!fuzzy->in_bulk_insert);
+
+   fuzzy->in_bulk_insert = TRUE;
+}
+
+
+/**
+ * fuzzy_end_bulk_insert:
+ * @fuzzy: (in): A #Fuzzy.
+ *
+ * Complete a bulk insert, compacting the index if enough keys were
+ * removed while it was in progress.
  */
 void
+fuzzy_end_bulk_insert (Fuzzy *fuzzy)
+{
+   g_return_if_fail(fuzzy);
+   g_return_if_fail(fuzzy->in_bulk_insert);
+
+   fuzzy->in_bulk_insert = FALSE;
+
+   fuzzy_maybe_compact(fuzzy);
+}
+
+
+/**
+ * fuzzy_insert:
+ * @fuzzy: (in): A #Fuzzy.
+ * @key: (in): A UTF-8 encoded string.
+ * @value: (in): A value to associate with key.
+ *
+ * Inserts a string into the fuzzy matcher.
+ *
+ * Only the first 4096 characters of @key are indexed with the
+ * %FUZZY_LAYOUT_PACKED layout, and the first 65536 with
+ * %FUZZY_LAYOUT_WIDE.
+ *
+ * Keys are given increasing ids, so the new postings are simply appended
+ * to each char table and the index never needs to be sorted.
+ *
+ * Returns: The id of the new key, which can be passed to fuzzy_remove().
+ */
+guint
 fuzzy_insert (Fuzzy       *fuzzy,
               const gchar *key,
               gpointer     value)
 {
-   FuzzyItem item;
-   GArray *table;
-   gchar *downcase = NULL;
+   FuzzyTable *table;
+   gchar *downcase;
    gsize offset;
-   guint idx;
-   gint id;
-   gint i;
+   gunichar ch;
+   guint max_pos;
+   guint id;
+   guint i;
 
-   g_return_if_fail(fuzzy);
-   g_return_if_fail(key);
-   g_return_if_fail(fuzzy->id_to_text_offset->len < ((1 << 20) - 1));
+   g_return_val_if_fail(fuzzy, G_MAXUINT);
+   g_return_val_if_fail(key, G_MAXUINT);
+   g_return_val_if_fail(g_utf8_validate(key, -1, NULL), G_MAXUINT);
+   g_return_val_if_fail((fuzzy->layout != FUZZY_LAYOUT_PACKED) ||
+                        (fuzzy_get_n_ids(fuzzy) < FUZZY_PACKED_MAX_KEYS),
+                        G_MAXUINT);
+   g_return_val_if_fail(fuzzy_get_n_ids(fuzzy) < G_MAXUINT, G_MAXUINT);
 
-   if (!*key) {
-      return;
-   }
+   fuzzy_thaw(fuzzy);
 
-   if (!fuzzy->case_sensitive) {
-      downcase = g_ascii_strdown(key, -1);
-   }
+   downcase = fuzzy_fold(fuzzy, key);
 
    /*
     * Insert the string into our heap.
@@ -304,25 +1158,247 @@ fuzzy_insert (Fuzzy       *fuzzy,
 
    id = fuzzy->id_to_text_offset->len - 1;
 
-   if (!fuzzy->case_sensitive) {
+   if (downcase) {
       key = downcase;
    }
 
-   for (i = 0; key[i]; i++) {
-      idx = key[i];
-      table = g_ptr_array_index(fuzzy->char_tables, idx);
+   if (fuzzy->layout == FUZZY_LAYOUT_PACKED) {
+      max_pos = FUZZY_PACKED_MAX_POS;
+   } else {
+      max_pos = FUZZY_WIDE_MAX_POS;
+   }
+
+   /*
+    * Positions are counted in characters rather than bytes so that the
+    * gap between two matched characters does not depend on encoding.
+    * Characters past max_pos are not indexed rather than wrapping around.
+    */
+   for (i = 0; *key && (i <= max_pos); i++) {
+      ch = fuzzy_next_char(&key);
+      table = fuzzy_get_table(fuzzy, ch, TRUE);
 
-      item.id = id;
-      item.pos = i;
-      g_array_append_val(table, item);
+      fuzzy_table_append(table, id, i);
+   }
+
+   g_free(downcase);
+
+   return id;
+}
+
+
+/**
+ * fuzzy_remove:
+ * @fuzzy: (in): A #Fuzzy.
+ * @id: (in): An id returned from fuzzy_insert().
+ *
+ * Removes the key identified by @id from the fuzzy matcher, freeing its
+ * value with the free func of @fuzzy.
+ *
+ * The key is marked as removed right away and its postings are dropped
+ * the next time the index is compacted. Ids of other keys are not
+ * affected, and @id is never reused. With %FUZZY_LAYOUT_PACKED, removed
+ * keys still count towards %FUZZY_PACKED_MAX_KEYS.
+ */
+void
+fuzzy_remove (Fuzzy *fuzzy,
+              guint  id)
+{
+   gpointer value;
+
+   g_return_if_fail(fuzzy);
+   g_return_if_fail(id < fuzzy_get_n_ids(fuzzy));
+
+   if (fuzzy_id_is_removed(fuzzy, id)) {
+      return;
+   }
+
+   fuzzy_thaw(fuzzy);
+
+   g_array_index(fuzzy->id_to_text_offset, gsize, id) = FUZZY_TOMBSTONE;
+
+   value = g_ptr_array_index(fuzzy->id_to_value, id);
+   g_ptr_array_index(fuzzy->id_to_value, id) = NULL;
 
-      if (!fuzzy->in_bulk_insert) {
-         g_array_sort(table, fuzzy_item_compare);
+   if (value && fuzzy->free_func) {
+      fuzzy->free_func(value);
+   }
+
+   fuzzy->n_removed++;
+
+   fuzzy_maybe_compact(fuzzy);
+}
+
+
+static FuzzyTable *
+fuzzy_table_copy (const FuzzyTable *table)
+{
+   FuzzyTable *copy;
+
+   copy = g_slice_dup(FuzzyTable, table);
+
+   if (table->items) {
+      copy->items = g_array_sized_new(FALSE, FALSE, sizeof(FuzzyItem),
+                                      table->items->len);
+      g_array_append_vals(copy->items, table->items->data,
+                          table->items->len);
+   }
+
+   if (table->ids) {
+      copy->ids = g_byte_array_sized_new(table->ids->len);
+      g_byte_array_append(copy->ids, table->ids->data, table->ids->len);
+   }
+
+   if (table->positions) {
+      copy->positions = g_array_sized_new(FALSE, FALSE, sizeof(guint16),
+                                          table->positions->len);
+      g_array_append_vals(copy->positions, table->positions->data,
+                          table->positions->len);
+   }
+
+   if (table->skips) {
+      copy->skips = g_array_sized_new(FALSE, FALSE, sizeof(FuzzySkip),
+                                      table->skips->len);
+      g_array_append_vals(copy->skips, table->skips->data, table->skips->len);
+   }
+
+   return copy;
+}
+
+
+/**
+ * fuzzy_copy:
+ * @fuzzy: (in): A #Fuzzy.
+ * @value_copy_func: (in) (allow-none): A function to copy values, or %NULL.
+ *
+ * Creates a copy of @fuzzy that can be modified while @fuzzy is still
+ * being queried from another thread. Ids are preserved.
+ *
+ * If @value_copy_func is %NULL, values are shared with @fuzzy and the copy
+ * will not free them. Otherwise each value is copied and the copy uses the
+ * free func of @fuzzy. A #Fuzzy loaded with fuzzy_new_from_file() shares
+ * the mapped file with its copies.
+ *
+ * Returns: A newly allocated #Fuzzy that should be freed with fuzzy_unref().
+ */
+Fuzzy *
+fuzzy_copy (Fuzzy          *fuzzy,
+            GBoxedCopyFunc  value_copy_func)
+{
+   GHashTableIter iter;
+   FuzzyTable *table;
+   gpointer value;
+   gpointer key;
+   Fuzzy *copy;
+   guint i;
+
+   g_return_val_if_fail(fuzzy, NULL);
+   g_return_val_if_fail(!fuzzy->in_bulk_insert, NULL);
+
+   copy = g_new0(Fuzzy, 1);
+   copy->ref_count = 1;
+   copy->layout = fuzzy->layout;
+   copy->case_sensitive = fuzzy->case_sensitive;
+   copy->n_removed = fuzzy->n_removed;
+   copy->heap_offset = fuzzy->heap_offset;
+   copy->heap_length = fuzzy->heap_length;
+
+   if (fuzzy->mapped) {
+      copy->mapped = g_mapped_file_ref(fuzzy->mapped);
+      copy->mapped_text_offsets = fuzzy->mapped_text_offsets;
+      copy->mapped_value_offsets = fuzzy->mapped_value_offsets;
+      copy->mapped_values = fuzzy->mapped_values;
+      copy->mapped_values_length = fuzzy->mapped_values_length;
+      copy->mapped_n_ids = fuzzy->mapped_n_ids;
+      copy->heap = fuzzy->heap;
+   } else {
+      copy->free_func = value_copy_func ? fuzzy->free_func : NULL;
+      copy->heap = g_malloc(fuzzy->heap_length);
+      memcpy(copy->heap, fuzzy->heap, fuzzy->heap_offset);
+      copy->id_to_text_offset =
+         g_array_sized_new(FALSE, FALSE, sizeof(gsize),
+                           fuzzy->id_to_text_offset->len);
+      g_array_append_vals(copy->id_to_text_offset,
+                          fuzzy->id_to_text_offset->data,
+                          fuzzy->id_to_text_offset->len);
+      copy->id_to_value = g_ptr_array_sized_new(fuzzy->id_to_value->len);
+      g_ptr_array_set_free_func(copy->id_to_value, copy->free_func);
+      for (i = 0; i < fuzzy->id_to_value->len; i++) {
+         value = g_ptr_array_index(fuzzy->id_to_value, i);
+         if (value && value_copy_func) {
+            value = value_copy_func(value);
+         }
+         g_ptr_array_add(copy->id_to_value, value);
       }
    }
 
-   if (!fuzzy->case_sensitive) {
-      g_free(downcase);
+   copy->char_tables = g_ptr_array_new_full(fuzzy->char_tables->len,
+                                            fuzzy_table_free);
+   for (i = 0; i < fuzzy->char_tables->len; i++) {
+      g_ptr_array_add(copy->char_tables,
+                      fuzzy_table_copy(g_ptr_array_index(fuzzy->char_tables,
+                                                         i)));
+   }
+
+   if (fuzzy->unichar_tables) {
+      copy->unichar_tables = g_hash_table_new_full(NULL, NULL, NULL,
+                                                   fuzzy_table_free);
+      g_hash_table_iter_init(&iter, fuzzy->unichar_tables);
+      while (g_hash_table_iter_next(&iter, &key, (gpointer *)&table)) {
+         g_hash_table_insert(copy->unichar_tables, key,
+                             fuzzy_table_copy(table));
+      }
+   }
+
+   return copy;
+}
+
+
+/**
+ * fuzzy_get_next_id:
+ * @fuzzy: (in): A #Fuzzy.
+ *
+ * Gets the id that the next call to fuzzy_insert() will return. This is
+ * also the number of ids in use, including those of removed keys.
+ *
+ * Returns: An id.
+ */
+guint
+fuzzy_get_next_id (Fuzzy *fuzzy)
+{
+   g_return_val_if_fail(fuzzy, 0);
+
+   return fuzzy_get_n_ids(fuzzy);
+}
+
+
+/**
+ * fuzzy_foreach:
+ * @fuzzy: (in): A #Fuzzy.
+ * @func: (in) (scope call): A function to call for each key.
+ * @user_data: (in): User data for @func.
+ *
+ * Calls @func for each key of @fuzzy that has not been removed, in order
+ * of increasing id.
+ */
+void
+fuzzy_foreach (Fuzzy            *fuzzy,
+               FuzzyForeachFunc  func,
+               gpointer          user_data)
+{
+   gsize offset;
+   guint n_ids;
+   guint i;
+
+   g_return_if_fail(fuzzy);
+   g_return_if_fail(func);
+
+   n_ids = fuzzy_get_n_ids(fuzzy);
+
+   for (i = 0; i < n_ids; i++) {
+      offset = fuzzy_get_text_offset(fuzzy, i);
+      if (offset != FUZZY_TOMBSTONE) {
+         func(i, fuzzy->heap + offset, fuzzy_get_value(fuzzy, i), user_data);
+      }
    }
 }
 
@@ -341,20 +1417,22 @@ fuzzy_unref (Fuzzy *fuzzy)
    g_return_if_fail (fuzzy->ref_count > 0);
 
    if (g_atomic_int_dec_and_test (&fuzzy->ref_count)) {
-      g_free(fuzzy->heap);
+      if (!fuzzy->mapped) {
+         g_free(fuzzy->heap);
+      }
       fuzzy->heap = 0;
       fuzzy->heap_offset = 0;
       fuzzy->heap_length = 0;
 
-      g_array_unref(fuzzy->id_to_text_offset);
-      fuzzy->id_to_text_offset = NULL;
-
-      g_ptr_array_unref(fuzzy->id_to_value);
-      fuzzy->id_to_value = NULL;
+      g_clear_pointer(&fuzzy->id_to_text_offset, g_array_unref);
+      g_clear_pointer(&fuzzy->id_to_value, g_ptr_array_unref);
 
       g_ptr_array_unref(fuzzy->char_tables);
       fuzzy->char_tables = NULL;
 
+      g_clear_pointer(&fuzzy->unichar_tables, g_hash_table_unref);
+      g_clear_pointer(&fuzzy->mapped, g_mapped_file_unref);
+
       g_free(fuzzy);
    }
 }
@@ -370,47 +1448,41 @@ fuzzy_free (Fuzzy *fuzzy)
 
 static gboolean
 fuzzy_do_match (FuzzyLookup *lookup,
-                FuzzyItem   *item,
+                guint        id,
+                guint        pos,
                 gint         table_index,
-                gint         score)
+                gint         score,
+                gint        *best_score)
 {
-   FuzzyItem *iter;
-   gpointer key;
-   GArray *table;
-   gint *state;
+   FuzzyCursor *cursor;
    gint iter_score;
 
    g_assert(lookup);
-   g_assert(item);
    g_assert(table_index);
+   g_assert(best_score);
 
-   table = lookup->tables[table_index];
-   state = &lookup->state[table_index];
+   cursor = &lookup->cursors[table_index];
 
-   for (; state[0] < table->len; state[0]++) {
-      iter = &g_array_index(table, FuzzyItem, state[0]);
-
-      if ((iter->id < item->id) ||
-          ((iter->id == item->id) && (iter->pos <= item->pos))) {
+   for (; fuzzy_cursor_is_valid(cursor); fuzzy_cursor_next(cursor)) {
+      if ((cursor->id < id) ||
+          ((cursor->id == id) && (cursor->pos <= pos))) {
          continue;
-      } else if (iter->id > item->id) {
+      } else if (cursor->id > id) {
          break;
       }
 
-      iter_score = score + (iter->pos - item->pos);
+      iter_score = score + (cursor->pos - pos);
 
       if ((table_index + 1) < lookup->n_tables) {
-         if (fuzzy_do_match(lookup, iter, table_index + 1, iter_score)) {
+         if (fuzzy_do_match(lookup, cursor->id, cursor->pos, table_index + 1,
+                            iter_score, best_score)) {
             return TRUE;
          }
          continue;
       }
 
-      key = GINT_TO_POINTER(iter->id);
-
-      if (!g_hash_table_contains(lookup->matches, key) ||
-          (iter_score < GPOINTER_TO_INT(g_hash_table_lookup(lookup->matches, key)))) {
-         g_hash_table_insert(lookup->matches, key, GINT_TO_POINTER(iter_score));
+      if (iter_score < *best_score) {
+         *best_score = iter_score;
       }
 
       return TRUE;
@@ -429,23 +1501,139 @@ fuzzy_get_string (Fuzzy *fuzzy,
    g_assert(fuzzy);
    g_assert(id >= 0);
 
-   offset = g_array_index(fuzzy->id_to_text_offset, gsize, id);
+   offset = fuzzy_get_text_offset(fuzzy, id);
    return fuzzy->heap + offset;
 }
 
 
+static inline gfloat
+fuzzy_score (gsize key_len,
+             gint  gap)
+{
+   return 1.0 / (key_len + gap);
+}
+
+
+/*
+ * The matches array of a bounded lookup is kept as a binary heap with the
+ * worst match (as ordered by fuzzy_match_compare()) at the root, so that
+ * it can be replaced cheaply once a better candidate shows up.
+ */
+static void
+fuzzy_lookup_sift_down (GArray *heap,
+                        guint   idx)
+{
+   FuzzyMatch *base = (FuzzyMatch *)(gpointer)heap->data;
+   FuzzyMatch tmp;
+   guint child;
+
+   while ((child = (idx * 2) + 1) < heap->len) {
+      if (((child + 1) < heap->len) &&
+          (fuzzy_match_compare(&base[child + 1], &base[child]) > 0)) {
+         child++;
+      }
+
+      if (fuzzy_match_compare(&base[idx], &base[child]) >= 0) {
+         break;
+      }
+
+      tmp = base[idx];
+      base[idx] = base[child];
+      base[child] = tmp;
+      idx = child;
+   }
+}
+
+
+static void
+fuzzy_lookup_sift_up (GArray *heap,
+                      guint   idx)
+{
+   FuzzyMatch *base = (FuzzyMatch *)(gpointer)heap->data;
+   FuzzyMatch tmp;
+   guint parent;
+
+   while (idx > 0) {
+      parent = (idx - 1) / 2;
+
+      if (fuzzy_match_compare(&base[parent], &base[idx]) >= 0) {
+         break;
+      }
+
+      tmp = base[idx];
+      base[idx] = base[parent];
+      base[parent] = tmp;
+      idx = parent;
+   }
+}
+
+
+/**
+ * fuzzy_lookup_accepts:
+ * @lookup: A #FuzzyLookup.
+ * @key: The key of the candidate.
+ * @score: The best score the candidate could possibly reach.
+ *
+ * Checks if a candidate reaching @score could still make it into the
+ * top max_matches of @lookup. This lets us skip walking the remaining
+ * tables for keys that cannot beat the current worst match.
+ *
+ * Returns: %TRUE if the candidate is worth scoring.
+ */
+static gboolean
+fuzzy_lookup_accepts (FuzzyLookup *lookup,
+                      const gchar *key,
+                      gfloat       score)
+{
+   FuzzyMatch *worst;
+
+   if (!lookup->max_matches || (lookup->matches->len < lookup->max_matches)) {
+      return TRUE;
+   }
+
+   worst = &g_array_index(lookup->matches, FuzzyMatch, 0);
+
+   if (score != worst->score) {
+      return (score > worst->score);
+   }
+
+   return (g_strcmp0(key, worst->key) < 0);
+}
+
+
+static void
+fuzzy_lookup_push (FuzzyLookup *lookup,
+                   FuzzyMatch  *match)
+{
+   GArray *heap = lookup->matches;
+
+   if (!lookup->max_matches) {
+      g_array_append_val(heap, *match);
+   } else if (heap->len < lookup->max_matches) {
+      g_array_append_val(heap, *match);
+      fuzzy_lookup_sift_up(heap, heap->len - 1);
+   } else if (fuzzy_match_compare(match, &g_array_index(heap, FuzzyMatch, 0)) < 0) {
+      g_array_index(heap, FuzzyMatch, 0) = *match;
+      fuzzy_lookup_sift_down(heap, 0);
+   }
+}
+
+
 /**
  * fuzzy_match:
  * @fuzzy: (in): A #Fuzzy.
  * @needle: (in): The needle to fuzzy search for.
- * @max_matches: (in): The max number of matches to return.
+ * @max_matches: (in): The max number of matches to return, or 0 for all.
  *
  * Fuzzy searches within @fuzzy for strings that fuzzy match @needle.
  * Only up to @max_matches will be returned.
  *
- * @needle MUST be an ascii string.
+ * Matches are collected into a heap bounded by @max_matches, and keys
+ * that cannot score better than the current worst match are skipped
+ * before walking the rest of the needle. The cost of a query therefore
+ * depends on @max_matches rather than on the total size of the index.
  *
- * TODO: max_matches is not yet respected.
+ * @needle MUST be a UTF-8 encoded string.
  *
  * Returns: (transfer full) (element-type FuzzyMatch): A newly allocated
  *   #GArray containing #FuzzyMatch elements. This should be freed when
@@ -457,92 +1645,649 @@ GArray *
 fuzzy_match (Fuzzy       *fuzzy,
              const gchar *needle,
              gsize        max_matches)
+{
+   return fuzzy_match_range(fuzzy, needle, max_matches, 0, G_MAXUINT);
+}
+
+
+/**
+ * fuzzy_match_range:
+ * @fuzzy: (in): A #Fuzzy.
+ * @needle: (in): The needle to fuzzy search for.
+ * @max_matches: (in): The max number of matches to return, or 0 for all.
+ * @begin_id: (in): The first id to search.
+ * @end_id: (in): The id to stop searching at.
+ *
+ * Like fuzzy_match() but only searches keys with an id from @begin_id up
+ * to, but not including, @end_id.
+ *
+ * Postings are sorted by id, so each range only walks its own part of the
+ * index. This allows a large index to be split into ranges that are
+ * searched in parallel from multiple threads, as long as @fuzzy is not
+ * modified meanwhile. The best @max_matches of the combined results are
+ * the best @max_matches of each range, merged.
+ *
+ * Returns: (transfer full) (element-type FuzzyMatch): A newly allocated
+ *   #GArray containing #FuzzyMatch elements.
+ */
+GArray *
+fuzzy_match_range (Fuzzy       *fuzzy,
+                   const gchar *needle,
+                   gsize        max_matches,
+                   guint        begin_id,
+                   guint        end_id)
 {
    FuzzyLookup lookup = { 0 };
+   FuzzyCursor root;
+   FuzzyTable *table;
    FuzzyMatch match;
-   FuzzyItem *item;
    GArray *matches = NULL;
-   GArray *root;
-   gchar *downcase = NULL;
+   const gchar *iter;
+   gchar *downcase;
+   gsize key_len;
+   guint id;
+   gint best_score;
+   gint min_gap;
    gint i;
 
    g_return_val_if_fail(fuzzy, NULL);
    g_return_val_if_fail(!fuzzy->in_bulk_insert, NULL);
    g_return_val_if_fail(needle, NULL);
+   g_return_val_if_fail(g_utf8_validate(needle, -1, NULL), NULL);
 
-   matches = g_array_new(FALSE, FALSE, sizeof(FuzzyMatch));
+   matches = g_array_sized_new(FALSE, FALSE, sizeof(FuzzyMatch),
+                               MIN(max_matches, FUZZY_GROW_HEAP_BY));
 
    if (!*needle) {
       return matches;
    }
 
-   if (!fuzzy->case_sensitive) {
-      downcase = g_ascii_strdown(needle, -1);
+   if ((downcase = fuzzy_fold(fuzzy, needle))) {
       needle = downcase;
    }
 
    lookup.fuzzy = fuzzy;
-   lookup.n_tables = strlen(needle);
-   lookup.state = g_new0(gint, lookup.n_tables);
-   lookup.tables = g_new0(GArray*, lookup.n_tables);
+   lookup.n_tables = g_utf8_strlen(needle, -1);
+   lookup.cursors = g_new0(FuzzyCursor, lookup.n_tables);
    lookup.needle = needle;
    lookup.max_matches = max_matches;
-   lookup.matches = g_hash_table_new(NULL, NULL);
+   lookup.matches = matches;
+
+   for (i = 0, iter = needle; *iter; i++) {
+      table = fuzzy_get_table(fuzzy, fuzzy_next_char(&iter), FALSE);
+
+      /*
+       * Nothing can match a character that was never inserted.
+       */
+      if (!table) {
+         goto cleanup;
+      }
 
-   for (i = 0; needle[i]; i++) {
-      lookup.tables[i] = g_ptr_array_index(fuzzy->char_tables,
-                                           (guint)needle[i]);
+      fuzzy_cursor_init(&lookup.cursors[i], fuzzy->layout, table);
+      fuzzy_cursor_seek(&lookup.cursors[i], begin_id);
    }
 
-   root = g_ptr_array_index(fuzzy->char_tables, (guint)needle[0]);
+   /*
+    * Every following character is at least one position after the
+    * previous one, so no key can do better than this gap.
+    */
+   min_gap = lookup.n_tables - 1;
+
+   root = lookup.cursors[0];
 
-   if (G_LIKELY(lookup.n_tables > 1)) {
-      for (i = 0; i < root->len; i++) {
-         item = &g_array_index(root, FuzzyItem, i);
-         fuzzy_do_match(&lookup, item, 1, 0);
+   /*
+    * The root table is sorted by id, so all of the candidate positions
+    * for a key are adjacent. We track the best score of the current key
+    * as we go and flush it to the heap once we move on to the next id.
+    */
+   while (fuzzy_cursor_is_valid(&root) && (root.id < end_id)) {
+      id = root.id;
+      best_score = G_MAXINT;
+
+      if (fuzzy_id_is_removed(fuzzy, id)) {
+         fuzzy_cursor_skip_id(&root, id);
+         continue;
       }
+
+      match.key = fuzzy_get_string(fuzzy, id);
+      key_len = strlen(match.key);
+
+      if (!fuzzy_lookup_accepts(&lookup, match.key,
+                                fuzzy_score(key_len, min_gap))) {
+         fuzzy_cursor_skip_id(&root, id);
+         continue;
+      }
+
+      for (; fuzzy_cursor_is_valid(&root); fuzzy_cursor_next(&root)) {
+         if (root.id != id) {
+            break;
+         } else if (best_score == min_gap) {
+            continue;
+         } else if (lookup.n_tables == 1) {
+            best_score = 0;
+         } else {
+            fuzzy_do_match(&lookup, root.id, root.pos, 1, 0, &best_score);
+         }
+      }
+
+      if (best_score != G_MAXINT) {
+         match.score = fuzzy_score(key_len, best_score);
+         match.value = fuzzy_get_value(fuzzy, id);
+         fuzzy_lookup_push(&lookup, &match);
+      }
+   }
+
+   g_array_sort(matches, fuzzy_match_compare);
+
+cleanup:
+   g_free(downcase);
+   g_free(lookup.cursors);
+
+   return matches;
+}
+
+
+static gsize
+fuzzy_file_append (GByteArray    *buffer,
+                   gconstpointer  data,
+                   gsize          len)
+{
+   static const guint8 zeroes[8] = { 0 };
+   gsize offset;
+
+   if (buffer->len % 8) {
+      g_byte_array_append(buffer, zeroes, 8 - (buffer->len % 8));
+   }
+
+   offset = buffer->len;
+
+   if (len) {
+      g_byte_array_append(buffer, data, len);
+   }
+
+   return offset;
+}
+
+
+static void
+fuzzy_file_append_table (Fuzzy      *fuzzy,
+                         GByteArray *buffer,
+                         GArray     *entries,
+                         gunichar    ch,
+                         FuzzyTable *table)
+{
+   FuzzyFileTable entry = { 0 };
+
+   entry.ch = ch;
+
+   if (table->items) {
+      entry.len = table->items->len;
+      entry.data_length = table->items->len * sizeof(FuzzyItem);
+      entry.data_offset = fuzzy_file_append(buffer, table->items->data,
+                                            entry.data_length);
    } else {
-      for (i = 0; i < root->len; i++) {
-         item = &g_array_index(root, FuzzyItem, i);
-         match.key = fuzzy_get_string(fuzzy, item->id);
-         match.value = g_ptr_array_index(fuzzy->id_to_value, item->id);
-         match.score = 0;
-         g_array_append_val(matches, match);
-      }
-      g_free(downcase);
-      return matches;
+      entry.len = table->positions->len;
+      entry.data_length = table->ids->len;
+      entry.data_offset = fuzzy_file_append(buffer, table->ids->data,
+                                            entry.data_length);
+      entry.positions_offset =
+         fuzzy_file_append(buffer, table->positions->data,
+                           table->positions->len * sizeof(guint16));
+      entry.skips_offset =
+         fuzzy_file_append(buffer, table->skips->data,
+                           table->skips->len * sizeof(FuzzySkip));
+   }
+
+   if (entry.len) {
+      g_array_append_val(entries, entry);
+   }
+}
+
+
+/**
+ * fuzzy_save:
+ * @fuzzy: (in): A #Fuzzy.
+ * @filename: (in): The file to write to.
+ * @tag: (in) (allow-none): A string identifying the contents, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Writes the index of @fuzzy to @filename in a format that can be mapped
+ * back into memory with fuzzy_new_from_file() without any parsing. The
+ * file is replaced atomically.
+ *
+ * Values are saved as strings, so this may only be used when every value
+ * of @fuzzy is either %NULL or a string.
+ *
+ * The file is native to the machine that wrote it and is meant to be
+ * used as a cache. Keys removed with fuzzy_remove() are compacted out of
+ * @fuzzy before saving.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ */
+gboolean
+fuzzy_save (Fuzzy        *fuzzy,
+            const gchar  *filename,
+            const gchar  *tag,
+            GError      **error)
+{
+   FuzzyFileHeader header = { { 0 } };
+   GHashTableIter iter;
+   FuzzyTable *table;
+   GByteArray *buffer;
+   GByteArray *values;
+   gpointer key;
+   GArray *text_offsets;
+   GArray *value_offsets;
+   GArray *entries;
+   const gchar *value;
+   guint64 offset;
+   gboolean has_values = FALSE;
+   gboolean ret;
+   guint n_ids;
+   guint i;
+
+   g_return_val_if_fail(fuzzy, FALSE);
+   g_return_val_if_fail(!fuzzy->in_bulk_insert, FALSE);
+   g_return_val_if_fail(filename, FALSE);
+
+   fuzzy_thaw(fuzzy);
+
+   if (fuzzy->n_removed) {
+      fuzzy_compact(fuzzy);
    }
 
-   {
-      GHashTableIter iter;
-      gpointer key;
-      gpointer value;
+   n_ids = fuzzy_get_n_ids(fuzzy);
+
+   text_offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint64), n_ids);
+   value_offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint64), n_ids);
+   values = g_byte_array_new();
+
+   for (i = 0; i < n_ids; i++) {
+      offset = fuzzy_get_text_offset(fuzzy, i);
+      if (offset == FUZZY_TOMBSTONE) {
+         offset = FUZZY_FILE_NO_VALUE;
+      }
+      g_array_append_val(text_offsets, offset);
 
-      g_hash_table_iter_init(&iter, lookup.matches);
-      while (g_hash_table_iter_next(&iter, &key, &value)) {
-         match.key = fuzzy_get_string(fuzzy, GPOINTER_TO_INT(key));
-         match.score = 1.0 / (strlen(match.key) + GPOINTER_TO_INT(value));
-         match.value = g_ptr_array_index(fuzzy->id_to_value,
-                                         GPOINTER_TO_INT(key));
-         g_array_append_val(matches, match);
+      offset = FUZZY_FILE_NO_VALUE;
+      if ((value = fuzzy_get_value(fuzzy, i))) {
+         offset = values->len;
+         g_byte_array_append(values, (const guint8 *)value, strlen(value) + 1);
+         has_values = TRUE;
       }
+      g_array_append_val(value_offsets, offset);
+   }
 
-      g_array_sort(matches, fuzzy_match_compare);
+   buffer = g_byte_array_new();
+   g_byte_array_append(buffer, (const guint8 *)&header, sizeof header);
+
+   memcpy(header.magic, FUZZY_FILE_MAGIC, sizeof header.magic);
+   header.version = FUZZY_FILE_VERSION;
+   header.byte_order = FUZZY_FILE_BYTE_ORDER;
+   header.layout = fuzzy->layout;
+   header.case_sensitive = !!fuzzy->case_sensitive;
+   header.n_ids = n_ids;
+
+   tag = tag ? tag : "";
+   header.tag_offset = fuzzy_file_append(buffer, tag, strlen(tag) + 1);
+   header.text_offsets_offset =
+      fuzzy_file_append(buffer, text_offsets->data, n_ids * sizeof(guint64));
+   if (has_values) {
+      header.value_offsets_offset =
+         fuzzy_file_append(buffer, value_offsets->data,
+                           n_ids * sizeof(guint64));
+      header.values_length = values->len;
+      header.values_offset = fuzzy_file_append(buffer, values->data,
+                                               values->len);
+   }
+   header.heap_length = fuzzy->heap_offset;
+   header.heap_offset = fuzzy_file_append(buffer, fuzzy->heap,
+                                          fuzzy->heap_offset);
 
-      /*
-       * TODO: We could be more clever here when inserting into the array
-       *       only if it is a lower score than the end or < max items.
-       */
+   entries = g_array_new(FALSE, FALSE, sizeof(FuzzyFileTable));
 
-      if (max_matches && (matches->len > max_matches)) {
-         g_array_set_size(matches, max_matches);
+   for (i = 0; i < fuzzy->char_tables->len; i++) {
+      fuzzy_file_append_table(fuzzy, buffer, entries, i,
+                              g_ptr_array_index(fuzzy->char_tables, i));
+   }
+
+   if (fuzzy->unichar_tables) {
+      g_hash_table_iter_init(&iter, fuzzy->unichar_tables);
+      while (g_hash_table_iter_next(&iter, &key, (gpointer *)&table)) {
+         fuzzy_file_append_table(fuzzy, buffer, entries,
+                                 GPOINTER_TO_UINT(key), table);
       }
    }
 
-   g_free(downcase);
-   g_free(lookup.state);
-   g_free(lookup.tables);
-   g_hash_table_unref(lookup.matches);
+   header.n_tables = entries->len;
+   header.tables_offset = fuzzy_file_append(buffer, entries->data,
+                                            entries->len *
+                                            sizeof(FuzzyFileTable));
 
-   return matches;
+   memcpy(buffer->data, &header, sizeof header);
+
+   ret = g_file_set_contents(filename, (const gchar *)buffer->data,
+                             buffer->len, error);
+
+   g_array_unref(entries);
+   g_array_unref(text_offsets);
+   g_array_unref(value_offsets);
+   g_byte_array_unref(values);
+   g_byte_array_unref(buffer);
+
+   return ret;
+}
+
+
+/**
+ * fuzzy_retag_file:
+ * @filename: (in): A file written by fuzzy_save().
+ * @old_tag: (in) (allow-none): The tag the file is expected to have.
+ * @new_tag: (in) (allow-none): The tag to replace it with.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Replaces the tag of a file written by fuzzy_save() in place, without
+ * rewriting the index. This is useful when the contents identified by the
+ * tag changed in a way that does not affect the index.
+ *
+ * This fails with %FUZZY_ERROR_TAG_MISMATCH if the file is not tagged with
+ * @old_tag, or if @new_tag is longer than the space of the current tag.
+ * Tags of the same length always fit.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ */
+gboolean
+fuzzy_retag_file (const gchar  *filename,
+                  const gchar  *old_tag,
+                  const gchar  *new_tag,
+                  GError      **error)
+{
+   FuzzyFileHeader header;
+   gboolean ret = FALSE;
+   gchar *current = NULL;
+   gsize tag_space = 0;
+   gsize tag_len;
+   gint fd;
+
+   g_return_val_if_fail(filename, FALSE);
+
+   old_tag = old_tag ? old_tag : "";
+   new_tag = new_tag ? new_tag : "";
+   tag_len = strlen(new_tag) + 1;
+
+   if ((fd = g_open(filename, O_RDWR, 0)) == -1) {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                  "Failed to open \"%s\": %s", filename, g_strerror(errno));
+      return FALSE;
+   }
+
+   /*
+    * The tag is the first section after the header and the text offsets
+    * follow it, so everything in between is available for the tag.
+    */
+   if ((pread(fd, &header, sizeof header, 0) == sizeof header) &&
+       (memcmp(header.magic, FUZZY_FILE_MAGIC, sizeof header.magic) == 0) &&
+       (header.version == FUZZY_FILE_VERSION) &&
+       (header.byte_order == FUZZY_FILE_BYTE_ORDER) &&
+       (header.tag_offset >= sizeof header) &&
+       (header.text_offsets_offset > header.tag_offset) &&
+       ((header.text_offsets_offset - header.tag_offset) <= G_MAXUINT16)) {
+      tag_space = header.text_offsets_offset - header.tag_offset;
+      current = g_malloc(tag_space);
+      if (pread(fd, current, tag_space, header.tag_offset) != (gssize)tag_space) {
+         g_clear_pointer(&current, g_free);
+      }
+   }
+
+   if (!current || !memchr(current, '\0', tag_space)) {
+      g_set_error(error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE,
+                  "\"%s\" is not a valid fuzzy index.", filename);
+   } else if ((strcmp(current, old_tag) != 0) || (tag_len > tag_space)) {
+      g_set_error(error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH,
+                  "The tag of \"%s\" cannot be replaced.", filename);
+   } else if (pwrite(fd, new_tag, tag_len, header.tag_offset) != (gssize)tag_len) {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                  "Failed to write \"%s\": %s", filename, g_strerror(errno));
+   } else {
+      ret = TRUE;
+   }
+
+   g_free(current);
+   close(fd);
+
+   return ret;
+}
+
+
+static gboolean
+fuzzy_file_check_section (gsize   file_length,
+                          guint64 offset,
+                          guint64 length)
+{
+   return (!(offset % 8) &&
+           (offset <= file_length) &&
+           (length <= (file_length - offset)));
+}
+
+
+/*
+ * Decodes the LEB128 ids of a %FUZZY_LAYOUT_WIDE table and checks that
+ * exactly @entry->len of them fill the section, each at most 5 bytes, and
+ * that every skip entry points at the start of its posting with the id
+ * preceding it. The cursor relies on this to never read past a table.
+ */
+static gboolean
+fuzzy_file_check_ids (const gchar          *data,
+                      gsize                 file_length,
+                      const FuzzyFileTable *entry)
+{
+   const FuzzySkip *skips;
+   const guint8 *ids;
+   guint64 offset = 0;
+   guint64 delta;
+   guint64 id = 0;
+   guint n_skips;
+   guint shift;
+   guint8 byte;
+   guint i;
+
+   n_skips = FUZZY_N_SKIPS(entry->len);
+
+   if (!fuzzy_file_check_section(file_length, entry->skips_offset,
+                                 n_skips * sizeof(FuzzySkip))) {
+      return FALSE;
+   }
+
+   skips = (const FuzzySkip *)(gconstpointer)(data + entry->skips_offset);
+   ids = (const guint8 *)data + entry->data_offset;
+
+   for (i = 0; i < entry->len; i++) {
+      if (!(i % FUZZY_SKIP_INTERVAL)) {
+         const FuzzySkip *skip = &skips[i / FUZZY_SKIP_INTERVAL];
+
+         if ((skip->offset != offset) || (skip->id != id)) {
+            return FALSE;
+         }
+      }
+
+      delta = 0;
+      shift = 0;
+
+      do {
+         if ((offset >= entry->data_length) || (shift > 28)) {
+            return FALSE;
+         }
+         byte = ids[offset++];
+         delta |= (guint64)(byte & 0x7F) << shift;
+         shift += 7;
+      } while (byte & 0x80);
+
+      id += delta;
+
+      if (id > G_MAXUINT32) {
+         return FALSE;
+      }
+   }
+
+   return (offset == entry->data_length);
+}
+
+
+/**
+ * fuzzy_new_from_file:
+ * @filename: (in): A file written by fuzzy_save().
+ * @tag: (in) (allow-none): The tag that was given to fuzzy_save(), or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Maps a file written by fuzzy_save() into memory and uses it in place.
+ * The tables are validated but not copied, and the pages of the file are
+ * shared with any other process mapping the same file.
+ *
+ * Values of the resulting #Fuzzy are strings owned by it. The index is
+ * copied out of the file the first time it is modified.
+ *
+ * Returns: A newly allocated #Fuzzy that should be freed with fuzzy_unref(),
+ *   or %NULL if the file could not be loaded or its tag does not match
+ *   @tag. In that case @error is set.
+ */
+Fuzzy *
+fuzzy_new_from_file (const gchar  *filename,
+                     const gchar  *tag,
+                     GError      **error)
+{
+   const FuzzyFileHeader *header;
+   const FuzzyFileTable *entries;
+   const FuzzyFileTable *entry;
+   GMappedFile *mapped;
+   FuzzyTable *table;
+   const gchar *data;
+   Fuzzy *fuzzy;
+   gsize length;
+   guint64 positions_length;
+   guint i;
+
+   g_return_val_if_fail(filename, NULL);
+
+   if (!(mapped = g_mapped_file_new(filename, FALSE, error))) {
+      return NULL;
+   }
+
+   data = g_mapped_file_get_contents(mapped);
+   length = g_mapped_file_get_length(mapped);
+   header = (const FuzzyFileHeader *)(gconstpointer)data;
+
+   if ((length < sizeof *header) ||
+       (memcmp(header->magic, FUZZY_FILE_MAGIC, sizeof header->magic) != 0) ||
+       (header->version != FUZZY_FILE_VERSION) ||
+       (header->byte_order != FUZZY_FILE_BYTE_ORDER) ||
+       ((header->layout != FUZZY_LAYOUT_PACKED) &&
+        (header->layout != FUZZY_LAYOUT_WIDE)) ||
+       !fuzzy_file_check_section(length, header->tag_offset, 1) ||
+       !memchr(data + header->tag_offset, '\0',
+               length - header->tag_offset) ||
+       !fuzzy_file_check_section(length, header->text_offsets_offset,
+                                 header->n_ids * sizeof(guint64)) ||
+       (header->values_length &&
+        !fuzzy_file_check_section(length, header->value_offsets_offset,
+                                  header->n_ids * sizeof(guint64))) ||
+       !fuzzy_file_check_section(length, header->values_offset,
+                                 header->values_length) ||
+       (header->values_length &&
+        data[header->values_offset + header->values_length - 1]) ||
+       !fuzzy_file_check_section(length, header->heap_offset,
+                                 header->heap_length) ||
+       (header->heap_length &&
+        data[header->heap_offset + header->heap_length - 1]) ||
+       !fuzzy_file_check_section(length, header->tables_offset,
+                                 header->n_tables * sizeof(FuzzyFileTable))) {
+      g_set_error(error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE,
+                  "\"%s\" is not a valid fuzzy index.", filename);
+      g_mapped_file_unref(mapped);
+      return NULL;
+   }
+
+   if (g_strcmp0(tag ? tag : "", data + header->tag_offset) != 0) {
+      g_set_error(error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH,
+                  "\"%s\" does not match the requested tag.", filename);
+      g_mapped_file_unref(mapped);
+      return NULL;
+   }
+
+   fuzzy = g_new0(Fuzzy, 1);
+   fuzzy->ref_count = 1;
+   fuzzy->layout = header->layout;
+   fuzzy->case_sensitive = header->case_sensitive;
+   fuzzy->mapped = mapped;
+   fuzzy->mapped_n_ids = header->n_ids;
+   fuzzy->mapped_text_offsets =
+      (const guint64 *)(gconstpointer)(data + header->text_offsets_offset);
+   fuzzy->heap = (gchar *)data + header->heap_offset;
+   fuzzy->heap_offset = header->heap_length;
+   fuzzy->heap_length = header->heap_length;
+
+   if (header->values_length) {
+      fuzzy->mapped_value_offsets =
+         (const guint64 *)(gconstpointer)(data + header->value_offsets_offset);
+      fuzzy->mapped_values = data + header->values_offset;
+      fuzzy->mapped_values_length = header->values_length;
+   }
+
+   fuzzy->char_tables = g_ptr_array_new_with_free_func(fuzzy_table_free);
+
+   for (i = 0; i < FUZZY_N_CHAR_TABLES; i++) {
+      g_ptr_array_add(fuzzy->char_tables, g_slice_new0(FuzzyTable));
+   }
+
+   entries = (const FuzzyFileTable *)(gconstpointer)(data +
+                                                     header->tables_offset);
+
+   for (i = 0; i < header->n_tables; i++) {
+      entry = &entries[i];
+
+      if (header->layout == FUZZY_LAYOUT_PACKED) {
+         positions_length = 0;
+      } else {
+         positions_length = entry->len * sizeof(guint16);
+      }
+
+      /* Make sure the cursor cannot walk off the end of a table. */
+      if (!fuzzy_file_check_section(length, entry->data_offset,
+                                    entry->data_length) ||
+          ((header->layout == FUZZY_LAYOUT_PACKED) &&
+           (entry->data_length != entry->len * sizeof(FuzzyItem))) ||
+          ((header->layout == FUZZY_LAYOUT_WIDE) &&
+           (!fuzzy_file_check_section(length, entry->positions_offset,
+                                      positions_length) ||
+            !fuzzy_file_check_ids(data, length, entry)))) {
+         g_set_error(error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE,
+                     "\"%s\" contains an invalid table.", filename);
+         fuzzy_unref(fuzzy);
+         return NULL;
+      }
+
+      if (entry->ch < FUZZY_N_CHAR_TABLES) {
+         table = g_ptr_array_index(fuzzy->char_tables, entry->ch);
+      } else {
+         if (!fuzzy->unichar_tables) {
+            fuzzy->unichar_tables =
+               g_hash_table_new_full(NULL, NULL, NULL, fuzzy_table_free);
+         }
+         table = g_slice_new0(FuzzyTable);
+         g_hash_table_insert(fuzzy->unichar_tables,
+                             GUINT_TO_POINTER(entry->ch), table);
+      }
+
+      table->mapped_data = (const guint8 *)data + entry->data_offset;
+      table->mapped_data_len = entry->data_length;
+      table->mapped_len = entry->len;
+
+      if (header->layout == FUZZY_LAYOUT_WIDE) {
+         table->mapped_positions =
+            (const guint16 *)(gconstpointer)(data + entry->positions_offset);
+         table->mapped_skips =
+            (const FuzzySkip *)(gconstpointer)(data + entry->skips_offset);
+      }
+   }
+
+   return fuzzy;
 }
@@ -26,6 +26,42 @@ G_BEGIN_DECLS
 typedef struct _Fuzzy      Fuzzy;
 typedef struct _FuzzyMatch FuzzyMatch;
 
+
+typedef void (*FuzzyForeachFunc) (guint        id,
+                                  const gchar *key,
+                                  gpointer     value,
+                                  gpointer     user_data);
+
+
+/**
+ * FuzzyLayout:
+ * @FUZZY_LAYOUT_PACKED: Each indexed character costs a 4 byte posting.
+ *   Limited to %FUZZY_PACKED_MAX_KEYS keys and 4096 characters per key.
+ * @FUZZY_LAYOUT_WIDE: Postings are stored as delta encoded id and 16-bit
+ *   position columns. Scales to tens of millions of keys.
+ *
+ * The storage layout of the index of a #Fuzzy.
+ */
+typedef enum
+{
+   FUZZY_LAYOUT_PACKED,
+   FUZZY_LAYOUT_WIDE,
+} FuzzyLayout;
+
+
+#define FUZZY_PACKED_MAX_KEYS ((1 << 20) - 1)
+
+
+#define FUZZY_ERROR (fuzzy_error_quark())
+
+
+typedef enum
+{
+   FUZZY_ERROR_INVALID_FILE,
+   FUZZY_ERROR_TAG_MISMATCH,
+} FuzzyError;
+
+
 struct _FuzzyMatch
 {
    const gchar *key;
@@ -33,22 +69,50 @@ struct _FuzzyMatch
    gfloat       score;
 };
 
-Fuzzy     *fuzzy_new                (gboolean        case_sensitive);
-Fuzzy     *fuzzy_new_with_free_func (gboolean        case_sensitive,
-                                     GDestroyNotify  free_func);
-void       fuzzy_set_free_func      (Fuzzy          *fuzzy,
-                                     GDestroyNotify  free_func);
-void       fuzzy_begin_bulk_insert  (Fuzzy          *fuzzy);
-void       fuzzy_end_bulk_insert    (Fuzzy          *fuzzy);
-void       fuzzy_insert             (Fuzzy          *fuzzy,
-                                     const gchar    *key,
-                                     gpointer        value);
-GArray    *fuzzy_match              (Fuzzy          *fuzzy,
-                                     const gchar    *needle,
-                                     gsize           max_matches);
-Fuzzy     *fuzzy_ref                (Fuzzy          *fuzzy);
-void       fuzzy_free               (Fuzzy          *fuzzy);
-void       fuzzy_unref              (Fuzzy          *fuzzy);
+Fuzzy       *fuzzy_new                (gboolean        case_sensitive);
+Fuzzy       *fuzzy_new_with_free_func (gboolean        case_sensitive,
+                                       GDestroyNotify  free_func);
+Fuzzy       *fuzzy_new_with_layout    (gboolean        case_sensitive,
+                                       FuzzyLayout     layout);
+Fuzzy       *fuzzy_new_from_file      (const gchar    *filename,
+                                       const gchar    *tag,
+                                       GError        **error);
+gboolean     fuzzy_save               (Fuzzy          *fuzzy,
+                                       const gchar    *filename,
+                                       const gchar    *tag,
+                                       GError        **error);
+gboolean     fuzzy_retag_file         (const gchar    *filename,
+                                       const gchar    *old_tag,
+                                       const gchar    *new_tag,
+                                       GError        **error);
+GQuark       fuzzy_error_quark        (void);
+Fuzzy       *fuzzy_copy               (Fuzzy          *fuzzy,
+                                       GBoxedCopyFunc  value_copy_func);
+FuzzyLayout  fuzzy_get_layout         (Fuzzy          *fuzzy);
+void         fuzzy_set_free_func      (Fuzzy          *fuzzy,
+                                       GDestroyNotify  free_func);
+void         fuzzy_begin_bulk_insert  (Fuzzy          *fuzzy);
+void         fuzzy_end_bulk_insert    (Fuzzy          *fuzzy);
+guint        fuzzy_insert             (Fuzzy          *fuzzy,
+                                       const gchar    *key,
+                                       gpointer        value);
+void         fuzzy_remove             (Fuzzy          *fuzzy,
+                                       guint           id);
+guint        fuzzy_get_next_id        (Fuzzy          *fuzzy);
+void         fuzzy_foreach            (Fuzzy          *fuzzy,
+                                       FuzzyForeachFunc func,
+                                       gpointer        user_data);
+GArray      *fuzzy_match              (Fuzzy          *fuzzy,
+                                       const gchar    *needle,
+                                       gsize           max_matches);
+GArray      *fuzzy_match_range        (Fuzzy          *fuzzy,
+                                       const gchar    *needle,
+                                       gsize           max_matches,
+                                       guint           begin_id,
+                                       guint           end_id);
+Fuzzy       *fuzzy_ref                (Fuzzy          *fuzzy);
+void         fuzzy_free               (Fuzzy          *fuzzy);
+void         fuzzy_unref              (Fuzzy          *fuzzy);
 
 G_END_DECLS
 
@@ -52,16 +52,6 @@ typedef struct
   gchar          *value;
 } GcaFixit;
 
-typedef struct
-{
-  GcaSeverity  severity;
-  GArray      *fixits;
-  GArray      *locations;
-  gchar       *message;
-} GcaDiagnostic;
-
-GArray *gca_diagnostics_from_variant (GVariant *variant);
-
 G_END_DECLS
 
 #endif /* GCA_STRUCTS_H */
@@ -18,7 +18,6 @@
 
 #define G_LOG_DOMAIN "git-search"
 
-#include <ctype.h>
 #include <glib/gi18n.h>
 #include <string.h>
 
@@ -32,17 +31,45 @@
 #include "gb-string.h"
 #include "gb-workbench.h"
 
-#define GB_GIT_SEARCH_PROVIDER_MAX_MATCHES 1000
+#define GB_GIT_SEARCH_PROVIDER_MAX_MATCHES    1000
+#define GB_GIT_SEARCH_PROVIDER_MIN_SHARD_SIZE 16384
+#define UPDATE_TIMEOUT_MSEC                   500
 
 struct _GbGitSearchProviderPrivate
 {
   GgitRepository *repository;
   Fuzzy          *file_index;
+  GHashTable     *file_ids;
+  gchar          *file_index_checksum;
   GFile          *repository_dir;
+  GFileMonitor   *index_monitor;
   gchar          *repository_shorthand;
   GbWorkbench    *workbench;
+  guint           update_timeout;
+  guint           update_in_progress : 1;
+  guint           update_pending : 1;
 };
 
+/*
+ * The state handed to the worker thread when building or updating the
+ * file index. file_ids maps each path to its id within file_index and is
+ * only ever used by one thread at a time. checksum is the checksum of the
+ * git index that file_index was built from, and is replaced with the one
+ * of the result by the worker.
+ *
+ * unchanged is set when the git index changed without adding or removing
+ * a path (such as when staging a modification), in which case the result
+ * is file_index itself.
+ */
+typedef struct
+{
+  GFile      *repository_dir;
+  Fuzzy      *file_index;
+  GHashTable *file_ids;
+  gchar      *checksum;
+  guint       unchanged : 1;
+} FileIndexState;
+
 G_DEFINE_TYPE_WITH_PRIVATE (GbGitSearchProvider,
                             gb_git_search_provider,
                             GB_TYPE_SEARCH_PROVIDER)
@@ -75,12 +102,31 @@ gb_git_search_provider_set_workbench (GbGitSearchProvider *provider,
   gb_set_weak_pointer (workbench, &provider->priv->workbench);
 }
 
+static void
+file_index_state_free (gpointer data)
+{
+  FileIndexState *state = data;
+
+  if (state)
+    {
+      g_clear_object (&state->repository_dir);
+      g_clear_pointer (&state->file_index, fuzzy_unref);
+      g_clear_pointer (&state->file_ids, g_hash_table_unref);
+      g_free (state->checksum);
+      g_slice_free (FileIndexState, state);
+    }
+}
+
+static void gb_git_search_provider_update (GbGitSearchProvider *provider);
+
 static void
 load_cb (GObject      *object,
          GAsyncResult *result,
          gpointer      user_data)
 {
   GbGitSearchProvider *provider = (GbGitSearchProvider *)object;
+  GbGitSearchProviderPrivate *priv;
+  FileIndexState *state;
   GTask *task = (GTask *)result;
   Fuzzy *file_index;
   GError *error = NULL;
@@ -88,23 +134,268 @@ load_cb (GObject      *object,
   g_return_if_fail (GB_IS_GIT_SEARCH_PROVIDER (provider));
   g_return_if_fail (G_IS_TASK (task));
 
+  priv = provider->priv;
+  state = g_task_get_task_data (task);
   file_index = g_task_propagate_pointer (task, &error);
 
-  if (!file_index)
+  priv->update_in_progress = FALSE;
+
+  /*
+   * Drop the result if the repository changed while we were updating.
+   * An update for the new repository has been queued already.
+   */
+  if (!priv->repository_dir ||
+      !g_file_equal (priv->repository_dir, state->repository_dir))
+    {
+      g_clear_error (&error);
+      g_clear_pointer (&file_index, fuzzy_unref);
+    }
+  else if (!file_index)
     {
       g_warning ("%s", error->message);
       g_clear_error (&error);
     }
   else
     {
-      g_clear_pointer (&provider->priv->repository_shorthand, g_free);
-      provider->priv->repository_shorthand =
+      g_clear_pointer (&priv->repository_shorthand, g_free);
+      priv->repository_shorthand =
         g_strdup (g_object_get_data (G_OBJECT (task), "shorthand"));
 
-      g_clear_pointer (&provider->priv->file_index, fuzzy_unref);
-      provider->priv->file_index = fuzzy_ref (file_index);
+      /*
+       * Swap in the new snapshot. A search that is still running holds its
+       * own reference to the previous one and is not affected.
+       */
+      g_clear_pointer (&priv->file_index, fuzzy_unref);
+      priv->file_index = file_index;
+      g_free (priv->file_index_checksum);
+      priv->file_index_checksum = g_strdup (state->checksum);
       g_message ("Git file index loaded.");
     }
+
+  /*
+   * The paths of the index are handed back even on failure so that the
+   * next update can still apply a delta.
+   */
+  if (priv->repository_dir &&
+      g_file_equal (priv->repository_dir, state->repository_dir))
+    {
+      g_clear_pointer (&priv->file_ids, g_hash_table_unref);
+      priv->file_ids = state->file_ids;
+      state->file_ids = NULL;
+    }
+
+  if (priv->update_pending)
+    {
+      priv->update_pending = FALSE;
+      gb_git_search_provider_update (provider);
+    }
+}
+
+static guint
+gb_git_search_provider_insert_path (Fuzzy       *fuzzy,
+                                    const gchar *path)
+{
+  const gchar *shortname;
+
+  shortname = strrchr (path, '/');
+
+  if (shortname)
+    return fuzzy_insert (fuzzy, shortname, g_strdup (path));
+  else
+    return fuzzy_insert (fuzzy, path, g_strdup (path));
+}
+
+static void
+add_file_id_cb (guint        id,
+                const gchar *key,
+                gpointer     value,
+                gpointer     user_data)
+{
+  GHashTable *file_ids = user_data;
+
+  g_hash_table_insert (file_ids, g_strdup (value), GUINT_TO_POINTER (id));
+}
+
+/*
+ * Applies the difference between the paths of @state and the new index
+ * @entries to a copy of the previous file index. The previous index is
+ * still being searched from the main thread, so it must not be modified.
+ *
+ * If no path was added or removed, the previous index is returned as is
+ * and state->unchanged is set.
+ *
+ * Returns %NULL if so much changed (such as when switching branches) that
+ * building a new index is cheaper.
+ */
+static Fuzzy *
+gb_git_search_provider_apply_delta (FileIndexState   *state,
+                                    GgitIndexEntries *entries,
+                                    guint             count)
+{
+  GHashTableIter iter;
+  GHashTable *file_ids;
+  GPtrArray *added;
+  gpointer key;
+  gpointer value;
+  Fuzzy *fuzzy = NULL;
+  guint next_id;
+  guint n_changed;
+  guint i;
+
+  if (!state->file_ids)
+    {
+      state->file_ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, NULL);
+      fuzzy_foreach (state->file_index, add_file_id_cb, state->file_ids);
+    }
+
+  file_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  added = g_ptr_array_new_with_free_func (g_free);
+
+  /*
+   * Move every path that is still in the index over to the new table.
+   * Whatever is left in the old table has been removed.
+   */
+  for (i = 0; i < count; i++)
+    {
+      GgitIndexEntry *entry;
+      const gchar *path;
+
+      entry = ggit_index_entries_get_by_index (entries, i);
+      path = ggit_index_entry_get_path (entry);
+
+      if (g_utf8_validate (path, -1, NULL) &&
+          !g_hash_table_contains (file_ids, path))
+        {
+          if (g_hash_table_lookup_extended (state->file_ids, path,
+                                            &key, &value))
+            {
+              g_hash_table_steal (state->file_ids, key);
+              g_hash_table_insert (file_ids, key, value);
+            }
+          else
+            {
+              g_ptr_array_add (added, g_strdup (path));
+            }
+        }
+
+      ggit_index_entry_unref (entry);
+    }
+
+  n_changed = added->len + g_hash_table_size (state->file_ids);
+
+  if (n_changed == 0)
+    {
+      g_hash_table_unref (state->file_ids);
+      state->file_ids = file_ids;
+      state->unchanged = TRUE;
+      fuzzy = fuzzy_ref (state->file_index);
+      goto cleanup;
+    }
+
+  next_id = fuzzy_get_next_id (state->file_index);
+
+  /*
+   * Removed keys keep their id and text, so rebuild once half of the ids
+   * are wasted or the packed layout would run out of ids.
+   */
+  if ((n_changed > (count / 2)) ||
+      ((next_id + added->len) > (2 * count)) ||
+      ((fuzzy_get_layout (state->file_index) == FUZZY_LAYOUT_PACKED) &&
+       ((next_id + added->len) >= FUZZY_PACKED_MAX_KEYS)))
+    {
+      g_hash_table_unref (file_ids);
+      g_clear_pointer (&state->file_ids, g_hash_table_unref);
+      goto cleanup;
+    }
+
+  fuzzy = fuzzy_copy (state->file_index, (GBoxedCopyFunc)g_strdup);
+
+  g_hash_table_iter_init (&iter, state->file_ids);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    fuzzy_remove (fuzzy, GPOINTER_TO_UINT (value));
+
+  for (i = 0; i < added->len; i++)
+    {
+      gchar *path = g_ptr_array_index (added, i);
+      guint id;
+
+      id = gb_git_search_provider_insert_path (fuzzy, path);
+      g_hash_table_insert (file_ids, g_strdup (path), GUINT_TO_POINTER (id));
+    }
+
+  g_hash_table_unref (state->file_ids);
+  state->file_ids = file_ids;
+
+cleanup:
+  g_ptr_array_unref (added);
+
+  return fuzzy;
+}
+
+static gchar *
+gb_git_search_provider_get_cache_path (GFile *repository_dir)
+{
+  gchar *checksum;
+  gchar *filename;
+  gchar *path;
+  gchar *uri;
+
+  g_return_val_if_fail (G_IS_FILE (repository_dir), NULL);
+
+  uri = g_file_get_uri (repository_dir);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  filename = g_strdup_printf ("%s.fuzzy", checksum);
+  path = g_build_filename (g_get_user_cache_dir (),
+                           "gnome-builder",
+                           "git-search",
+                           filename,
+                           NULL);
+
+  g_free (filename);
+  g_free (checksum);
+  g_free (uri);
+
+  return path;
+}
+
+/*
+ * The git index file ends with a SHA-1 checksum of its contents. Use that
+ * to check whether a cached file index is still up to date, so we only
+ * read 20 bytes of the index instead of walking all of its entries.
+ */
+static gchar *
+gb_git_search_provider_get_index_checksum (GFile        *repository_dir,
+                                           GCancellable *cancellable)
+{
+  GFileInputStream *stream = NULL;
+  GString *str = NULL;
+  GFile *index_file;
+  guint8 checksum [20];
+  gsize n_read = 0;
+  guint i;
+
+  g_return_val_if_fail (G_IS_FILE (repository_dir), NULL);
+
+  index_file = g_file_get_child (repository_dir, "index");
+  stream = g_file_read (index_file, cancellable, NULL);
+
+  if (stream &&
+      g_seekable_seek (G_SEEKABLE (stream), -(goffset)sizeof checksum,
+                       G_SEEK_END, cancellable, NULL) &&
+      g_input_stream_read_all (G_INPUT_STREAM (stream), checksum,
+                               sizeof checksum, &n_read, cancellable, NULL) &&
+      (n_read == sizeof checksum))
+    {
+      str = g_string_new (NULL);
+      for (i = 0; i < sizeof checksum; i++)
+        g_string_append_printf (str, "%02x", checksum [i]);
+    }
+
+  g_clear_object (&stream);
+  g_clear_object (&index_file);
+
+  return str ? g_string_free (str, FALSE) : NULL;
 }
 
 static void
@@ -118,12 +409,15 @@ gb_git_search_provider_build_file_index (GTask        *task,
   GgitIndex *index = NULL;
   GgitRef *ref;
   GError *error = NULL;
-  GFile *repository_dir = task_data;
-  Fuzzy *fuzzy;
+  FileIndexState *state = task_data;
+  Fuzzy *fuzzy = NULL;
+  gchar *cache_path = NULL;
+  gchar *checksum = NULL;
   guint count;
   guint i;
 
-  g_return_if_fail (G_IS_FILE (repository_dir));
+  g_return_if_fail (state);
+  g_return_if_fail (G_IS_FILE (state->repository_dir));
 
   /*
    * The process below works as follows:
@@ -134,9 +428,23 @@ gb_git_search_provider_build_file_index (GTask        *task,
    *    coallesce the index build, as it's *much* faster since you don't have
    *    to do as much index reordering.
    * 4) Return the fuzzy index back to the task.
+   *
+   * If a cached index matching the checksum of the git index exists, it
+   * is mapped into memory instead and steps 2 and 3 are skipped. Otherwise
+   * the new index is written to the cache for the next time.
+   *
+   * When the git index changes after that, we are given the previous file
+   * index and only apply the paths that were added or removed to a copy
+   * of it, instead of steps 2 and 3. Most changes to the git index do not
+   * add or remove paths at all, in which case the previous file index is
+   * returned as is and the cache only needs to be retagged.
+   *
+   * Only the paths tracked by the git index are indexed. Untracked files
+   * show up once they are added with git add, which is also when the git
+   * index (the only file we monitor) changes.
    */
 
-  repository = ggit_repository_open (repository_dir, &error);
+  repository = ggit_repository_open (state->repository_dir, &error);
   if (!repository)
     {
       g_task_return_error (task, error);
@@ -157,6 +465,24 @@ gb_git_search_provider_build_file_index (GTask        *task,
       g_clear_object (&ref);
     }
 
+  cache_path = gb_git_search_provider_get_cache_path (state->repository_dir);
+  checksum = gb_git_search_provider_get_index_checksum (state->repository_dir,
+                                                        cancellable);
+
+  if (checksum)
+    {
+      fuzzy = fuzzy_new_from_file (cache_path, checksum, NULL);
+      if (fuzzy)
+        {
+          /* The paths will be read from the index on the next update. */
+          g_clear_pointer (&state->file_ids, g_hash_table_unref);
+          g_free (state->checksum);
+          state->checksum = g_strdup (checksum);
+          g_task_return_pointer (task, fuzzy, (GDestroyNotify)fuzzy_unref);
+          goto cleanup;
+        }
+    }
+
   index = ggit_repository_get_index (repository, &error);
   if (!index)
     {
@@ -165,48 +491,186 @@ gb_git_search_provider_build_file_index (GTask        *task,
     }
 
   entries = ggit_index_get_entries (index);
-
-  fuzzy = fuzzy_new_with_free_func (FALSE, g_free);
-  fuzzy_begin_bulk_insert (fuzzy);
-
   count = ggit_index_entries_size (entries);
 
-  for (i = 0; i < count; i++)
-    {
-      GgitIndexEntry *entry;
-      const gchar *path;
+  if (state->file_index)
+    fuzzy = gb_git_search_provider_apply_delta (state, entries, count);
 
-      entry = ggit_index_entries_get_by_index (entries, i);
-      path = ggit_index_entry_get_path (entry);
+  if (!fuzzy)
+    {
+      g_clear_pointer (&state->file_ids, g_hash_table_unref);
+      state->file_ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, NULL);
 
-      /* FIXME:
-       *
-       *   fuzzy does not yet support UTF-8, which is the native format
-       *   for the filesystem. It wont be as fast, but we can just take
-       *   the cost of gunichar most likely.
+      /*
+       * The packed layout is faster to query, but can only hold about a
+       * million keys. Switch to the wide layout for larger repositories.
        */
-      if (g_str_is_ascii (path))
+      if (count < FUZZY_PACKED_MAX_KEYS)
+        fuzzy = fuzzy_new (FALSE);
+      else
+        fuzzy = fuzzy_new_with_layout (FALSE, FUZZY_LAYOUT_WIDE);
+
+      fuzzy_set_free_func (fuzzy, g_free);
+      fuzzy_begin_bulk_insert (fuzzy);
+
+      for (i = 0; i < count; i++)
         {
-          const gchar *shortname = strrchr (path, '/');
+          GgitIndexEntry *entry;
+          const gchar *path;
+
+          entry = ggit_index_entries_get_by_index (entries, i);
+          path = ggit_index_entry_get_path (entry);
+
+          /*
+           * Paths are stored as raw bytes in the index. Anything that is
+           * not valid UTF-8 cannot be typed into the search entry anyway.
+           * Conflicted paths are listed once per stage.
+           */
+          if (g_utf8_validate (path, -1, NULL) &&
+              !g_hash_table_contains (state->file_ids, path))
+            {
+              guint id;
 
-          if (shortname)
-            fuzzy_insert (fuzzy, shortname, g_strdup (path));
-          else
-            fuzzy_insert (fuzzy, path, g_strdup (path));
+              id = gb_git_search_provider_insert_path (fuzzy, path);
+              g_hash_table_insert (state->file_ids, g_strdup (path),
+                                   GUINT_TO_POINTER (id));
+            }
+
+          ggit_index_entry_unref (entry);
         }
 
-      ggit_index_entry_unref (entry);
+      fuzzy_end_bulk_insert (fuzzy);
+    }
+
+  if (checksum && state->unchanged)
+    {
+      /*
+       * The file index is shared with the main thread, so it must not be
+       * saved (which compacts it). The cache already holds the same paths
+       * if it is still tagged with the previous checksum.
+       */
+      if (!fuzzy_retag_file (cache_path, state->checksum, checksum, NULL))
+        g_debug ("Git file index cache is out of date, not updating it.");
+    }
+  else if (checksum)
+    {
+      gchar *cache_dir;
+
+      cache_dir = g_path_get_dirname (cache_path);
+      g_mkdir_with_parents (cache_dir, 0750);
+      g_free (cache_dir);
+
+      if (!fuzzy_save (fuzzy, cache_path, checksum, &error))
+        {
+          g_warning ("Failed to save git file index: %s", error->message);
+          g_clear_error (&error);
+        }
     }
 
-  fuzzy_end_bulk_insert (fuzzy);
+  g_free (state->checksum);
+  state->checksum = g_strdup (checksum);
+
   g_task_return_pointer (task, fuzzy, (GDestroyNotify)fuzzy_unref);
 
 cleanup:
+  g_free (cache_path);
+  g_free (checksum);
   g_clear_pointer (&entries, ggit_index_entries_unref);
   g_clear_object (&index);
   g_clear_object (&repository);
 }
 
+static void
+gb_git_search_provider_update (GbGitSearchProvider *provider)
+{
+  GbGitSearchProviderPrivate *priv;
+  FileIndexState *state;
+  GTask *task;
+
+  g_return_if_fail (GB_IS_GIT_SEARCH_PROVIDER (provider));
+
+  priv = provider->priv;
+
+  if (!priv->repository_dir)
+    return;
+
+  /*
+   * Only one update runs at a time, since each one builds on the result
+   * of the previous one. Changes that arrive meanwhile are coalesced into
+   * a single follow-up update.
+   */
+  if (priv->update_in_progress)
+    {
+      priv->update_pending = TRUE;
+      return;
+    }
+
+  priv->update_in_progress = TRUE;
+
+  state = g_slice_new0 (FileIndexState);
+  state->repository_dir = g_object_ref (priv->repository_dir);
+  if (priv->file_index)
+    state->file_index = fuzzy_ref (priv->file_index);
+  state->file_ids = priv->file_ids;
+  state->checksum = g_strdup (priv->file_index_checksum);
+  priv->file_ids = NULL;
+
+  task = g_task_new (provider, NULL, load_cb, provider);
+  g_task_set_task_data (task, state, file_index_state_free);
+  g_task_run_in_thread (task, gb_git_search_provider_build_file_index);
+  g_clear_object (&task);
+}
+
+static gboolean
+gb_git_search_provider_update_timeout (gpointer user_data)
+{
+  GbGitSearchProvider *provider = user_data;
+
+  g_return_val_if_fail (GB_IS_GIT_SEARCH_PROVIDER (provider), G_SOURCE_REMOVE);
+
+  provider->priv->update_timeout = 0;
+  gb_git_search_provider_update (provider);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_index_changed (GbGitSearchProvider *provider,
+                  GFile               *file,
+                  GFile               *other_file,
+                  GFileMonitorEvent    event_type,
+                  GFileMonitor        *monitor)
+{
+  GbGitSearchProviderPrivate *priv;
+
+  g_return_if_fail (GB_IS_GIT_SEARCH_PROVIDER (provider));
+
+  priv = provider->priv;
+
+  /*
+   * git writes the index to index.lock and renames it over the index, and
+   * commands such as rebase do that many times in a row. Wait for things
+   * to settle before reading it.
+   */
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+      if (priv->update_timeout)
+        g_source_remove (priv->update_timeout);
+      priv->update_timeout =
+        g_timeout_add (UPDATE_TIMEOUT_MSEC,
+                       gb_git_search_provider_update_timeout,
+                       provider);
+      break;
+
+    default:
+      break;
+    }
+}
+
 static gchar **
 split_path (const gchar  *path,
             gchar       **shortname)
@@ -259,29 +723,200 @@ activate_cb (GbSearchResult *result,
   g_free (base_path);
 }
 
+/*
+ * The state of a single search. It is shared by the shards of the search
+ * and freed once the last of them completes.
+ */
+typedef struct
+{
+  GTask               *task;
+  GbGitSearchProvider *provider;
+  GbSearchContext     *context;
+  GCancellable        *cancellable;
+  Fuzzy               *file_index;
+  gchar               *search_terms;
+  gchar               *delimited;
+  GString             *str;
+  gsize                truncate_len;
+  GbSearchReducer      reducer;
+  guint64              count;
+  guint                n_active;
+} PopulateState;
+
+typedef struct
+{
+  PopulateState *state;
+  guint          begin_id;
+  guint          end_id;
+} PopulateShard;
+
+static void
+populate_state_free (PopulateState *state)
+{
+  gb_search_reducer_destroy (&state->reducer);
+  g_clear_object (&state->task);
+  g_clear_object (&state->provider);
+  g_clear_object (&state->context);
+  g_clear_object (&state->cancellable);
+  g_clear_pointer (&state->file_index, fuzzy_unref);
+  g_free (state->search_terms);
+  g_free (state->delimited);
+  g_string_free (state->str, TRUE);
+  g_slice_free (PopulateState, state);
+}
+
+static void
+populate_shard_free (gpointer data)
+{
+  g_slice_free (PopulateShard, data);
+}
+
 static void
-gb_git_search_provider_populate (GbSearchProvider *provider,
-                                 GbSearchContext  *context,
-                                 const gchar      *search_terms,
-                                 gsize             max_results,
-                                 GCancellable     *cancellable)
+gb_git_search_provider_add_match (PopulateState *state,
+                                  FuzzyMatch    *match)
+{
+  GbSearchResult *result;
+  gchar *shortname = NULL;
+  gchar *markup;
+  gchar **parts;
+  guint i;
+
+  if (!gb_search_reducer_accepts (&state->reducer, match->score))
+    return;
+
+  parts = split_path (match->value, &shortname);
+  for (i = 0; parts [i]; i++)
+    g_string_append_printf (state->str, " / %s", parts [i]);
+
+  markup = gb_str_highlight (shortname, state->search_terms);
+
+  result = gb_search_result_new (markup, state->str->str, match->score);
+  g_object_set_qdata_full (G_OBJECT (result), gQuarkPath,
+                           g_strdup (match->value), g_free);
+  g_signal_connect (result,
+                    "activate",
+                    G_CALLBACK (activate_cb),
+                    state->provider);
+  gb_search_reducer_push (&state->reducer, result);
+  g_object_unref (result);
+
+  g_free (markup);
+  g_free (shortname);
+  g_strfreev (parts);
+  g_string_truncate (state->str, state->truncate_len);
+}
+
+static void
+gb_git_search_provider_match_shard (GTask        *task,
+                                    gpointer      source_object,
+                                    gpointer      task_data,
+                                    GCancellable *cancellable)
+{
+  PopulateShard *shard = task_data;
+  GArray *matches;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  matches = fuzzy_match_range (shard->state->file_index,
+                               shard->state->delimited,
+                               GB_GIT_SEARCH_PROVIDER_MAX_MATCHES,
+                               shard->begin_id,
+                               shard->end_id);
+  g_task_return_pointer (task, matches, (GDestroyNotify)g_array_unref);
+}
+
+static void
+match_shard_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  PopulateShard *shard;
+  PopulateState *state;
+  GArray *matches;
+  guint i;
+
+  shard = g_task_get_task_data (G_TASK (result));
+  state = shard->state;
+
+  /*
+   * Each shard returns its own best matches. The reducer merges them as
+   * they arrive and the top results so far are committed to the display
+   * after every shard, so the fastest shards show up right away. Only the
+   * difference against the previous commit is emitted.
+   *
+   * A shard with more than GB_GIT_SEARCH_PROVIDER_MAX_MATCHES hits only
+   * returns that many, so the count is that of the merged matches, capped
+   * the same way, rather than the sum of what each shard found.
+   */
+  matches = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  if (matches)
+    {
+      if (!g_cancellable_is_cancelled (state->cancellable))
+        {
+          for (i = 0; i < matches->len; i++)
+            {
+              FuzzyMatch *match;
+
+              match = &g_array_index (matches, FuzzyMatch, i);
+              gb_git_search_provider_add_match (state, match);
+            }
+
+          state->count = MIN (state->count + matches->len,
+                              GB_GIT_SEARCH_PROVIDER_MAX_MATCHES);
+
+          gb_search_reducer_commit (&state->reducer);
+          gb_search_context_set_provider_count (state->context,
+                                                GB_SEARCH_PROVIDER (state->provider),
+                                                state->count);
+        }
+
+      g_array_unref (matches);
+    }
+
+  if (--state->n_active == 0)
+    {
+      if (!g_task_return_error_if_cancelled (state->task))
+        g_task_return_boolean (state->task, TRUE);
+
+      populate_state_free (state);
+    }
+}
+
+static void
+gb_git_search_provider_populate_async (GbSearchProvider    *provider,
+                                       GbSearchContext     *context,
+                                       const gchar         *search_terms,
+                                       gsize                max_results,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
 {
   GbGitSearchProvider *self = (GbGitSearchProvider *)provider;
+  GTask *task;
 
   g_return_if_fail (GB_IS_GIT_SEARCH_PROVIDER (self));
   g_return_if_fail (GB_IS_SEARCH_CONTEXT (context));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  if (self->priv->file_index)
+  task = g_task_new (self, cancellable, callback, user_data);
+
+  if (!self->priv->file_index)
     {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+    }
+  else
+    {
+      PopulateState *state;
       GString *str = g_string_new (NULL);
       GString *stripped = g_string_new (NULL);
-      GbSearchReducer reducer = { 0 };
       const gchar *ptr;
-      gchar *delimited;
-      GArray *matches;
+      guint n_ids;
+      guint n_shards;
+      guint shard_size;
       guint i;
-      guint truncate_len;
 
       for (ptr = search_terms; *ptr; ptr = g_utf8_next_char (ptr))
         {
@@ -289,14 +924,10 @@ gb_git_search_provider_populate (GbSearchProvider *provider,
 
           ch = g_utf8_get_char (ptr);
 
-          if ((isascii (ch) != 0) && !g_unichar_isspace (ch))
+          if (!g_unichar_isspace (ch))
             g_string_append_unichar (stripped, ch);
         }
 
-      delimited = g_string_free (stripped, FALSE);
-      matches = fuzzy_match (self->priv->file_index, delimited,
-                             GB_GIT_SEARCH_PROVIDER_MAX_MATCHES);
-
       if (self->priv->repository)
         {
           GFile *repo_dir = NULL;
@@ -330,54 +961,64 @@ gb_git_search_provider_populate (GbSearchProvider *provider,
                                     self->priv->repository_shorthand);
         }
 
-      truncate_len = str->len;
+      /*
+       * Take a reference to the current file index so that an update to
+       * it while we are searching does not affect this search.
+       */
+      state = g_slice_new0 (PopulateState);
+      state->task = task;
+      state->provider = g_object_ref (self);
+      state->context = g_object_ref (context);
+      state->cancellable = cancellable ? g_object_ref (cancellable)
+                                       : g_cancellable_new ();
+      state->file_index = fuzzy_ref (self->priv->file_index);
+      state->search_terms = g_strdup (search_terms);
+      state->delimited = g_string_free (stripped, FALSE);
+      state->str = str;
+      state->truncate_len = str->len;
+      gb_search_reducer_init (&state->reducer, context, provider);
+
+      /*
+       * Split the index into ranges of ids that are searched in parallel on
+       * the worker threads. Small indexes are not worth the overhead.
+       */
+      n_ids = fuzzy_get_next_id (state->file_index);
+      n_shards = CLAMP (n_ids / GB_GIT_SEARCH_PROVIDER_MIN_SHARD_SIZE,
+                        1, g_get_num_processors ());
+      shard_size = (n_ids / n_shards) + 1;
 
-      gb_search_reducer_init (&reducer, context, provider);
+      state->n_active = n_shards;
 
-      for (i = 0; i < matches->len; i++)
+      for (i = 0; i < n_shards; i++)
         {
-          FuzzyMatch *match;
-          gchar *shortname = NULL;
-          gchar **parts;
-          guint j;
-
-          match = &g_array_index (matches, FuzzyMatch, i);
-
-          if (gb_search_reducer_accepts (&reducer, match->score))
-            {
-              GbSearchResult *result;
-              gchar *markup;
-
-              parts = split_path (match->value, &shortname);
-              for (j = 0; parts [j]; j++)
-                g_string_append_printf (str, " / %s", parts [j]);
-
-              markup = gb_str_highlight (shortname, search_terms);
-
-              result = gb_search_result_new (markup, str->str, match->score);
-              g_object_set_qdata_full (G_OBJECT (result), gQuarkPath,
-                                       g_strdup (match->value), g_free);
-              g_signal_connect (result,
-                                "activate",
-                                G_CALLBACK (activate_cb),
-                                provider);
-              gb_search_reducer_push (&reducer, result);
-              g_object_unref (result);
-
-              g_free (markup);
-              g_free (shortname);
-              g_strfreev (parts);
-              g_string_truncate (str, truncate_len);
-            }
+          PopulateShard *shard;
+          GTask *shard_task;
+
+          shard = g_slice_new0 (PopulateShard);
+          shard->state = state;
+          shard->begin_id = i * shard_size;
+          shard->end_id = (i + 1 == n_shards) ? G_MAXUINT
+                                              : (i + 1) * shard_size;
+
+          shard_task = g_task_new (self, state->cancellable,
+                                   match_shard_cb, NULL);
+          g_task_set_task_data (shard_task, shard, populate_shard_free);
+          g_task_run_in_thread (shard_task,
+                                gb_git_search_provider_match_shard);
+          g_object_unref (shard_task);
         }
+    }
+}
 
-      gb_search_context_set_provider_count (context, provider, matches->len);
+static gboolean
+gb_git_search_provider_populate_finish (GbSearchProvider  *provider,
+                                        GAsyncResult      *result,
+                                        GError           **error)
+{
+  g_return_val_if_fail (GB_IS_GIT_SEARCH_PROVIDER (provider), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
 
-      gb_search_reducer_destroy (&reducer);
-      g_array_unref (matches);
-      g_free (delimited);
-      g_string_free (str, TRUE);
-    }
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 GgitRepository *
@@ -403,20 +1044,43 @@ gb_git_search_provider_set_repository (GbGitSearchProvider *provider,
       if (priv->repository)
         g_clear_object (&provider->priv->repository);
 
+      if (priv->update_timeout)
+        {
+          g_source_remove (priv->update_timeout);
+          priv->update_timeout = 0;
+        }
+
+      if (priv->index_monitor)
+        {
+          g_file_monitor_cancel (priv->index_monitor);
+          g_clear_object (&priv->index_monitor);
+        }
+
+      g_clear_pointer (&priv->file_index, fuzzy_unref);
+      g_clear_pointer (&priv->file_ids, g_hash_table_unref);
+      g_clear_pointer (&priv->file_index_checksum, g_free);
+      g_clear_object (&priv->repository_dir);
+
       if (repository)
         {
-          GTask *task;
+          GFile *index_file;
 
-          g_clear_object (&priv->repository_dir);
           priv->repository_dir = ggit_repository_get_location (repository);
-
           priv->repository = g_object_ref (repository);
-          task = g_task_new (provider, NULL, load_cb, provider);
-          g_task_set_task_data (task,
-                                g_object_ref (priv->repository_dir),
-                                g_object_unref);
-          g_task_run_in_thread (task, gb_git_search_provider_build_file_index);
-          g_clear_object (&task);
+
+          index_file = g_file_get_child (priv->repository_dir, "index");
+          priv->index_monitor = g_file_monitor_file (index_file,
+                                                     G_FILE_MONITOR_NONE,
+                                                     NULL, NULL);
+          if (priv->index_monitor)
+            g_signal_connect_object (priv->index_monitor,
+                                     "changed",
+                                     G_CALLBACK (on_index_changed),
+                                     provider,
+                                     G_CONNECT_SWAPPED);
+          g_clear_object (&index_file);
+
+          gb_git_search_provider_update (provider);
         }
     }
 }
@@ -434,10 +1098,24 @@ gb_git_search_provider_finalize (GObject *object)
 {
   GbGitSearchProviderPrivate *priv = GB_GIT_SEARCH_PROVIDER (object)->priv;
 
+  if (priv->update_timeout)
+    {
+      g_source_remove (priv->update_timeout);
+      priv->update_timeout = 0;
+    }
+
+  if (priv->index_monitor)
+    {
+      g_file_monitor_cancel (priv->index_monitor);
+      g_clear_object (&priv->index_monitor);
+    }
+
   g_clear_pointer (&priv->repository_shorthand, g_free);
   g_clear_object (&priv->repository_dir);
   g_clear_object (&priv->repository);
   g_clear_pointer (&priv->file_index, fuzzy_unref);
+  g_clear_pointer (&priv->file_ids, g_hash_table_unref);
+  g_clear_pointer (&priv->file_index_checksum, g_free);
 
   G_OBJECT_CLASS (gb_git_search_provider_parent_class)->finalize (object);
 }
@@ -498,7 +1176,8 @@ gb_git_search_provider_class_init (GbGitSearchProviderClass *klass)
   object_class->get_property = gb_git_search_provider_get_property;
   object_class->set_property = gb_git_search_provider_set_property;
 
-  provider_class->populate = gb_git_search_provider_populate;
+  provider_class->populate_async = gb_git_search_provider_populate_async;
+  provider_class->populate_finish = gb_git_search_provider_populate_finish;
   provider_class->get_verb = gb_git_search_provider_get_verb;
 
   /**
@@ -19,10 +19,13 @@ libgnome_builder_la_SOURCES = \
 	src/auto-indent/gb-source-auto-indenter-xml.h \
 	src/auto-indent/gb-source-auto-indenter.c \
 	src/auto-indent/gb-source-auto-indenter.h \
+	src/code-assistant/gb-source-code-assistant-private.h \
 	src/code-assistant/gb-source-code-assistant-renderer.c \
 	src/code-assistant/gb-source-code-assistant-renderer.h \
 	src/code-assistant/gb-source-code-assistant.c \
 	src/code-assistant/gb-source-code-assistant.h \
+	src/code-assistant/gb-source-diagnostics.c \
+	src/code-assistant/gb-source-diagnostics.h \
 	src/commands/gb-command-bar-item.c \
 	src/commands/gb-command-bar-item.h \
 	src/commands/gb-command-bar.c \
@@ -75,6 +78,8 @@ libgnome_builder_la_SOURCES = \
 	src/editor/gb-editor-frame-private.h \
 	src/editor/gb-editor-frame.c \
 	src/editor/gb-editor-frame.h \
+	src/editor/gb-editor-language-cache.c \
+	src/editor/gb-editor-language-cache.h \
 	src/editor/gb-editor-navigation-item.c \
 	src/editor/gb-editor-navigation-item.h \
 	src/editor/gb-editor-settings-widget.c \
@@ -87,6 +92,7 @@ libgnome_builder_la_SOURCES = \
 	src/editor/gb-editor-workspace.h \
 	src/editor/gb-source-change-gutter-renderer.c \
 	src/editor/gb-source-change-gutter-renderer.h \
+	src/editor/gb-source-change-monitor-private.h \
 	src/editor/gb-source-change-monitor.c \
 	src/editor/gb-source-change-monitor.h \
 	src/editor/gb-source-formatter.c \
@@ -105,7 +111,6 @@ libgnome_builder_la_SOURCES = \
 	src/gca/gca-diagnostics.h \
 	src/gca/gca-service.c \
 	src/gca/gca-service.h \
-	src/gca/gca-structs.c \
 	src/gca/gca-structs.h \
 	src/gd/gd-tagged-entry.c \
 	src/gd/gd-tagged-entry.h \
@@ -177,6 +182,8 @@ libgnome_builder_la_SOURCES = \
 	src/snippets/gb-source-snippet-parser.c \
 	src/snippets/gb-source-snippet-parser.h \
 	src/snippets/gb-source-snippet-private.h \
+	src/snippets/gb-source-snippet-variables.c \
+	src/snippets/gb-source-snippet-variables.h \
 	src/snippets/gb-source-snippet.c \
 	src/snippets/gb-source-snippet.h \
 	src/snippets/gb-source-snippets-manager.c \
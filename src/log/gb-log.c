@@ -26,13 +26,67 @@
 
 #include <glib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gb-log.h"
 
+/*
+ * Logging is split between the threads that log and a single writer
+ * thread. Each logging thread owns a ring buffer of binary records which it
+ * fills without taking any locks. The writer drains all of the rings
+ * periodically, or sooner when a ring is half full, and formats the records
+ * into one batched write per channel.
+ *
+ * When a ring is full the record is either dropped and counted, or the
+ * logging thread waits for the writer, depending on the policy. Fatal
+ * messages skip the rings and are written synchronously along with
+ * everything still pending, since the process is about to abort.
+ */
+
+#define RING_SIZE      (64 * 1024)
+#define RING_MASK      (RING_SIZE - 1)
+#define MAX_RECORD     (RING_SIZE / 4)
+#define MAX_DOMAIN     255
+#define FLUSH_INTERVAL (G_TIME_SPAN_MILLISECOND * 100)
+
+typedef struct
+{
+  guint32 length;
+  guint32 level;
+  gint32  thread;
+  guint16 domain_len;
+  guint16 message_len;
+  gint64  time;
+} LogRecord;
+
+typedef struct _LogRing LogRing;
+
+struct _LogRing
+{
+  LogRing       *next;
+  volatile guint head;
+  volatile guint tail;
+  volatile gint  orphaned;
+  gchar          data [RING_SIZE];
+};
+
+static void gb_log_ring_release (gpointer data);
+
 static GPtrArray *channels = NULL;
 static gchar hostname[64] = "";
 static GLogFunc last_handler = NULL;
+static LogRing *rings = NULL;
+static GPrivate ring_key = G_PRIVATE_INIT (gb_log_ring_release);
+static GbLogPolicy policy = GB_LOG_POLICY_DROP;
+static volatile guint dropped = 0;
+static guint dropped_reported = 0;
+static GThread *writer_thread = NULL;
+static GMutex writer_mutex;
+static GCond writer_cond;
+static volatile gint writer_wakeup = FALSE;
+static gboolean writer_stopping = FALSE;
+static GString *writer_buffer = NULL;
 
 G_LOCK_DEFINE (channels_lock);
 
@@ -86,18 +140,298 @@ gb_log_level_str (GLogLevelFlags log_level)
 /**
  * gb_log_write_to_channel:
  * @channel: A #GIOChannel.
- * @message: A string log message.
+ * @buffer: A #GString containing formatted log messages.
  *
- * Writes @message to @channel and flushes the channel.
+ * Writes @buffer to @channel and flushes the channel.
  */
 static void
-gb_log_write_to_channel (GIOChannel  *channel,
-                         const gchar *message)
+gb_log_write_to_channel (GIOChannel *channel,
+                         GString    *buffer)
 {
-  g_io_channel_write_chars (channel, message, -1, NULL, NULL);
+  g_io_channel_write_chars (channel, buffer->str, buffer->len, NULL, NULL);
   g_io_channel_flush (channel, NULL);
 }
 
+static void
+gb_log_ring_write (LogRing       *ring,
+                   guint          pos,
+                   gconstpointer  data,
+                   guint          len)
+{
+  guint offset = pos & RING_MASK;
+  guint first = MIN (len, RING_SIZE - offset);
+
+  memcpy (ring->data + offset, data, first);
+  memcpy (ring->data, (const gchar *)data + first, len - first);
+}
+
+static void
+gb_log_ring_read (LogRing  *ring,
+                  guint     pos,
+                  gpointer  data,
+                  guint     len)
+{
+  guint offset = pos & RING_MASK;
+  guint first = MIN (len, RING_SIZE - offset);
+
+  memcpy (data, ring->data + offset, first);
+  memcpy ((gchar *)data + first, ring->data, len - first);
+}
+
+static void
+gb_log_ring_release (gpointer data)
+{
+  LogRing *ring = data;
+
+  /* The writer frees the ring once it has been drained. */
+  g_atomic_int_set (&ring->orphaned, TRUE);
+}
+
+static LogRing *
+gb_log_ring_get (void)
+{
+  LogRing *ring;
+
+  ring = g_private_get (&ring_key);
+
+  if (G_UNLIKELY (!ring))
+    {
+      ring = g_new0 (LogRing, 1);
+
+      do
+        ring->next = g_atomic_pointer_get (&rings);
+      while (!g_atomic_pointer_compare_and_exchange (&rings, ring->next, ring));
+
+      g_private_set (&ring_key, ring);
+    }
+
+  return ring;
+}
+
+static void
+gb_log_wake_writer (void)
+{
+  if (g_atomic_int_compare_and_exchange (&writer_wakeup, FALSE, TRUE))
+    {
+      g_mutex_lock (&writer_mutex);
+      g_cond_signal (&writer_cond);
+      g_mutex_unlock (&writer_mutex);
+    }
+}
+
+static void
+gb_log_format (GString        *buffer,
+               gint64          time,
+               const gchar    *log_domain,
+               gint            thread,
+               GLogLevelFlags  log_level,
+               const gchar    *message,
+               gsize           message_len)
+{
+  static gint64 last_second = -1;
+  static gchar ftime[32];
+  gint64 second = time / G_USEC_PER_SEC;
+
+  /* Consecutive records usually share the same second. */
+  if (second != last_second)
+    {
+      time_t t = (time_t)second;
+      struct tm tt;
+
+      localtime_r (&t, &tt);
+      strftime (ftime, sizeof (ftime), "%Y/%m/%d %H:%M:%S", &tt);
+      last_second = second;
+    }
+
+  g_string_append_printf (buffer, "%s.%04d  %s: %20s[%d]: %8s: ",
+                          ftime, (gint)((time % G_USEC_PER_SEC) / 100),
+                          hostname, log_domain, thread,
+                          gb_log_level_str (log_level));
+  g_string_append_len (buffer, message, message_len);
+  g_string_append_c (buffer, '\n');
+}
+
+/*
+ * Formats every record in @ring into writer_buffer. Must be called with
+ * channels_lock held, which makes the caller the only consumer.
+ */
+static void
+gb_log_ring_drain (LogRing *ring)
+{
+  gchar domain [MAX_DOMAIN + 1];
+  gchar message [MAX_RECORD];
+  guint head;
+  guint tail;
+
+  head = g_atomic_int_get (&ring->head);
+  tail = ring->tail;
+
+  while (tail != head)
+    {
+      LogRecord record;
+
+      gb_log_ring_read (ring, tail, &record, sizeof record);
+      gb_log_ring_read (ring, tail + sizeof record, domain, record.domain_len);
+      gb_log_ring_read (ring, tail + sizeof record + record.domain_len,
+                        message, record.message_len);
+      domain [record.domain_len] = '\0';
+
+      gb_log_format (writer_buffer, record.time, domain, record.thread,
+                     record.level, message, record.message_len);
+
+      tail += record.length;
+    }
+
+  g_atomic_int_set (&ring->tail, tail);
+}
+
+/*
+ * Drains all rings and writes the result to the channels. Rings of threads
+ * that have exited are freed once empty. Producers only ever push at the
+ * head of the list, so rings after the head can be unlinked directly.
+ */
+static void
+gb_log_flush_locked (void)
+{
+  LogRing *prev = NULL;
+  LogRing *ring;
+  guint n_dropped;
+
+  ring = g_atomic_pointer_get (&rings);
+
+  while (ring)
+    {
+      LogRing *next = ring->next;
+
+      gb_log_ring_drain (ring);
+
+      if (g_atomic_int_get (&ring->orphaned) &&
+          (g_atomic_int_get (&ring->head) == ring->tail))
+        {
+          if (prev)
+            {
+              prev->next = next;
+              g_free (ring);
+              ring = next;
+              continue;
+            }
+          else if (g_atomic_pointer_compare_and_exchange (&rings, ring, next))
+            {
+              g_free (ring);
+              ring = next;
+              continue;
+            }
+        }
+
+      prev = ring;
+      ring = next;
+    }
+
+  n_dropped = g_atomic_int_get (&dropped);
+
+  if (n_dropped != dropped_reported)
+    {
+      g_string_append_printf (writer_buffer,
+                              "%s: %u log records were dropped\n",
+                              hostname, n_dropped - dropped_reported);
+      dropped_reported = n_dropped;
+    }
+
+  if (writer_buffer->len)
+    {
+      g_ptr_array_foreach (channels, (GFunc) gb_log_write_to_channel,
+                           writer_buffer);
+      g_string_truncate (writer_buffer, 0);
+    }
+}
+
+static gpointer
+gb_log_writer_thread (gpointer data)
+{
+  gboolean stopping = FALSE;
+
+  while (!stopping)
+    {
+      g_mutex_lock (&writer_mutex);
+      if (!g_atomic_int_get (&writer_wakeup) && !writer_stopping)
+        g_cond_wait_until (&writer_cond, &writer_mutex,
+                           g_get_monotonic_time () + FLUSH_INTERVAL);
+      g_atomic_int_set (&writer_wakeup, FALSE);
+      stopping = writer_stopping;
+      g_mutex_unlock (&writer_mutex);
+
+      G_LOCK (channels_lock);
+      gb_log_flush_locked ();
+      G_UNLOCK (channels_lock);
+    }
+
+  return NULL;
+}
+
+/**
+ * gb_log_push:
+ * @log_domain: A string containing the log section.
+ * @log_level: A #GLogLevelFlags.
+ * @message: The string message.
+ *
+ * Copies a record into the ring of the calling thread. The message is
+ * truncated if it would take more than a quarter of the ring.
+ */
+static void
+gb_log_push (const gchar    *log_domain,
+             GLogLevelFlags  log_level,
+             const gchar    *message)
+{
+  LogRecord record;
+  LogRing *ring;
+  gsize domain_len;
+  gsize message_len;
+  guint head;
+  guint tail;
+
+  ring = gb_log_ring_get ();
+
+  domain_len = log_domain ? MIN (strlen (log_domain), MAX_DOMAIN) : 0;
+  message_len = MIN (strlen (message), MAX_RECORD - sizeof record - domain_len);
+
+  record.length = (sizeof record + domain_len + message_len + 7) & ~7;
+  record.level = log_level;
+  record.thread = gb_log_get_thread ();
+  record.domain_len = domain_len;
+  record.message_len = message_len;
+  record.time = g_get_real_time ();
+
+  head = ring->head;
+
+  for (;;)
+    {
+      tail = g_atomic_int_get (&ring->tail);
+
+      if ((RING_SIZE - (head - tail)) >= record.length)
+        break;
+
+      /* The writer cannot wait on itself. */
+      if ((policy == GB_LOG_POLICY_DROP) || (g_thread_self () == writer_thread))
+        {
+          g_atomic_int_inc (&dropped);
+          return;
+        }
+
+      gb_log_wake_writer ();
+      g_usleep (100);
+    }
+
+  gb_log_ring_write (ring, head, &record, sizeof record);
+  gb_log_ring_write (ring, head + sizeof record, log_domain, domain_len);
+  gb_log_ring_write (ring, head + sizeof record + domain_len, message,
+                     message_len);
+
+  g_atomic_int_set (&ring->head, head + record.length);
+
+  if ((head + record.length - tail) >= (RING_SIZE / 2))
+    gb_log_wake_writer ();
+}
+
 /**
  * gb_log_handler:
  * @log_domain: A string containing the log section.
@@ -117,31 +451,50 @@ gb_log_handler (const gchar   *log_domain,
                 const gchar   *message,
                 gpointer       user_data)
 {
-  struct timespec ts;
-  struct tm tt;
-  time_t t;
-  const gchar *level;
-  gchar ftime[32];
-  gchar *buffer;
-
   if (G_LIKELY (channels->len))
     {
-      level = gb_log_level_str (log_level);
-      clock_gettime (CLOCK_REALTIME, &ts);
-      t = (time_t) ts.tv_sec;
-      tt = *localtime (&t);
-      strftime (ftime, sizeof (ftime), "%Y/%m/%d %H:%M:%S", &tt);
-      buffer = g_strdup_printf ("%s.%04ld  %s: %20s[%d]: %8s: %s\n",
-                                ftime, ts.tv_nsec / 100000,
-                                hostname, log_domain,
-                                gb_log_get_thread (), level, message);
+      if (G_LIKELY (!(log_level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR))))
+        {
+          gb_log_push (log_domain, log_level, message);
+          return;
+        }
+
       G_LOCK (channels_lock);
-      g_ptr_array_foreach (channels, (GFunc) gb_log_write_to_channel, buffer);
+      gb_log_flush_locked ();
+      gb_log_format (writer_buffer, g_get_real_time (),
+                     log_domain ? log_domain : "", gb_log_get_thread (),
+                     log_level, message, strlen (message));
+      gb_log_flush_locked ();
       G_UNLOCK (channels_lock);
-      g_free (buffer);
     }
 }
 
+/**
+ * gb_log_set_policy:
+ * @log_policy: A #GbLogPolicy.
+ *
+ * Sets what happens to a record when the ring buffer of the logging thread
+ * is full. The default is %GB_LOG_POLICY_DROP.
+ */
+void
+gb_log_set_policy (GbLogPolicy log_policy)
+{
+  policy = log_policy;
+}
+
+/**
+ * gb_log_get_dropped:
+ *
+ * Gets the number of records dropped because a ring buffer was full.
+ *
+ * Returns: The number of dropped records.
+ */
+guint
+gb_log_get_dropped (void)
+{
+  return g_atomic_int_get (&dropped);
+}
+
 /**
  * gb_log_init:
  * @stdout_: Indicates logging should be written to stdout.
@@ -182,7 +535,11 @@ gb_log_init (gboolean     stdout_,
 # endif /* __APPLE__ */
 #endif /* __linux__ */
 
-      g_log_set_default_handler (gb_log_handler, NULL);
+      writer_buffer = g_string_sized_new (RING_SIZE);
+      writer_thread = g_thread_new ("gb-log-writer", gb_log_writer_thread,
+                                    NULL);
+
+      last_handler = g_log_set_default_handler (gb_log_handler, NULL);
       g_once_init_leave (&initialized, TRUE);
     }
 }
@@ -190,7 +547,8 @@ gb_log_init (gboolean     stdout_,
 /**
  * gb_log_shutdown:
  *
- * Cleans up after the logging subsystem.
+ * Cleans up after the logging subsystem. Pending records are written
+ * before this returns.
  */
 void
 gb_log_shutdown (void)
@@ -200,4 +558,15 @@ gb_log_shutdown (void)
       g_log_set_default_handler (last_handler, NULL);
       last_handler = NULL;
     }
+
+  if (writer_thread)
+    {
+      g_mutex_lock (&writer_mutex);
+      writer_stopping = TRUE;
+      g_cond_signal (&writer_cond);
+      g_mutex_unlock (&writer_mutex);
+
+      g_thread_join (writer_thread);
+      writer_thread = NULL;
+    }
 }
@@ -68,9 +68,17 @@ G_BEGIN_DECLS
 #define RETURN(_r) return _r
 #endif
 
-void gb_log_init     (gboolean     stdout_,
-                      const gchar *filename);
-void gb_log_shutdown (void);
+typedef enum
+{
+  GB_LOG_POLICY_DROP,
+  GB_LOG_POLICY_BLOCK,
+} GbLogPolicy;
+
+void  gb_log_init        (gboolean     stdout_,
+                          const gchar *filename);
+void  gb_log_shutdown    (void);
+void  gb_log_set_policy  (GbLogPolicy  policy);
+guint gb_log_get_dropped (void);
 
 G_END_DECLS
 
@@ -167,6 +167,7 @@ static void
 gb_search_box_entry_changed (GbSearchBox    *box,
                              GtkSearchEntry *entry)
 {
+  GbSearchContext *context;
   GtkToggleButton *button;
   const gchar *text;
   gboolean active;
@@ -182,6 +183,14 @@ gb_search_box_entry_changed (GbSearchBox    *box,
   if (gtk_toggle_button_get_active (button) != active)
     gtk_toggle_button_set_active (button, active);
 
+  /*
+   * The results of the previous search are stale now. Stop the providers
+   * from doing any more work on them while we wait to start the next one.
+   */
+  context = gb_search_display_get_context (box->priv->display);
+  if (context)
+    gb_search_context_cancel (context);
+
   if (!box->priv->delay_timeout)
     {
       const gchar *search_text;
@@ -36,6 +36,7 @@ enum {
   COUNT_SET,
   RESULT_ADDED,
   RESULT_REMOVED,
+  RESULTS_CHANGED,
   LAST_SIGNAL
 };
 
@@ -79,6 +80,29 @@ gb_search_context_remove_result (GbSearchContext  *context,
   g_signal_emit (context, gSignals [RESULT_REMOVED], 0, provider, result);
 }
 
+/**
+ * gb_search_context_update_results:
+ * @removed: (element-type GbSearchResult): results no longer in the top set.
+ * @added: (element-type GbSearchResult): results new to the top set.
+ *
+ * Emits a single batched change for @provider so that the display only has
+ * to update (and re-sort) once, rather than once per result.
+ */
+void
+gb_search_context_update_results (GbSearchContext  *context,
+                                  GbSearchProvider *provider,
+                                  GPtrArray        *removed,
+                                  GPtrArray        *added)
+{
+  g_return_if_fail (GB_IS_SEARCH_CONTEXT (context));
+  g_return_if_fail (GB_IS_SEARCH_PROVIDER (provider));
+  g_return_if_fail (removed);
+  g_return_if_fail (added);
+
+  g_signal_emit (context, gSignals [RESULTS_CHANGED], 0,
+                 provider, removed, added);
+}
+
 void
 gb_search_context_set_provider_count (GbSearchContext  *context,
                                       GbSearchProvider *provider,
@@ -90,6 +114,28 @@ gb_search_context_set_provider_count (GbSearchContext  *context,
   g_signal_emit (context, gSignals [COUNT_SET], 0, provider, count);
 }
 
+static void
+gb_search_context_populate_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  GbSearchProvider *provider = (GbSearchProvider *)object;
+  GbSearchContext *context = user_data;
+  GError *error = NULL;
+
+  g_return_if_fail (GB_IS_SEARCH_PROVIDER (provider));
+  g_return_if_fail (GB_IS_SEARCH_CONTEXT (context));
+
+  if (!gb_search_provider_populate_finish (provider, result, &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("%s", error->message);
+      g_clear_error (&error);
+    }
+
+  g_object_unref (context);
+}
+
 void
 gb_search_context_execute (GbSearchContext *context,
                            const gchar     *search_terms)
@@ -102,17 +148,24 @@ gb_search_context_execute (GbSearchContext *context,
 
   context->priv->executed = TRUE;
 
+  /*
+   * Start all of the providers at once. Each of them adds its results from
+   * the main loop as they become available, so a slow provider does not
+   * hold back the others or block the search entry.
+   */
   for (iter = context->priv->providers; iter; iter = iter->next)
     {
       gsize max_results = 0;
 
       /* TODO: Get the max results for this provider */
 
-      gb_search_provider_populate (iter->data,
-                                   context,
-                                   search_terms,
-                                   max_results,
-                                   context->priv->cancellable);
+      gb_search_provider_populate_async (iter->data,
+                                         context,
+                                         search_terms,
+                                         max_results,
+                                         context->priv->cancellable,
+                                         gb_search_context_populate_cb,
+                                         g_object_ref (context));
     }
 }
 
@@ -197,6 +250,20 @@ gb_search_context_class_init (GbSearchContextClass *klass)
                   2,
                   GB_TYPE_SEARCH_PROVIDER,
                   GB_TYPE_SEARCH_RESULT);
+
+  gSignals [RESULTS_CHANGED] =
+    g_signal_new ("results-changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_generic,
+                  G_TYPE_NONE,
+                  3,
+                  GB_TYPE_SEARCH_PROVIDER,
+                  G_TYPE_PTR_ARRAY,
+                  G_TYPE_PTR_ARRAY);
 }
 
 static void
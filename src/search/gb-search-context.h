@@ -50,6 +50,10 @@ struct _GbSearchContextClass
   void (*result_removed) (GbSearchContext  *context,
                           GbSearchProvider *provider,
                           GbSearchResult   *result);
+  void (*results_changed) (GbSearchContext  *context,
+                           GbSearchProvider *provider,
+                           GPtrArray        *removed,
+                           GPtrArray        *added);
 };
 
 GbSearchContext *gb_search_context_new                (void);
@@ -63,6 +67,10 @@ void             gb_search_context_add_result         (GbSearchContext  *context
 void             gb_search_context_remove_result      (GbSearchContext  *context,
                                                        GbSearchProvider *provider,
                                                        GbSearchResult   *result);
+void             gb_search_context_update_results     (GbSearchContext  *context,
+                                                       GbSearchProvider *provider,
+                                                       GPtrArray        *removed,
+                                                       GPtrArray        *added);
 void             gb_search_context_cancel             (GbSearchContext  *context);
 void             gb_search_context_execute            (GbSearchContext  *context,
                                                        const gchar      *search_terms);
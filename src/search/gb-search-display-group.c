@@ -151,7 +151,10 @@ gb_search_display_group_remove_result (GbSearchDisplayGroup *group,
   row = g_object_get_qdata (G_OBJECT (result), gQuarkRow);
 
   if (row)
-    gtk_container_remove (GTK_CONTAINER (group->priv->rows), row);
+    {
+      gtk_container_remove (GTK_CONTAINER (group->priv->rows), row);
+      group->priv->count--;
+    }
 }
 
 void
@@ -171,6 +174,40 @@ gb_search_display_group_add_result (GbSearchDisplayGroup *group,
   group->priv->count++;
 }
 
+/**
+ * gb_search_display_group_update_results:
+ * @removed: (element-type GbSearchResult): results to remove.
+ * @added: (element-type GbSearchResult): results to add.
+ *
+ * Applies a batch of changes to the group, re-sorting the rows only once.
+ */
+void
+gb_search_display_group_update_results (GbSearchDisplayGroup *group,
+                                        GPtrArray            *removed,
+                                        GPtrArray            *added)
+{
+  GtkWidget *row;
+  guint i;
+
+  g_return_if_fail (GB_IS_SEARCH_DISPLAY_GROUP (group));
+  g_return_if_fail (removed);
+  g_return_if_fail (added);
+
+  for (i = 0; i < removed->len; i++)
+    gb_search_display_group_remove_result (group,
+                                           g_ptr_array_index (removed, i));
+
+  for (i = 0; i < added->len; i++)
+    {
+      row = gb_search_display_group_create_row (g_ptr_array_index (added, i));
+      gtk_container_add (GTK_CONTAINER (group->priv->rows), row);
+      group->priv->count++;
+    }
+
+  if (added->len)
+    gtk_list_box_invalidate_sort (group->priv->rows);
+}
+
 void
 gb_search_display_group_set_count (GbSearchDisplayGroup *group,
                                    guint64               count)
@@ -51,6 +51,9 @@ void              gb_search_display_group_add_result    (GbSearchDisplayGroup *g
                                                          GbSearchResult       *result);
 void              gb_search_display_group_remove_result (GbSearchDisplayGroup *group,
                                                          GbSearchResult       *result);
+void              gb_search_display_group_update_results (GbSearchDisplayGroup *group,
+                                                          GPtrArray            *removed,
+                                                          GPtrArray            *added);
 void              gb_search_display_group_set_count     (GbSearchDisplayGroup *group,
                                                          guint64               count);
 void              gb_search_display_group_unselect      (GbSearchDisplayGroup *group);
@@ -348,6 +348,35 @@ gb_search_display_result_removed (GbSearchDisplay  *display,
     }
 }
 
+static void
+gb_search_display_results_changed (GbSearchDisplay  *display,
+                                   GbSearchProvider *provider,
+                                   GPtrArray        *removed,
+                                   GPtrArray        *added,
+                                   GbSearchContext  *context)
+{
+  guint i;
+
+  g_return_if_fail (GB_IS_SEARCH_DISPLAY (display));
+  g_return_if_fail (GB_IS_SEARCH_PROVIDER (provider));
+  g_return_if_fail (GB_IS_SEARCH_CONTEXT (context));
+
+  for (i = 0; i < display->priv->providers->len; i++)
+    {
+      ProviderEntry *ptr;
+
+      ptr = &g_array_index (display->priv->providers, ProviderEntry, i);
+
+      if (ptr->provider == provider)
+        {
+          gb_search_display_group_update_results (ptr->group, removed, added);
+          if (added->len)
+            gtk_widget_show (GTK_WIDGET (ptr->group));
+          break;
+        }
+    }
+}
+
 static void
 gb_search_display_count_set (GbSearchDisplay  *display,
                              GbSearchProvider *provider,
@@ -399,6 +428,11 @@ gb_search_display_connect_context (GbSearchDisplay *display,
                            G_CALLBACK (gb_search_display_result_removed),
                            display,
                            G_CONNECT_SWAPPED);
+  g_signal_connect_object (context,
+                           "results-changed",
+                           G_CALLBACK (gb_search_display_results_changed),
+                           display,
+                           G_CONNECT_SWAPPED);
   g_signal_connect_object (context,
                            "count-set",
                            G_CALLBACK (gb_search_display_count_set),
@@ -81,9 +81,118 @@ gb_search_provider_populate (GbSearchProvider *provider,
              g_type_name (G_TYPE_FROM_INSTANCE (provider)));
 }
 
+/**
+ * gb_search_provider_populate_async:
+ * @provider: A #GbSearchProvider.
+ * @context: The #GbSearchContext to add results to.
+ * @search_terms: The search terms.
+ * @max_results: The max number of results, or 0 for no limit.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A callback to execute once the provider is done.
+ * @user_data: User data for @callback.
+ *
+ * Asynchronously adds the results matching @search_terms to @context.
+ * Results may be added in batches from the main loop until @callback is
+ * executed.
+ *
+ * Providers that only implement the populate vfunc have it called from
+ * this function, on the main thread, before it returns. Results are added
+ * to @context from populate and the display must only be updated from the
+ * main thread, so it cannot simply be moved to a worker thread. Providers
+ * that do more than trivial work must therefore override populate_async
+ * and match off the main thread themselves, as #GbGitSearchProvider does.
+ *
+ * Once @cancellable is cancelled, no further results are added.
+ */
+void
+gb_search_provider_populate_async (GbSearchProvider    *provider,
+                                   GbSearchContext     *context,
+                                   const gchar         *search_terms,
+                                   gsize                max_results,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_return_if_fail (GB_IS_SEARCH_PROVIDER (provider));
+  g_return_if_fail (GB_IS_SEARCH_CONTEXT (context));
+  g_return_if_fail (search_terms);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  GB_SEARCH_PROVIDER_GET_CLASS (provider)->populate_async (provider,
+                                                           context,
+                                                           search_terms,
+                                                           max_results,
+                                                           cancellable,
+                                                           callback,
+                                                           user_data);
+}
+
+/**
+ * gb_search_provider_populate_finish:
+ * @provider: A #GbSearchProvider.
+ * @result: A #GAsyncResult.
+ * @error: (allow-none): A location for a #GError, or %NULL.
+ *
+ * Completes a call to gb_search_provider_populate_async().
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ */
+gboolean
+gb_search_provider_populate_finish (GbSearchProvider  *provider,
+                                    GAsyncResult      *result,
+                                    GError           **error)
+{
+  g_return_val_if_fail (GB_IS_SEARCH_PROVIDER (provider), FALSE);
+  g_return_val_if_fail (G_IS_ASYNC_RESULT (result), FALSE);
+
+  return GB_SEARCH_PROVIDER_GET_CLASS (provider)->populate_finish (provider,
+                                                                   result,
+                                                                   error);
+}
+
+static void
+gb_search_provider_real_populate_async (GbSearchProvider    *provider,
+                                        GbSearchContext     *context,
+                                        const gchar         *search_terms,
+                                        gsize                max_results,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+  GTask *task;
+
+  /*
+   * This blocks the main loop for as long as populate runs. It is only
+   * suitable for providers that are cheap to query, see the documentation
+   * of gb_search_provider_populate_async().
+   */
+  task = g_task_new (provider, cancellable, callback, user_data);
+
+  if (!g_task_return_error_if_cancelled (task))
+    {
+      gb_search_provider_populate (provider, context, search_terms,
+                                   max_results, cancellable);
+      g_task_return_boolean (task, TRUE);
+    }
+
+  g_object_unref (task);
+}
+
+static gboolean
+gb_search_provider_real_populate_finish (GbSearchProvider  *provider,
+                                         GAsyncResult      *result,
+                                         GError           **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 static void
 gb_search_provider_class_init (GbSearchProviderClass *klass)
 {
+  klass->populate_async = gb_search_provider_real_populate_async;
+  klass->populate_finish = gb_search_provider_real_populate_finish;
 }
 
 static void
@@ -44,24 +44,44 @@ struct _GbSearchProviderClass
 {
   GObjectClass parent;
 
-  gunichar     (*get_prefix)   (GbSearchProvider *provider);
-  gint         (*get_priority) (GbSearchProvider *provider);
-  const gchar *(*get_verb)     (GbSearchProvider *provider);
-  void         (*populate)     (GbSearchProvider *provider,
-                                GbSearchContext  *context,
-                                const gchar      *search_terms,
-                                gsize             max_results,
-                                GCancellable     *cancellable);
+  gunichar     (*get_prefix)      (GbSearchProvider     *provider);
+  gint         (*get_priority)    (GbSearchProvider     *provider);
+  const gchar *(*get_verb)        (GbSearchProvider     *provider);
+  void         (*populate)        (GbSearchProvider     *provider,
+                                   GbSearchContext      *context,
+                                   const gchar          *search_terms,
+                                   gsize                 max_results,
+                                   GCancellable         *cancellable);
+  void         (*populate_async)  (GbSearchProvider     *provider,
+                                   GbSearchContext      *context,
+                                   const gchar          *search_terms,
+                                   gsize                 max_results,
+                                   GCancellable         *cancellable,
+                                   GAsyncReadyCallback   callback,
+                                   gpointer              user_data);
+  gboolean     (*populate_finish) (GbSearchProvider     *provider,
+                                   GAsyncResult         *result,
+                                   GError              **error);
 };
 
-gunichar     gb_search_provider_get_prefix   (GbSearchProvider *provider);
-gint         gb_search_provider_get_priority (GbSearchProvider *provider);
-const gchar *gb_search_provider_get_verb     (GbSearchProvider *provider);
-void         gb_search_provider_populate     (GbSearchProvider *provider,
-                                              GbSearchContext  *context,
-                                              const gchar      *search_terms,
-                                              gsize             max_results,
-                                              GCancellable     *cancellable);
+gunichar     gb_search_provider_get_prefix      (GbSearchProvider     *provider);
+gint         gb_search_provider_get_priority    (GbSearchProvider     *provider);
+const gchar *gb_search_provider_get_verb        (GbSearchProvider     *provider);
+void         gb_search_provider_populate        (GbSearchProvider     *provider,
+                                                 GbSearchContext      *context,
+                                                 const gchar          *search_terms,
+                                                 gsize                 max_results,
+                                                 GCancellable         *cancellable);
+void         gb_search_provider_populate_async  (GbSearchProvider     *provider,
+                                                 GbSearchContext      *context,
+                                                 const gchar          *search_terms,
+                                                 gsize                 max_results,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+gboolean     gb_search_provider_populate_finish (GbSearchProvider     *provider,
+                                                 GAsyncResult         *result,
+                                                 GError              **error);
 
 G_END_DECLS
 
@@ -21,6 +21,85 @@
 #include "gb-search-reducer.h"
 #include "gb-search-result.h"
 
+/*
+ * The reducer keeps the best max_results results seen so far in an array
+ * backed binary min-heap ordered by score. The root is always the lowest
+ * scoring result, so both accepts() and replacing the lowest entry are
+ * cheap. Nothing is emitted to the context while results are pushed; the
+ * provider calls gb_search_reducer_commit() once it is done matching and
+ * the display receives a single diff against what was last committed.
+ */
+
+#define HEAP_SCORE(h,i) \
+  gb_search_result_get_score (g_ptr_array_index ((h), (i)))
+
+static void
+gb_search_reducer_swap (GPtrArray *heap,
+                        guint      a,
+                        guint      b)
+{
+  gpointer tmp;
+
+  tmp = heap->pdata [a];
+  heap->pdata [a] = heap->pdata [b];
+  heap->pdata [b] = tmp;
+}
+
+static void
+gb_search_reducer_sift_up (GPtrArray *heap,
+                           guint      i)
+{
+  while (i > 0)
+    {
+      guint parent = (i - 1) / 2;
+
+      if (HEAP_SCORE (heap, parent) <= HEAP_SCORE (heap, i))
+        break;
+
+      gb_search_reducer_swap (heap, parent, i);
+      i = parent;
+    }
+}
+
+static void
+gb_search_reducer_sift_down (GPtrArray *heap,
+                             guint      i)
+{
+  for (;;)
+    {
+      guint left = (i * 2) + 1;
+      guint right = left + 1;
+      guint lowest = i;
+
+      if ((left < heap->len) &&
+          (HEAP_SCORE (heap, left) < HEAP_SCORE (heap, lowest)))
+        lowest = left;
+
+      if ((right < heap->len) &&
+          (HEAP_SCORE (heap, right) < HEAP_SCORE (heap, lowest)))
+        lowest = right;
+
+      if (lowest == i)
+        break;
+
+      gb_search_reducer_swap (heap, lowest, i);
+      i = lowest;
+    }
+}
+
+static gboolean
+gb_search_reducer_contains (GPtrArray *array,
+                            gpointer   data)
+{
+  guint i;
+
+  for (i = 0; i < array->len; i++)
+    if (g_ptr_array_index (array, i) == data)
+      return TRUE;
+
+  return FALSE;
+}
+
 void
 gb_search_reducer_init (GbSearchReducer  *reducer,
                         GbSearchContext  *context,
@@ -32,8 +111,9 @@ gb_search_reducer_init (GbSearchReducer  *reducer,
 
   reducer->context = context;
   reducer->provider = provider;
-  reducer->sequence = g_sequence_new (g_object_unref);
   reducer->max_results = 10;
+  reducer->heap = g_ptr_array_new_full (reducer->max_results, g_object_unref);
+  reducer->committed = g_ptr_array_new_with_free_func (g_object_unref);
   reducer->count = 0;
 }
 
@@ -42,57 +122,96 @@ gb_search_reducer_destroy (GbSearchReducer *reducer)
 {
   g_return_if_fail (reducer);
 
-  g_sequence_free (reducer->sequence);
+  g_clear_pointer (&reducer->heap, g_ptr_array_unref);
+  g_clear_pointer (&reducer->committed, g_ptr_array_unref);
 }
 
 void
 gb_search_reducer_push (GbSearchReducer *reducer,
                         GbSearchResult  *result)
 {
+  GPtrArray *heap;
+
   g_return_if_fail (reducer);
   g_return_if_fail (GB_IS_SEARCH_RESULT (result));
 
-  if (reducer->max_results <= g_sequence_get_length (reducer->sequence))
+  heap = reducer->heap;
+
+  if (reducer->max_results == 0)
+    return;
+
+  if (heap->len < reducer->max_results)
     {
-      GSequenceIter *iter;
-      GbSearchResult *lowest;
-
-      /* Remove lowest score */
-      iter = g_sequence_get_begin_iter (reducer->sequence);
-      lowest = g_sequence_get (iter);
-      gb_search_context_remove_result (reducer->context, reducer->provider,
-                                       lowest);
-      g_sequence_remove (iter);
+      g_ptr_array_add (heap, g_object_ref (result));
+      gb_search_reducer_sift_up (heap, heap->len - 1);
+      return;
     }
 
-  g_sequence_insert_sorted (reducer->sequence,
-                            g_object_ref (result),
-                            (GCompareDataFunc)gb_search_result_compare,
-                            NULL);
-  gb_search_context_add_result (reducer->context, reducer->provider, result);
+  /* Replace the lowest score */
+  g_object_unref (heap->pdata [0]);
+  heap->pdata [0] = g_object_ref (result);
+  gb_search_reducer_sift_down (heap, 0);
 }
 
 gboolean
 gb_search_reducer_accepts (GbSearchReducer *reducer,
                            gfloat           score)
 {
-  GSequenceIter *iter;
-
   g_return_val_if_fail (reducer, FALSE);
 
-  if (g_sequence_get_length (reducer->sequence) < reducer->max_results)
+  if (reducer->heap->len < reducer->max_results)
     return TRUE;
 
-  iter = g_sequence_get_begin_iter (reducer->sequence);
+  if (reducer->heap->len == 0)
+    return FALSE;
+
+  return score > HEAP_SCORE (reducer->heap, 0);
+}
 
-  if (iter)
+/**
+ * gb_search_reducer_commit:
+ *
+ * Publishes the current top results to the search context as one batch.
+ * Only the difference against the previous commit is emitted, so calling
+ * this several times while a provider is still matching is cheap.
+ */
+void
+gb_search_reducer_commit (GbSearchReducer *reducer)
+{
+  GPtrArray *removed;
+  GPtrArray *added;
+  guint i;
+
+  g_return_if_fail (reducer);
+
+  removed = g_ptr_array_new ();
+  added = g_ptr_array_new ();
+
+  for (i = 0; i < reducer->committed->len; i++)
     {
-      GbSearchResult *result;
+      gpointer item = g_ptr_array_index (reducer->committed, i);
 
-      result = g_sequence_get (iter);
-      if (result)
-        return score > gb_search_result_get_score (result);
+      if (!gb_search_reducer_contains (reducer->heap, item))
+        g_ptr_array_add (removed, item);
     }
 
-  return FALSE;
+  for (i = 0; i < reducer->heap->len; i++)
+    {
+      gpointer item = g_ptr_array_index (reducer->heap, i);
+
+      if (!gb_search_reducer_contains (reducer->committed, item))
+        g_ptr_array_add (added, item);
+    }
+
+  if (removed->len || added->len)
+    gb_search_context_update_results (reducer->context, reducer->provider,
+                                      removed, added);
+
+  g_ptr_array_unref (removed);
+  g_ptr_array_unref (added);
+
+  g_ptr_array_set_size (reducer->committed, 0);
+  for (i = 0; i < reducer->heap->len; i++)
+    g_ptr_array_add (reducer->committed,
+                     g_object_ref (g_ptr_array_index (reducer->heap, i)));
 }
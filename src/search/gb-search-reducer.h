@@ -29,7 +29,8 @@ typedef struct
 {
   GbSearchContext  *context;
   GbSearchProvider *provider;
-  GSequence        *sequence;
+  GPtrArray        *heap;
+  GPtrArray        *committed;
   gsize             max_results;
   gsize             count;
 } GbSearchReducer;
@@ -41,6 +42,7 @@ gboolean gb_search_reducer_accepts (GbSearchReducer  *reducer,
                                     gfloat            score);
 void     gb_search_reducer_push    (GbSearchReducer  *reducer,
                                     GbSearchResult   *result);
+void     gb_search_reducer_commit  (GbSearchReducer  *reducer);
 void     gb_search_reducer_destroy (GbSearchReducer  *reducer);
 
 
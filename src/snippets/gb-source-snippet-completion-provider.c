@@ -22,6 +22,8 @@
 #include "gb-source-snippet-completion-item.h"
 #include "gb-source-snippet-completion-provider.h"
 
+#define DEFAULT_MAX_PROPOSALS 100
+
 static void init_provider (GtkSourceCompletionProviderIface *iface);
 
 G_DEFINE_TYPE_EXTENDED (GbSourceSnippetCompletionProvider,
@@ -35,17 +37,25 @@ struct _GbSourceSnippetCompletionProviderPrivate
 {
   GbSourceView     *source_view;
   GbSourceSnippets *snippets;
+
+  /*
+   * Proposals are reused across keystrokes. The key is the snippet, which
+   * is kept alive by the reference the proposal holds on it.
+   */
+  GHashTable       *proposals;
+
+  guint             max_proposals;
 };
 
 typedef struct
 {
-  GtkSourceCompletionProvider *provider;
-  gchar                       *word;
-  GList                       *list;
+  GbSourceSnippetCompletionProvider *provider;
+  GQueue                             queue;
 } SearchState;
 
 enum {
   PROP_0,
+  PROP_MAX_PROPOSALS,
   PROP_SNIPPETS,
   PROP_SOURCE_VIEW,
   LAST_PROP
@@ -78,10 +88,33 @@ gb_source_snippet_completion_provider_set_snippets (GbSourceSnippetCompletionPro
   g_return_if_fail (GB_IS_SOURCE_SNIPPET_COMPLETION_PROVIDER (provider));
 
   g_clear_object (&provider->priv->snippets);
+  g_hash_table_remove_all (provider->priv->proposals);
   provider->priv->snippets = snippets ? g_object_ref (snippets) : NULL;
   g_object_notify_by_pspec (G_OBJECT (provider), gParamSpecs[PROP_SNIPPETS]);
 }
 
+guint
+gb_source_snippet_completion_provider_get_max_proposals (GbSourceSnippetCompletionProvider *provider)
+{
+  g_return_val_if_fail (GB_IS_SOURCE_SNIPPET_COMPLETION_PROVIDER (provider), 0);
+
+  return provider->priv->max_proposals;
+}
+
+void
+gb_source_snippet_completion_provider_set_max_proposals (GbSourceSnippetCompletionProvider *provider,
+                                                         guint                              max_proposals)
+{
+  g_return_if_fail (GB_IS_SOURCE_SNIPPET_COMPLETION_PROVIDER (provider));
+
+  if (provider->priv->max_proposals != max_proposals)
+    {
+      provider->priv->max_proposals = max_proposals;
+      g_object_notify_by_pspec (G_OBJECT (provider),
+                                gParamSpecs[PROP_MAX_PROPOSALS]);
+    }
+}
+
 static void
 gb_source_snippet_completion_provider_finalize (GObject *object)
 {
@@ -90,6 +123,7 @@ gb_source_snippet_completion_provider_finalize (GObject *object)
   priv = GB_SOURCE_SNIPPET_COMPLETION_PROVIDER (object)->priv;
 
   g_clear_object (&priv->snippets);
+  g_clear_pointer (&priv->proposals, g_hash_table_unref);
 
   if (priv->source_view)
     g_object_remove_weak_pointer (G_OBJECT (priv->source_view),
@@ -112,6 +146,10 @@ gb_source_snippet_completion_provider_get_property (GObject    *object,
       g_value_set_object (value, provider->priv->source_view);
       break;
 
+    case PROP_MAX_PROPOSALS:
+      g_value_set_uint (value, gb_source_snippet_completion_provider_get_max_proposals (provider));
+      break;
+
     case PROP_SNIPPETS:
       g_value_set_object (value, gb_source_snippet_completion_provider_get_snippets (provider));
       break;
@@ -143,6 +181,10 @@ gb_source_snippet_completion_provider_set_property (GObject      *object,
                                    (gpointer *) &provider->priv->source_view);
       break;
 
+    case PROP_MAX_PROPOSALS:
+      gb_source_snippet_completion_provider_set_max_proposals (provider, g_value_get_uint (value));
+      break;
+
     case PROP_SNIPPETS:
       gb_source_snippet_completion_provider_set_snippets (provider, g_value_get_object (value));
       break;
@@ -163,6 +205,17 @@ gb_source_snippet_completion_provider_class_init (GbSourceSnippetCompletionProvi
   object_class->set_property = gb_source_snippet_completion_provider_set_property;
   g_type_class_add_private (object_class, sizeof (GbSourceSnippetCompletionProviderPrivate));
 
+  gParamSpecs[PROP_MAX_PROPOSALS] =
+    g_param_spec_uint ("max-proposals",
+                       _("Max Proposals"),
+                       _("The maximum number of proposals to show, or 0 for no limit."),
+                       0,
+                       G_MAXUINT,
+                       DEFAULT_MAX_PROPOSALS,
+                       (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_MAX_PROPOSALS,
+                                   gParamSpecs[PROP_MAX_PROPOSALS]);
+
   gParamSpecs[PROP_SOURCE_VIEW] =
     g_param_spec_object ("source-view",
                          _("Source View"),
@@ -189,6 +242,12 @@ gb_source_snippet_completion_provider_init (GbSourceSnippetCompletionProvider *p
     G_TYPE_INSTANCE_GET_PRIVATE (provider,
                                  GB_TYPE_SOURCE_SNIPPET_COMPLETION_PROVIDER,
                                  GbSourceSnippetCompletionProviderPrivate);
+
+  provider->priv->max_proposals = DEFAULT_MAX_PROPOSALS;
+  provider->priv->proposals = g_hash_table_new_full (g_direct_hash,
+                                                     g_direct_equal,
+                                                     NULL,
+                                                     g_object_unref);
 }
 
 static gboolean
@@ -269,14 +328,21 @@ foreach_snippet (gpointer data,
   GtkSourceCompletionProposal *item;
   GbSourceSnippet *snippet = data;
   SearchState *state = user_data;
-  const char *trigger;
+  GHashTable *proposals = state->provider->priv->proposals;
 
-  trigger = gb_source_snippet_get_trigger (snippet);
-  if (!g_str_has_prefix (trigger, state->word))
-    return;
+  /*
+   * The snippets trie only visits triggers below the typed prefix, so
+   * there is no need to check the trigger again here.
+   */
+  item = g_hash_table_lookup (proposals, snippet);
 
-  item = gb_source_snippet_completion_item_new (snippet);
-  state->list = g_list_append (state->list, item);
+  if (!item)
+    {
+      item = gb_source_snippet_completion_item_new (snippet);
+      g_hash_table_insert (proposals, snippet, item);
+    }
+
+  g_queue_push_tail (&state->queue, item);
 }
 
 static void
@@ -284,8 +350,9 @@ provider_populate (GtkSourceCompletionProvider *provider,
                    GtkSourceCompletionContext  *context)
 {
   GbSourceSnippetCompletionProviderPrivate *priv;
-  SearchState state = { 0 };
+  SearchState state;
   GtkTextIter iter;
+  gchar *word;
 
   priv = GB_SOURCE_SNIPPET_COMPLETION_PROVIDER (provider)->priv;
 
@@ -297,23 +364,28 @@ provider_populate (GtkSourceCompletionProvider *provider,
 
   gtk_source_completion_context_get_iter (context, &iter);
 
-  state.list = NULL;
-  state.provider = provider;
-  state.word = get_word (provider, &iter);
+  state.provider = GB_SOURCE_SNIPPET_COMPLETION_PROVIDER (provider);
+  g_queue_init (&state.queue);
+
+  word = get_word (provider, &iter);
 
-  if (state.word && *state.word)
-    gb_source_snippets_foreach (priv->snippets, state.word, foreach_snippet,
-                                &state);
+  if (word && *word)
+    gb_source_snippets_foreach_limit (priv->snippets, word,
+                                      priv->max_proposals, foreach_snippet,
+                                      &state);
 
   /*
    * XXX: GtkSourceView seems to be warning quite a bit inside here
    *      right now about g_object_ref(). But ... it doesn't seem to be us?
+   *
+   * The context takes its own reference to each proposal, the cached
+   * proposals remain owned by priv->proposals.
    */
-  gtk_source_completion_context_add_proposals (context, provider, state.list, TRUE);
+  gtk_source_completion_context_add_proposals (context, provider,
+                                               state.queue.head, TRUE);
 
-  g_list_foreach (state.list, (GFunc) g_object_unref, NULL);
-  g_list_free (state.list);
-  g_free (state.word);
+  g_queue_clear (&state.queue);
+  g_free (word);
 }
 
 static gboolean
@@ -54,6 +54,9 @@ struct _GbSourceSnippetCompletionProviderClass
 GType                        gb_source_snippet_completion_provider_get_type (void);
 GtkSourceCompletionProvider *gb_source_snippet_completion_provider_new      (GbSourceView     *source_view,
                                                                              GbSourceSnippets *snippets);
+guint                        gb_source_snippet_completion_provider_get_max_proposals (GbSourceSnippetCompletionProvider *provider);
+void                         gb_source_snippet_completion_provider_set_max_proposals (GbSourceSnippetCompletionProvider *provider,
+                                                                                      guint                              max_proposals);
 
 G_END_DECLS
 
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 
 #include "gb-source-snippet-context.h"
+#include "gb-source-snippet-variables.h"
 
 /**
  * SECTION:gb-source-snippet-context:
@@ -109,12 +110,37 @@ gb_source_snippet_context_get_variable (GbSourceSnippetContext *context,
 
   g_return_val_if_fail (GB_IS_SOURCE_SNIPPET_CONTEXT (context), NULL);
 
-  if (!(ret = g_hash_table_lookup (context->priv->variables, key)))
-    ret = g_hash_table_lookup (context->priv->shared, key);
+  if (!(ret = g_hash_table_lookup (context->priv->variables, key)) &&
+      !(ret = g_hash_table_lookup (context->priv->shared, key)))
+    {
+      GbSourceSnippetVariables *variables;
+
+      /*
+       * Variables that require running a command, such as "email", are
+       * resolved off the main thread and cached process-wide.
+       */
+      variables = gb_source_snippet_variables_get_default ();
+      ret = gb_source_snippet_variables_lookup (variables, key);
+    }
 
   return ret;
 }
 
+/*
+ * A variable that was still being resolved when the chunks were expanded
+ * is now known, so expand them again. Chunks of a snippet that is already
+ * in the buffer are rewritten with the new text on its next edit.
+ */
+static void
+on_variables_changed (GbSourceSnippetContext   *context,
+                      const gchar              *command,
+                      GbSourceSnippetVariables *variables)
+{
+  g_return_if_fail (GB_IS_SOURCE_SNIPPET_CONTEXT (context));
+
+  gb_source_snippet_context_emit_changed (context);
+}
+
 static gchar *
 filter_lower (const gchar *input)
 {
@@ -602,32 +628,6 @@ gb_source_snippet_context_emit_changed (GbSourceSnippetContext *context)
   g_signal_emit (context, gSignals[CHANGED], 0);
 }
 
-static gchar *
-run_command (const gchar *command)
-{
-  GError *error = NULL;
-  gchar *output = NULL;
-  gchar **argv = NULL;
-  gint argc = 0;
-
-  if (!g_shell_parse_argv (command, &argc, &argv, NULL))
-    return NULL;
-
-  /*
-   * TODO: Run in project directory.
-   */
-
-  if (!g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, &output, NULL, NULL, &error))
-    {
-      g_printerr ("%s\n", error->message);
-      g_error_free (error);
-    }
-
-  g_strfreev (argv);
-
-  return g_strstrip (output);
-}
-
 static void
 gb_source_snippet_context_finalize (GObject *object)
 {
@@ -695,6 +695,12 @@ gb_source_snippet_context_init (GbSourceSnippetContext *context)
                                                  g_free,
                                                  g_free);
 
+  g_signal_connect_object (gb_source_snippet_variables_get_default (),
+                           "changed",
+                           G_CALLBACK (on_variables_changed),
+                           context,
+                           G_CONNECT_SWAPPED);
+
 #define ADD_VARIABLE(k, v) \
   g_hash_table_insert (context->priv->shared, g_strdup (k), g_strdup (v))
 
@@ -717,9 +723,5 @@ gb_source_snippet_context_init (GbSourceSnippetContext *context)
   g_free (str);
   g_date_time_unref (dt);
 
-  str = run_command ("git config user.email");
-  ADD_VARIABLE ("email", str);
-  g_free (str);
-
 #undef ADD_VARIABLE
 }
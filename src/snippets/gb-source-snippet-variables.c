@@ -0,0 +1,412 @@
+/* gb-source-snippet-variables.c
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "snippets"
+
+#include <glib/gi18n.h>
+
+#include "gb-source-snippet-variables.h"
+
+/**
+ * SECTION:gb-source-snippet-variables:
+ * @title: GbSourceSnippetVariables
+ * @short_description: Cached values for snippet variables that run commands.
+ *
+ * Some snippet variables, such as the user's git email, can only be found
+ * by running a command. Running it synchronously every time a snippet is
+ * expanded stalls the main loop, so the output is resolved once on a worker
+ * thread and cached here. Lookups never block. A lookup that misses the
+ * cache returns %NULL and schedules the command; #GbSourceSnippetVariables
+ * emits "changed" once the output is available.
+ *
+ * The cache is invalidated when the user's git configuration changes, or
+ * by calling gb_source_snippet_variables_invalidate().
+ */
+
+struct _GbSourceSnippetVariablesPrivate
+{
+  GHashTable *commands;
+  GPtrArray  *monitors;
+};
+
+typedef struct
+{
+  gchar *value;
+  guint  resolved : 1;
+  guint  pending : 1;
+  guint  stale : 1;
+} CommandEntry;
+
+enum {
+  CHANGED,
+  LAST_SIGNAL
+};
+
+static const struct {
+  const gchar *key;
+  const gchar *command;
+} gDynamicVariables[] = {
+  { "email", "git config user.email" },
+};
+
+static guint gSignals [LAST_SIGNAL];
+
+G_DEFINE_TYPE_WITH_PRIVATE (GbSourceSnippetVariables,
+                            gb_source_snippet_variables,
+                            G_TYPE_OBJECT)
+
+static void
+command_entry_free (gpointer data)
+{
+  CommandEntry *entry = data;
+
+  g_free (entry->value);
+  g_slice_free (CommandEntry, entry);
+}
+
+GbSourceSnippetVariables *
+gb_source_snippet_variables_get_default (void)
+{
+  static GbSourceSnippetVariables *instance;
+
+  if (!instance)
+    {
+      instance = g_object_new (GB_TYPE_SOURCE_SNIPPET_VARIABLES, NULL);
+      g_object_add_weak_pointer (G_OBJECT (instance),
+                                 (gpointer *) &instance);
+    }
+
+  return instance;
+}
+
+static void
+gb_source_snippet_variables_run_worker (GTask        *task,
+                                        gpointer      source_object,
+                                        gpointer      task_data,
+                                        GCancellable *cancellable)
+{
+  const gchar *command = task_data;
+  GError *error = NULL;
+  gchar *output = NULL;
+  gchar **argv = NULL;
+  gint exit_status = 0;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (command);
+
+  if (!g_shell_parse_argv (command, NULL, &argv, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  /*
+   * Commands run in the current directory rather than in a project, so
+   * they see the user's global git configuration. That is also the only
+   * configuration we monitor for changes.
+   */
+
+  if (!g_spawn_sync (NULL, argv, NULL,
+                     (G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL),
+                     NULL, NULL, &output, NULL, &exit_status, &error))
+    {
+      g_strfreev (argv);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_strfreev (argv);
+
+  if (exit_status != 0)
+    g_clear_pointer (&output, g_free);
+
+  g_task_return_pointer (task, output ? g_strstrip (output) : NULL, g_free);
+}
+
+static void gb_source_snippet_variables_resolve (GbSourceSnippetVariables *variables,
+                                                 const gchar              *command,
+                                                 CommandEntry             *entry);
+
+static void
+gb_source_snippet_variables_run_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+  GbSourceSnippetVariables *variables = (GbSourceSnippetVariables *)object;
+  CommandEntry *entry;
+  const gchar *command;
+  GError *error = NULL;
+  gchar *output;
+
+  g_assert (GB_IS_SOURCE_SNIPPET_VARIABLES (variables));
+  g_assert (G_IS_TASK (result));
+
+  command = g_task_get_task_data (G_TASK (result));
+  entry = g_hash_table_lookup (variables->priv->commands, command);
+
+  if (!(output = g_task_propagate_pointer (G_TASK (result), &error)) && error)
+    {
+      g_debug ("Failed to run \"%s\": %s", command, error->message);
+      g_clear_error (&error);
+    }
+
+  if (!entry)
+    {
+      g_free (output);
+      return;
+    }
+
+  entry->pending = FALSE;
+  entry->resolved = TRUE;
+
+  if (g_strcmp0 (entry->value, output) != 0)
+    {
+      g_free (entry->value);
+      entry->value = output;
+      g_signal_emit (variables, gSignals [CHANGED], 0, command);
+    }
+  else
+    g_free (output);
+
+  /*
+   * The configuration changed while the command was running, so the
+   * output may already be out of date.
+   */
+  if (entry->stale)
+    gb_source_snippet_variables_resolve (variables, command, entry);
+}
+
+static void
+gb_source_snippet_variables_resolve (GbSourceSnippetVariables *variables,
+                                     const gchar              *command,
+                                     CommandEntry             *entry)
+{
+  GTask *task;
+
+  g_assert (GB_IS_SOURCE_SNIPPET_VARIABLES (variables));
+  g_assert (command);
+  g_assert (entry);
+
+  if (entry->pending)
+    {
+      entry->stale = TRUE;
+      return;
+    }
+
+  entry->pending = TRUE;
+  entry->stale = FALSE;
+
+  task = g_task_new (variables, NULL, gb_source_snippet_variables_run_cb, NULL);
+  g_task_set_task_data (task, g_strdup (command), g_free);
+  g_task_run_in_thread (task, gb_source_snippet_variables_run_worker);
+  g_object_unref (task);
+}
+
+/**
+ * gb_source_snippet_variables_lookup:
+ * @variables: A #GbSourceSnippetVariables.
+ * @key: The name of a snippet variable, such as "email".
+ *
+ * Gets the cached value of a snippet variable that is resolved by running
+ * a command. If the value is not cached, the command is run on a worker
+ * thread and "changed" is emitted when it completes.
+ *
+ * Returns: (nullable): The value of @key, or %NULL if it is not yet known,
+ *   the command failed, or @key is not such a variable.
+ */
+const gchar *
+gb_source_snippet_variables_lookup (GbSourceSnippetVariables *variables,
+                                    const gchar              *key)
+{
+  CommandEntry *entry;
+  const gchar *command = NULL;
+  guint i;
+
+  g_return_val_if_fail (GB_IS_SOURCE_SNIPPET_VARIABLES (variables), NULL);
+  g_return_val_if_fail (key, NULL);
+
+  for (i = 0; !command && (i < G_N_ELEMENTS (gDynamicVariables)); i++)
+    {
+      if (g_str_equal (key, gDynamicVariables [i].key))
+        command = gDynamicVariables [i].command;
+    }
+
+  if (!command)
+    return NULL;
+
+  entry = g_hash_table_lookup (variables->priv->commands, command);
+
+  if (!entry)
+    {
+      entry = g_slice_new0 (CommandEntry);
+      g_hash_table_insert (variables->priv->commands, g_strdup (command), entry);
+    }
+
+  if ((!entry->resolved || entry->stale) && !entry->pending)
+    gb_source_snippet_variables_resolve (variables, command, entry);
+
+  return entry->value;
+}
+
+/**
+ * gb_source_snippet_variables_invalidate:
+ * @variables: A #GbSourceSnippetVariables.
+ *
+ * Runs every cached command again. The previous values are returned from
+ * lookups until the new output is available.
+ */
+void
+gb_source_snippet_variables_invalidate (GbSourceSnippetVariables *variables)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_return_if_fail (GB_IS_SOURCE_SNIPPET_VARIABLES (variables));
+
+  g_hash_table_iter_init (&iter, variables->priv->commands);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    gb_source_snippet_variables_resolve (variables, key, value);
+}
+
+static void
+on_config_changed (GFileMonitor             *monitor,
+                   GFile                    *file,
+                   GFile                    *other_file,
+                   GFileMonitorEvent         event,
+                   GbSourceSnippetVariables *variables)
+{
+  g_assert (GB_IS_SOURCE_SNIPPET_VARIABLES (variables));
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+      gb_source_snippet_variables_invalidate (variables);
+      break;
+
+    default:
+      break;
+    }
+}
+
+static void
+gb_source_snippet_variables_monitor (GbSourceSnippetVariables *variables,
+                                     const gchar              *path)
+{
+  GFileMonitor *monitor;
+  GFile *file;
+
+  g_assert (GB_IS_SOURCE_SNIPPET_VARIABLES (variables));
+  g_assert (path);
+
+  file = g_file_new_for_path (path);
+  monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+
+  if (monitor)
+    {
+      g_signal_connect_object (monitor,
+                               "changed",
+                               G_CALLBACK (on_config_changed),
+                               variables,
+                               0);
+      g_ptr_array_add (variables->priv->monitors, monitor);
+    }
+
+  g_object_unref (file);
+}
+
+static void
+gb_source_snippet_variables_constructed (GObject *object)
+{
+  GbSourceSnippetVariables *variables = (GbSourceSnippetVariables *)object;
+  gchar *path;
+  guint i;
+
+  G_OBJECT_CLASS (gb_source_snippet_variables_parent_class)->constructed (object);
+
+  path = g_build_filename (g_get_home_dir (), ".gitconfig", NULL);
+  gb_source_snippet_variables_monitor (variables, path);
+  g_free (path);
+
+  path = g_build_filename (g_get_user_config_dir (), "git", "config", NULL);
+  gb_source_snippet_variables_monitor (variables, path);
+  g_free (path);
+
+  /*
+   * Start resolving the well known variables now so that they are usually
+   * available by the time the first snippet is expanded.
+   */
+  for (i = 0; i < G_N_ELEMENTS (gDynamicVariables); i++)
+    gb_source_snippet_variables_lookup (variables, gDynamicVariables [i].key);
+}
+
+static void
+gb_source_snippet_variables_finalize (GObject *object)
+{
+  GbSourceSnippetVariablesPrivate *priv;
+
+  priv = GB_SOURCE_SNIPPET_VARIABLES (object)->priv;
+
+  g_clear_pointer (&priv->commands, g_hash_table_unref);
+  g_clear_pointer (&priv->monitors, g_ptr_array_unref);
+
+  G_OBJECT_CLASS (gb_source_snippet_variables_parent_class)->finalize (object);
+}
+
+static void
+gb_source_snippet_variables_class_init (GbSourceSnippetVariablesClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gb_source_snippet_variables_constructed;
+  object_class->finalize = gb_source_snippet_variables_finalize;
+
+  /**
+   * GbSourceSnippetVariables::changed:
+   * @variables: A #GbSourceSnippetVariables.
+   * @command: The command whose output changed.
+   *
+   * Emitted when the output of a command has been resolved and differs
+   * from the previously cached value.
+   */
+  gSignals [CHANGED] =
+    g_signal_new ("changed",
+                  GB_TYPE_SOURCE_SNIPPET_VARIABLES,
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (GbSourceSnippetVariablesClass, changed),
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_VOID__STRING,
+                  G_TYPE_NONE,
+                  1,
+                  G_TYPE_STRING);
+}
+
+static void
+gb_source_snippet_variables_init (GbSourceSnippetVariables *variables)
+{
+  variables->priv = gb_source_snippet_variables_get_instance_private (variables);
+
+  variables->priv->commands = g_hash_table_new_full (g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     command_entry_free);
+  variables->priv->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+}
@@ -0,0 +1,62 @@
+/* gb-source-snippet-variables.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_SOURCE_SNIPPET_VARIABLES_H
+#define GB_SOURCE_SNIPPET_VARIABLES_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GB_TYPE_SOURCE_SNIPPET_VARIABLES            (gb_source_snippet_variables_get_type())
+#define GB_SOURCE_SNIPPET_VARIABLES(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_SOURCE_SNIPPET_VARIABLES, GbSourceSnippetVariables))
+#define GB_SOURCE_SNIPPET_VARIABLES_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GB_TYPE_SOURCE_SNIPPET_VARIABLES, GbSourceSnippetVariables const))
+#define GB_SOURCE_SNIPPET_VARIABLES_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GB_TYPE_SOURCE_SNIPPET_VARIABLES, GbSourceSnippetVariablesClass))
+#define GB_IS_SOURCE_SNIPPET_VARIABLES(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GB_TYPE_SOURCE_SNIPPET_VARIABLES))
+#define GB_IS_SOURCE_SNIPPET_VARIABLES_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GB_TYPE_SOURCE_SNIPPET_VARIABLES))
+#define GB_SOURCE_SNIPPET_VARIABLES_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GB_TYPE_SOURCE_SNIPPET_VARIABLES, GbSourceSnippetVariablesClass))
+
+typedef struct _GbSourceSnippetVariables        GbSourceSnippetVariables;
+typedef struct _GbSourceSnippetVariablesClass   GbSourceSnippetVariablesClass;
+typedef struct _GbSourceSnippetVariablesPrivate GbSourceSnippetVariablesPrivate;
+
+struct _GbSourceSnippetVariables
+{
+  GObject parent;
+
+  /*< private >*/
+  GbSourceSnippetVariablesPrivate *priv;
+};
+
+struct _GbSourceSnippetVariablesClass
+{
+  GObjectClass parent_class;
+
+  void (*changed) (GbSourceSnippetVariables *variables,
+                   const gchar              *command);
+};
+
+GType                     gb_source_snippet_variables_get_type       (void);
+GbSourceSnippetVariables *gb_source_snippet_variables_get_default    (void);
+const gchar              *gb_source_snippet_variables_lookup         (GbSourceSnippetVariables *variables,
+                                                                      const gchar              *key);
+void                      gb_source_snippet_variables_invalidate     (GbSourceSnippetVariables *variables);
+
+G_END_DECLS
+
+#endif /* GB_SOURCE_SNIPPET_VARIABLES_H */
@@ -19,7 +19,9 @@
 #define G_LOG_DOMAIN "snippets"
 
 #include <glib/gi18n.h>
+#include <string.h>
 
+#include "gb-source-snippet-variables.h"
 #include "gb-source-snippets-manager.h"
 
 struct _GbSourceSnippetsManagerPrivate
@@ -27,125 +29,483 @@ struct _GbSourceSnippetsManagerPrivate
   GHashTable *by_language_id;
 };
 
+typedef struct
+{
+  gchar *language_id;
+  gchar *user_dir;
+  gchar *cache_dir;
+} LoadState;
+
 G_DEFINE_TYPE_WITH_PRIVATE (GbSourceSnippetsManager,
                             gb_source_snippets_manager,
                             G_TYPE_OBJECT)
 
 #define SNIPPETS_DIRECTORY "/org/gnome/builder/snippets/"
 
+/*
+ * Each snippet file is compiled into a GVariant of this type and stored in
+ * the user cache directory. The cache is mapped and checked against the
+ * version, stamp and size of the source file before use. The list of
+ * languages found in the file comes first so that loading a language can
+ * skip files that have nothing for it without walking their snippets.
+ *
+ *   (version, stamp, size, [language], [(trigger, language, description,
+ *                                        [(tab_stop, spec)])])
+ */
+#define SNIPPETS_CACHE_VERSION 1
+#define SNIPPETS_CACHE_TYPE    G_VARIANT_TYPE ("(uttasa(sssa(is)))")
+
+static void
+load_state_free (gpointer data)
+{
+  LoadState *state = data;
+
+  g_free (state->language_id);
+  g_free (state->user_dir);
+  g_free (state->cache_dir);
+  g_slice_free (LoadState, state);
+}
+
+/*
+ * Resources have no modification time, so they are keyed by a hash of
+ * their contents instead. Looking up resource data does not copy it.
+ */
 static gboolean
-gb_source_snippets_manager_load_file (GbSourceSnippetsManager *manager,
-                                      GFile                   *file,
-                                      GError                 **error)
+get_file_stamp (GFile   *file,
+                guint64 *stamp,
+                guint64 *size)
 {
-  GbSourceSnippets *snippets;
-  GbSourceSnippetParser *parser;
-  GbSourceSnippet *snippet;
-  GList *iter;
-  
-  g_return_val_if_fail (GB_IS_SOURCE_SNIPPETS_MANAGER (manager), FALSE);
-  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  if (g_file_has_uri_scheme (file, "resource"))
+    {
+      const guint8 *data;
+      GBytes *bytes;
+      gchar *uri;
+      gsize len;
+      gsize i;
+      guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+
+      uri = g_file_get_uri (file);
+      bytes = g_resources_lookup_data (uri + strlen ("resource://"),
+                                       G_RESOURCE_LOOKUP_FLAGS_NONE,
+                                       NULL);
+      g_free (uri);
+
+      if (!bytes)
+        return FALSE;
+
+      data = g_bytes_get_data (bytes, &len);
+      for (i = 0; i < len; i++)
+        hash = (hash ^ data [i]) * G_GUINT64_CONSTANT (1099511628211);
+
+      *stamp = hash;
+      *size = len;
+
+      g_bytes_unref (bytes);
+    }
+  else
+    {
+      GFileInfo *info;
+
+      info = g_file_query_info (file,
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC","
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                G_FILE_QUERY_INFO_NONE,
+                                NULL,
+                                NULL);
+
+      if (!info)
+        return FALSE;
+
+      *stamp = (g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)
+                * G_USEC_PER_SEC) +
+               g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+      *size = g_file_info_get_size (info);
 
-  parser = gb_source_snippet_parser_new ();
-  if (!gb_source_snippet_parser_load_from_file (parser, file, error))
+      g_object_unref (info);
+    }
+
+  return TRUE;
+}
+
+static gchar *
+get_cache_path (const gchar *cache_dir,
+                GFile       *file)
+{
+  gchar *checksum;
+  gchar *name;
+  gchar *path;
+  gchar *uri;
+
+  uri = g_file_get_uri (file);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  name = g_strdup_printf ("%s.cache", checksum);
+  path = g_build_filename (cache_dir, name, NULL);
+
+  g_free (checksum);
+  g_free (name);
+  g_free (uri);
+
+  return path;
+}
+
+static GVariant *
+load_cache (const gchar *path,
+            guint64      stamp,
+            guint64      size)
+{
+  GMappedFile *mapped;
+  GVariant *variant;
+  GBytes *bytes;
+  guint64 cached_stamp;
+  guint64 cached_size;
+  guint version;
+
+  if (!(mapped = g_mapped_file_new (path, FALSE, NULL)))
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+
+  variant = g_variant_new_from_bytes (SNIPPETS_CACHE_TYPE, bytes, FALSE);
+  g_variant_ref_sink (variant);
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (variant, 0, "u", &version);
+  g_variant_get_child (variant, 1, "t", &cached_stamp);
+  g_variant_get_child (variant, 2, "t", &cached_size);
+
+  if ((version != SNIPPETS_CACHE_VERSION) ||
+      (cached_stamp != stamp) ||
+      (cached_size != size))
     {
-      g_object_unref (parser);
-      return FALSE;
+      g_variant_unref (variant);
+      return NULL;
     }
 
-  iter = gb_source_snippet_parser_get_snippets (parser);
-  for (; iter; iter = iter->next) 
+  return variant;
+}
+
+static GVariant *
+compile_snippets (GList   *snippets,
+                  guint64  stamp,
+                  guint64  size)
+{
+  GVariantBuilder languages;
+  GVariantBuilder builder;
+  GHashTable *seen;
+  GList *iter;
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_variant_builder_init (&languages, G_VARIANT_TYPE ("as"));
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sssa(is))"));
+
+  for (iter = snippets; iter; iter = iter->next)
     {
+      GbSourceSnippet *snippet = iter->data;
+      const gchar *description;
       const gchar *language;
-      snippet  = iter->data;
-      language = gb_source_snippet_get_language(snippet);
-      snippets = g_hash_table_lookup (manager->priv->by_language_id, language);
+      guint n_chunks;
+      guint i;
+
+      language = gb_source_snippet_get_language (snippet);
+      description = gb_source_snippet_get_description (snippet);
+      n_chunks = gb_source_snippet_get_n_chunks (snippet);
+
+      if (!language)
+        continue;
+
+      if (!g_hash_table_contains (seen, language))
+        {
+          g_hash_table_add (seen, (gchar *)language);
+          g_variant_builder_add (&languages, "s", language);
+        }
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sssa(is))"));
+      g_variant_builder_add (&builder, "s", gb_source_snippet_get_trigger (snippet));
+      g_variant_builder_add (&builder, "s", language);
+      g_variant_builder_add (&builder, "s", description ? description : "");
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(is)"));
 
-      if (!snippets)
+      for (i = 0; i < n_chunks; i++)
         {
-          snippets = gb_source_snippets_new ();
-          g_hash_table_insert (manager->priv->by_language_id,
-                               g_strdup (language),
-                               snippets);
+          GbSourceSnippetChunk *chunk;
+
+          chunk = gb_source_snippet_get_nth_chunk (snippet, i);
+          g_variant_builder_add (&builder, "(is)",
+                                 gb_source_snippet_chunk_get_tab_stop (chunk),
+                                 gb_source_snippet_chunk_get_spec (chunk));
         }
-      gb_source_snippets_add (snippets, snippet);
+
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
     }
 
-  g_object_unref (parser);
+  g_hash_table_unref (seen);
 
-  return TRUE;
+  return g_variant_ref_sink (g_variant_new ("(utt@as@a(sssa(is)))",
+                                            SNIPPETS_CACHE_VERSION,
+                                            stamp,
+                                            size,
+                                            g_variant_builder_end (&languages),
+                                            g_variant_builder_end (&builder)));
 }
 
 static void
-gb_source_snippets_manager_load_directory (GbSourceSnippetsManager *manager,
-                                           const gchar             *path)
+save_cache (const gchar *path,
+            GVariant    *variant)
 {
-  const gchar *name;
   GError *error = NULL;
-  gchar *filename;
+
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error))
+    {
+      g_debug ("Failed to write snippet cache: %s", error->message);
+      g_clear_error (&error);
+    }
+}
+
+static void
+collect_snippets (GVariant    *variant,
+                  const gchar *language_id,
+                  GPtrArray   *snippets)
+{
+  GVariantIter *chunks;
+  GVariantIter *languages;
+  GVariantIter iter;
+  GVariant *children;
+  const gchar *trigger;
+  const gchar *language;
+  const gchar *description;
+  const gchar *spec;
+  gboolean found = FALSE;
+  gint tab_stop;
+
+  g_variant_get_child (variant, 3, "as", &languages);
+  while (!found && g_variant_iter_next (languages, "&s", &language))
+    found = (g_strcmp0 (language, language_id) == 0);
+  g_variant_iter_free (languages);
+
+  if (!found)
+    return;
+
+  children = g_variant_get_child_value (variant, 4);
+  g_variant_iter_init (&iter, children);
+
+  while (g_variant_iter_next (&iter, "(&s&s&sa(is))",
+                              &trigger, &language, &description, &chunks))
+    {
+      if (g_strcmp0 (language, language_id) == 0)
+        {
+          GbSourceSnippet *snippet;
+
+          snippet = gb_source_snippet_new (trigger, language);
+          if (*description)
+            gb_source_snippet_set_description (snippet, description);
+
+          while (g_variant_iter_next (chunks, "(i&s)", &tab_stop, &spec))
+            {
+              GbSourceSnippetChunk *chunk;
+
+              chunk = gb_source_snippet_chunk_new ();
+              gb_source_snippet_chunk_set_spec (chunk, spec);
+              gb_source_snippet_chunk_set_tab_stop (chunk, tab_stop);
+              gb_source_snippet_add_chunk (snippet, chunk);
+              g_object_unref (chunk);
+            }
+
+          g_ptr_array_add (snippets, snippet);
+        }
+
+      g_variant_iter_free (chunks);
+    }
+
+  g_variant_unref (children);
+}
+
+static void
+gb_source_snippets_manager_load_file (GFile     *file,
+                                      LoadState *state,
+                                      GPtrArray *snippets)
+{
+  GbSourceSnippetParser *parser;
+  GVariant *variant;
+  GError *error = NULL;
+  guint64 stamp;
+  guint64 size;
+  gchar *cache_path;
+
+  g_assert (G_IS_FILE (file));
+  g_assert (state);
+  g_assert (snippets);
+
+  if (!get_file_stamp (file, &stamp, &size))
+    return;
+
+  cache_path = get_cache_path (state->cache_dir, file);
+
+  if (!(variant = load_cache (cache_path, stamp, size)))
+    {
+      parser = gb_source_snippet_parser_new ();
+
+      if (!gb_source_snippet_parser_load_from_file (parser, file, &error))
+        {
+          gchar *uri = g_file_get_uri (file);
+
+          g_warning (_("Failed to load file: %s: %s"), uri, error->message);
+          g_clear_error (&error);
+          g_object_unref (parser);
+          g_free (cache_path);
+          g_free (uri);
+
+          return;
+        }
+
+      variant = compile_snippets (gb_source_snippet_parser_get_snippets (parser),
+                                  stamp, size);
+      save_cache (cache_path, variant);
+
+      g_object_unref (parser);
+    }
+
+  collect_snippets (variant, state->language_id, snippets);
+
+  g_variant_unref (variant);
+  g_free (cache_path);
+}
+
+static void
+gb_source_snippets_manager_load_worker (GTask        *task,
+                                        gpointer      source_object,
+                                        gpointer      task_data,
+                                        GCancellable *cancellable)
+{
+  LoadState *state = task_data;
+  GPtrArray *snippets;
+  const gchar *name;
+  gchar **names;
   GFile *file;
   GDir *dir;
+  guint i;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (state);
+
+  snippets = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_mkdir_with_parents (state->user_dir, 0700);
+  g_mkdir_with_parents (state->cache_dir, 0700);
+
+  /*
+   * Bundled snippets are loaded first so that user snippets with the same
+   * trigger replace them.
+   */
+  names = g_resources_enumerate_children (SNIPPETS_DIRECTORY,
+                                          G_RESOURCE_LOOKUP_FLAGS_NONE,
+                                          NULL);
 
-  dir = g_dir_open (path, 0, &error);
-  if (!dir)
+  for (i = 0; names && names [i]; i++)
     {
-      g_warning (_("Failed to open directory: %s"),
-                 error->message);
-      g_error_free (error);
-      return;
+      gchar *uri;
+
+      uri = g_strdup_printf ("resource://"SNIPPETS_DIRECTORY"%s", names [i]);
+      file = g_file_new_for_uri (uri);
+      gb_source_snippets_manager_load_file (file, state, snippets);
+      g_object_unref (file);
+      g_free (uri);
     }
 
-  while ((name = g_dir_read_name (dir)))
+  g_strfreev (names);
+
+  if ((dir = g_dir_open (state->user_dir, 0, NULL)))
     {
-      if (g_str_has_suffix (name, ".snippets"))
+      while ((name = g_dir_read_name (dir)))
         {
-          filename = g_build_filename (path, name, NULL);
+          gchar *filename;
+
+          if (!g_str_has_suffix (name, ".snippets"))
+            continue;
+
+          filename = g_build_filename (state->user_dir, name, NULL);
           file = g_file_new_for_path (filename);
-          if (!gb_source_snippets_manager_load_file (manager, file,
-                                                     &error))
-            {
-              g_warning (_("Failed to load file: %s: %s"),
-                         filename, error->message);
-              g_clear_error (&error);
-            }
+          gb_source_snippets_manager_load_file (file, state, snippets);
           g_object_unref (file);
           g_free (filename);
         }
+
+      g_dir_close (dir);
     }
 
-  g_dir_close (dir);
+  g_task_return_pointer (task, snippets, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+gb_source_snippets_manager_load_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+  GbSourceSnippets *snippets = user_data;
+  GPtrArray *ar;
+  guint i;
+
+  g_assert (G_IS_TASK (result));
+  g_assert (GB_IS_SOURCE_SNIPPETS (snippets));
+
+  if ((ar = g_task_propagate_pointer (G_TASK (result), NULL)))
+    {
+      for (i = 0; i < ar->len; i++)
+        gb_source_snippets_add (snippets, g_ptr_array_index (ar, i));
+      g_ptr_array_unref (ar);
+    }
+
+  g_object_unref (snippets);
 }
 
 GbSourceSnippetsManager *
 gb_source_snippets_manager_get_default (void)
 {
   static GbSourceSnippetsManager *instance;
-  gchar *path;
 
   if (!instance)
     {
       instance = g_object_new (GB_TYPE_SOURCE_SNIPPETS_MANAGER, NULL);
-      path = g_build_filename (g_get_user_config_dir (),
-                               "gnome-builder",
-                               "snippets",
-                               NULL);
-      g_mkdir_with_parents (path, 0700);
-      gb_source_snippets_manager_load_directory (instance, path);
-      g_free (path);
       g_object_add_weak_pointer (G_OBJECT (instance),
                                  (gpointer *) &instance);
+
+      /*
+       * Start resolving variables such as the git email now, rather than
+       * when the first snippet is expanded.
+       */
+      gb_source_snippet_variables_get_default ();
     }
 
   return instance;
 }
 
+/**
+ * gb_source_snippets_manager_get_for_language:
+ * @manager: A #GbSourceSnippetsManager.
+ * @language: A #GtkSourceLanguage.
+ *
+ * Gets the snippets for @language. The first time a language is requested
+ * an empty #GbSourceSnippets is returned and the snippet files are loaded
+ * into it from a worker thread. Completion providers holding the returned
+ * object will see the snippets as soon as they are loaded.
+ *
+ * Returns: (transfer none): A #GbSourceSnippets.
+ */
 GbSourceSnippets *
 gb_source_snippets_manager_get_for_language (GbSourceSnippetsManager *manager,
                                              GtkSourceLanguage       *language)
 {
   GbSourceSnippetsManagerPrivate *priv;
   GbSourceSnippets *snippets;
+  LoadState *state;
   const char *language_id;
+  GTask *task;
 
   g_return_val_if_fail (GB_IS_SOURCE_SNIPPETS_MANAGER (manager), NULL);
   g_return_val_if_fail (GTK_SOURCE_IS_LANGUAGE (language), NULL);
@@ -155,46 +515,32 @@ gb_source_snippets_manager_get_for_language (GbSourceSnippetsManager *manager,
   language_id = gtk_source_language_get_id (language);
   snippets = g_hash_table_lookup (priv->by_language_id, language_id);
 
-  return snippets;
-}
-
-static void
-gb_source_snippets_manager_constructed (GObject *object)
-{
-  GbSourceSnippetsManager *manager = (GbSourceSnippetsManager *)object;
-  GError *error = NULL;
-  GFile *file;
-  gchar *path;
-  gchar **names;
-  guint i;
-
-  g_assert (GB_IS_SOURCE_SNIPPETS_MANAGER (manager));
-
-  names = g_resources_enumerate_children (SNIPPETS_DIRECTORY,
-                                          G_RESOURCE_LOOKUP_FLAGS_NONE,
-                                          &error);
-
-  if (!names)
+  if (!snippets)
     {
-      g_message ("%s", error->message);
-      g_clear_error (&error);
-      return;
+      snippets = gb_source_snippets_new ();
+      g_hash_table_insert (priv->by_language_id,
+                           g_strdup (language_id),
+                           snippets);
+
+      state = g_slice_new0 (LoadState);
+      state->language_id = g_strdup (language_id);
+      state->user_dir = g_build_filename (g_get_user_config_dir (),
+                                          "gnome-builder",
+                                          "snippets",
+                                          NULL);
+      state->cache_dir = g_build_filename (g_get_user_cache_dir (),
+                                           "gnome-builder",
+                                           "snippets",
+                                           NULL);
+
+      task = g_task_new (manager, NULL, gb_source_snippets_manager_load_cb,
+                         g_object_ref (snippets));
+      g_task_set_task_data (task, state, load_state_free);
+      g_task_run_in_thread (task, gb_source_snippets_manager_load_worker);
+      g_object_unref (task);
     }
 
-  for (i = 0; names[i]; i++)
-    {
-      path = g_strdup_printf ("resource://"SNIPPETS_DIRECTORY"%s", names[i]);
-      file = g_file_new_for_uri (path);
-      if (!gb_source_snippets_manager_load_file (manager, file, &error))
-        {
-          g_message ("%s", error->message);
-          g_clear_error (&error);
-        }
-      g_free (path);
-      g_clear_object (&file);
-    }
-
-  g_strfreev (names);
+  return snippets;
 }
 
 static void
@@ -214,7 +560,6 @@ gb_source_snippets_manager_class_init (GbSourceSnippetsManagerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
-  object_class->constructed = gb_source_snippets_manager_constructed;
   object_class->finalize = gb_source_snippets_manager_finalize;
 }
 
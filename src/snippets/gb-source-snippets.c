@@ -99,30 +99,57 @@ gb_source_snippets_add (GbSourceSnippets *snippets,
   trie_insert (snippets->priv->snippets, trigger, g_object_ref (snippet));
 }
 
-gboolean
+typedef struct
+{
+  GFunc    func;
+  gpointer user_data;
+  guint    max_results;
+  guint    n_results;
+} ForeachState;
+
+static gboolean
 gb_source_snippets_foreach_cb (Trie        *trie,
                                const gchar *key,
                                gpointer     value,
                                gpointer     user_data)
 {
-  gpointer *closure = user_data;
+  ForeachState *state = user_data;
 
-  ((GFunc) closure[0])(value, closure[1]);
+  state->func (value, state->user_data);
 
-  return FALSE;
+  /*
+   * Returning TRUE stops the traversal once we have visited as many
+   * snippets as the caller asked for.
+   */
+  return (state->max_results && ++state->n_results >= state->max_results);
 }
 
-void
-gb_source_snippets_foreach (GbSourceSnippets *snippets,
-                            const gchar      *prefix,
-                            GFunc             foreach_func,
-                            gpointer          user_data)
+/**
+ * gb_source_snippets_foreach_limit:
+ * @snippets: A #GbSourceSnippets.
+ * @prefix: (allow-none): The prefix to match, or %NULL for all snippets.
+ * @max_results: The maximum number of snippets to visit, or 0 for no limit.
+ * @foreach_func: A callback for each matching snippet.
+ * @user_data: User data for @foreach_func.
+ *
+ * Calls @foreach_func for every snippet whose trigger starts with @prefix.
+ * Only the subtree of the trie below @prefix is walked, so the caller does
+ * not need to check the trigger again.
+ *
+ * Returns: The number of snippets visited.
+ */
+guint
+gb_source_snippets_foreach_limit (GbSourceSnippets *snippets,
+                                  const gchar      *prefix,
+                                  guint             max_results,
+                                  GFunc             foreach_func,
+                                  gpointer          user_data)
 {
   GbSourceSnippetsPrivate *priv;
-  gpointer closure[2] = { foreach_func, user_data };
+  ForeachState state = { foreach_func, user_data, max_results, 0 };
 
-  g_return_if_fail (GB_IS_SOURCE_SNIPPETS (snippets));
-  g_return_if_fail (foreach_func);
+  g_return_val_if_fail (GB_IS_SOURCE_SNIPPETS (snippets), 0);
+  g_return_val_if_fail (foreach_func, 0);
 
   priv = snippets->priv;
 
@@ -135,7 +162,19 @@ gb_source_snippets_foreach (GbSourceSnippets *snippets,
                  G_TRAVERSE_LEAVES,
                  -1,
                  gb_source_snippets_foreach_cb,
-                 (gpointer) closure);
+                 &state);
+
+  return state.n_results;
+}
+
+void
+gb_source_snippets_foreach (GbSourceSnippets *snippets,
+                            const gchar      *prefix,
+                            GFunc             foreach_func,
+                            gpointer          user_data)
+{
+  gb_source_snippets_foreach_limit (snippets, prefix, 0, foreach_func,
+                                    user_data);
 }
 
 static void
@@ -61,6 +61,11 @@ void              gb_source_snippets_foreach        (GbSourceSnippets *snippets,
                                                      const gchar      *prefix,
                                                      GFunc             foreach_func,
                                                      gpointer          user_data);
+guint             gb_source_snippets_foreach_limit  (GbSourceSnippets *snippets,
+                                                     const gchar      *prefix,
+                                                     guint             max_results,
+                                                     GFunc             foreach_func,
+                                                     gpointer          user_data);
 
 G_END_DECLS
 
@@ -19,11 +19,13 @@
 #include <gtk/gtk.h>
 #include <string.h>
 
+#include "gb-application.h"
 #include "gb-support.h"
 
 gchar *
 gb_get_support_log (void)
 {
+  GApplication *app;
   GChecksum *checksum;
   GDateTime *now;
   GString *str;
@@ -91,6 +93,19 @@ gb_get_support_log (void)
     }
   g_string_append (str, "\n");
 
+  /*
+   * Log how long each startup phase took.
+   */
+  app = g_application_get_default ();
+  if (GB_IS_APPLICATION (app))
+    {
+      g_string_append (str, "[runtime.startup]\n");
+      tmp = gb_application_get_startup_profile (GB_APPLICATION (app));
+      g_string_append (str, tmp);
+      g_free (tmp);
+      g_string_append (str, "\n");
+    }
+
   /*
    * Log the environment variables.
    */
@@ -43,6 +43,12 @@
  * To insert a key and value pair into the #Trie use trie_insert().
  * To remove a key from the #Trie use trie_remove().
  * To traverse all children of the #Trie from a given key use trie_traverse().
+ *
+ * Chains of nodes that have a single child and no value are collapsed into
+ * one node carrying the bytes of the chain as its label, so long shared
+ * prefixes such as "gtk_source_" do not cost a node per byte. Nodes and
+ * chunks are carved out of cache line aligned blocks owned by the #Trie,
+ * which are released all at once by trie_destroy().
  */
 
 typedef struct _TrieNode      TrieNode;
@@ -66,9 +72,24 @@ typedef struct _TrieNodeChunk TrieNodeChunk;
 #define TRIE_NODE_CHUNK_KEYS(c) (((c)->is_inline) ? 3 : 5)
 #endif
 
+/*
+ * The label of a node is stored directly after its inline chunk, and the
+ * allocation is rounded up to whole cache lines so that the next node in
+ * the arena starts on a fresh line.
+ */
+#define TRIE_MAX_LABEL           127
+#define TRIE_NODE_LABEL(n)       (((guint8 *)(n)) + TRIE_NODE_SIZE)
+#define TRIE_NODE_ALLOC_SIZE(l)  (TRIE_NODE_SIZE + \
+                                  ((((l) + TRIE_NODE_SIZE - 1) / \
+                                    TRIE_NODE_SIZE) * TRIE_NODE_SIZE))
+#define TRIE_N_SIZE_CLASSES      (TRIE_NODE_ALLOC_SIZE(TRIE_MAX_LABEL) / \
+                                  TRIE_NODE_SIZE + 1)
+#define TRIE_ARENA_MIN_BLOCK     (TRIE_NODE_SIZE * 16)
+#define TRIE_ARENA_MAX_BLOCK     (TRIE_NODE_SIZE * 1024)
+
 /**
  * TrieNodeChunk:
- * @flags: Flags describing behaviors of the TrieNodeChunk.
+ * @label_len: The length of the node label. Only used by inline chunks.
  * @count: The number of items added to this chunk.
  * @keys: The keys for @children.
  * @next: The next #TrieNodeChunk if there is one.
@@ -80,7 +101,7 @@ struct _TrieNodeChunk
 {
    TrieNodeChunk *next;
    gboolean       is_inline : 1;
-   guint          flags : 7;
+   guint          label_len : 7;
    guint          count : 8;
    guint8         keys[6];
    TrieNode      *children[0];
@@ -94,6 +115,10 @@ struct _TrieNodeChunk
  * @value: A pointer to the user provided value, or %NULL.
  * @chunk: The first chunk in the chain. Inline chunks have fewer children
  *    elements than extra allocated chunks so that they are cache aligned.
+ *
+ * The key byte leading to a node is stored in its parent's chunk. Any
+ * further bytes of the path up to the node are stored in the node label,
+ * which follows the node in memory.
  */
 #pragma pack(push, 1)
 struct _TrieNode
@@ -104,15 +129,39 @@ struct _TrieNode
 };
 #pragma pack(pop)
 
+/**
+ * TrieArenaBlock:
+ * @next: The previously allocated block.
+ *
+ * A block of memory that nodes and chunks are allocated from. The usable
+ * memory starts at the first cache line following the header.
+ */
+typedef struct _TrieArenaBlock TrieArenaBlock;
+
+struct _TrieArenaBlock
+{
+   TrieArenaBlock *next;
+};
+
 /**
  * Trie:
  * @value_destroy: A #GDestroyNotify to free data pointers.
  * @root: The root TrieNode.
+ * @blocks: The arena blocks, most recent first.
+ * @block_size: The size of the next block to allocate.
+ * @arena_pos: The next free byte in the current block.
+ * @arena_end: The end of the current block.
+ * @free_lists: Released allocations, by number of cache lines.
  */
 struct _Trie
 {
    GDestroyNotify  value_destroy;
    TrieNode       *root;
+   TrieArenaBlock *blocks;
+   gsize           block_size;
+   guint8         *arena_pos;
+   guint8         *arena_end;
+   gpointer        free_lists[TRIE_N_SIZE_CLASSES];
 };
 
 /**
@@ -120,8 +169,12 @@ struct _Trie
  * @trie: A #Trie
  * @size: Number of bytes to allocate.
  *
- * Wrapper function to allocate a memory chunk. This gives us somewhere to
- * perform the abstraction if we want to use mmap()'d I/O at some point.
+ * Allocates @size bytes from the arena of @trie. @size must be a multiple
+ * of TRIE_NODE_SIZE. Memory released with trie_free() is reused first,
+ * otherwise the allocation is carved from the current block. Blocks start
+ * small, since many tries only hold a handful of keys, and double in size
+ * as the trie grows.
+ *
  * The memory will be zero'd before being returned.
  *
  * Returns: A pointer to the allocation.
@@ -130,43 +183,102 @@ static gpointer
 trie_malloc0 (Trie  *trie,
               gsize  size)
 {
-   return g_malloc0(size);
+   TrieArenaBlock *block;
+   gpointer ret;
+   guint size_class;
+
+   g_assert(trie);
+   g_assert(size && !(size % TRIE_NODE_SIZE));
+
+   size_class = size / TRIE_NODE_SIZE;
+   g_assert(size_class < TRIE_N_SIZE_CLASSES);
+
+   if ((ret = trie->free_lists[size_class])) {
+      trie->free_lists[size_class] = *(gpointer *)ret;
+      memset(ret, 0, size);
+      return ret;
+   }
+
+   if ((trie->arena_pos + size) > trie->arena_end) {
+      trie->block_size = CLAMP(trie->block_size * 2,
+                               TRIE_ARENA_MIN_BLOCK,
+                               TRIE_ARENA_MAX_BLOCK);
+      block = g_malloc0(TRIE_NODE_SIZE + trie->block_size);
+      block->next = trie->blocks;
+      trie->blocks = block;
+      /*
+       * Skip past the header to the first aligned cache line. g_malloc()
+       * only guarantees pointer alignment, so the usable region may be a
+       * little shorter than block_size.
+       */
+      trie->arena_pos = (guint8 *)(((gsize)(block + 1) + TRIE_NODE_SIZE - 1) &
+                                   ~(gsize)(TRIE_NODE_SIZE - 1));
+      trie->arena_end = ((guint8 *)block) + TRIE_NODE_SIZE + trie->block_size;
+   }
+
+   ret = trie->arena_pos;
+   trie->arena_pos += size;
+
+   return ret;
 }
 
 /**
  * trie_free:
  * @trie: A #Trie.
  * @data: The data to free.
+ * @size: The size of @data.
  *
- * Frees a portion of memory allocated by @trie.
+ * Releases a portion of memory allocated by @trie so that it may be reused
+ * by a later allocation. The memory is returned to the system when @trie
+ * is destroyed.
  */
 static void
 trie_free (Trie     *trie,
-           gpointer  data)
+           gpointer  data,
+           gsize     size)
 {
-   g_free(data);
+   guint size_class;
+
+   g_assert(trie);
+   g_assert(data);
+
+   size_class = size / TRIE_NODE_SIZE;
+   g_assert(size_class < TRIE_N_SIZE_CLASSES);
+
+   *(gpointer *)data = trie->free_lists[size_class];
+   trie->free_lists[size_class] = data;
 }
 
 /**
  * trie_node_new:
  * @trie: A #Trie.
  * @parent: The nodes parent or %NULL.
+ * @label: The label for the node.
+ * @label_len: The length of @label, at most TRIE_MAX_LABEL.
  *
  * Create a new node that can be placed in a Trie. The node contains a chunk
  * embedded in it that may contain only 4 pointers instead of the full 6 do
  * to the overhead of the TrieNode itself.
  *
- * Returns: A newly allocated TrieNode that should be freed with g_free().
+ * Returns: A newly allocated TrieNode that should be freed with trie_free().
  */
 TrieNode *
-trie_node_new (Trie     *trie,
-               TrieNode *parent)
+trie_node_new (Trie        *trie,
+               TrieNode    *parent,
+               const gchar *label,
+               guint        label_len)
 {
    TrieNode *node;
 
-   node = trie_malloc0(trie, TRIE_NODE_SIZE);
+   g_assert(label_len <= TRIE_MAX_LABEL);
+
+   node = trie_malloc0(trie, TRIE_NODE_ALLOC_SIZE(label_len));
    node->chunk.is_inline = TRUE;
+   node->chunk.label_len = label_len;
    node->parent = parent;
+   if (label_len) {
+      memcpy(TRIE_NODE_LABEL(node), label, label_len);
+   }
    return node;
 }
 
@@ -320,46 +432,129 @@ trie_find_node (Trie     *trie,
 }
 
 /**
- * trie_find_or_create_node:
+ * trie_node_add_child:
  * @trie: A #Trie.
  * @node: A #TrieNode.
- * @key: The key to insert.
+ * @key: The key for @child.
+ * @child: The #TrieNode to add.
+ *
+ * Appends @child to the last chunk in the chain of @node.
+ */
+static void
+trie_node_add_child (Trie     *trie,
+                     TrieNode *node,
+                     guint8    key,
+                     TrieNode *child)
+{
+   TrieNodeChunk *last;
+
+   g_assert(node);
+   g_assert(child);
+
+   for (last = &node->chunk; last->next; last = last->next) { }
+
+   trie_append_to_node(trie, node, last, key, child);
+}
+
+/**
+ * trie_node_split:
+ * @trie: A #Trie.
+ * @node: A #TrieNode.
+ * @offset: The position within the label of @node to split at.
  *
- * Attempts to find key within @node. If @key is not found, it is added to the
- * node. The child for the key is returned.
+ * Inserts a new node between @node and its parent, taking the first
+ * @offset bytes of the label of @node. The byte at @offset becomes the
+ * key for @node within the new node, and the rest stays in the label of
+ * @node. The allocation of @node is kept as is, since labels only shrink.
  *
- * Returns: (transfer none): The child #TrieNode for @key.
+ * Returns: (transfer none): The new #TrieNode.
  */
 static TrieNode *
-trie_find_or_create_node (Trie     *trie,
-                          TrieNode *node,
-                          guint8    key)
+trie_node_split (Trie     *trie,
+                 TrieNode *node,
+                 guint     offset)
 {
    TrieNodeChunk *iter;
-   TrieNodeChunk *last = NULL;
+   TrieNode *parent;
+   TrieNode *split;
+   guint8 *label;
+   guint label_len;
    guint i;
 
    g_assert(node);
+   g_assert(node->parent);
+   g_assert(offset < node->chunk.label_len);
 
-   for (iter = &node->chunk; iter; iter = iter->next) {
+   parent = node->parent;
+   label = TRIE_NODE_LABEL(node);
+   label_len = node->chunk.label_len;
+
+   split = trie_node_new(trie, parent, (const gchar *)label, offset);
+
+   for (iter = &parent->chunk; iter; iter = iter->next) {
       for (i = 0; i < iter->count; i++) {
-         if (iter->keys[i] == key) {
-            if (iter != &node->chunk) {
-               trie_node_move_to_front(node, iter, i);
-               __builtin_prefetch(node->chunk.children[0]);
-               return node->chunk.children[0];
-            }
-            __builtin_prefetch(iter->children[i]);
-            return iter->children[i];
+         if (iter->children[i] == node) {
+            iter->children[i] = split;
+            goto found;
          }
       }
-      last = iter;
    }
 
-   g_assert(last);
+   g_assert_not_reached();
+
+found:
+   split->chunk.keys[0] = label[offset];
+   split->chunk.children[0] = node;
+   split->chunk.count = 1;
+
+   memmove(label, label + offset + 1, label_len - offset - 1);
+   node->chunk.label_len = label_len - offset - 1;
+   node->parent = split;
+
+   return split;
+}
+
+/**
+ * trie_find_key:
+ * @trie: A #Trie.
+ * @key: The key to find.
+ * @label_pos: (out): The position within the label of the result.
+ *
+ * Walks @trie following @key. If @key ends in the middle of a node label,
+ * that node is returned and @label_pos is set to the number of label bytes
+ * that matched. Otherwise @label_pos is the full length of the label.
+ *
+ * Returns: (transfer none): A #TrieNode or %NULL.
+ */
+static TrieNode *
+trie_find_key (Trie        *trie,
+               const gchar *key,
+               guint       *label_pos)
+{
+   TrieNode *node;
+   guint8 *label;
+   guint pos = 0;
+
+   g_assert(trie);
+   g_assert(key);
+   g_assert(label_pos);
+
+   node = trie->root;
+
+   while (*key) {
+      if (!(node = trie_find_node(trie, node, *key++))) {
+         return NULL;
+      }
+      label = TRIE_NODE_LABEL(node);
+      for (pos = 0; (pos < node->chunk.label_len) && *key; pos++, key++) {
+         if (label[pos] != (guint8)*key) {
+            return NULL;
+         }
+      }
+   }
+
+   *label_pos = pos;
 
-   node = trie_node_new(trie, node);
-   trie_append_to_node(trie, node->parent, last, key, node);
    return node;
 }
 
@@ -461,14 +656,14 @@ trie_destroy_node (Trie           *trie,
    for (iter = node->chunk.next; iter;) {
       tmp = iter;
       iter = iter->next;
-      trie_free(trie, tmp);
+      trie_free(trie, tmp, TRIE_NODE_CHUNK_SIZE);
    }
 
    if (node->value && value_destroy) {
       value_destroy(node->value);
    }
 
-   trie_free(trie, node);
+   trie_free(trie, node, TRIE_NODE_ALLOC_SIZE(node->chunk.label_len));
 }
 
 /**
@@ -495,7 +690,7 @@ trie_new (GDestroyNotify value_destroy)
 #endif
 
    trie = g_new0(Trie, 1);
-   trie->root = trie_node_new(trie, NULL);
+   trie->root = trie_node_new(trie, NULL, NULL, 0);
    trie->value_destroy = value_destroy;
 
    return trie;
@@ -514,17 +709,45 @@ trie_insert (Trie        *trie,
              const gchar *key,
              gpointer     value)
 {
+   TrieNode *child;
    TrieNode *node;
+   guint8 *label;
+   guint8 c;
+   gsize len;
+   guint i;
 
    g_return_if_fail(trie);
    g_return_if_fail(key);
    g_return_if_fail(value);
 
    node = trie->root;
+   len = strlen(key);
 
    while (*key) {
-      node = trie_find_or_create_node(trie, node, *key);
-      key++;
+      c = *key++;
+      len--;
+
+      if (!(child = trie_find_node(trie, node, c))) {
+         /*
+          * Nothing shares this prefix, so the rest of the key goes into the
+          * label of a single new node (or a few, for very long keys).
+          */
+         i = MIN(len, TRIE_MAX_LABEL);
+         child = trie_node_new(trie, node, key, i);
+         trie_node_add_child(trie, node, c, child);
+      } else {
+         label = TRIE_NODE_LABEL(child);
+         for (i = 0;
+              (i < child->chunk.label_len) && (label[i] == (guint8)key[i]);
+              i++) { }
+         if (i < child->chunk.label_len) {
+            child = trie_node_split(trie, child, i);
+         }
+      }
+
+      node = child;
+      key += i;
+      len -= i;
    }
 
    if (node->value && trie->value_destroy) {
@@ -548,6 +771,7 @@ trie_lookup (Trie        *trie,
              const gchar *key)
 {
    TrieNode *node;
+   guint pos;
 
    __builtin_prefetch(trie);
    __builtin_prefetch(key);
@@ -555,14 +779,9 @@ trie_lookup (Trie        *trie,
    g_return_val_if_fail(trie, NULL);
    g_return_val_if_fail(key, NULL);
 
-   node = trie->root;
-
-   while (*key && node) {
-      node = trie_find_node(trie, node, *key);
-      key++;
-   }
+   node = trie_find_key(trie, key, &pos);
 
-   return node ? node->value : NULL;
+   return (node && (pos == node->chunk.label_len)) ? node->value : NULL;
 }
 
 /**
@@ -580,25 +799,22 @@ trie_remove (Trie        *trie,
              const gchar *key)
 {
    TrieNode *node;
+   guint pos;
 
    g_return_val_if_fail(trie, FALSE);
    g_return_val_if_fail(key, FALSE);
 
-   node = trie->root;
-
-   while (*key && node) {
-      node = trie_find_node(trie, node, *key);
-      key++;
-   }
+   node = trie_find_key(trie, key, &pos);
 
-   if (node && node->value) {
+   if (node && (pos == node->chunk.label_len) && node->value) {
       if (trie->value_destroy) {
          trie->value_destroy(node->value);
       }
 
       node->value = NULL;
 
-      if (!node->chunk.count) {
+      /* The root is never released, even when it no longer has a value. */
+      if (!node->chunk.count && node->parent) {
          while (node->parent &&
                 node->parent->parent &&
                 !node->parent->value &&
@@ -618,6 +834,7 @@ trie_remove (Trie        *trie,
  * trie_traverse_node_pre_order:
  * @trie: A #Trie.
  * @node: A #TrieNode.
+ * @label_pos: The number of label bytes of @node already in @str.
  * @str: The prefix for this node.
  * @flags: The flags for which nodes to callback.
  * @max_depth: the maximum depth to process.
@@ -630,11 +847,16 @@ trie_remove (Trie        *trie,
  * This assumes that the order is %G_POST_ORDER, and therefore does not
  * have the conditionals to check pre-vs-pre ordering.
  *
+ * Each byte of the label of @node that is not yet in @str is treated as a
+ * node without a value, so that depth and %G_TRAVERSE_NON_LEAVES behave
+ * as if the label had not been collapsed into @node.
+ *
  * Returns: %TRUE if traversal was cancelled; otherwise %FALSE.
  */
 static gboolean
 trie_traverse_node_pre_order (Trie             *trie,
                               TrieNode         *node,
+                              guint             label_pos,
                               GString          *str,
                               GTraverseFlags    flags,
                               gint              max_depth,
@@ -649,7 +871,18 @@ trie_traverse_node_pre_order (Trie             *trie,
    g_assert(node);
    g_assert(str);
 
-   if (max_depth) {
+   if (max_depth && (label_pos < node->chunk.label_len)) {
+      if ((flags & G_TRAVERSE_NON_LEAVES) &&
+          func(trie, str->str, NULL, user_data)) {
+         return TRUE;
+      }
+      g_string_append_c(str, TRIE_NODE_LABEL(node)[label_pos]);
+      if (trie_traverse_node_pre_order(trie, node, label_pos + 1, str, flags,
+                                       max_depth - 1, func, user_data)) {
+         return TRUE;
+      }
+      g_string_truncate(str, str->len - 1);
+   } else if (max_depth) {
       if ((!node->value && (flags & G_TRAVERSE_NON_LEAVES)) ||
           (node->value && (flags & G_TRAVERSE_LEAVES))) {
          if (func(trie, str->str, node->value, user_data)) {
@@ -661,6 +894,7 @@ trie_traverse_node_pre_order (Trie             *trie,
             g_string_append_c(str, iter->keys[i]);
             if (trie_traverse_node_pre_order(trie,
                                              iter->children[i],
+                                             0,
                                              str,
                                              flags,
                                              max_depth - 1,
@@ -680,6 +914,7 @@ trie_traverse_node_pre_order (Trie             *trie,
  * trie_traverse_node_post_order:
  * @trie: A #Trie.
  * @node: A #TrieNode.
+ * @label_pos: The number of label bytes of @node already in @str.
  * @str: The prefix for this node.
  * @flags: The flags for which nodes to callback.
  * @max_depth: the maximum depth to process.
@@ -692,11 +927,16 @@ trie_traverse_node_pre_order (Trie             *trie,
  * This assumes that the order is %G_POST_ORDER, and therefore does not
  * have the conditionals to check pre-vs-post ordering.
  *
+ * Each byte of the label of @node that is not yet in @str is treated as a
+ * node without a value, so that depth and %G_TRAVERSE_NON_LEAVES behave
+ * as if the label had not been collapsed into @node.
+ *
  * Returns: %TRUE if traversal was cancelled; otherwise %FALSE.
  */
 static gboolean
 trie_traverse_node_post_order (Trie             *trie,
                                TrieNode         *node,
+                               guint             label_pos,
                                GString          *str,
                                GTraverseFlags    flags,
                                gint              max_depth,
@@ -711,12 +951,23 @@ trie_traverse_node_post_order (Trie             *trie,
    g_assert(node);
    g_assert(str);
 
-   if (max_depth) {
+   if (max_depth && (label_pos < node->chunk.label_len)) {
+      g_string_append_c(str, TRIE_NODE_LABEL(node)[label_pos]);
+      if (trie_traverse_node_post_order(trie, node, label_pos + 1, str, flags,
+                                        max_depth - 1, func, user_data)) {
+         return TRUE;
+      }
+      g_string_truncate(str, str->len - 1);
+      if (flags & G_TRAVERSE_NON_LEAVES) {
+         ret = func(trie, str->str, NULL, user_data);
+      }
+   } else if (max_depth) {
       for (iter = &node->chunk; iter; iter = iter->next) {
          for (i = 0; i < iter->count; i++) {
             g_string_append_c(str, iter->keys[i]);
             if (trie_traverse_node_post_order(trie,
                                               iter->children[i],
+                                              0,
                                               str,
                                               flags,
                                               max_depth - 1,
@@ -765,26 +1016,22 @@ trie_traverse (Trie             *trie,
 {
    TrieNode *node;
    GString *str;
+   guint pos;
 
    g_return_if_fail(trie);
    g_return_if_fail(func);
 
-   node = trie->root;
    key = key ? key : "";
 
    str = g_string_new(key);
-
-   while (*key && node) {
-      node = trie_find_node(trie, node, *key);
-      key++;
-   }
+   node = trie_find_key(trie, key, &pos);
 
    if (node) {
       if (order == G_PRE_ORDER) {
-         trie_traverse_node_pre_order(trie, node, str, flags,
+         trie_traverse_node_pre_order(trie, node, pos, str, flags,
                                       max_depth, func, user_data);
       } else if (order == G_POST_ORDER) {
-         trie_traverse_node_post_order(trie, node, str, flags,
+         trie_traverse_node_post_order(trie, node, pos, str, flags,
                                        max_depth, func, user_data);
       } else {
          g_warning(_("Traversal order %u is not supported on Trie."), order);
@@ -794,17 +1041,56 @@ trie_traverse (Trie             *trie,
    g_string_free(str, TRUE);
 }
 
+/**
+ * trie_destroy_values:
+ * @trie: A #Trie.
+ * @node: A #TrieNode.
+ *
+ * Calls the value destroy function of @trie for every value found in @node
+ * or any of its children.
+ */
+static void
+trie_destroy_values (Trie     *trie,
+                     TrieNode *node)
+{
+   TrieNodeChunk *iter;
+   guint i;
+
+   g_assert(trie);
+   g_assert(node);
+   g_assert(trie->value_destroy);
+
+   if (node->value) {
+      trie->value_destroy(node->value);
+   }
+
+   for (iter = &node->chunk; iter; iter = iter->next) {
+      for (i = 0; i < iter->count; i++) {
+         trie_destroy_values(trie, iter->children[i]);
+      }
+   }
+}
+
 /**
  * trie_destroy:
  * @trie: A #Trie or %NULL.
  *
- * Frees @trie and all associated memory.
+ * Frees @trie and all associated memory. Nodes are not unlinked one by
+ * one; the arena blocks they were allocated from are simply released.
  */
 void
 trie_destroy (Trie *trie)
 {
+   TrieArenaBlock *block;
+
    if (trie) {
-      trie_destroy_node(trie, trie->root, trie->value_destroy);
+      if (trie->value_destroy) {
+         trie_destroy_values(trie, trie->root);
+      }
+      while ((block = trie->blocks)) {
+         trie->blocks = block->next;
+         g_free(block);
+      }
       trie->root = NULL;
       trie->value_destroy = NULL;
       g_free(trie);
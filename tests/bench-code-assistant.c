@@ -0,0 +1,218 @@
+/* bench-code-assistant.c
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the two ways of writing a buffer to the temporary file handed
+ * to the code-assistance service. The old path copied the whole buffer and
+ * rewrote the file with g_file_set_contents(), the new one is the
+ * gb_source_code_assistant_write_buffer() used by GbSourceCodeAssistant.
+ * After each write the file is read back by path, as gnome-code-assistance
+ * does with the data_path argument of Parse.
+ *
+ * Only writing and reading back the file is measured. The D-Bus round trip
+ * and the parse itself are the same for both paths and are not included.
+ *
+ * Sizes on the command line are in bytes. "results" is the number of bytes
+ * the kernel reported as written to storage per submission.
+ */
+
+#include <glib/gstdio.h>
+
+#include "bench-common.h"
+#include "gb-source-code-assistant-private.h"
+
+#define N_SUBMITS 50
+
+typedef enum
+{
+  SUBMIT_SET_CONTENTS,
+  SUBMIT_PWRITE,
+  SUBMIT_LAST
+} SubmitMode;
+
+static const gchar *submit_names[] = {
+  "set-contents", "pwrite",
+};
+
+static guint64
+get_write_bytes (void)
+{
+  gchar *contents = NULL;
+  gchar *line;
+  guint64 ret = 0;
+
+  if (!g_file_get_contents ("/proc/self/io", &contents, NULL, NULL))
+    return 0;
+
+  if ((line = strstr (contents, "\nwrite_bytes: ")))
+    ret = g_ascii_strtoull (line + strlen ("\nwrite_bytes: "), NULL, 10);
+
+  g_free (contents);
+
+  return ret;
+}
+
+static gboolean
+submit_set_contents (const gchar   *path,
+                     GtkTextBuffer *buffer)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  gboolean ret;
+  gchar *text;
+
+  gtk_text_buffer_get_bounds (buffer, &begin, &end);
+  text = gtk_text_buffer_get_text (buffer, &begin, &end, TRUE);
+  ret = g_file_set_contents (path, text, -1, NULL);
+  g_free (text);
+
+  return ret;
+}
+
+static gboolean
+read_back (const gchar *data_path,
+           gsize        expected)
+{
+  gchar *contents = NULL;
+  gsize len = 0;
+
+  if (!g_file_get_contents (data_path, &contents, &len, NULL))
+    return FALSE;
+
+  g_free (contents);
+
+  return (len == expected);
+}
+
+static gchar *
+make_source (gsize len)
+{
+  GString *str;
+  GRand *rand;
+
+  rand = g_rand_new_with_seed (len);
+  str = g_string_sized_new (len + 64);
+
+  while (str->len < len)
+    g_string_append_printf (str, "  %s_%s (%s, %u);\n",
+                            BENCH_PICK (rand, bench_words),
+                            BENCH_PICK (rand, bench_words),
+                            BENCH_PICK (rand, bench_words),
+                            g_rand_int (rand));
+
+  g_string_truncate (str, len);
+  g_rand_free (rand);
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+run_bench (SubmitMode     mode,
+           GtkTextBuffer *buffer,
+           gsize          len)
+{
+  gint64 samples [N_SUBMITS];
+  guint64 write_before;
+  guint64 write_after;
+  gchar *path = NULL;
+  gint64 begin;
+  gsize heap_before;
+  gsize heap_after;
+  guint i;
+  int fd;
+
+  fd = g_file_open_tmp ("builder-code-assistant-XXXXXX.c", &path, NULL);
+  if (fd == -1)
+    g_error ("Failed to create temporary file");
+
+  heap_before = bench_heap_size ();
+  write_before = get_write_bytes ();
+
+  for (i = 0; i < N_SUBMITS; i++)
+    {
+      gboolean ret = FALSE;
+
+      begin = bench_now ();
+
+      switch (mode)
+        {
+        case SUBMIT_SET_CONTENTS:
+          ret = submit_set_contents (path, buffer);
+          break;
+
+        case SUBMIT_PWRITE:
+          ret = gb_source_code_assistant_write_buffer (buffer, fd, NULL);
+          break;
+
+        case SUBMIT_LAST:
+        default:
+          g_assert_not_reached ();
+        }
+
+      if (!ret || !read_back (path, len))
+        g_error ("Submission %u failed", i);
+
+      samples [i] = bench_now () - begin;
+    }
+
+  write_after = get_write_bytes ();
+  heap_after = bench_heap_size ();
+
+  bench_report ("code-assistant", "submit", "source", submit_names [mode],
+                len, 0.0, samples, N_SUBMITS,
+                (heap_after > heap_before) ? heap_after - heap_before : 0,
+                (gdouble)(write_after - write_before) / N_SUBMITS);
+
+  close (fd);
+  g_unlink (path);
+  g_free (path);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  GArray *sizes;
+  guint i;
+  guint j;
+
+  sizes = bench_parse_sizes (argc, argv);
+
+  for (i = 0; i < sizes->len; i++)
+    {
+      guint len = g_array_index (sizes, guint, i);
+      GtkTextBuffer *buffer;
+      gchar *data;
+
+      data = make_source (len);
+      buffer = gtk_text_buffer_new (NULL);
+      gtk_text_buffer_set_text (buffer, data, len);
+
+      for (j = 0; j < SUBMIT_LAST; j++)
+        run_bench (j, buffer, len);
+
+      g_object_unref (buffer);
+      g_free (data);
+    }
+
+  g_array_unref (sizes);
+
+  bench_report_process ("code-assistant");
+
+  return 0;
+}
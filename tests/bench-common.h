@@ -0,0 +1,315 @@
+/* bench-common.h
+ *
+ * Copyright (C) 2015 Christian Hergert <christian@hergert.me>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/*
+ * Helpers shared by the bench-* programs. Each benchmark prints one JSON
+ * object per line so that results can be collected and compared by CI
+ * without scraping human readable output.
+ *
+ * Not every program uses every helper, so they are inline to keep -Wall
+ * quiet about the ones a program does not need.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/*
+ * __GLIBC_PREREQ is only defined by glibc, so it cannot be used in the
+ * same #if as the check for __GLIBC__.
+ */
+#ifdef __GLIBC__
+# include <malloc.h>
+# if __GLIBC_PREREQ(2, 33)
+#  define BENCH_HAVE_MALLINFO2
+# endif
+#endif
+
+#define BENCH_N_QUERIES 1000
+
+#define BENCH_PICK(rand,words) \
+  ((words) [g_rand_int_range ((rand), 0, G_N_ELEMENTS (words))])
+
+typedef enum
+{
+  BENCH_CORPUS_PATHS,
+  BENCH_CORPUS_SYMBOLS,
+  BENCH_CORPUS_UNICODE,
+  BENCH_CORPUS_LAST
+} BenchCorpus;
+
+static const guint bench_default_sizes[] = {
+  10000, 100000, 1000000, 5000000,
+};
+
+static const gchar *bench_corpus_names[] G_GNUC_UNUSED = {
+  "paths", "symbols", "unicode",
+};
+
+static const gchar *bench_dirs[] = {
+  "src", "app", "editor", "search", "git", "snippets", "trie", "fuzzy",
+  "util", "workbench", "tests", "data", "plugins", "resources", "log",
+};
+
+static const gchar *bench_words[] = {
+  "gb", "editor", "search", "view", "source", "snippet", "git", "provider",
+  "context", "document", "manager", "workbench", "trie", "fuzzy", "log",
+  "get", "set", "buffer", "iter", "new", "free", "changed", "result",
+};
+
+static const gchar *bench_unicode_words[] = {
+  "gb", "éditeur", "recherche", "vue", "источник", "фрагмент", "git",
+  "提供者", "contexte", "文書", "gestionnaire", "Werkbank", "trie", "fuzzy",
+  "журнал",
+};
+
+/*
+ * Generates @n_keys unique keys shaped like the data the editor indexes:
+ * file paths from a git tree, C symbols from a tags file, or paths using
+ * multibyte characters. The seed only depends on the corpus and size, so
+ * every run produces exactly the same keys.
+ */
+static inline gchar **
+bench_corpus_new (BenchCorpus corpus,
+                  guint       n_keys)
+{
+  GString *str;
+  GRand *rand;
+  gchar **keys;
+  guint i;
+  guint j;
+
+  rand = g_rand_new_with_seed ((corpus << 24) ^ n_keys);
+  keys = g_new0 (gchar *, n_keys + 1);
+  str = g_string_new (NULL);
+
+  for (i = 0; i < n_keys; i++)
+    {
+      guint n_words = g_rand_int_range (rand, 2, 5);
+
+      g_string_truncate (str, 0);
+
+      switch (corpus)
+        {
+        case BENCH_CORPUS_PATHS:
+          for (j = g_rand_int_range (rand, 1, 4); j > 0; j--)
+            {
+              g_string_append (str, BENCH_PICK (rand, bench_dirs));
+              g_string_append_c (str, '/');
+            }
+          for (j = 0; j < n_words; j++)
+            {
+              if (j)
+                g_string_append_c (str, '-');
+              g_string_append (str, BENCH_PICK (rand, bench_words));
+            }
+          g_string_append_printf (str, "-%u.c", i);
+          break;
+
+        case BENCH_CORPUS_SYMBOLS:
+          for (j = 0; j < n_words; j++)
+            {
+              if (j)
+                g_string_append_c (str, '_');
+              g_string_append (str, BENCH_PICK (rand, bench_words));
+            }
+          g_string_append_printf (str, "_%u", i);
+          break;
+
+        case BENCH_CORPUS_UNICODE:
+          for (j = 0; j < n_words; j++)
+            {
+              if (j)
+                g_string_append_c (str, '-');
+              g_string_append (str, BENCH_PICK (rand, bench_unicode_words));
+            }
+          g_string_append_printf (str, "-%u.c", i);
+          break;
+
+        case BENCH_CORPUS_LAST:
+        default:
+          g_assert_not_reached ();
+        }
+
+      keys [i] = g_strdup (str->str);
+    }
+
+  g_string_free (str, TRUE);
+  g_rand_free (rand);
+
+  return keys;
+}
+
+static inline gint64
+bench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec * G_GINT64_CONSTANT (1000000000)) + ts.tv_nsec;
+}
+
+static inline gint
+bench_compare_int64 (gconstpointer a,
+                     gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/*
+ * Returns the @percentile latency of @samples in microseconds. @samples
+ * is sorted in place.
+ */
+static inline gdouble
+bench_percentile (gint64 *samples,
+                  guint   n_samples,
+                  guint   percentile)
+{
+  guint idx;
+
+  if (n_samples == 0)
+    return 0.0;
+
+  qsort (samples, n_samples, sizeof (gint64), bench_compare_int64);
+
+  idx = MIN (n_samples - 1, (n_samples * percentile) / 100);
+
+  return samples [idx] / 1000.0;
+}
+
+/*
+ * Returns the number of bytes currently allocated from the heap. With glibc
+ * this comes from mallinfo so that memory released by a previous run and
+ * reused by the next one is not lost in the measurement. Elsewhere we fall
+ * back to the resident set size, which is only an approximation.
+ */
+static inline gsize
+bench_heap_size (void)
+{
+#ifdef BENCH_HAVE_MALLINFO2
+  struct mallinfo2 info = mallinfo2 ();
+
+  return info.uordblks + info.hblkhd;
+#else
+  gchar *contents = NULL;
+  gsize ret = 0;
+
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    {
+      gchar **parts = g_strsplit (contents, " ", 3);
+
+      if (parts [0] && parts [1])
+        ret = (g_ascii_strtoull (parts [1], NULL, 10) *
+               sysconf (_SC_PAGESIZE));
+
+      g_strfreev (parts);
+      g_free (contents);
+    }
+
+  return ret;
+#endif
+}
+
+/* Returns the peak resident set size of the process in kilobytes. */
+static inline glong
+bench_peak_rss (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return usage.ru_maxrss;
+}
+
+/*
+ * Prints the peak resident set size of the whole process. This is a high
+ * water mark that never goes down, so it cannot be attributed to a single
+ * run and is only reported once, after all of them.
+ */
+static inline void
+bench_report_process (const gchar *bench)
+{
+  g_print ("{\"bench\": \"%s\", \"op\": \"process\", \"peak_rss_kb\": %ld}\n",
+           bench, bench_peak_rss ());
+}
+
+/*
+ * Parses the command line, which is an optional list of corpus sizes. If no
+ * sizes are given, the default 10k to 5M set is used.
+ */
+static inline GArray *
+bench_parse_sizes (gint   argc,
+                   gchar *argv[])
+{
+  GArray *sizes;
+  gint i;
+
+  sizes = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 1; i < argc; i++)
+    {
+      guint size = MAX (1, atoi (argv [i]));
+      g_array_append_val (sizes, size);
+    }
+
+  if (sizes->len == 0)
+    g_array_append_vals (sizes, bench_default_sizes,
+                         G_N_ELEMENTS (bench_default_sizes));
+
+  return sizes;
+}
+
+/*
+ * Prints a single result line. The fields are fixed so that each line can
+ * be parsed on its own as a JSON object.
+ */
+static inline void
+bench_report (const gchar *bench,
+              const gchar *operation,
+              const gchar *corpus,
+              const gchar *variant,
+              guint        n_keys,
+              gdouble      build_msec,
+              gint64      *samples,
+              guint        n_samples,
+              gsize        heap_bytes,
+              gdouble      results)
+{
+  g_print ("{\"bench\": \"%s\", \"op\": \"%s\", \"corpus\": \"%s\", "
+           "\"variant\": \"%s\", \"keys\": %u, \"build_ms\": %.3lf, "
+           "\"p50_us\": %.3lf, \"p99_us\": %.3lf, "
+           "\"bytes_per_key\": %.2lf, \"results\": %.2lf}\n",
+           bench, operation, corpus, variant, n_keys, build_msec,
+           bench_percentile (samples, n_samples, 50),
+           bench_percentile (samples, n_samples, 99),
+           n_keys ? (gdouble)heap_bytes / n_keys : 0.0,
+           results);
+}
+
+#endif /* BENCH_COMMON_H */
@@ -0,0 +1,128 @@
+#include "bench-common.h"
+#include "fuzzy.h"
+
+#define MAX_MATCHES 1000
+
+static gchar *
+build_needle (GRand       *rand,
+              const gchar *key)
+{
+  GString *str;
+  glong len;
+  glong pos;
+  guint i;
+
+  /* Take a few characters from the key in order so the needle matches. */
+  str = g_string_new (NULL);
+  len = g_utf8_strlen (key, -1);
+  pos = 0;
+
+  for (i = 0; (i < 3) && (pos < len); i++)
+    {
+      const gchar *ptr;
+
+      pos += g_rand_int_range (rand, 0, 3);
+      if (pos >= len)
+        break;
+
+      ptr = g_utf8_offset_to_pointer (key, pos++);
+      g_string_append_unichar (str, g_utf8_get_char (ptr));
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+run_bench (BenchCorpus   corpus,
+           FuzzyLayout   layout,
+           gchar       **keys,
+           guint         n_keys)
+{
+  gint64 samples [BENCH_N_QUERIES];
+  GRand *rand;
+  Fuzzy *fuzzy;
+  gint64 begin;
+  gint64 build_nsec;
+  gsize heap_before;
+  gsize heap_after;
+  guint n_matches = 0;
+  guint i;
+
+  heap_before = bench_heap_size ();
+  begin = bench_now ();
+
+  fuzzy = fuzzy_new_with_layout (FALSE, layout);
+  fuzzy_begin_bulk_insert (fuzzy);
+  for (i = 0; i < n_keys; i++)
+    fuzzy_insert (fuzzy, keys [i], NULL);
+  fuzzy_end_bulk_insert (fuzzy);
+
+  build_nsec = bench_now () - begin;
+  heap_after = bench_heap_size ();
+
+  rand = g_rand_new_with_seed (BENCH_N_QUERIES);
+
+  for (i = 0; i < BENCH_N_QUERIES; i++)
+    {
+      GArray *matches;
+      gchar *needle;
+
+      needle = build_needle (rand, keys [g_rand_int_range (rand, 0, n_keys)]);
+
+      begin = bench_now ();
+      matches = fuzzy_match (fuzzy, needle, MAX_MATCHES);
+      samples [i] = bench_now () - begin;
+
+      n_matches += matches->len;
+
+      g_array_unref (matches);
+      g_free (needle);
+    }
+
+  bench_report ("fuzzy", "match",
+                bench_corpus_names [corpus],
+                (layout == FUZZY_LAYOUT_WIDE) ? "wide" : "packed",
+                n_keys,
+                build_nsec / 1000000.0,
+                samples, BENCH_N_QUERIES,
+                (heap_after > heap_before) ? heap_after - heap_before : 0,
+                (gdouble)n_matches / BENCH_N_QUERIES);
+
+  g_rand_free (rand);
+  fuzzy_unref (fuzzy);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  GArray *sizes;
+  guint i;
+  guint j;
+
+  sizes = bench_parse_sizes (argc, argv);
+
+  for (i = 0; i < sizes->len; i++)
+    {
+      guint n_keys = g_array_index (sizes, guint, i);
+
+      for (j = 0; j < BENCH_CORPUS_LAST; j++)
+        {
+          gchar **keys;
+
+          keys = bench_corpus_new (j, n_keys);
+
+          if (n_keys < FUZZY_PACKED_MAX_KEYS)
+            run_bench (j, FUZZY_LAYOUT_PACKED, keys, n_keys);
+          run_bench (j, FUZZY_LAYOUT_WIDE, keys, n_keys);
+
+          g_strfreev (keys);
+        }
+    }
+
+  g_array_unref (sizes);
+
+  bench_report_process ("fuzzy");
+
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include "bench-common.h"
+#include "trie.h"
+
+#define MAX_COMPLETIONS 100
+
+typedef struct
+{
+  guint count;
+  guint total;
+} Completions;
+
+static gboolean
+traverse_cb (Trie        *trie,
+             const gchar *key,
+             gpointer     value,
+             gpointer     user_data)
+{
+  Completions *completions = user_data;
+
+  completions->total++;
+
+  return (++completions->count >= MAX_COMPLETIONS);
+}
+
+static void
+run_bench (BenchCorpus   corpus,
+           gchar       **keys,
+           guint         n_keys)
+{
+  gint64 lookup_samples [BENCH_N_QUERIES];
+  gint64 traverse_samples [BENCH_N_QUERIES];
+  Completions completions = { 0 };
+  GRand *rand;
+  Trie *trie;
+  gint64 begin;
+  gint64 build_nsec;
+  gsize heap_before;
+  gsize heap_after;
+  gsize heap_bytes;
+  guint n_found = 0;
+  guint i;
+
+  heap_before = bench_heap_size ();
+  begin = bench_now ();
+
+  trie = trie_new (NULL);
+  for (i = 0; i < n_keys; i++)
+    trie_insert (trie, keys [i], GUINT_TO_POINTER (i + 1));
+
+  build_nsec = bench_now () - begin;
+  heap_after = bench_heap_size ();
+  heap_bytes = (heap_after > heap_before) ? heap_after - heap_before : 0;
+
+  rand = g_rand_new_with_seed (BENCH_N_QUERIES);
+
+  for (i = 0; i < BENCH_N_QUERIES; i++)
+    {
+      const gchar *key = keys [g_rand_int_range (rand, 0, n_keys)];
+
+      begin = bench_now ();
+      if (trie_lookup (trie, key))
+        n_found++;
+      lookup_samples [i] = bench_now () - begin;
+    }
+
+  for (i = 0; i < BENCH_N_QUERIES; i++)
+    {
+      const gchar *key = keys [g_rand_int_range (rand, 0, n_keys)];
+      gchar *prefix;
+
+      /* Complete from a short prefix, like the word completion does. */
+      prefix = g_strndup (key, g_rand_int_range (rand, 1, 5));
+
+      completions.count = 0;
+
+      begin = bench_now ();
+      trie_traverse (trie, prefix, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1,
+                     traverse_cb, &completions);
+      traverse_samples [i] = bench_now () - begin;
+
+      g_free (prefix);
+    }
+
+  bench_report ("trie", "lookup", bench_corpus_names [corpus], "default",
+                n_keys, build_nsec / 1000000.0,
+                lookup_samples, BENCH_N_QUERIES, heap_bytes,
+                (gdouble)n_found / BENCH_N_QUERIES);
+  bench_report ("trie", "traverse", bench_corpus_names [corpus], "default",
+                n_keys, build_nsec / 1000000.0,
+                traverse_samples, BENCH_N_QUERIES, heap_bytes,
+                (gdouble)completions.total / BENCH_N_QUERIES);
+
+  g_rand_free (rand);
+  trie_destroy (trie);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  GArray *sizes;
+  guint i;
+  guint j;
+
+  sizes = bench_parse_sizes (argc, argv);
+
+  for (i = 0; i < sizes->len; i++)
+    {
+      guint n_keys = g_array_index (sizes, guint, i);
+
+      for (j = 0; j < BENCH_CORPUS_LAST; j++)
+        {
+          gchar **keys;
+
+          keys = bench_corpus_new (j, n_keys);
+          run_bench (j, keys, n_keys);
+          g_strfreev (keys);
+        }
+    }
+
+  g_array_unref (sizes);
+
+  bench_report_process ("trie");
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <glib/gstdio.h>
+
+#include "gb-editor-file-marks.h"
+
+#define N_JOURNAL_URIS 3000
+
+static gchar *
+journal_uri (guint i)
+{
+  return g_strdup_printf ("file:///tmp/journal-%u.c", i);
+}
+
+static guint
+get_line (GbEditorFileMarks *marks,
+          const gchar       *uri)
+{
+  GbEditorFileMark *mark;
+  GFile *file;
+
+  file = g_file_new_for_uri (uri);
+  mark = gb_editor_file_marks_get_for_file (marks, file);
+  g_object_unref (file);
+
+  return gb_editor_file_mark_get_line (mark);
+}
+
+/*
+ * Marks handed out and changed before the deferred load are the newest
+ * state, so loading a journal with more URIs than the cap must evict the
+ * journal records and keep the pending changes.
+ */
+static void
+test_file_marks_load_after_dirty (void)
+{
+  GbEditorFileMarks *marks;
+  GbEditorFileMark *live;
+  GbEditorFileMark *shared;
+  GError *error = NULL;
+  GString *str;
+  GFile *file;
+  gchar *path;
+  gchar *uri;
+  guint i;
+
+  path = g_build_filename (g_get_user_data_dir (), "gnome-builder", NULL);
+  g_mkdir_with_parents (path, 0750);
+  g_free (path);
+
+  str = g_string_new (NULL);
+  for (i = 0; i < N_JOURNAL_URIS; i++)
+    {
+      uri = journal_uri (i);
+      g_string_append_printf (str, "%u:1 %s\n", i + 1, uri);
+      g_free (uri);
+    }
+
+  path = g_build_filename (g_get_user_data_dir (), "gnome-builder",
+                           "file-marks", NULL);
+  g_file_set_contents (path, str->str, str->len, &error);
+  g_assert_no_error (error);
+  g_string_free (str, TRUE);
+
+  marks = gb_editor_file_marks_new ();
+
+  file = g_file_new_for_uri ("file:///tmp/live.c");
+  live = gb_editor_file_marks_get_for_file (marks, file);
+  gb_editor_file_mark_set_line (live, 42);
+  g_object_unref (file);
+
+  /* Also in the journal, where it is older than the live change. */
+  uri = journal_uri (5);
+  file = g_file_new_for_uri (uri);
+  shared = gb_editor_file_marks_get_for_file (marks, file);
+  gb_editor_file_mark_set_line (shared, 7);
+  g_object_unref (file);
+  g_free (uri);
+
+  g_assert (gb_editor_file_marks_load (marks, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpint (get_line (marks, "file:///tmp/live.c"), ==, 42);
+  uri = journal_uri (5);
+  g_assert_cmpint (get_line (marks, uri), ==, 7);
+  g_free (uri);
+  uri = journal_uri (N_JOURNAL_URIS - 1);
+  g_assert_cmpint (get_line (marks, uri), ==, N_JOURNAL_URIS);
+  g_free (uri);
+
+  g_assert (gb_editor_file_marks_save (marks, NULL, &error));
+  g_assert_no_error (error);
+  g_object_unref (marks);
+
+  /* The pending changes made it to disk and the oldest records are gone. */
+  marks = gb_editor_file_marks_new ();
+  g_assert (gb_editor_file_marks_load (marks, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpint (get_line (marks, "file:///tmp/live.c"), ==, 42);
+  uri = journal_uri (5);
+  g_assert_cmpint (get_line (marks, uri), ==, 7);
+  g_free (uri);
+  uri = journal_uri (N_JOURNAL_URIS - 1);
+  g_assert_cmpint (get_line (marks, uri), ==, N_JOURNAL_URIS);
+  g_free (uri);
+  uri = journal_uri (0);
+  g_assert_cmpint (get_line (marks, uri), ==, 0);
+  g_free (uri);
+
+  g_object_unref (marks);
+
+  g_unlink (path);
+  g_free (path);
+
+  path = g_build_filename (g_get_user_data_dir (), "gnome-builder", NULL);
+  g_rmdir (path);
+  g_free (path);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  gchar *tmpdir;
+  gint ret;
+
+  tmpdir = g_dir_make_tmp ("test-editor-file-marks-XXXXXX", NULL);
+  g_assert (tmpdir);
+  g_setenv ("XDG_DATA_HOME", tmpdir, TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/EditorFileMarks/load_after_dirty",
+                   test_file_marks_load_after_dirty);
+  ret = g_test_run ();
+
+  g_rmdir (tmpdir);
+  g_free (tmpdir);
+
+  return ret;
+}
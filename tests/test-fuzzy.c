@@ -0,0 +1,593 @@
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "fuzzy.h"
+
+static void
+test_fuzzy_basic (void)
+{
+  FuzzyMatch *match;
+  GArray *matches;
+  Fuzzy *fuzzy;
+
+  fuzzy = fuzzy_new (FALSE);
+  fuzzy_insert (fuzzy, "gb-editor-view.c", NULL);
+  fuzzy_insert (fuzzy, "gb-editor-workspace.c", NULL);
+  fuzzy_insert (fuzzy, "gb-search-box.c", NULL);
+
+  matches = fuzzy_match (fuzzy, "edview", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, "gb-editor-view.c");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "GBC", 0);
+  g_assert_cmpint (matches->len, ==, 3);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "gbc", 2);
+  g_assert_cmpint (matches->len, ==, 2);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, "gb-search-box.c");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "xyz", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_utf8 (void)
+{
+  FuzzyMatch *match;
+  GArray *matches;
+  Fuzzy *fuzzy;
+
+  fuzzy = fuzzy_new (FALSE);
+  fuzzy_begin_bulk_insert (fuzzy);
+  fuzzy_insert (fuzzy, "Überblick.txt", NULL);
+  fuzzy_insert (fuzzy, "résumé.odt", NULL);
+  fuzzy_insert (fuzzy, "日本語.md", NULL);
+  fuzzy_insert (fuzzy, "readme.md", NULL);
+  fuzzy_end_bulk_insert (fuzzy);
+
+  matches = fuzzy_match (fuzzy, "überb", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, "Überblick.txt");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "RÉSUMÉ", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "本md", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, "日本語.md");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "中", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_wide (void)
+{
+  FuzzyMatch *match;
+  GArray *matches;
+  Fuzzy *fuzzy;
+  gchar *key;
+  guint i;
+
+  fuzzy = fuzzy_new_with_layout (FALSE, FUZZY_LAYOUT_WIDE);
+  g_assert_cmpint (fuzzy_get_layout (fuzzy), ==, FUZZY_LAYOUT_WIDE);
+
+  fuzzy_begin_bulk_insert (fuzzy);
+  for (i = 0; i < 1000; i++)
+    {
+      key = g_strdup_printf ("file-%u.c", i);
+      fuzzy_insert (fuzzy, key, NULL);
+      g_free (key);
+    }
+  fuzzy_end_bulk_insert (fuzzy);
+
+  /* Keys longer than the packed layout supports are still indexed. */
+  key = g_strnfill (5000, 'x');
+  key [4500] = 'q';
+  fuzzy_insert (fuzzy, key, NULL);
+
+  matches = fuzzy_match (fuzzy, "f999", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, "file-999.c");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "xq", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  match = &g_array_index (matches, FuzzyMatch, 0);
+  g_assert_cmpstr (match->key, ==, key);
+  g_array_unref (matches);
+
+  g_free (key);
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_remove_layout (FuzzyLayout layout)
+{
+  GArray *matches;
+  Fuzzy *fuzzy;
+  guint ids [100];
+  guint id;
+  guint i;
+
+  fuzzy = fuzzy_new_with_layout (FALSE, layout);
+  fuzzy_set_free_func (fuzzy, g_free);
+
+  for (i = 0; i < G_N_ELEMENTS (ids); i++)
+    {
+      gchar *key = g_strdup_printf ("src/file-%03u.c", i);
+      ids [i] = fuzzy_insert (fuzzy, key, key);
+    }
+
+  matches = fuzzy_match (fuzzy, "file", 0);
+  g_assert_cmpint (matches->len, ==, 100);
+  g_array_unref (matches);
+
+  /* Remove enough keys to trigger a compaction of the index. */
+  for (i = 0; i < G_N_ELEMENTS (ids); i += 2)
+    fuzzy_remove (fuzzy, ids [i]);
+
+  matches = fuzzy_match (fuzzy, "file", 0);
+  g_assert_cmpint (matches->len, ==, 50);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "f010", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_assert_cmpstr (g_array_index (matches, FuzzyMatch, 0).value, ==,
+                   "src/file-011.c");
+  g_array_unref (matches);
+
+  /* Ids of remaining keys stay valid after compaction. */
+  fuzzy_remove (fuzzy, ids [11]);
+  matches = fuzzy_match (fuzzy, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  id = fuzzy_insert (fuzzy, "src/file-011.c", g_strdup ("again"));
+  g_assert_cmpint (id, >=, G_N_ELEMENTS (ids));
+  matches = fuzzy_match (fuzzy, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_assert_cmpstr (g_array_index (matches, FuzzyMatch, 0).value, ==, "again");
+  g_array_unref (matches);
+
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_remove (void)
+{
+  test_fuzzy_remove_layout (FUZZY_LAYOUT_PACKED);
+  test_fuzzy_remove_layout (FUZZY_LAYOUT_WIDE);
+}
+
+static void
+test_fuzzy_save_layout (FuzzyLayout layout)
+{
+  GError *error = NULL;
+  GArray *matches;
+  Fuzzy *fuzzy;
+  Fuzzy *loaded;
+  Fuzzy *retagged;
+  gchar *filename;
+  gchar *tmpdir;
+  guint i;
+
+  tmpdir = g_dir_make_tmp ("test-fuzzy-XXXXXX", &error);
+  g_assert_no_error (error);
+  filename = g_build_filename (tmpdir, "index.fuzzy", NULL);
+
+  fuzzy = fuzzy_new_with_layout (FALSE, layout);
+  fuzzy_set_free_func (fuzzy, g_free);
+  fuzzy_begin_bulk_insert (fuzzy);
+  for (i = 0; i < 100; i++)
+    {
+      gchar *key = g_strdup_printf ("src/file-%03u.c", i);
+      fuzzy_insert (fuzzy, key, key);
+    }
+  fuzzy_insert (fuzzy, "日本語.md", NULL);
+  fuzzy_end_bulk_insert (fuzzy);
+  fuzzy_remove (fuzzy, 10);
+
+  fuzzy_save (fuzzy, filename, "abc", &error);
+  g_assert_no_error (error);
+
+  loaded = fuzzy_new_from_file (filename, "def", &error);
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH);
+  g_assert (loaded == NULL);
+  g_clear_error (&error);
+
+  loaded = fuzzy_new_from_file (filename, "abc", &error);
+  g_assert_no_error (error);
+  g_assert (loaded != NULL);
+  g_assert_cmpint (fuzzy_get_layout (loaded), ==, layout);
+
+  matches = fuzzy_match (loaded, "file", 0);
+  g_assert_cmpint (matches->len, ==, 99);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (loaded, "f010", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (loaded, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_assert_cmpstr (g_array_index (matches, FuzzyMatch, 0).key, ==,
+                   "src/file-011.c");
+  g_assert_cmpstr (g_array_index (matches, FuzzyMatch, 0).value, ==,
+                   "src/file-011.c");
+  g_array_unref (matches);
+
+  matches = fuzzy_match (loaded, "本md", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_assert (g_array_index (matches, FuzzyMatch, 0).value == NULL);
+  g_array_unref (matches);
+
+  /* Retagging keeps the index but changes what it loads with. */
+  g_assert (!fuzzy_retag_file (filename, "abd", "xyz", &error));
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH);
+  g_clear_error (&error);
+  g_assert (!fuzzy_retag_file (filename, "abc", "abcdefghijkl", &error));
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH);
+  g_clear_error (&error);
+  g_assert (fuzzy_retag_file (filename, "abc", "xyz", &error));
+  g_assert_no_error (error);
+  g_assert (!fuzzy_new_from_file (filename, "abc", &error));
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_TAG_MISMATCH);
+  g_clear_error (&error);
+
+  retagged = fuzzy_new_from_file (filename, "xyz", &error);
+  g_assert_no_error (error);
+  matches = fuzzy_match (retagged, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_array_unref (matches);
+  fuzzy_unref (retagged);
+
+  /* Modifying a loaded index copies it out of the file. */
+  fuzzy_remove (loaded, 11);
+  fuzzy_insert (loaded, "src/new-file.c", g_strdup ("new"));
+
+  matches = fuzzy_match (loaded, "f011", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (loaded, "newfile", 0);
+  g_assert_cmpint (matches->len, ==, 1);
+  g_assert_cmpstr (g_array_index (matches, FuzzyMatch, 0).value, ==, "new");
+  g_array_unref (matches);
+
+  fuzzy_unref (loaded);
+  fuzzy_unref (fuzzy);
+
+  g_file_set_contents (filename, "garbage", -1, &error);
+  g_assert_no_error (error);
+  loaded = fuzzy_new_from_file (filename, "abc", &error);
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE);
+  g_assert (loaded == NULL);
+  g_clear_error (&error);
+
+  g_unlink (filename);
+  g_rmdir (tmpdir);
+  g_free (filename);
+  g_free (tmpdir);
+}
+
+static void
+test_fuzzy_save (void)
+{
+  test_fuzzy_save_layout (FUZZY_LAYOUT_PACKED);
+  test_fuzzy_save_layout (FUZZY_LAYOUT_WIDE);
+}
+
+/* Offsets within FuzzyFileHeader and FuzzyFileTable, see fuzzy.c. */
+#define HEADER_N_TABLES_OFFSET      28
+#define HEADER_TABLES_OFFSET_OFFSET 88
+#define TABLE_SIZE                  40
+#define TABLE_DATA_OFFSET_OFFSET    8
+#define TABLE_DATA_LENGTH_OFFSET    16
+
+static void
+test_fuzzy_save_corrupt (void)
+{
+  GError *error = NULL;
+  Fuzzy *fuzzy;
+  Fuzzy *loaded;
+  guint64 tables_offset;
+  guint64 data_offset = 0;
+  guint64 data_length = 0;
+  guint32 n_tables;
+  gchar *contents;
+  gchar *filename;
+  gchar *tmpdir;
+  gsize length;
+  guint i;
+
+  tmpdir = g_dir_make_tmp ("test-fuzzy-XXXXXX", &error);
+  g_assert_no_error (error);
+  filename = g_build_filename (tmpdir, "index.fuzzy", NULL);
+
+  fuzzy = fuzzy_new_with_layout (FALSE, FUZZY_LAYOUT_WIDE);
+  for (i = 0; i < 300; i++)
+    {
+      gchar *key = g_strdup_printf ("src/file-%03u.c", i);
+      fuzzy_insert (fuzzy, key, NULL);
+      g_free (key);
+    }
+  fuzzy_save (fuzzy, filename, NULL, &error);
+  g_assert_no_error (error);
+  fuzzy_unref (fuzzy);
+
+  g_file_get_contents (filename, &contents, &length, &error);
+  g_assert_no_error (error);
+
+  /* Find the largest table of encoded ids. */
+  memcpy (&n_tables, contents + HEADER_N_TABLES_OFFSET, sizeof n_tables);
+  memcpy (&tables_offset, contents + HEADER_TABLES_OFFSET_OFFSET,
+          sizeof tables_offset);
+  for (i = 0; i < n_tables; i++)
+    {
+      const gchar *table = contents + tables_offset + (i * TABLE_SIZE);
+      guint64 len;
+
+      memcpy (&len, table + TABLE_DATA_LENGTH_OFFSET, sizeof len);
+      if (len > data_length)
+        {
+          data_length = len;
+          memcpy (&data_offset, table + TABLE_DATA_OFFSET_OFFSET,
+                  sizeof data_offset);
+        }
+    }
+  g_assert_cmpint (data_length, >, 2);
+
+  /*
+   * Continuation bytes followed by a terminator decode to fewer ids than
+   * the table claims, which would leave the cursor reading past it.
+   */
+  memset (contents + data_offset, 0x80, data_length - 1);
+  contents [data_offset + data_length - 1] = 0;
+  g_file_set_contents (filename, contents, length, &error);
+  g_assert_no_error (error);
+
+  loaded = fuzzy_new_from_file (filename, NULL, &error);
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE);
+  g_assert (loaded == NULL);
+  g_clear_error (&error);
+
+  /* A single id longer than 5 bytes is rejected too. */
+  memset (contents + data_offset, 0, data_length);
+  memset (contents + data_offset, 0x80, 6);
+  g_file_set_contents (filename, contents, length, &error);
+  g_assert_no_error (error);
+
+  loaded = fuzzy_new_from_file (filename, NULL, &error);
+  g_assert_error (error, FUZZY_ERROR, FUZZY_ERROR_INVALID_FILE);
+  g_assert (loaded == NULL);
+  g_clear_error (&error);
+
+  g_unlink (filename);
+  g_rmdir (tmpdir);
+  g_free (contents);
+  g_free (filename);
+  g_free (tmpdir);
+}
+
+static void
+count_cb (guint        id,
+          const gchar *key,
+          gpointer     value,
+          gpointer     user_data)
+{
+  guint *count = user_data;
+
+  g_assert_cmpstr (key, ==, strrchr (value, '/') + 1);
+  (*count)++;
+}
+
+static guint n_freed;
+
+static void
+counting_free (gpointer data)
+{
+  n_freed++;
+  g_free (data);
+}
+
+static void
+test_fuzzy_copy (void)
+{
+  GArray *matches;
+  Fuzzy *fuzzy;
+  Fuzzy *copy;
+  guint count = 0;
+  guint i;
+
+  n_freed = 0;
+
+  fuzzy = fuzzy_new (FALSE);
+  fuzzy_set_free_func (fuzzy, counting_free);
+  for (i = 0; i < 10; i++)
+    fuzzy_insert (fuzzy, "file.c", g_strdup_printf ("dir%u/file.c", i));
+  fuzzy_remove (fuzzy, 3);
+  g_assert_cmpint (n_freed, ==, 1);
+
+  copy = fuzzy_copy (fuzzy, (GBoxedCopyFunc)g_strdup);
+  g_assert_cmpint (fuzzy_get_next_id (copy), ==, 10);
+
+  /* Changes to the copy are not visible in the original. */
+  fuzzy_remove (copy, 4);
+  g_assert_cmpint (n_freed, ==, 2);
+  g_assert_cmpint (fuzzy_insert (copy, "main.c", g_strdup ("x/main.c")), ==, 10);
+
+  matches = fuzzy_match (fuzzy, "file", 0);
+  g_assert_cmpint (matches->len, ==, 9);
+  g_array_unref (matches);
+
+  matches = fuzzy_match (fuzzy, "main", 0);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  fuzzy_unref (fuzzy);
+  g_assert_cmpint (n_freed, ==, 11);
+
+  matches = fuzzy_match (copy, "file", 0);
+  g_assert_cmpint (matches->len, ==, 8);
+  g_array_unref (matches);
+
+  fuzzy_foreach (copy, count_cb, &count);
+  g_assert_cmpint (count, ==, 9);
+
+  /* The copy frees the values it duplicated and the one inserted into it. */
+  fuzzy_unref (copy);
+  g_assert_cmpint (n_freed, ==, 20);
+}
+
+static void
+test_fuzzy_range_layout (FuzzyLayout layout)
+{
+  GArray *matches;
+  Fuzzy *fuzzy;
+  guint total = 0;
+  guint i;
+
+  fuzzy = fuzzy_new_with_layout (FALSE, layout);
+  fuzzy_begin_bulk_insert (fuzzy);
+  for (i = 0; i < 1000; i++)
+    {
+      gchar *key = g_strdup_printf ("file-%03u.c", i);
+      fuzzy_insert (fuzzy, key, NULL);
+      g_free (key);
+    }
+  fuzzy_end_bulk_insert (fuzzy);
+
+  matches = fuzzy_match_range (fuzzy, "f99", 0, 990, 1000);
+  g_assert_cmpint (matches->len, ==, 10);
+  for (i = 0; i < matches->len; i++)
+    g_assert (g_str_has_prefix (g_array_index (matches, FuzzyMatch, i).key,
+                                "file-99"));
+  g_array_unref (matches);
+
+  /* Splitting the ids into ranges finds every match exactly once. */
+  for (i = 0; i < 1000; i += 300)
+    {
+      matches = fuzzy_match_range (fuzzy, "fc", 0, i, i + 300);
+      total += matches->len;
+      g_array_unref (matches);
+    }
+  g_assert_cmpint (total, ==, 1000);
+
+  matches = fuzzy_match_range (fuzzy, "fc", 0, 1000, G_MAXUINT);
+  g_assert_cmpint (matches->len, ==, 0);
+  g_array_unref (matches);
+
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_range (void)
+{
+  test_fuzzy_range_layout (FUZZY_LAYOUT_PACKED);
+  test_fuzzy_range_layout (FUZZY_LAYOUT_WIDE);
+}
+
+/*
+ * Keys of the same length with the needle at the same distance share a
+ * score, and duplicate keys tie completely. The bounded heap must keep the
+ * same matches, in the same order, as sorting everything and truncating.
+ */
+static void
+test_fuzzy_top_layout (FuzzyLayout layout)
+{
+  static const gchar *needles[] = { "ab", "a1", "c-0", "e", "zz" };
+  static const gsize limits[] = { 1, 2, 3, 7, 16, 63, 250, 1000 };
+  GArray *all;
+  GArray *top;
+  Fuzzy *fuzzy;
+  guint i;
+  guint j;
+  guint k;
+
+  fuzzy = fuzzy_new_with_layout (FALSE, layout);
+  fuzzy_begin_bulk_insert (fuzzy);
+  for (i = 0; i < 300; i++)
+    {
+      gchar *key;
+
+      key = g_strdup_printf ("%c%c-%02u", 'a' + (i % 5), 'a' + ((i / 5) % 5),
+                             i % 13);
+      fuzzy_insert (fuzzy, key, GUINT_TO_POINTER (i));
+      if ((i % 7) == 0)
+        fuzzy_insert (fuzzy, key, GUINT_TO_POINTER (i));
+      g_free (key);
+    }
+  fuzzy_end_bulk_insert (fuzzy);
+
+  for (i = 0; i < G_N_ELEMENTS (needles); i++)
+    {
+      all = fuzzy_match (fuzzy, needles [i], 0);
+
+      for (j = 0; j < G_N_ELEMENTS (limits); j++)
+        {
+          top = fuzzy_match (fuzzy, needles [i], limits [j]);
+          g_assert_cmpint (top->len, ==, MIN (all->len, limits [j]));
+
+          for (k = 0; k < top->len; k++)
+            {
+              FuzzyMatch *a = &g_array_index (all, FuzzyMatch, k);
+              FuzzyMatch *b = &g_array_index (top, FuzzyMatch, k);
+
+              g_assert_cmpstr (a->key, ==, b->key);
+              g_assert_cmpfloat (a->score, ==, b->score);
+            }
+
+          g_array_unref (top);
+        }
+
+      g_array_unref (all);
+    }
+
+  fuzzy_unref (fuzzy);
+}
+
+static void
+test_fuzzy_top (void)
+{
+  test_fuzzy_top_layout (FUZZY_LAYOUT_PACKED);
+  test_fuzzy_top_layout (FUZZY_LAYOUT_WIDE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Fuzzy/basic", test_fuzzy_basic);
+  g_test_add_func ("/Fuzzy/utf8", test_fuzzy_utf8);
+  g_test_add_func ("/Fuzzy/wide", test_fuzzy_wide);
+  g_test_add_func ("/Fuzzy/remove", test_fuzzy_remove);
+  g_test_add_func ("/Fuzzy/save", test_fuzzy_save);
+  g_test_add_func ("/Fuzzy/save_corrupt", test_fuzzy_save_corrupt);
+  g_test_add_func ("/Fuzzy/copy", test_fuzzy_copy);
+  g_test_add_func ("/Fuzzy/range", test_fuzzy_range);
+  g_test_add_func ("/Fuzzy/top", test_fuzzy_top);
+  return g_test_run ();
+}
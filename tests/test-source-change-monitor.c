@@ -0,0 +1,354 @@
+#include <string.h>
+
+#include "gb-source-change-monitor-private.h"
+
+static GArray *
+split (const gchar *text)
+{
+  GArray *lines;
+
+  lines = gb_source_change_lines_new (0);
+  gb_source_change_lines_split (lines, text, strlen (text));
+
+  return lines;
+}
+
+static void
+assert_lines_equal (GArray *a,
+                    GArray *b)
+{
+  guint i;
+
+  g_assert_cmpint (a->len, ==, b->len);
+
+  for (i = 0; i < a->len; i++)
+    {
+      GbSourceChangeLine *la = &g_array_index (a, GbSourceChangeLine, i);
+      GbSourceChangeLine *lb = &g_array_index (b, GbSourceChangeLine, i);
+
+      g_assert_cmpint (la->hash, ==, lb->hash);
+      g_assert_cmpint (la->len, ==, lb->len);
+      g_assert_cmpstr (la->text, ==, lb->text);
+    }
+}
+
+/*
+ * Returns the state of each new line as a string, "." for lines that are
+ * unchanged and "c" or "a" for changed and added lines.
+ */
+static gchar *
+diff_to_string (GArray *old_lines,
+                GArray *new_lines)
+{
+  GArray *runs;
+  gchar *str;
+  guint i;
+  guint j;
+
+  runs = gb_source_change_diff ((GbSourceChangeLine *)(gpointer)old_lines->data,
+                                old_lines->len,
+                                (GbSourceChangeLine *)(gpointer)new_lines->data,
+                                new_lines->len,
+                                0);
+
+  str = g_malloc (new_lines->len + 1);
+  memset (str, '.', new_lines->len);
+  str [new_lines->len] = '\0';
+
+  for (i = 0; i < runs->len; i++)
+    {
+      GbSourceChangeRun *run = &g_array_index (runs, GbSourceChangeRun, i);
+
+      /* Runs are sorted and do not overlap. */
+      if (i > 0)
+        {
+          GbSourceChangeRun *prev = run - 1;
+
+          g_assert_cmpint (prev->line + prev->len, <=, run->line);
+        }
+
+      g_assert_cmpint (run->len, >, 0);
+      g_assert_cmpint (run->line + run->len, <=, new_lines->len);
+
+      for (j = run->line; j < run->line + run->len; j++)
+        str [j] = (run->flags == GB_SOURCE_CHANGE_CHANGED) ? 'c' : 'a';
+    }
+
+  g_array_unref (runs);
+
+  return str;
+}
+
+static void
+test_split (void)
+{
+  GbSourceChangeLine *line;
+  GArray *lines;
+
+  lines = split ("a\r\nb\rc\xe2\x80\xa9" "d\n");
+  g_assert_cmpint (lines->len, ==, 5);
+  g_assert_cmpstr (g_array_index (lines, GbSourceChangeLine, 0).text, ==, "a");
+  g_assert_cmpstr (g_array_index (lines, GbSourceChangeLine, 1).text, ==, "b");
+  g_assert_cmpstr (g_array_index (lines, GbSourceChangeLine, 2).text, ==, "c");
+  g_assert_cmpstr (g_array_index (lines, GbSourceChangeLine, 3).text, ==, "d");
+  line = &g_array_index (lines, GbSourceChangeLine, 4);
+  g_assert_cmpstr (line->text, ==, "");
+  g_assert_cmpint (line->len, ==, 0);
+  g_array_unref (lines);
+
+  lines = split ("");
+  g_assert_cmpint (lines->len, ==, 1);
+  g_array_unref (lines);
+}
+
+static void
+test_diff_basic (void)
+{
+  GArray *old_lines;
+  GArray *new_lines;
+  gchar *str;
+
+  old_lines = split ("a\nb\nc\nd");
+
+  new_lines = split ("a\nb\nc\nd");
+  str = diff_to_string (old_lines, new_lines);
+  g_assert_cmpstr (str, ==, "....");
+  g_free (str);
+  g_array_unref (new_lines);
+
+  new_lines = split ("a\nB\nc\nd\ne\nf");
+  str = diff_to_string (old_lines, new_lines);
+  g_assert_cmpstr (str, ==, ".c..aa");
+  g_free (str);
+  g_array_unref (new_lines);
+
+  new_lines = split ("x\na\nd");
+  str = diff_to_string (old_lines, new_lines);
+  g_assert_cmpstr (str, ==, "a..");
+  g_free (str);
+  g_array_unref (new_lines);
+
+  g_array_unref (old_lines);
+}
+
+/*
+ * Both lines have the same length and the same FNV-1a hash, so only their
+ * text tells them apart.
+ */
+static void
+test_diff_collision (void)
+{
+  GArray *old_lines;
+  GArray *new_lines;
+  gchar *str;
+
+  old_lines = split ("a\nx0171384\nb");
+  new_lines = split ("a\nx6249098\nb");
+
+  g_assert_cmpint (g_array_index (old_lines, GbSourceChangeLine, 1).hash, ==,
+                   g_array_index (new_lines, GbSourceChangeLine, 1).hash);
+
+  str = diff_to_string (old_lines, new_lines);
+  g_assert_cmpstr (str, ==, ".c.");
+  g_free (str);
+
+  g_array_unref (old_lines);
+  g_array_unref (new_lines);
+}
+
+static guint
+lcs_length (GArray *a,
+            GArray *b)
+{
+  guint *row;
+  guint ret;
+  guint i;
+  guint j;
+
+  row = g_new0 (guint, (a->len + 1) * (b->len + 1));
+
+#define CELL(i,j) row [(i) * (b->len + 1) + (j)]
+  for (i = 1; i <= a->len; i++)
+    for (j = 1; j <= b->len; j++)
+      {
+        if (g_str_equal (g_array_index (a, GbSourceChangeLine, i - 1).text,
+                         g_array_index (b, GbSourceChangeLine, j - 1).text))
+          CELL (i, j) = CELL (i - 1, j - 1) + 1;
+        else
+          CELL (i, j) = MAX (CELL (i - 1, j), CELL (i, j - 1));
+      }
+  ret = CELL (a->len, b->len);
+#undef CELL
+
+  g_free (row);
+
+  return ret;
+}
+
+static GArray *
+random_lines (guint max_lines)
+{
+  static const gchar *words[] = { "a", "b", "c", "d", "" };
+  GString *str;
+  GArray *lines;
+  guint n;
+  guint i;
+
+  str = g_string_new (NULL);
+  n = g_test_rand_int_range (0, max_lines);
+
+  for (i = 0; i < n; i++)
+    {
+      if (i)
+        g_string_append_c (str, '\n');
+      g_string_append (str, words [g_test_rand_int_range (0, G_N_ELEMENTS (words))]);
+    }
+
+  lines = split (str->str);
+  g_string_free (str, TRUE);
+
+  return lines;
+}
+
+/*
+ * The lines left unmarked must be a longest common subsequence of both
+ * files: in the same order in both, and as many as possible.
+ */
+static void
+test_diff_random (void)
+{
+  guint i;
+
+  for (i = 0; i < 2000; i++)
+    {
+      GArray *old_lines = random_lines (40);
+      GArray *new_lines = random_lines (40);
+      guint n_unchanged = 0;
+      guint pos = 0;
+      gchar *str;
+      guint j;
+
+      str = diff_to_string (old_lines, new_lines);
+
+      for (j = 0; j < new_lines->len; j++)
+        {
+          const gchar *text;
+
+          if (str [j] != '.')
+            continue;
+
+          text = g_array_index (new_lines, GbSourceChangeLine, j).text;
+
+          while ((pos < old_lines->len) &&
+                 !g_str_equal (g_array_index (old_lines, GbSourceChangeLine, pos).text,
+                               text))
+            pos++;
+
+          g_assert_cmpint (pos, <, old_lines->len);
+          pos++;
+          n_unchanged++;
+        }
+
+      g_assert_cmpint (n_unchanged, ==, lcs_length (old_lines, new_lines));
+
+      g_free (str);
+      g_array_unref (old_lines);
+      g_array_unref (new_lines);
+    }
+}
+
+static void
+assert_incremental (GbSourceChangeMonitor *monitor,
+                    GtkTextBuffer         *buffer)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  GArray *expected;
+  gchar *text;
+
+  gb_source_change_monitor_update_lines (monitor);
+
+  gtk_text_buffer_get_bounds (buffer, &begin, &end);
+  text = gtk_text_buffer_get_text (buffer, &begin, &end, TRUE);
+  expected = split (text);
+
+  assert_lines_equal (gb_source_change_monitor_get_buffer_lines (monitor),
+                      expected);
+
+  g_array_unref (expected);
+  g_free (text);
+}
+
+/*
+ * Applies random edits to a buffer, sometimes several between two updates,
+ * and checks that the lines tracked from insert-text and delete-range match
+ * splitting the whole buffer again.
+ */
+static void
+test_incremental_random (void)
+{
+  static const gchar alphabet[] = "ab\n\n";
+  GbSourceChangeMonitor *monitor;
+  GtkTextBuffer *buffer;
+  GString *str;
+  guint i;
+  guint j;
+
+  buffer = gtk_text_buffer_new (NULL);
+  gtk_text_buffer_set_text (buffer, "a\nb\n\nab\nba", -1);
+
+  monitor = gb_source_change_monitor_new (buffer);
+  assert_incremental (monitor, buffer);
+
+  str = g_string_new (NULL);
+
+  for (i = 0; i < 5000; i++)
+    {
+      GtkTextIter begin;
+      GtkTextIter end;
+      gint n_chars = gtk_text_buffer_get_char_count (buffer);
+
+      gtk_text_buffer_get_iter_at_offset (buffer, &begin,
+                                          g_test_rand_int_range (0, n_chars + 1));
+
+      if ((n_chars > 0) && (g_test_rand_int_range (0, 5) < 2))
+        {
+          end = begin;
+          gtk_text_iter_forward_chars (&end, g_test_rand_int_range (1, 12));
+          gtk_text_buffer_delete (buffer, &begin, &end);
+        }
+      else
+        {
+          guint len = g_test_rand_int_range (1, 10);
+
+          g_string_truncate (str, 0);
+          for (j = 0; j < len; j++)
+            g_string_append_c (str, alphabet [g_test_rand_int_range (0, 4)]);
+
+          gtk_text_buffer_insert (buffer, &begin, str->str, str->len);
+        }
+
+      if (g_test_rand_int_range (0, 3) == 0)
+        assert_incremental (monitor, buffer);
+    }
+
+  assert_incremental (monitor, buffer);
+
+  g_string_free (str, TRUE);
+  g_object_unref (monitor);
+  g_object_unref (buffer);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/SourceChangeMonitor/split", test_split);
+  g_test_add_func ("/SourceChangeMonitor/diff_basic", test_diff_basic);
+  g_test_add_func ("/SourceChangeMonitor/diff_collision", test_diff_collision);
+  g_test_add_func ("/SourceChangeMonitor/diff_random", test_diff_random);
+  g_test_add_func ("/SourceChangeMonitor/incremental_random",
+                   test_incremental_random);
+  return g_test_run ();
+}
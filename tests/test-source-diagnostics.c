@@ -0,0 +1,262 @@
+#include <glib.h>
+
+#include "gb-source-diagnostics.h"
+
+static void
+add_diagnostic (GVariantBuilder *builder,
+                GcaSeverity      severity,
+                const gchar     *message,
+                gint64           begin_line,
+                gint64           begin_column,
+                gint64           end_line,
+                gint64           end_column)
+{
+  GVariantBuilder locations;
+
+  g_variant_builder_init (&locations, G_VARIANT_TYPE ("a(x(xx)(xx))"));
+  g_variant_builder_add (&locations, "(x(xx)(xx))", (gint64)0,
+                         begin_line, begin_column, end_line, end_column);
+  g_variant_builder_add (builder, "(ua((x(xx)(xx))s)a(x(xx)(xx))s)",
+                         (guint)severity, NULL, &locations, message);
+}
+
+/* Lines and columns are 1-based, as sent by the code-assistance service. */
+static GbSourceDiagnostics *
+create_diagnostics (void)
+{
+  GbSourceDiagnostics *diagnostics;
+  GVariantBuilder builder;
+  GVariant *variant;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ua((x(xx)(xx))s)a(x(xx)(xx))s)"));
+  add_diagnostic (&builder, GCA_SEVERITY_WARNING, "unused", 10, 5, 10, 9);
+  add_diagnostic (&builder, GCA_SEVERITY_ERROR, "missing ;", 3, 1, 3, 2);
+  add_diagnostic (&builder, GCA_SEVERITY_INFO, "spans", 8, 1, 12, 1);
+  add_diagnostic (&builder, GCA_SEVERITY_ERROR, "unused", 10, 1, 10, 2);
+  add_diagnostic (&builder, GCA_SEVERITY_FATAL, "no line", 0, 0, 0, 0);
+
+  variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+  diagnostics = gb_source_diagnostics_new_from_variant (variant);
+  g_variant_unref (variant);
+
+  return diagnostics;
+}
+
+static gboolean
+count_cb (const GbSourceDiagnostic *diag,
+          gpointer                  user_data)
+{
+  guint *count = user_data;
+
+  (*count)++;
+
+  return FALSE;
+}
+
+static void
+test_diagnostics_sorted (void)
+{
+  const GbSourceDiagnostic *first;
+  const GbSourceDiagnostic *last;
+  GbSourceDiagnostics *diagnostics;
+
+  diagnostics = create_diagnostics ();
+
+  /* The diagnostic without a line is dropped. */
+  g_assert_cmpint (gb_source_diagnostics_get_length (diagnostics), ==, 4);
+
+  first = gb_source_diagnostics_get_nth (diagnostics, 0);
+  g_assert_cmpint (first->range.begin.line, ==, 2);
+  g_assert_cmpstr (first->message, ==, "missing ;");
+
+  last = gb_source_diagnostics_get_nth (diagnostics, 3);
+  g_assert_cmpint (last->range.begin.line, ==, 9);
+  g_assert_cmpint (last->range.begin.column, ==, 4);
+
+  /* Identical messages share storage. */
+  g_assert (last->message == gb_source_diagnostics_get_nth (diagnostics, 2)->message);
+
+  gb_source_diagnostics_unref (diagnostics);
+}
+
+static void
+test_diagnostics_severity (void)
+{
+  GbSourceDiagnostics *diagnostics;
+
+  diagnostics = create_diagnostics ();
+
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 0), ==, GCA_SEVERITY_NONE);
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 2), ==, GCA_SEVERITY_ERROR);
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 7), ==, GCA_SEVERITY_INFO);
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 9), ==, GCA_SEVERITY_ERROR);
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 11), ==, GCA_SEVERITY_INFO);
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 12), ==, GCA_SEVERITY_NONE);
+
+  gb_source_diagnostics_unref (diagnostics);
+}
+
+static void
+test_diagnostics_range (void)
+{
+  GbSourceDiagnostics *diagnostics;
+  guint count;
+
+  diagnostics = create_diagnostics ();
+
+  count = 0;
+  gb_source_diagnostics_foreach_in_range (diagnostics, 0, 100, count_cb, &count);
+  g_assert_cmpint (count, ==, 4);
+
+  count = 0;
+  gb_source_diagnostics_foreach_in_range (diagnostics, 3, 6, count_cb, &count);
+  g_assert_cmpint (count, ==, 0);
+
+  count = 0;
+  gb_source_diagnostics_foreach_in_range (diagnostics, 10, 11, count_cb, &count);
+  g_assert_cmpint (count, ==, 1);
+
+  count = 0;
+  gb_source_diagnostics_foreach_in_range (diagnostics, 9, 9, count_cb, &count);
+  g_assert_cmpint (count, ==, 3);
+
+  gb_source_diagnostics_unref (diagnostics);
+}
+
+static void
+test_diagnostics_navigate (void)
+{
+  const GbSourceDiagnostic *diag;
+  GbSourceDiagnostics *diagnostics;
+
+  diagnostics = create_diagnostics ();
+
+  diag = gb_source_diagnostics_get_next (diagnostics, 2, 0);
+  g_assert_cmpint (diag->range.begin.line, ==, 7);
+
+  /* Diagnostics on the same line are visited in column order. */
+  diag = gb_source_diagnostics_get_next (diagnostics, 9, 0);
+  g_assert_cmpint (diag->range.begin.column, ==, 4);
+
+  diag = gb_source_diagnostics_get_next (diagnostics, 9, 4);
+  g_assert_cmpint (diag->range.begin.line, ==, 2);
+
+  diag = gb_source_diagnostics_get_previous (diagnostics, 9, 4);
+  g_assert_cmpint (diag->range.begin.line, ==, 9);
+  g_assert_cmpint (diag->range.begin.column, ==, 0);
+
+  diag = gb_source_diagnostics_get_previous (diagnostics, 2, 0);
+  g_assert_cmpint (diag->range.begin.line, ==, 9);
+  g_assert_cmpint (diag->range.begin.column, ==, 4);
+
+  gb_source_diagnostics_unref (diagnostics);
+
+  diagnostics = gb_source_diagnostics_new_from_variant (NULL);
+  g_assert (!gb_source_diagnostics_get_next (diagnostics, 0, 0));
+  g_assert (!gb_source_diagnostics_get_previous (diagnostics, 0, 0));
+  g_assert_cmpint (gb_source_diagnostics_get_line_severity (diagnostics, 0), ==, GCA_SEVERITY_NONE);
+  gb_source_diagnostics_unref (diagnostics);
+}
+
+static gboolean
+collect_cb (const GbSourceDiagnostic *diag,
+            gpointer                  user_data)
+{
+  GHashTable *visited = user_data;
+
+  g_assert (!g_hash_table_contains (visited, diag));
+  g_hash_table_add (visited, (gpointer)diag);
+
+  return FALSE;
+}
+
+/*
+ * Enough intervals that the tree has several levels above the ones that
+ * are scanned linearly, with a mix of short and long ranges so that the
+ * max_end pruning is exercised. Every query is checked against a scan of
+ * all the diagnostics.
+ */
+static void
+test_diagnostics_random (void)
+{
+  GbSourceDiagnostics *diagnostics;
+  GVariantBuilder builder;
+  GHashTable *visited;
+  GVariant *variant;
+  guint n_diagnostics = 500;
+  guint i;
+  guint j;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ua((x(xx)(xx))s)a(x(xx)(xx))s)"));
+
+  for (i = 0; i < n_diagnostics; i++)
+    {
+      gint64 begin_line;
+      gint64 end_line;
+
+      begin_line = g_test_rand_int_range (1, 2000);
+      if (g_test_rand_int_range (0, 10) == 0)
+        end_line = begin_line + g_test_rand_int_range (0, 400);
+      else
+        end_line = begin_line + g_test_rand_int_range (0, 3);
+
+      add_diagnostic (&builder,
+                      g_test_rand_int_range (GCA_SEVERITY_INFO,
+                                             GCA_SEVERITY_FATAL + 1),
+                      "random", begin_line, g_test_rand_int_range (1, 80),
+                      end_line, 1);
+    }
+
+  variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+  diagnostics = gb_source_diagnostics_new_from_variant (variant);
+  g_variant_unref (variant);
+
+  g_assert_cmpint (gb_source_diagnostics_get_length (diagnostics), ==, n_diagnostics);
+
+  visited = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < 1000; i++)
+    {
+      guint begin_line;
+      guint end_line;
+      guint expected = 0;
+
+      begin_line = g_test_rand_int_range (0, 2500);
+      end_line = begin_line + g_test_rand_int_range (0, (i % 2) ? 3 : 100);
+
+      g_hash_table_remove_all (visited);
+      gb_source_diagnostics_foreach_in_range (diagnostics, begin_line, end_line,
+                                              collect_cb, visited);
+
+      for (j = 0; j < n_diagnostics; j++)
+        {
+          const GbSourceDiagnostic *diag;
+          gboolean overlaps;
+
+          diag = gb_source_diagnostics_get_nth (diagnostics, j);
+          overlaps = ((diag->range.begin.line <= end_line) &&
+                      (diag->range.end.line >= begin_line));
+
+          g_assert_cmpint (overlaps, ==, g_hash_table_contains (visited, diag));
+          expected += overlaps;
+        }
+
+      g_assert_cmpint (g_hash_table_size (visited), ==, expected);
+    }
+
+  g_hash_table_unref (visited);
+  gb_source_diagnostics_unref (diagnostics);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/SourceDiagnostics/sorted", test_diagnostics_sorted);
+  g_test_add_func ("/SourceDiagnostics/severity", test_diagnostics_severity);
+  g_test_add_func ("/SourceDiagnostics/range", test_diagnostics_range);
+  g_test_add_func ("/SourceDiagnostics/navigate", test_diagnostics_navigate);
+  g_test_add_func ("/SourceDiagnostics/random", test_diagnostics_random);
+  return g_test_run ();
+}
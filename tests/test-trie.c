@@ -0,0 +1,303 @@
+#include <string.h>
+
+#include "trie.h"
+
+static guint n_destroyed;
+
+static void
+counting_free (gpointer data)
+{
+  n_destroyed++;
+  g_free (data);
+}
+
+static gboolean
+collect_cb (Trie        *trie,
+            const gchar *key,
+            gpointer     value,
+            gpointer     user_data)
+{
+  GHashTable *found = user_data;
+
+  g_assert (value);
+  g_assert (!g_hash_table_contains (found, key));
+  g_hash_table_insert (found, g_strdup (key), value);
+
+  return FALSE;
+}
+
+/*
+ * Checks that traversing @trie from @prefix finds exactly the keys of
+ * @reference starting with @prefix, with the same values.
+ */
+static void
+assert_traverse (Trie          *trie,
+                 GHashTable    *reference,
+                 const gchar   *prefix,
+                 GTraverseType  order)
+{
+  GHashTableIter iter;
+  GHashTable *found;
+  gpointer key;
+  gpointer value;
+  guint expected = 0;
+
+  found = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  trie_traverse (trie, prefix, order, G_TRAVERSE_LEAVES, -1, collect_cb, found);
+
+  g_hash_table_iter_init (&iter, reference);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (g_str_has_prefix (key, prefix))
+        {
+          g_assert (g_hash_table_lookup (found, key) == value);
+          expected++;
+        }
+    }
+
+  g_assert_cmpint (g_hash_table_size (found), ==, expected);
+
+  g_hash_table_unref (found);
+}
+
+static void
+test_trie_basic (void)
+{
+  GHashTable *reference;
+  gchar *value;
+  Trie *trie;
+  guint i;
+  static const gchar *keys[] = {
+    "gtk_source_buffer_new",
+    "gtk_source_view_new",
+    "gtk_source_",
+    "gtk_",
+    "g",
+    "gdk_window",
+    "",
+  };
+
+  n_destroyed = 0;
+
+  trie = trie_new (counting_free);
+  reference = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* Each insert splits the label of the node before it. */
+  for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    {
+      value = g_strdup (keys [i]);
+      trie_insert (trie, keys [i], value);
+      g_hash_table_insert (reference, (gchar *)keys [i], value);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    g_assert_cmpstr (trie_lookup (trie, keys [i]), ==, keys [i]);
+
+  /* Prefixes ending within a label are not keys. */
+  g_assert (!trie_lookup (trie, "gtk_s"));
+  g_assert (!trie_lookup (trie, "gtk_source_buffer"));
+  g_assert (!trie_lookup (trie, "gtk_source_buffer_new_"));
+  g_assert (!trie_lookup (trie, "gd"));
+
+  assert_traverse (trie, reference, "", G_PRE_ORDER);
+  assert_traverse (trie, reference, "gtk_s", G_PRE_ORDER);
+  assert_traverse (trie, reference, "gtk_source_", G_POST_ORDER);
+  assert_traverse (trie, reference, "x", G_PRE_ORDER);
+
+  /* Replacing a value destroys the previous one. */
+  value = g_strdup ("gtk_");
+  trie_insert (trie, "gtk_", value);
+  g_hash_table_insert (reference, "gtk_", value);
+  g_assert_cmpint (n_destroyed, ==, 1);
+  g_assert (trie_lookup (trie, "gtk_") == value);
+
+  /* Removing an inner key keeps the keys below it. */
+  g_assert (trie_remove (trie, "gtk_source_"));
+  g_hash_table_remove (reference, "gtk_source_");
+  g_assert_cmpint (n_destroyed, ==, 2);
+  g_assert (!trie_lookup (trie, "gtk_source_"));
+  g_assert_cmpstr (trie_lookup (trie, "gtk_source_view_new"), ==, "gtk_source_view_new");
+
+  /* Removing a leaf only drops the branch that is no longer shared. */
+  g_assert (trie_remove (trie, "gtk_source_view_new"));
+  g_hash_table_remove (reference, "gtk_source_view_new");
+  g_assert_cmpstr (trie_lookup (trie, "gtk_source_buffer_new"), ==, "gtk_source_buffer_new");
+  g_assert (!trie_remove (trie, "gtk_source_view_new"));
+  g_assert (!trie_remove (trie, "gtk_source"));
+
+  /* The root can hold a value and be emptied again. */
+  g_assert (trie_remove (trie, ""));
+  g_hash_table_remove (reference, "");
+  g_assert (!trie_lookup (trie, ""));
+
+  assert_traverse (trie, reference, "", G_POST_ORDER);
+  assert_traverse (trie, reference, "gtk_source_", G_PRE_ORDER);
+
+  /* A leaf can be inserted again where a branch was removed. */
+  trie_insert (trie, "gtk_source_view", g_strdup ("gtk_source_view"));
+  g_assert_cmpstr (trie_lookup (trie, "gtk_source_view"), ==, "gtk_source_view");
+
+  g_assert_cmpint (n_destroyed, ==, 4);
+
+  trie_destroy (trie);
+  g_hash_table_unref (reference);
+
+  g_assert_cmpint (n_destroyed, ==, 9);
+}
+
+static void
+test_trie_empty (void)
+{
+  Trie *trie;
+
+  trie = trie_new (NULL);
+
+  g_assert (!trie_lookup (trie, ""));
+  g_assert (!trie_lookup (trie, "a"));
+  g_assert (!trie_remove (trie, ""));
+  g_assert (!trie_remove (trie, "a"));
+
+  /* Removing the only key from the root must not release the root. */
+  trie_insert (trie, "", GINT_TO_POINTER (1));
+  g_assert (trie_remove (trie, ""));
+  g_assert (!trie_lookup (trie, ""));
+  trie_insert (trie, "a", GINT_TO_POINTER (2));
+  trie_insert (trie, "b", GINT_TO_POINTER (3));
+  g_assert (!trie_lookup (trie, ""));
+  g_assert (trie_lookup (trie, "a") == GINT_TO_POINTER (2));
+  g_assert (trie_lookup (trie, "b") == GINT_TO_POINTER (3));
+  g_assert (!trie_lookup (trie, "aa"));
+  g_assert (trie_remove (trie, "a"));
+  g_assert (!trie_lookup (trie, "a"));
+  g_assert (trie_lookup (trie, "b") == GINT_TO_POINTER (3));
+
+  trie_destroy (trie);
+}
+
+static void
+test_trie_long_keys (void)
+{
+  GHashTable *reference;
+  GString *str;
+  Trie *trie;
+  guint i;
+
+  trie = trie_new (g_free);
+  reference = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  str = g_string_new (NULL);
+
+  /* Longer than a single label, sharing prefixes at and around its limit. */
+  for (i = 0; i < 600; i += 7)
+    {
+      gchar *value;
+
+      g_string_truncate (str, 0);
+      while (str->len < i)
+        g_string_append_c (str, 'a' + (str->len % 3));
+      g_string_append_printf (str, "%u", i);
+
+      value = g_strdup (str->str);
+      trie_insert (trie, str->str, value);
+      g_hash_table_insert (reference, g_strdup (str->str), value);
+    }
+
+  assert_traverse (trie, reference, "", G_PRE_ORDER);
+  assert_traverse (trie, reference, "abcabc", G_POST_ORDER);
+
+  g_string_truncate (str, 0);
+  while (str->len < 300)
+    g_string_append_c (str, 'a' + (str->len % 3));
+  assert_traverse (trie, reference, str->str, G_PRE_ORDER);
+
+  g_string_free (str, TRUE);
+  g_hash_table_unref (reference);
+  trie_destroy (trie);
+}
+
+/*
+ * Keys are built from a tiny alphabet so that they share many prefixes,
+ * which splits labels on insert and collapses branches on remove. After
+ * every batch of operations the whole trie is compared against a
+ * #GHashTable.
+ */
+static void
+test_trie_random (void)
+{
+  static const gchar *alphabet = "abc_";
+  GHashTable *reference;
+  GString *str;
+  Trie *trie;
+  guint n_inserted = 0;
+  guint i;
+  guint j;
+
+  n_destroyed = 0;
+
+  trie = trie_new (counting_free);
+  reference = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  str = g_string_new (NULL);
+
+  for (i = 0; i < 20000; i++)
+    {
+      guint len = g_test_rand_int_range (0, 12);
+
+      g_string_truncate (str, 0);
+      for (j = 0; j < len; j++)
+        g_string_append_c (str, alphabet [g_test_rand_int_range (0, 4)]);
+
+      if (g_test_rand_int_range (0, 3) == 0)
+        {
+          gboolean removed;
+
+          removed = trie_remove (trie, str->str);
+          g_assert_cmpint (removed, ==, g_hash_table_remove (reference, str->str));
+        }
+      else
+        {
+          gchar *value = g_strdup_printf ("%s:%u", str->str, i);
+
+          trie_insert (trie, str->str, value);
+          g_hash_table_replace (reference, g_strdup (str->str), value);
+          n_inserted++;
+        }
+
+      g_assert (trie_lookup (trie, str->str) ==
+                g_hash_table_lookup (reference, str->str));
+
+      if ((i % 1000) == 0)
+        {
+          GHashTableIter iter;
+          gpointer key;
+          gpointer value;
+
+          g_hash_table_iter_init (&iter, reference);
+          while (g_hash_table_iter_next (&iter, &key, &value))
+            g_assert (trie_lookup (trie, key) == value);
+
+          str->str [len / 2] = '\0';
+          assert_traverse (trie, reference, "", G_PRE_ORDER);
+          assert_traverse (trie, reference, str->str, G_PRE_ORDER);
+          assert_traverse (trie, reference, str->str, G_POST_ORDER);
+        }
+    }
+
+  g_assert_cmpint (n_destroyed, ==, n_inserted - g_hash_table_size (reference));
+
+  g_string_free (str, TRUE);
+  g_hash_table_unref (reference);
+  trie_destroy (trie);
+
+  g_assert_cmpint (n_destroyed, ==, n_inserted);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Trie/basic", test_trie_basic);
+  g_test_add_func ("/Trie/empty", test_trie_empty);
+  g_test_add_func ("/Trie/long_keys", test_trie_long_keys);
+  g_test_add_func ("/Trie/random", test_trie_random);
+  return g_test_run ();
+}
@@ -10,3 +10,54 @@ TESTS += test-navigation-list
 test_navigation_list_SOURCES = tests/test-navigation-list.c
 test_navigation_list_CFLAGS = $(libgnome_builder_la_CFLAGS)
 test_navigation_list_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += test-fuzzy
+TESTS += test-fuzzy
+test_fuzzy_SOURCES = tests/test-fuzzy.c
+test_fuzzy_CFLAGS = $(libgnome_builder_la_CFLAGS)
+test_fuzzy_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += bench-fuzzy
+bench_fuzzy_SOURCES = tests/bench-common.h tests/bench-fuzzy.c
+bench_fuzzy_CFLAGS = $(libgnome_builder_la_CFLAGS)
+bench_fuzzy_LDADD = libgnome-builder.la
+
+noinst_PROGRAMS += bench-trie
+bench_trie_SOURCES = tests/bench-common.h tests/bench-trie.c
+bench_trie_CFLAGS = $(libgnome_builder_la_CFLAGS)
+bench_trie_LDADD = libgnome-builder.la
+
+noinst_PROGRAMS += bench-code-assistant
+bench_code_assistant_SOURCES = tests/bench-common.h tests/bench-code-assistant.c
+bench_code_assistant_CFLAGS = $(libgnome_builder_la_CFLAGS)
+bench_code_assistant_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += test-source-diagnostics
+TESTS += test-source-diagnostics
+test_source_diagnostics_SOURCES = tests/test-source-diagnostics.c
+test_source_diagnostics_CFLAGS = $(libgnome_builder_la_CFLAGS)
+test_source_diagnostics_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += test-trie
+TESTS += test-trie
+test_trie_SOURCES = tests/test-trie.c
+test_trie_CFLAGS = $(libgnome_builder_la_CFLAGS)
+test_trie_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += test-editor-file-marks
+TESTS += test-editor-file-marks
+test_editor_file_marks_SOURCES = tests/test-editor-file-marks.c
+test_editor_file_marks_CFLAGS = $(libgnome_builder_la_CFLAGS)
+test_editor_file_marks_LDADD = libgnome-builder.la
+
+
+noinst_PROGRAMS += test-source-change-monitor
+TESTS += test-source-change-monitor
+test_source_change_monitor_SOURCES = tests/test-source-change-monitor.c
+test_source_change_monitor_CFLAGS = $(libgnome_builder_la_CFLAGS)
+test_source_change_monitor_LDADD = libgnome-builder.la